@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+
+/***************************************************************************************************
+ * BoardProfile
+ * Everything that differs between hardware revisions, as one constexpr struct per variant. The
+ * PlatformIO env picks a variant with -DMEDIBOX_BOARD_<NAME>; main.cpp reads BOARD and skips the
+ * code for absent peripherals with `if constexpr`, so they are never set up or driven. Their driver
+ * objects (the shade Servo) are still constructed, idle. The static_asserts at the bottom reject a
+ * profile that would not fit the firmware.
+ **************************************************************************************************/
+
+enum EnvSensorKind : uint8_t
+{
+  ENV_SENSOR_DHT11,
+  ENV_SENSOR_DHT22
+};
+
+struct BoardProfile
+{
+  const char *name;
+
+  // Pins
+  uint8_t pin_buzzer;
+  uint8_t pin_led_1;
+  uint8_t pin_led_2;
+  uint8_t pin_cancel;
+  uint8_t pin_ok;
+  uint8_t pin_up;
+  uint8_t pin_down;
+  uint8_t pin_dht;
+  uint8_t pin_servo;
+  uint8_t pin_ldr;
+
+  // Peripherals
+  EnvSensorKind env_sensor;
+  bool has_servo;
+  bool has_ldr;
+  uint16_t screen_width;
+  uint16_t screen_height;
+  uint8_t screen_address;
+
+  // Capacities
+  uint8_t n_alarms;
+  uint8_t light_log_blocks; // Compressed sample log blocks (SAMPLE_BLOCK_BYTES each) for the LDR
+  uint8_t env_log_blocks;   // ... and for temperature and for humidity
+
+  // Network
+  const char *wifi_ssid;
+  const char *wifi_password;
+  uint8_t wifi_channel;
+  const char *ntp_server;
+  const char *mqtt_host;
+  uint16_t mqtt_port;
+};
+
+// Original board (and the Wokwi simulation): shade servo, LDR, DHT22, 128x64 OLED.
+constexpr BoardProfile PROFILE_REV_A = {
+    "rev-a",
+    5, 15, 2, 34, 32, 33, 35, 12, 13, 36,
+    ENV_SENSOR_DHT22, true, true, 128, 64, 0x3c,
+    3, 8, 4,
+    "Wokwi-GUEST", "", 6, "time.google.com", "test.mosquitto.org", 1883};
+
+// Reminder-only box: no shade mechanism or light sensor, DHT11, OLED strapped to 0x3d.
+constexpr BoardProfile PROFILE_LITE = {
+    "lite",
+    5, 15, 2, 34, 32, 33, 35, 12, 0, 0,
+    ENV_SENSOR_DHT11, false, false, 128, 64, 0x3d,
+    2, 1, 4,
+    "Wokwi-GUEST", "", 6, "time.google.com", "test.mosquitto.org", 1883};
+
+#if defined(MEDIBOX_BOARD_LITE)
+constexpr const BoardProfile &BOARD = PROFILE_LITE;
+#else
+constexpr const BoardProfile &BOARD = PROFILE_REV_A;
+#endif
+
+/***************************************************************************************************
+ * Profile checks
+ **************************************************************************************************/
+constexpr bool board_pins_distinct(const BoardProfile &b)
+{
+  const uint8_t pins[] = {b.pin_buzzer, b.pin_led_1, b.pin_led_2, b.pin_cancel, b.pin_ok,
+                          b.pin_up, b.pin_down, b.pin_dht,
+                          b.has_servo ? b.pin_servo : (uint8_t)0xFF,
+                          b.has_ldr ? b.pin_ldr : (uint8_t)0xFE};
+  const int n = sizeof(pins) / sizeof(pins[0]);
+  for (int i = 0; i < n; i++)
+    for (int j = i + 1; j < n; j++)
+      if (pins[i] == pins[j])
+        return false;
+  return true;
+}
+
+static_assert(board_pins_distinct(BOARD), "board profile assigns one GPIO to two functions");
+static_assert(BOARD.pin_dht < 34 && BOARD.pin_buzzer < 34 && BOARD.pin_led_1 < 34 && BOARD.pin_led_2 < 34,
+              "GPIO 34-39 are input-only");
+static_assert(!BOARD.has_servo || BOARD.pin_servo < 34, "GPIO 34-39 are input-only");
+static_assert(!BOARD.has_ldr || BOARD.pin_ldr == 36, "LdrAcquisition samples ADC1 channel 0 (GPIO 36)");
+static_assert(BOARD.screen_width == 128 && BOARD.screen_height == 64, "screens are laid out for a 128x64 panel");
+static_assert(BOARD.n_alarms >= 1 && BOARD.n_alarms <= 4, "the menu has labels for 1-4 alarms");
+static_assert(BOARD.light_log_blocks >= 1 && BOARD.env_log_blocks >= 1, "each sample log needs at least one block");
+static_assert((BOARD.light_log_blocks + 2 * BOARD.env_log_blocks) * 128 <= 4096, "sample logs exceed their 4 KB RAM budget");
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Adafruit_SSD1306.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * DisplayFlusher
+ * Moves SSD1306 bus traffic off the main loop. Drawing still goes into the Adafruit framebuffer;
+ * display_flush() snapshots it into a pending buffer and returns immediately, and a background
+ * task streams the newest pending frame at Fast-mode I2C speed. Frames submitted while one is
+ * still pending replace it (coalesced) instead of queueing.
+ **************************************************************************************************/
+
+#define DISPLAY_I2C_HZ 800000 // Above the 400 kHz datasheet figure; SSD1306 modules run reliably here
+
+struct DisplayFlushStats
+{
+  uint32_t submitted;    // display_flush() calls
+  uint32_t flushed;      // Frames actually sent to the panel
+  uint32_t coalesced;    // Frames replaced before they were sent
+  uint32_t last_flush_us;
+  uint32_t max_flush_us;
+};
+
+void display_flusher_begin(Adafruit_SSD1306 &display, uint8_t i2c_address);
+void display_flush();
+DisplayFlushStats display_flush_stats();
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <Indicator.h>
+
+/***************************************************************************************************
+ * IndicatorEsp32
+ * Binds the indicator sequencer to the board: LEDC PWM channels for LED_1, LED_2 and the buzzer,
+ * LEDC hardware fades, and one esp_timer per channel for step boundaries.
+ **************************************************************************************************/
+
+void indicator_begin(int led_1_pin, int led_2_pin, int buzzer_pin);
+void indicator_play(uint8_t channel, const IndicatorPattern *pattern, uint8_t priority);
+void indicator_stop(uint8_t channel, uint8_t priority);
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <AdherenceJournal.h>
+#include <PubSubClient.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * JournalStore
+ * Keeps lib/AdherenceJournal on LittleFS (the flash data partition, formatted on first boot). The
+ * alarm screen records events into RAM; journal_store_poll() commits them in batches from the
+ * main loop, never while an alarm rings.
+ *
+ * A message on medibox/<id>/journal/get holding a cursor (a sequence number, or empty for the
+ * oldest record) starts a stream on medibox/<id>/journal: one JSON batch per loop pass, e.g.
+ * {"next":5,"end":false,"events":[[1,1760000000,"fired",0,null],[2,1760000060,"dismissed",0,1.3]]}
+ * with [seq, epoch, event, alarm slot, latency in seconds], until a batch says "end":true. A
+ * client keeps "next" and asks from there after a reconnect.
+ **************************************************************************************************/
+
+#define JOURNAL_MQTT_BATCH 200 // With the topic, stays inside PubSubClient's default 256-byte packet
+
+struct JournalStoreStats
+{
+  bool mounted;
+  uint32_t first_seq;
+  uint32_t end_seq;
+  uint32_t max_commit_us; // Longest batched write
+  uint32_t streamed;      // Records published
+};
+
+void journal_store_begin();
+void journal_store_record(JournalKind kind, uint8_t alarm, uint32_t latency_ms);
+void journal_store_request(const uint8_t *payload, size_t length);
+void journal_store_poll(PubSubClient &client, const char *topic);
+JournalStats journal_store_journal_stats();
+JournalStoreStats journal_store_stats();
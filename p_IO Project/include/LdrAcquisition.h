@@ -0,0 +1,18 @@
+#pragma once
+
+#include <ConfigStore.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * LdrAcquisition
+ * Samples the LDR in the background with the ADC's continuous (DMA) mode. A low-priority task
+ * filters each burst (lib/LdrFilter), applies the eFuse calibration curve and averages the bursts
+ * over the sampling period ts, which it takes from the config store. The mean of the last full
+ * period is left where the main loop can pick it up without touching the ADC, so a light sample
+ * covers its whole period rather than the last 13 ms of it.
+ **************************************************************************************************/
+
+void ldr_acquisition_begin(const ConfigStore &store);
+float ldr_latest_normalized();
+uint32_t ldr_latest_millivolts();
+uint32_t ldr_burst_count();
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <BinLog.h>
+#include <PubSubClient.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * LogDrain
+ * The consumer side of lib/BinLog. A low-priority task on core 0 pops records, formats them and
+ * writes them to Serial, so a UART that is backed up stalls only that task, not the loop. It also
+ * reports when records were dropped.
+ *
+ * Built with -DMEDIBOX_LOG_MQTT, records at MEDIBOX_LOG_MQTT_LEVEL or more severe are also
+ * batched in wire form and published on medibox/<id>/log from the main loop (PubSubClient is not
+ * thread-safe). Decode them with `pio run -e logdecode` and the firmware ELF.
+ **************************************************************************************************/
+
+#define LOG_DRAIN_PERIOD_MS 20
+#define LOG_MQTT_BATCH 208 // With the topic, stays inside PubSubClient's default 256-byte packet
+
+#ifndef MEDIBOX_LOG_MQTT_LEVEL
+#define MEDIBOX_LOG_MQTT_LEVEL LOG_LEVEL_WARN
+#endif
+
+struct LogDrainStats
+{
+  uint32_t printed;       // Lines written to Serial
+  uint32_t mqtt_records;  // Records published by the MQTT sink
+  uint32_t mqtt_dropped;  // Records lost because the batch was full or the broker was down
+  uint32_t max_drain_us;  // Longest time the task spent emptying the ring
+};
+
+void log_drain_begin();
+void log_mqtt_sink_poll(PubSubClient &client, const char *topic);
+LogDrainStats log_drain_stats();
@@ -0,0 +1,17 @@
+#pragma once
+
+/***************************************************************************************************
+ * MqttTlsCredentials
+ * Broker identity for the TLS transport (-DMEDIBOX_MQTT_TLS). Regenerate with
+ * scripts/mosquitto_tls/make_certs.sh <broker-ip>, which also writes a matching mosquitto.conf.
+ **************************************************************************************************/
+
+#define MQTT_TLS_HOST "192.168.1.10"
+#define MQTT_TLS_PORT 8883
+#define MQTT_TLS_SERVER_NAME "medibox-broker" // Must match the broker certificate's CN/SAN
+
+// CA that signed the broker certificate (PEM)
+#define MQTT_TLS_CA_PEM ""
+
+// SHA-256 of the broker certificate (DER), hex; empty to rely on the CA alone
+#define MQTT_TLS_PIN_SHA256 ""
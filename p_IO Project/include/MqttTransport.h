@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Client.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * MqttTransport
+ * The Client PubSubClient runs over. Plain TCP by default; built with -DMEDIBOX_MQTT_TLS it is a
+ * pinned TLS session (lib/TlsLink) to the broker in MqttTlsCredentials.h that resumes its session
+ * across reconnects.
+ **************************************************************************************************/
+
+#if defined(MEDIBOX_MQTT_TLS)
+#define MQTT_TLS_ENABLED 1
+#else
+#define MQTT_TLS_ENABLED 0
+#endif
+
+bool mqtt_transport_begin();
+Client &mqtt_transport();
+const char *mqtt_broker_host(const char *plain_host);
+uint16_t mqtt_broker_port(uint16_t plain_port);
+void mqtt_transport_report();
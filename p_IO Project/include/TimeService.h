@@ -0,0 +1,39 @@
+#pragma once
+
+#include <TimeSync.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * TimeService
+ * The box's wall clock: lib/TimeSync over UDP to the board's NTP server, on esp_timer (the crystal
+ * driven microsecond counter), copied into the system clock so time(), getLocalTime() and every
+ * epoch stamp keep working. It replaces configTime(), whose SNTP client stepped the clock to a reply
+ * every hour and let it run uncorrected in between.
+ *
+ * time_service_poll() runs from the main loop: it sends a request when one is due, takes the reply,
+ * and keeps the system clock on the disciplined time. Once it is TIME_SERVICE_SLEW_US off, the
+ * difference is handed to adjtime(), which slews the system clock without stopping or reversing it;
+ * the clock is only stepped with settimeofday() at the first sync or when it is more than
+ * TIMESYNC_STEP_US off, as TimeSync itself does. The time zone is only the TZ variable now, so
+ * changing it sends nothing.
+ **************************************************************************************************/
+
+#define TIME_SERVICE_LOCAL_PORT 4123
+#define TIME_SERVICE_SLEW_US 1000
+
+struct TimeServiceStats
+{
+  bool synced;
+  uint32_t error_ms;      // Estimated bound on the clock's error now
+  int32_t drift_ppb;      // Measured crystal drift (positive: esp_timer runs slow)
+  uint32_t poll_interval_s;
+  uint32_t clock_steps;   // settimeofday() calls
+  uint32_t clock_slews;   // adjtime() calls
+};
+
+void time_service_begin(const char *server);
+void time_service_poll();
+bool time_service_synced();
+void time_service_set_utc_offset(int offset_s);
+TimeSyncStats time_service_sync_stats();
+TimeServiceStats time_service_stats();
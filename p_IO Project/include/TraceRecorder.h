@@ -0,0 +1,37 @@
+#pragma once
+
+#include <InputTrace.h>
+#include <PubSubClient.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * TraceRecorder
+ * Firmware side of lib/InputTrace. Built with -DMEDIBOX_TRACE, trace_recorder_begin() returns a
+ * TraceWriter for MediboxCore::set_trace(); the bytes it writes collect in a small ring of chunks
+ * that trace_recorder_poll() publishes from the main loop on medibox/<id>/trace, each chunk led by
+ * its sequence number. With -DMEDIBOX_TRACE_SERIAL the chunks go to Serial instead, as
+ * "#TRACE <hex>" lines mixed in with the log.
+ *
+ * Every input reaches the core on the main loop (the MQTT callback runs inside mqttClient.loop()),
+ * so the recorder needs no locking. A chunk waits in the ring while the broker is away. If the
+ * ring overflows, records are dropped whole and the next sequence number is skipped; once the
+ * backlog has been sent the trace restarts with a new BEGIN, which a replay starts over from.
+ *
+ * Without MEDIBOX_TRACE, trace_recorder_begin() returns NULL and nothing is recorded.
+ **************************************************************************************************/
+
+#define TRACE_CHUNK_SIZE 200 // With the topic, stays inside PubSubClient's default 256-byte packet
+#define TRACE_CHUNKS 8
+#define TRACE_FLUSH_MS 5000  // Longest a partly filled chunk waits before it is sent
+
+struct TraceRecorderStats
+{
+  uint32_t chunks_sent;
+  uint32_t bytes_recorded;
+  uint32_t bytes_dropped; // Written while the ring was full
+  uint32_t restarts;      // New BEGINs after an overflow
+};
+
+TraceWriter *trace_recorder_begin();
+void trace_recorder_poll(PubSubClient &client, const char *topic);
+TraceRecorderStats trace_recorder_stats();
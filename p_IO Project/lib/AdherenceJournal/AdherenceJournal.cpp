@@ -0,0 +1,413 @@
+#include "AdherenceJournal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SCAN_RECORDS 16 // Records read per call while scanning or copying
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/***************************************************************************************************
+ * journal_crc32()
+ * CRC-32 (IEEE, reflected) with a 16-entry table: a record is twelve bytes, so speed hardly
+ * matters and the table stays small.
+ **************************************************************************************************/
+uint32_t journal_crc32(const uint8_t *data, size_t n)
+{
+  static const uint32_t TABLE[16] = {0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+                                     0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+                                     0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < n; i++)
+  {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ TABLE[crc & 0x0F];
+    crc = (crc >> 4) ^ TABLE[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+void journal_encode(const JournalRecord &record, uint8_t out[JOURNAL_RECORD_SIZE])
+{
+  put_u32(out, record.seq);
+  put_u32(out + 4, record.epoch);
+  out[8] = record.kind;
+  out[9] = record.alarm;
+  out[10] = (uint8_t)record.latency_ds;
+  out[11] = (uint8_t)(record.latency_ds >> 8);
+  put_u32(out + 12, journal_crc32(out, 12));
+}
+
+bool journal_decode(const uint8_t in[JOURNAL_RECORD_SIZE], JournalRecord &record)
+{
+  if (get_u32(in + 12) != journal_crc32(in, 12) || in[8] >= JOURNAL_KIND_COUNT)
+    return false;
+  record.seq = get_u32(in);
+  record.epoch = get_u32(in + 4);
+  record.kind = (JournalKind)in[8];
+  record.alarm = in[9];
+  record.latency_ds = (uint16_t)(in[10] | (in[11] << 8));
+  return true;
+}
+
+const char *journal_kind_name(JournalKind kind)
+{
+  switch (kind)
+  {
+  case JOURNAL_FIRED:
+    return "fired";
+  case JOURNAL_DISMISSED:
+    return "dismissed";
+  case JOURNAL_SNOOZED:
+    return "snoozed";
+  case JOURNAL_MISSED:
+    return "missed";
+  default:
+    return "unknown";
+  }
+}
+
+AdherenceJournal::AdherenceJournal(JournalFs &fs)
+    : fs_(fs), ready_(false), old_first_(1), old_count_(0), active_first_(1), active_count_(0), pending_count_(0),
+      oldest_pending_ms_(0), failed_(false), last_snoozed_alarm_(JOURNAL_SNOOZED_ALARM)
+{
+  memset(pending_, 0, sizeof(pending_));
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+/***************************************************************************************************
+ * scan()
+ * Counts the valid records at the start of a file: each must pass its CRC and follow the previous
+ * sequence number. good_bytes is where the first bad record (or a partial one) starts.
+ **************************************************************************************************/
+bool AdherenceJournal::scan(const char *name, uint32_t &first, uint32_t &count, uint32_t &good_bytes)
+{
+  first = 0;
+  count = 0;
+  good_bytes = 0;
+  int32_t size = fs_.size(name);
+  if (size <= 0)
+    return size == 0 || size == -1;
+
+  uint8_t buffer[SCAN_RECORDS * JOURNAL_RECORD_SIZE];
+  uint32_t whole = (uint32_t)size / JOURNAL_RECORD_SIZE * JOURNAL_RECORD_SIZE;
+  for (uint32_t offset = 0; offset < whole; offset += sizeof(buffer))
+  {
+    uint32_t n = whole - offset < sizeof(buffer) ? whole - offset : sizeof(buffer);
+    if (!fs_.read(name, offset, buffer, n))
+      return false;
+    for (uint32_t i = 0; i < n; i += JOURNAL_RECORD_SIZE)
+    {
+      JournalRecord r;
+      if (!journal_decode(buffer + i, r) || (count && r.seq != first + count))
+        return true;
+      if (count == 0)
+        first = r.seq;
+      count++;
+      good_bytes += JOURNAL_RECORD_SIZE;
+    }
+  }
+  return true;
+}
+
+/***************************************************************************************************
+ * truncate_active()
+ * Keeps the first good_bytes of the journal: copies them to the temporary file, then renames it
+ * over the journal.
+ **************************************************************************************************/
+bool AdherenceJournal::truncate_active(uint32_t good_bytes)
+{
+  fs_.remove(JOURNAL_TMP_FILE);
+  uint8_t buffer[SCAN_RECORDS * JOURNAL_RECORD_SIZE];
+  for (uint32_t offset = 0; offset < good_bytes; offset += sizeof(buffer))
+  {
+    uint32_t n = good_bytes - offset < sizeof(buffer) ? good_bytes - offset : sizeof(buffer);
+    if (!fs_.read(JOURNAL_FILE, offset, buffer, n) || !fs_.append(JOURNAL_TMP_FILE, buffer, n))
+      return false;
+  }
+  if (good_bytes == 0)
+    return fs_.remove(JOURNAL_FILE);
+  return fs_.rename(JOURNAL_TMP_FILE, JOURNAL_FILE);
+}
+
+/***************************************************************************************************
+ * begin()
+ * Finds where the journal stands and repairs a torn tail. Returns false when the files cannot be
+ * read or repaired; record() then still buffers, and commits retry.
+ **************************************************************************************************/
+bool AdherenceJournal::begin()
+{
+  // Left over from an interrupted recovery. If the journal is gone the copy was complete and only
+  // the rename was cut short (a JournalFs may replace by remove + rename); otherwise it is stale.
+  if (fs_.size(JOURNAL_TMP_FILE) >= 0)
+  {
+    if (fs_.size(JOURNAL_FILE) < 0)
+      fs_.rename(JOURNAL_TMP_FILE, JOURNAL_FILE);
+    else
+      fs_.remove(JOURNAL_TMP_FILE);
+  }
+
+  uint32_t good = 0;
+  if (!scan(JOURNAL_OLD_FILE, old_first_, old_count_, good))
+    return false;
+
+  if (!scan(JOURNAL_FILE, active_first_, active_count_, good))
+    return false;
+  int32_t size = fs_.size(JOURNAL_FILE);
+  if (size > (int32_t)good)
+  {
+    stats_.recovered_bytes = (uint32_t)size - good;
+    if (!truncate_active(good))
+      return false;
+  }
+
+  uint32_t next = old_count_ ? old_first_ + old_count_ : 1;
+  if (active_count_ == 0)
+  {
+    active_first_ = next;
+  }
+  else if (old_count_ && active_first_ != next)
+  {
+    old_count_ = 0; // The old file does not lead into this one; stream only the journal
+  }
+  if (old_count_ == 0)
+    old_first_ = active_first_;
+
+  ready_ = true;
+  return true;
+}
+
+/***************************************************************************************************
+ * record()
+ * Buffers one event. A snoozed alarm coming back (JOURNAL_SNOOZED_ALARM) is recorded under the
+ * slot that was snoozed.
+ **************************************************************************************************/
+void AdherenceJournal::record(uint32_t now_ms, uint32_t epoch, JournalKind kind, uint8_t alarm, uint32_t latency_ms)
+{
+  stats_.recorded++;
+  if (alarm == JOURNAL_SNOOZED_ALARM)
+    alarm = last_snoozed_alarm_;
+  if (kind == JOURNAL_SNOOZED)
+    last_snoozed_alarm_ = alarm;
+
+  if (pending_count_ == JOURNAL_PENDING)
+  {
+    stats_.dropped++;
+    return;
+  }
+  if (pending_count_ == 0)
+    oldest_pending_ms_ = now_ms;
+
+  JournalRecord &r = pending_[pending_count_];
+  r.seq = end_seq() + pending_count_;
+  r.epoch = epoch;
+  r.kind = kind;
+  r.alarm = alarm;
+  uint32_t ds = (latency_ms + 50) / 100;
+  r.latency_ds = kind == JOURNAL_FIRED ? JOURNAL_NO_LATENCY : (uint16_t)(ds < 0xFFFE ? ds : 0xFFFE);
+  pending_count_++;
+}
+
+/***************************************************************************************************
+ * poll()
+ * Main loop. Commits when a batch is full or the oldest record has waited long enough. After a
+ * failed write the next attempt waits JOURNAL_COMMIT_MS, so a broken flash does not stall every
+ * pass of the loop.
+ **************************************************************************************************/
+bool AdherenceJournal::poll(uint32_t now_ms)
+{
+  if (pending_count_ == 0)
+    return false;
+  bool batch_full = pending_count_ >= JOURNAL_BATCH && !failed_;
+  if (!batch_full && now_ms - oldest_pending_ms_ < JOURNAL_COMMIT_MS)
+    return false;
+  if (commit())
+    return true;
+  oldest_pending_ms_ = now_ms;
+  return false;
+}
+
+/***************************************************************************************************
+ * commit()
+ * Writes every buffered record in one append, rotating the journal first if they would not fit.
+ * On failure the records stay buffered for the next attempt.
+ **************************************************************************************************/
+bool AdherenceJournal::commit()
+{
+  if (pending_count_ == 0)
+    return true;
+  if (!ready_)
+  {
+    if (!begin())
+    {
+      stats_.write_errors++;
+      failed_ = true;
+      return false;
+    }
+    settle_pending();
+  }
+
+  uint32_t bytes = pending_count_ * JOURNAL_RECORD_SIZE;
+  if (active_count_ && (active_count_ * JOURNAL_RECORD_SIZE + bytes > JOURNAL_MAX_BYTES))
+  {
+    if (!fs_.rename(JOURNAL_FILE, JOURNAL_OLD_FILE))
+    {
+      stats_.write_errors++;
+      failed_ = true;
+      return false;
+    }
+    old_first_ = active_first_;
+    old_count_ = active_count_;
+    active_first_ += active_count_;
+    active_count_ = 0;
+    stats_.rotations++;
+  }
+
+  uint8_t buffer[JOURNAL_PENDING * JOURNAL_RECORD_SIZE];
+  for (uint8_t i = 0; i < pending_count_; i++)
+    journal_encode(pending_[i], buffer + i * JOURNAL_RECORD_SIZE);
+  if (!fs_.append(JOURNAL_FILE, buffer, bytes))
+  {
+    stats_.write_errors++;
+    failed_ = true;
+    ready_ = false; // A partial append is cut off by the next begin()
+    return false;
+  }
+
+  active_count_ += pending_count_;
+  stats_.committed += pending_count_;
+  stats_.commits++;
+  pending_count_ = 0;
+  failed_ = false;
+  return true;
+}
+
+/***************************************************************************************************
+ * settle_pending()
+ * After the files were rescanned: buffered records that a failed append did write are dropped, and
+ * the rest continue from what is really on flash.
+ **************************************************************************************************/
+void AdherenceJournal::settle_pending()
+{
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < pending_count_; i++)
+  {
+    const JournalRecord &r = pending_[i];
+    uint8_t written[JOURNAL_RECORD_SIZE], wanted[JOURNAL_RECORD_SIZE];
+    journal_encode(r, wanted);
+    bool on_flash = r.seq >= active_first_ && r.seq < end_seq() &&
+                    fs_.read(JOURNAL_FILE, (r.seq - active_first_) * JOURNAL_RECORD_SIZE, written, sizeof(written)) &&
+                    memcmp(written, wanted, sizeof(written)) == 0;
+    if (!on_flash)
+      pending_[kept++] = r;
+  }
+  pending_count_ = kept;
+  for (uint8_t i = 0; i < pending_count_; i++)
+    pending_[i].seq = end_seq() + i;
+}
+
+uint32_t AdherenceJournal::first_seq() const
+{
+  return old_count_ ? old_first_ : active_first_;
+}
+
+uint32_t AdherenceJournal::end_seq() const
+{
+  return active_first_ + active_count_;
+}
+
+bool AdherenceJournal::read_file(const char *name, uint32_t first, uint32_t count, uint32_t cursor,
+                                 JournalRecord *records, size_t max, size_t &n)
+{
+  uint8_t buffer[SCAN_RECORDS * JOURNAL_RECORD_SIZE];
+  while (n < max && cursor >= first && cursor < first + count)
+  {
+    uint32_t take = first + count - cursor;
+    if (take > max - n)
+      take = max - n;
+    if (take > SCAN_RECORDS)
+      take = SCAN_RECORDS;
+    if (!fs_.read(name, (cursor - first) * JOURNAL_RECORD_SIZE, buffer, take * JOURNAL_RECORD_SIZE))
+      return false;
+    for (uint32_t i = 0; i < take; i++)
+    {
+      if (!journal_decode(buffer + i * JOURNAL_RECORD_SIZE, records[n]) || records[n].seq != cursor)
+        return false;
+      n++;
+      cursor++;
+    }
+  }
+  return true;
+}
+
+/***************************************************************************************************
+ * read()
+ * Up to max committed records from sequence number `cursor` on; next is the cursor to continue
+ * from. A cursor older than the oldest kept record starts at the oldest one. Records are fixed
+ * size and numbered without gaps, so the position in the file follows from the cursor.
+ **************************************************************************************************/
+size_t AdherenceJournal::read(uint32_t cursor, JournalRecord *records, size_t max, uint32_t &next)
+{
+  if (cursor < first_seq())
+    cursor = first_seq();
+  if (cursor > end_seq())
+    cursor = end_seq();
+
+  size_t n = 0;
+  bool ok = true;
+  if (old_count_)
+    ok = read_file(JOURNAL_OLD_FILE, old_first_, old_count_, cursor, records, max, n);
+  if (ok)
+    ok = read_file(JOURNAL_FILE, active_first_, active_count_, cursor + (uint32_t)n, records, max, n);
+  next = cursor + (uint32_t)n;
+  return n;
+}
+
+/***************************************************************************************************
+ * format_journal_batch()
+ * {"next":129,"end":false,"events":[[121,1760000000,"fired",0,null],[122,1760000012,"dismissed",0,12.4]]}
+ * with as many records as fit; `included` says how many, and "next" already accounts for them.
+ * Each event is [seq, epoch, kind, alarm slot, latency in seconds].
+ **************************************************************************************************/
+size_t format_journal_batch(char *buffer, size_t size, const JournalRecord *records, size_t n, uint32_t next,
+                            bool end, size_t &included)
+{
+  included = 0;
+  char event[64];
+  const size_t reserve = 48; // Header and closing
+  size_t used = 0;
+  char body[256];
+  body[0] = '\0';
+  for (size_t i = 0; i < n; i++)
+  {
+    const JournalRecord &r = records[i];
+    char latency[12];
+    if (r.latency_ds == JOURNAL_NO_LATENCY)
+      snprintf(latency, sizeof(latency), "null");
+    else
+      snprintf(latency, sizeof(latency), "%u.%u", r.latency_ds / 10, r.latency_ds % 10);
+    int len = snprintf(event, sizeof(event), "%s[%u,%u,\"%s\",%u,%s]", i ? "," : "", (unsigned)r.seq,
+                       (unsigned)r.epoch, journal_kind_name(r.kind), r.alarm, latency);
+    if (len < 0 || used + len + reserve >= size || used + len >= sizeof(body))
+      break;
+    memcpy(body + used, event, len + 1);
+    used += len;
+    included++;
+  }
+
+  uint32_t continue_at = next - (uint32_t)(n - included);
+  int written = snprintf(buffer, size, "{\"next\":%u,\"end\":%s,\"events\":[%s]}", (unsigned)continue_at,
+                         end && included == n ? "true" : "false", body);
+  return written > 0 && (size_t)written < size ? (size_t)written : 0;
+}
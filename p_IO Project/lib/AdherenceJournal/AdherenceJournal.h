@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * AdherenceJournal
+ * Append-only record of every medicine alarm: when it fired and whether it was dismissed, snoozed
+ * or missed, with the time the user took to answer. Events collect in RAM and are written to flash
+ * in batches, from the main loop, once JOURNAL_BATCH are waiting or the oldest has waited
+ * JOURNAL_COMMIT_MS; an alarm costs no flash write while it rings.
+ *
+ * A record is 16 bytes: sequence number, epoch seconds, kind, alarm slot, latency in tenths of a
+ * second, and a CRC-32 of the other twelve bytes. Sequence numbers run on without gaps, so a
+ * cursor is just the sequence number to continue from. The journal is JOURNAL_FILE; when it
+ * reaches JOURNAL_MAX_BYTES it becomes JOURNAL_OLD_FILE (replacing the previous one), so about
+ * two files' worth of history is kept.
+ *
+ * begin() checks every record. A torn or corrupt tail (power lost during a write) is cut off by
+ * copying the good records to JOURNAL_TMP_FILE and renaming it over the journal; an interrupted
+ * recovery is finished or redone at the next boot.
+ *
+ * Files are reached through JournalFs: LittleFS on the box, a directory on the host.
+ **************************************************************************************************/
+
+#define JOURNAL_FILE "/journal.bin"
+#define JOURNAL_OLD_FILE "/journal.old"
+#define JOURNAL_TMP_FILE "/journal.tmp"
+
+#define JOURNAL_RECORD_SIZE 16
+#define JOURNAL_BATCH 8              // Records that trigger a commit
+#define JOURNAL_PENDING 32           // Records held in RAM while the file cannot be written
+#define JOURNAL_COMMIT_MS 60000      // Longest a record waits in RAM
+#define JOURNAL_MAX_BYTES (16 * 1024) // 1024 records per file
+#define JOURNAL_NO_LATENCY 0xFFFF
+#define JOURNAL_SNOOZED_ALARM 0xFF // Slot passed for a snoozed alarm coming back (ALARM_SNOOZED)
+
+enum JournalKind : uint8_t
+{
+  JOURNAL_FIRED,
+  JOURNAL_DISMISSED,
+  JOURNAL_SNOOZED,
+  JOURNAL_MISSED, // Rang until the timeout without an answer
+  JOURNAL_KIND_COUNT
+};
+
+struct JournalRecord
+{
+  uint32_t seq;
+  uint32_t epoch;
+  JournalKind kind;
+  uint8_t alarm;       // Alarm slot; a snoozed alarm coming back keeps its slot
+  uint16_t latency_ds; // Fired to answered, tenths of a second; JOURNAL_NO_LATENCY for FIRED
+};
+
+class JournalFs
+{
+public:
+  virtual ~JournalFs() {}
+  virtual int32_t size(const char *name) = 0; // -1 when the file does not exist
+  virtual bool read(const char *name, uint32_t offset, uint8_t *data, size_t n) = 0;
+  virtual bool append(const char *name, const uint8_t *data, size_t n) = 0; // Creates the file
+  virtual bool rename(const char *from, const char *to) = 0;                // Replaces `to`
+  virtual bool remove(const char *name) = 0;
+};
+
+struct JournalStats
+{
+  uint32_t recorded;       // Events handed to record()
+  uint32_t committed;      // Records written to flash
+  uint32_t commits;        // Batched writes
+  uint32_t write_errors;
+  uint32_t dropped;        // Lost because the RAM buffer was full
+  uint32_t rotations;
+  uint32_t recovered_bytes; // Torn or corrupt tail cut off by begin()
+};
+
+class AdherenceJournal
+{
+public:
+  explicit AdherenceJournal(JournalFs &fs);
+
+  bool begin();
+  void record(uint32_t now_ms, uint32_t epoch, JournalKind kind, uint8_t alarm, uint32_t latency_ms);
+  bool poll(uint32_t now_ms);
+  bool commit();
+
+  size_t read(uint32_t cursor, JournalRecord *records, size_t max, uint32_t &next);
+  uint32_t first_seq() const; // Oldest record still on flash
+  uint32_t end_seq() const;   // One past the newest committed record
+  size_t pending() const { return pending_count_; }
+
+  JournalStats stats() const { return stats_; }
+
+private:
+  bool scan(const char *name, uint32_t &first, uint32_t &count, uint32_t &good_bytes);
+  bool truncate_active(uint32_t good_bytes);
+  void settle_pending();
+  bool read_file(const char *name, uint32_t first, uint32_t count, uint32_t cursor, JournalRecord *records,
+                 size_t max, size_t &n);
+
+  JournalFs &fs_;
+  bool ready_;
+
+  uint32_t old_first_;    // Sequence numbers held by JOURNAL_OLD_FILE
+  uint32_t old_count_;
+  uint32_t active_first_; // ... and by JOURNAL_FILE
+  uint32_t active_count_;
+
+  JournalRecord pending_[JOURNAL_PENDING];
+  uint8_t pending_count_;
+  uint32_t oldest_pending_ms_;
+  bool failed_; // Last commit failed; wait before retrying
+  uint8_t last_snoozed_alarm_;
+
+  JournalStats stats_;
+};
+
+void journal_encode(const JournalRecord &record, uint8_t out[JOURNAL_RECORD_SIZE]);
+bool journal_decode(const uint8_t in[JOURNAL_RECORD_SIZE], JournalRecord &record);
+uint32_t journal_crc32(const uint8_t *data, size_t n);
+const char *journal_kind_name(JournalKind kind);
+size_t format_journal_batch(char *buffer, size_t size, const JournalRecord *records, size_t n, uint32_t next,
+                            bool end, size_t &included);
@@ -0,0 +1,94 @@
+#include "AlertEngine.h"
+
+#include <math.h>
+#include <stdio.h>
+
+void alert_reset(AlertState &state)
+{
+  state.level = ALERT_NORMAL;
+  state.pending = ALERT_NORMAL;
+  state.pending_since = 0;
+}
+
+/***************************************************************************************************
+ * target_level()
+ * Level the reading points to given the current level. Leaving an alert needs the reading to be
+ * back inside the band by the hysteresis margin.
+ **************************************************************************************************/
+static AlertLevel target_level(AlertLevel current, const AlertThresholds &t, float value)
+{
+  if (value > t.high)
+    return ALERT_HIGH;
+  if (value < t.low)
+    return ALERT_LOW;
+
+  if (current == ALERT_HIGH && value > t.high - t.hysteresis)
+    return ALERT_HIGH;
+  if (current == ALERT_LOW && value < t.low + t.hysteresis)
+    return ALERT_LOW;
+  return ALERT_NORMAL;
+}
+
+/***************************************************************************************************
+ * alert_update()
+ * Feeds one reading. Returns an event with changed = true only when the reported level moves.
+ * NaN readings (sensor errors) are ignored and do not restart the dwell timer.
+ **************************************************************************************************/
+AlertEvent alert_update(AlertState &state, const AlertThresholds &thresholds, uint32_t dwell_ms, float value,
+                        uint32_t now_ms)
+{
+  AlertEvent event = {false, state.level, state.level, value, 0.0f};
+  if (isnan(value))
+    return event;
+
+  AlertLevel target = target_level(state.level, thresholds, value);
+  if (target != state.pending)
+  {
+    state.pending = target;
+    state.pending_since = now_ms;
+  }
+
+  if (state.pending != state.level && (uint32_t)(now_ms - state.pending_since) >= dwell_ms)
+  {
+    event.changed = true;
+    event.previous = state.level;
+    event.level = state.pending;
+    AlertLevel crossed = event.level != ALERT_NORMAL ? event.level : event.previous;
+    event.threshold = crossed == ALERT_HIGH ? thresholds.high : thresholds.low;
+    state.level = state.pending;
+  }
+  return event;
+}
+
+bool alert_thresholds_valid(const AlertThresholds &t)
+{
+  return t.low < t.high && t.hysteresis >= 0.0f && t.hysteresis * 2.0f < t.high - t.low;
+}
+
+const char *alert_level_name(AlertLevel level)
+{
+  switch (level)
+  {
+  case ALERT_LOW:
+    return "low";
+  case ALERT_HIGH:
+    return "high";
+  default:
+    return "clear";
+  }
+}
+
+/***************************************************************************************************
+ * format_alert_event()
+ * JSON published on medibox/<id>/alert, e.g.
+ * {"metric":"temperature","state":"high","value":33.10,"threshold":32.00,"ts":1760000000}
+ **************************************************************************************************/
+size_t format_alert_event(char *buffer, size_t size, const char *metric, const AlertEvent &event,
+                          long long timestamp)
+{
+  int n = snprintf(buffer, size, "{\"metric\":\"%s\",\"state\":\"%s\",\"value\":%.2f,\"threshold\":%.2f,\"ts\":%lld}",
+                   metric, alert_level_name(event.level), event.value, event.threshold, timestamp);
+  if (n < 0)
+    return 0;
+  return (size_t)n < size ? (size_t)n : size - 1;
+}
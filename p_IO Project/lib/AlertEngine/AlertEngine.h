@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * AlertEngine
+ * Edge-triggered range alerts for one metric. A reading has to stay beyond a threshold for the
+ * dwell time before the alert is raised, and has to come back inside the band by the hysteresis
+ * margin (again for the dwell time) before it clears, so a value sitting on a threshold produces
+ * one event instead of one per loop.
+ **************************************************************************************************/
+
+enum AlertLevel : uint8_t
+{
+  ALERT_NORMAL,
+  ALERT_LOW,
+  ALERT_HIGH
+};
+
+struct AlertThresholds
+{
+  float low;
+  float high;
+  float hysteresis;
+};
+
+struct AlertState
+{
+  AlertLevel level;        // Level last reported
+  AlertLevel pending;      // Level the readings currently point to
+  uint32_t pending_since;  // millis() when pending last changed
+};
+
+struct AlertEvent
+{
+  bool changed;            // True only on a raise or clear
+  AlertLevel level;        // New level
+  AlertLevel previous;     // Level before the transition
+  float value;             // Reading that completed the transition
+  float threshold;         // Threshold that was crossed
+};
+
+void alert_reset(AlertState &state);
+AlertEvent alert_update(AlertState &state, const AlertThresholds &thresholds, uint32_t dwell_ms, float value,
+                        uint32_t now_ms);
+bool alert_thresholds_valid(const AlertThresholds &thresholds);
+const char *alert_level_name(AlertLevel level);
+size_t format_alert_event(char *buffer, size_t size, const char *metric, const AlertEvent &event,
+                          long long timestamp);
@@ -0,0 +1,385 @@
+#include "BinLog.h"
+
+#include <stdio.h>
+
+static_assert((BINLOG_SLOTS & (BINLOG_SLOTS - 1)) == 0, "ring size must be a power of two");
+static_assert(BINLOG_ARG_BYTES <= 255 && BINLOG_MAX_STRING + 2 <= BINLOG_ARG_BYTES, "argument area too small");
+
+BinLog binlog;
+
+/***************************************************************************************************
+ * binlog_put()
+ * Appends one tagged argument. Once an argument does not fit, the rest of the record's arguments
+ * are skipped too, so the formatter never pairs a conversion with the wrong value.
+ **************************************************************************************************/
+void binlog_put(LogRecord &r, uint8_t tag, const void *value, size_t size)
+{
+  if ((r.flags & BINLOG_TRUNCATED) || r.length + 1 + size > BINLOG_ARG_BYTES)
+  {
+    r.flags |= BINLOG_TRUNCATED;
+    return;
+  }
+  r.args[r.length++] = tag;
+  memcpy(r.args + r.length, value, size);
+  r.length += size;
+}
+
+void binlog_put_str(LogRecord &r, const char *text, size_t length)
+{
+  if (length > BINLOG_MAX_STRING)
+    length = BINLOG_MAX_STRING;
+  if ((r.flags & BINLOG_TRUNCATED) || r.length + 2 + length > BINLOG_ARG_BYTES)
+  {
+    r.flags |= BINLOG_TRUNCATED;
+    return;
+  }
+  r.args[r.length++] = LOG_ARG_STR;
+  r.args[r.length++] = (uint8_t)length;
+  memcpy(r.args + r.length, text, length);
+  r.length += length;
+}
+
+/***************************************************************************************************
+ * BinLog
+ **************************************************************************************************/
+BinLog::BinLog() : now_ms_(NULL), enqueue_pos_(0), dequeue_pos_(0), written_(0), dropped_(0), truncated_(0)
+{
+  for (uint32_t i = 0; i < BINLOG_SLOTS; i++)
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+void BinLog::set_clock(uint32_t (*now_ms)())
+{
+  now_ms_ = now_ms;
+}
+
+BinLog::Slot *BinLog::claim(uint32_t &pos)
+{
+  pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (true)
+  {
+    Slot &slot = slots_[pos & (BINLOG_SLOTS - 1)];
+    uint32_t seq = slot.sequence.load(std::memory_order_acquire);
+    int32_t diff = (int32_t)(seq - pos);
+    if (diff == 0)
+    {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        return &slot;
+    }
+    else if (diff < 0)
+    {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return NULL;
+    }
+    else
+    {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+void BinLog::commit(Slot *slot, uint32_t pos)
+{
+  if (slot->record.flags & BINLOG_TRUNCATED)
+    truncated_.fetch_add(1, std::memory_order_relaxed);
+  written_.fetch_add(1, std::memory_order_relaxed);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+/***************************************************************************************************
+ * pop()
+ * Single consumer. Copies the oldest finished record out and frees its slot; returns false when
+ * the ring is empty or the oldest record is still being written.
+ **************************************************************************************************/
+bool BinLog::pop(LogRecord &out)
+{
+  Slot &slot = slots_[dequeue_pos_ & (BINLOG_SLOTS - 1)];
+  if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+    return false;
+
+  out = slot.record;
+  slot.sequence.store(dequeue_pos_ + BINLOG_SLOTS, std::memory_order_release);
+  dequeue_pos_++;
+  return true;
+}
+
+BinLogStats BinLog::stats() const
+{
+  BinLogStats s;
+  s.written = written_.load(std::memory_order_relaxed);
+  s.dropped = dropped_.load(std::memory_order_relaxed);
+  s.truncated = truncated_.load(std::memory_order_relaxed);
+  return s;
+}
+
+/***************************************************************************************************
+ * Formatting
+ **************************************************************************************************/
+struct LogArg
+{
+  uint8_t tag;
+  int64_t i;
+  uint64_t u;
+  double f;
+  char s[BINLOG_MAX_STRING + 1];
+};
+
+static bool next_arg(const uint8_t *args, size_t length, size_t &offset, LogArg &a)
+{
+  if (offset >= length)
+    return false;
+
+  a.tag = args[offset];
+  const uint8_t *p = args + offset + 1;
+  size_t left = length - offset - 1;
+  size_t size;
+  switch (a.tag)
+  {
+  case LOG_ARG_I32:
+  case LOG_ARG_U32:
+  case LOG_ARG_F32:
+    size = 4;
+    break;
+  case LOG_ARG_I64:
+  case LOG_ARG_U64:
+  case LOG_ARG_F64:
+    size = 8;
+    break;
+  case LOG_ARG_STR:
+    size = left > 0 ? 1 + (size_t)p[0] : 1;
+    break;
+  default:
+    return false;
+  }
+  if (size > left)
+    return false;
+
+  int32_t i32;
+  uint32_t u32;
+  float f32;
+  switch (a.tag)
+  {
+  case LOG_ARG_I32:
+    memcpy(&i32, p, 4);
+    a.i = i32;
+    a.u = (uint32_t)i32; // %x of a negative int prints 32 bits, as printf would
+    break;
+  case LOG_ARG_U32:
+    memcpy(&u32, p, 4);
+    a.i = u32;
+    a.u = u32;
+    break;
+  case LOG_ARG_I64:
+    memcpy(&a.i, p, 8);
+    a.u = (uint64_t)a.i;
+    break;
+  case LOG_ARG_U64:
+    memcpy(&a.u, p, 8);
+    a.i = (int64_t)a.u;
+    break;
+  case LOG_ARG_F32:
+    memcpy(&f32, p, 4);
+    a.f = f32;
+    break;
+  case LOG_ARG_F64:
+    memcpy(&a.f, p, 8);
+    break;
+  case LOG_ARG_STR:
+    memcpy(a.s, p + 1, p[0]);
+    a.s[p[0]] = '\0';
+    break;
+  }
+  offset += 1 + size;
+  return true;
+}
+
+static bool is_integer_tag(uint8_t tag)
+{
+  return tag == LOG_ARG_I32 || tag == LOG_ARG_U32 || tag == LOG_ARG_I64 || tag == LOG_ARG_U64;
+}
+
+static bool is_float_tag(uint8_t tag)
+{
+  return tag == LOG_ARG_F32 || tag == LOG_ARG_F64;
+}
+
+/***************************************************************************************************
+ * format_one()
+ * Prints one conversion. The length modifier comes from the stored argument, not the format
+ * string, so %d of an int64 or %lu of a 32-bit long both print correctly. A missing argument or
+ * one of the wrong kind prints "<?>".
+ **************************************************************************************************/
+static int format_one(char *out, size_t size, const char *flags, char conv, const LogArg *a)
+{
+  char spec[24];
+  if (strchr(flags, '*'))
+    a = NULL; // Width or precision taken from an argument is not supported
+  if (a && strchr("di", conv) && is_integer_tag(a->tag))
+  {
+    snprintf(spec, sizeof(spec), "%%%slld", flags);
+    return snprintf(out, size, spec, (long long)a->i);
+  }
+  if (a && strchr("uxXo", conv) && is_integer_tag(a->tag))
+  {
+    snprintf(spec, sizeof(spec), "%%%sll%c", flags, conv);
+    return snprintf(out, size, spec, (unsigned long long)a->u);
+  }
+  if (a && conv == 'c' && is_integer_tag(a->tag))
+  {
+    snprintf(spec, sizeof(spec), "%%%sc", flags);
+    return snprintf(out, size, spec, (int)a->i);
+  }
+  if (a && strchr("fFeEgGaA", conv) && is_float_tag(a->tag))
+  {
+    snprintf(spec, sizeof(spec), "%%%s%c", flags, conv);
+    return snprintf(out, size, spec, a->f);
+  }
+  if (a && conv == 's' && a->tag == LOG_ARG_STR)
+  {
+    snprintf(spec, sizeof(spec), "%%%ss", flags);
+    return snprintf(out, size, spec, a->s);
+  }
+  return snprintf(out, size, "<?>");
+}
+
+/***************************************************************************************************
+ * binlog_format()
+ * printf over stored arguments. Supports flags, width and precision written literally in the
+ * format; '*' prints "<?>". Output is cut at size - 1 and always terminated.
+ **************************************************************************************************/
+size_t binlog_format(const char *fmt, const uint8_t *args, size_t length, char *out, size_t size)
+{
+  if (size == 0)
+    return 0;
+
+  size_t pos = 0;
+  size_t offset = 0;
+  while (*fmt && pos + 1 < size)
+  {
+    if (*fmt != '%')
+    {
+      out[pos++] = *fmt++;
+      continue;
+    }
+    if (fmt[1] == '%')
+    {
+      out[pos++] = '%';
+      fmt += 2;
+      continue;
+    }
+
+    char flags[12];
+    size_t n = 0;
+    fmt++;
+    while (*fmt && strchr("-+ #0123456789.*", *fmt) && n + 1 < sizeof(flags))
+      flags[n++] = *fmt++;
+    flags[n] = '\0';
+    while (*fmt && strchr("hlLqjzt", *fmt))
+      fmt++;
+    if (!*fmt)
+      break;
+    char conv = *fmt++;
+
+    LogArg a;
+    bool have = next_arg(args, length, offset, a);
+    int written = format_one(out + pos, size - pos, flags, conv, have ? &a : NULL);
+    if (written < 0)
+      break;
+    pos += (size_t)written < size - pos ? (size_t)written : size - pos - 1;
+  }
+  out[pos] = '\0';
+  return pos;
+}
+
+/***************************************************************************************************
+ * binlog_format_line()
+ * "[seconds.millis] L message", with " [truncated]" when arguments were lost.
+ **************************************************************************************************/
+size_t binlog_format_line(const LogRecord &r, const char *fmt, char *out, size_t size)
+{
+  int n = snprintf(out, size, "[%lu.%03lu] %c ", (unsigned long)(r.timestamp_ms / 1000),
+                   (unsigned long)(r.timestamp_ms % 1000), log_level_name(r.level)[0]);
+  if (n < 0 || (size_t)n >= size)
+    return size ? strlen(out) : 0;
+
+  size_t pos = (size_t)n + binlog_format(fmt, r.args, r.length, out + n, size - n);
+  if (r.flags & BINLOG_TRUNCATED)
+  {
+    int extra = snprintf(out + pos, size - pos, " [truncated]");
+    if (extra > 0)
+      pos += (size_t)extra < size - pos ? (size_t)extra : size - pos - 1;
+  }
+  return pos;
+}
+
+/***************************************************************************************************
+ * Wire form
+ **************************************************************************************************/
+static void put_le32(uint8_t *p, uint32_t v)
+{
+  p[0] = (uint8_t)v;
+  p[1] = (uint8_t)(v >> 8);
+  p[2] = (uint8_t)(v >> 16);
+  p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+size_t binlog_encode(const LogRecord &r, uint8_t *out, size_t size)
+{
+  size_t total = BINLOG_WIRE_HEADER + r.length;
+  if (size < total)
+    return 0;
+
+  out[0] = BINLOG_WIRE_MAGIC;
+  out[1] = r.level;
+  out[2] = r.flags;
+  out[3] = r.length;
+  put_le32(out + 4, r.timestamp_ms);
+  put_le32(out + 8, (uint32_t)(uintptr_t)r.fmt);
+  memcpy(out + BINLOG_WIRE_HEADER, r.args, r.length);
+  return total;
+}
+
+/***************************************************************************************************
+ * binlog_decode()
+ * Parses one wire record. Returns the bytes it used, or 0 if the input does not start with a
+ * complete record. r.fmt is left NULL; the caller resolves fmt_address.
+ **************************************************************************************************/
+size_t binlog_decode(const uint8_t *in, size_t size, LogRecord &r, uint32_t &fmt_address)
+{
+  if (size < BINLOG_WIRE_HEADER || in[0] != BINLOG_WIRE_MAGIC || in[3] > BINLOG_ARG_BYTES)
+    return 0;
+  size_t total = BINLOG_WIRE_HEADER + in[3];
+  if (size < total)
+    return 0;
+
+  r.fmt = NULL;
+  r.level = in[1];
+  r.flags = in[2];
+  r.length = in[3];
+  r.timestamp_ms = get_le32(in + 4);
+  fmt_address = get_le32(in + 8);
+  memcpy(r.args, in + BINLOG_WIRE_HEADER, r.length);
+  return total;
+}
+
+const char *log_level_name(uint8_t level)
+{
+  switch (level)
+  {
+  case LOG_LEVEL_ERROR:
+    return "ERROR";
+  case LOG_LEVEL_WARN:
+    return "WARN";
+  case LOG_LEVEL_INFO:
+    return "INFO";
+  case LOG_LEVEL_DEBUG:
+    return "DEBUG";
+  default:
+    return "?";
+  }
+}
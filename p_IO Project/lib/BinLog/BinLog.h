@@ -0,0 +1,205 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+/***************************************************************************************************
+ * BinLog
+ * Deferred, leveled logging. A LOG_* call stores the format string pointer and the raw arguments in
+ * a fixed slot of a lock-free ring and returns; the printf formatting and the slow UART write
+ * happen later, when a low-priority task pops the record. Calls above MEDIBOX_LOG_LEVEL are
+ * discarded at compile time. A full ring drops the record and counts it, and never blocks the
+ * caller, so logging is safe from the main loop, other tasks and interrupts.
+ *
+ * Records also have a compact wire form (format string address + tagged arguments) for the MQTT
+ * sink. src/host/logdecode turns a capture back into text by looking the addresses up in the
+ * firmware ELF.
+ **************************************************************************************************/
+
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef MEDIBOX_LOG_LEVEL
+#define MEDIBOX_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define BINLOG_SLOTS 32      // Power of two; 132-byte slots on the ESP32 (record + sequence), 4.1 KB
+#define BINLOG_ARG_BYTES 116 // Tagged argument bytes per record
+#define BINLOG_MAX_STRING 48 // String arguments are copied, truncated to this many bytes
+#define BINLOG_TEXT_MAX 192  // Formatted message, including the terminator
+
+// Wire form: magic, level, flags, argument bytes, timestamp (LE32), format address (LE32), arguments
+#define BINLOG_WIRE_MAGIC 0xB7
+#define BINLOG_WIRE_HEADER 12
+#define BINLOG_WIRE_MAX (BINLOG_WIRE_HEADER + BINLOG_ARG_BYTES)
+
+#define BINLOG_TRUNCATED 0x01 // Some arguments did not fit and were left out
+
+enum LogArgTag : uint8_t
+{
+  LOG_ARG_I32 = 'i',
+  LOG_ARG_U32 = 'u',
+  LOG_ARG_I64 = 'I',
+  LOG_ARG_U64 = 'U',
+  LOG_ARG_F32 = 'f',
+  LOG_ARG_F64 = 'd',
+  LOG_ARG_STR = 's' // Length byte, then the bytes
+};
+
+struct LogRecord
+{
+  const char *fmt;
+  uint32_t timestamp_ms;
+  uint8_t level;
+  uint8_t flags;
+  uint8_t length; // Bytes used in args
+  uint8_t args[BINLOG_ARG_BYTES];
+};
+
+// Text that is not NUL-terminated, such as an MQTT payload: LOG_DEBUG("%s", log_str(p, n))
+struct LogStr
+{
+  const char *text;
+  size_t length;
+};
+
+inline LogStr log_str(const void *text, size_t length)
+{
+  LogStr s = {(const char *)text, length};
+  return s;
+}
+
+struct BinLogStats
+{
+  uint32_t written;   // Records queued
+  uint32_t dropped;   // Records lost because the ring was full
+  uint32_t truncated; // Records queued without some of their arguments
+};
+
+/***************************************************************************************************
+ * Argument capture
+ * One overload per argument kind; anything else (pointers, structs) fails to compile rather than
+ * being logged wrongly.
+ **************************************************************************************************/
+void binlog_put(LogRecord &r, uint8_t tag, const void *value, size_t size);
+void binlog_put_str(LogRecord &r, const char *text, size_t length);
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value>::type binlog_put(LogRecord &r, T value)
+{
+  if (sizeof(T) <= 4 && std::is_signed<T>::value)
+  {
+    int32_t v = (int32_t)value;
+    binlog_put(r, LOG_ARG_I32, &v, sizeof(v));
+  }
+  else if (sizeof(T) <= 4)
+  {
+    uint32_t v = (uint32_t)value;
+    binlog_put(r, LOG_ARG_U32, &v, sizeof(v));
+  }
+  else if (std::is_signed<T>::value)
+  {
+    int64_t v = (int64_t)value;
+    binlog_put(r, LOG_ARG_I64, &v, sizeof(v));
+  }
+  else
+  {
+    uint64_t v = (uint64_t)value;
+    binlog_put(r, LOG_ARG_U64, &v, sizeof(v));
+  }
+}
+
+inline void binlog_put(LogRecord &r, float value) { binlog_put(r, LOG_ARG_F32, &value, sizeof(value)); }
+inline void binlog_put(LogRecord &r, double value) { binlog_put(r, LOG_ARG_F64, &value, sizeof(value)); }
+inline void binlog_put(LogRecord &r, const char *text) { binlog_put_str(r, text ? text : "(null)", text ? strlen(text) : 6); }
+inline void binlog_put(LogRecord &r, LogStr text) { binlog_put_str(r, text.text, text.length); }
+
+inline void binlog_put_all(LogRecord &) {}
+
+template <typename T, typename... Rest>
+inline void binlog_put_all(LogRecord &r, T first, Rest... rest)
+{
+  binlog_put(r, first);
+  binlog_put_all(r, rest...);
+}
+
+/***************************************************************************************************
+ * BinLog
+ * Same bounded MPMC ring as EventBus: a producer claims the slot whose sequence equals the enqueue
+ * position, fills it in place and publishes it by advancing the sequence. pop() is for a single
+ * consumer, the drain task.
+ **************************************************************************************************/
+class BinLog
+{
+public:
+  BinLog();
+
+  void set_clock(uint32_t (*now_ms)());
+
+  template <typename... Args>
+  void write(uint8_t level, const char *fmt, Args... args)
+  {
+    uint32_t pos;
+    Slot *slot = claim(pos);
+    if (!slot)
+      return;
+
+    LogRecord &r = slot->record;
+    r.fmt = fmt;
+    r.timestamp_ms = now_ms_ ? now_ms_() : 0;
+    r.level = level;
+    r.flags = 0;
+    r.length = 0;
+    binlog_put_all(r, args...);
+    commit(slot, pos);
+  }
+
+  bool pop(LogRecord &out);
+  BinLogStats stats() const;
+
+private:
+  struct Slot
+  {
+    std::atomic<uint32_t> sequence;
+    LogRecord record;
+  };
+
+  Slot *claim(uint32_t &pos);
+  void commit(Slot *slot, uint32_t pos);
+
+  uint32_t (*now_ms_)();
+  Slot slots_[BINLOG_SLOTS];
+  std::atomic<uint32_t> enqueue_pos_;
+  uint32_t dequeue_pos_; // Only pop() moves it
+  std::atomic<uint32_t> written_;
+  std::atomic<uint32_t> dropped_;
+  std::atomic<uint32_t> truncated_;
+};
+
+extern BinLog binlog;
+
+// The level test is a constant, so disabled calls and their arguments compile to nothing
+#define BINLOG_AT(level, fmt, ...)                     \
+  do                                                   \
+  {                                                    \
+    if ((level) <= MEDIBOX_LOG_LEVEL)                  \
+      binlog.write((level), (fmt), ##__VA_ARGS__);     \
+  } while (0)
+
+#define LOG_ERROR(fmt, ...) BINLOG_AT(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...) BINLOG_AT(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...) BINLOG_AT(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) BINLOG_AT(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+// Formatting and the wire form, shared by the drain task and the host decoder
+size_t binlog_format(const char *fmt, const uint8_t *args, size_t length, char *out, size_t size);
+size_t binlog_format_line(const LogRecord &r, const char *fmt, char *out, size_t size);
+size_t binlog_encode(const LogRecord &r, uint8_t *out, size_t size);
+size_t binlog_decode(const uint8_t *in, size_t size, LogRecord &r, uint32_t &fmt_address);
+const char *log_level_name(uint8_t level);
@@ -0,0 +1,86 @@
+#include "ConfigStore.h"
+
+#include <math.h>
+#include <string.h>
+
+ConfigStore::ConfigStore(const MediboxConfig &initial) : sequence_(0), version_(0), published_(0), retries_(0)
+{
+  for (unsigned i = 0; i < WORDS; i++)
+    words_[i].store(0, std::memory_order_relaxed);
+  publish(config_snapshot(initial));
+  published_ = 0;
+}
+
+/***************************************************************************************************
+ * publish()
+ * The release fence after the odd sequence keeps the word stores from moving above it; the
+ * release store of the even sequence keeps them from moving below.
+ **************************************************************************************************/
+void ConfigStore::publish(const ConfigSnapshot &snapshot)
+{
+  uint32_t buffer[WORDS] = {};
+  memcpy(buffer, &snapshot, sizeof(snapshot));
+
+  uint32_t seq = sequence_.load(std::memory_order_relaxed);
+  sequence_.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (unsigned i = 0; i < WORDS; i++)
+    words_[i].store(buffer[i], std::memory_order_relaxed);
+  sequence_.store(seq + 2, std::memory_order_release);
+
+  version_.store(snapshot.config.version, std::memory_order_relaxed);
+  published_++;
+}
+
+/***************************************************************************************************
+ * read()
+ * Copies until the sequence was even and unchanged across the copy. Every word is an atomic, so
+ * a torn copy is only ever thrown away, never undefined.
+ **************************************************************************************************/
+void ConfigStore::read(ConfigSnapshot &out) const
+{
+  uint32_t buffer[WORDS];
+  while (true)
+  {
+    uint32_t before = sequence_.load(std::memory_order_acquire);
+    if ((before & 1) == 0)
+    {
+      for (unsigned i = 0; i < WORDS; i++)
+        buffer[i] = words_[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence_.load(std::memory_order_relaxed) == before)
+        break;
+    }
+    retries_.fetch_add(1, std::memory_order_relaxed);
+  }
+  memcpy(&out, buffer, sizeof(out));
+}
+
+uint32_t ConfigStore::version() const
+{
+  return version_.load(std::memory_order_relaxed);
+}
+
+ConfigStoreStats ConfigStore::stats() const
+{
+  ConfigStoreStats s;
+  s.published = published_;
+  s.retries = retries_.load(std::memory_order_relaxed);
+  return s;
+}
+
+/***************************************************************************************************
+ * config_snapshot()
+ * The config with its derived values. log_ratio is computed exactly as shade_angle() always did,
+ * so moving it here changes no angle.
+ **************************************************************************************************/
+ConfigSnapshot config_snapshot(const MediboxConfig &config)
+{
+  ConfigSnapshot snapshot;
+  memset(&snapshot, 0, sizeof(snapshot));
+  snapshot.config = config;
+  snapshot.log_ratio = logf((float)config.ts / config.tu);
+  snapshot.window_s = (uint32_t)config.tu;
+  snapshot.sample_ms = (uint32_t)config.ts * 1000;
+  return snapshot;
+}
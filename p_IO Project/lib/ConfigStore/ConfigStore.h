@@ -0,0 +1,59 @@
+#pragma once
+
+#include <MediboxConfig.h>
+#include <atomic>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * ConfigStore
+ * The applied config as an immutable snapshot, published by one writer (the main loop, when an
+ * MQTT document is applied) and read by any task without a lock. It is a seqlock: the writer
+ * makes the sequence odd, stores the words, then makes it even again; a reader copies the words
+ * and keeps the copy only if it saw the same even sequence before and after. Readers never block
+ * the writer, and a reader that raced an update simply copies again.
+ *
+ * A snapshot carries the values derived from the config (window length, sampling period, the
+ * shade model's log ratio), computed once per version by config_snapshot() instead of on every
+ * sample. So a reader always gets a tu and the window computed from that same tu.
+ *
+ * The writer must not be preempted by a reader on its own core while publishing, or the reader
+ * spins until the writer runs again; on the ESP32 the main loop is the writer and other tasks read
+ * from core 0.
+ **************************************************************************************************/
+
+struct ConfigSnapshot
+{
+  MediboxConfig config;
+  float log_ratio;    // ln(ts / tu), the shade model's time factor
+  uint32_t window_s;  // Light average window, tu
+  uint32_t sample_ms; // LDR sampling period, ts
+};
+
+struct ConfigStoreStats
+{
+  uint32_t published;
+  uint32_t retries; // Reads that raced an update and copied again
+};
+
+class ConfigStore
+{
+public:
+  explicit ConfigStore(const MediboxConfig &initial);
+
+  void publish(const ConfigSnapshot &snapshot); // One writer only
+  void read(ConfigSnapshot &out) const;
+  uint32_t version() const;
+
+  ConfigStoreStats stats() const;
+
+private:
+  static const unsigned WORDS = (sizeof(ConfigSnapshot) + 3) / 4;
+
+  std::atomic<uint32_t> sequence_; // Odd while publish() is writing
+  std::atomic<uint32_t> words_[WORDS];
+  std::atomic<uint32_t> version_;
+  uint32_t published_;
+  mutable std::atomic<uint32_t> retries_;
+};
+
+ConfigSnapshot config_snapshot(const MediboxConfig &config);
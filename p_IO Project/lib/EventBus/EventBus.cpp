@@ -0,0 +1,230 @@
+#include "EventBus.h"
+
+#include <string.h>
+
+static_assert((EVENT_QUEUE_CAPACITY & (EVENT_QUEUE_CAPACITY - 1)) == 0, "queue capacity must be a power of two");
+
+/***************************************************************************************************
+ * EventBus()
+ * Sorts the subscription table into per-type handler lists once, so dispatch is a direct index.
+ **************************************************************************************************/
+EventBus::EventBus(const EventSubscription *subscriptions, uint8_t count)
+    : rejected_(0), enqueue_pos_(0), dequeue_pos_(0), handler_calls_(0), posted_(0), dropped_(0), high_water_(0)
+{
+  memset(handlers_, 0, sizeof(handlers_));
+  memset(handler_count_, 0, sizeof(handler_count_));
+  memset(dispatched_, 0, sizeof(dispatched_));
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    EventType type = subscriptions[i].type;
+    if (type >= EVT_COUNT || !subscriptions[i].handler || handler_count_[type] >= EVENT_MAX_HANDLERS)
+    {
+      rejected_++;
+      continue;
+    }
+    handlers_[type][handler_count_[type]++] = subscriptions[i].handler;
+  }
+
+  for (uint32_t i = 0; i < EVENT_QUEUE_CAPACITY; i++)
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+/***************************************************************************************************
+ * publish()
+ * Main context only. Handlers run in table order and may publish further events themselves.
+ **************************************************************************************************/
+void EventBus::publish(const Event &event)
+{
+  if (event.type >= EVT_COUNT)
+    return;
+
+  dispatched_[event.type]++;
+  uint8_t n = handler_count_[event.type];
+  EventHandler *handlers = handlers_[event.type];
+  for (uint8_t i = 0; i < n; i++)
+    handlers[i](event);
+  handler_calls_ += n;
+}
+
+/***************************************************************************************************
+ * post()
+ * Safe from any context, including interrupts. Each slot carries a sequence number: a producer
+ * claims the slot whose sequence equals the enqueue position, fills it, then publishes it by
+ * advancing the sequence; drain() waits for that before reading.
+ **************************************************************************************************/
+bool EventBus::post(const Event &event)
+{
+  uint32_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (true)
+  {
+    Slot &slot = slots_[pos & (EVENT_QUEUE_CAPACITY - 1)];
+    uint32_t seq = slot.sequence.load(std::memory_order_acquire);
+    int32_t diff = (int32_t)(seq - pos);
+    if (diff == 0)
+    {
+      if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+      {
+        slot.event = event;
+        slot.sequence.store(pos + 1, std::memory_order_release);
+        posted_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    else if (diff < 0)
+    {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    else
+    {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+/***************************************************************************************************
+ * drain()
+ * Main context only. Dispatches up to max_events queued events and returns how many ran.
+ **************************************************************************************************/
+uint16_t EventBus::drain(uint16_t max_events)
+{
+  uint32_t depth = enqueue_pos_.load(std::memory_order_relaxed) - dequeue_pos_;
+  if (depth > high_water_)
+    high_water_ = depth;
+
+  uint16_t handled = 0;
+  while (handled < max_events)
+  {
+    Slot &slot = slots_[dequeue_pos_ & (EVENT_QUEUE_CAPACITY - 1)];
+    if (slot.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1)
+      break; // Empty, or the producer has not finished writing this slot
+
+    Event event = slot.event;
+    slot.sequence.store(dequeue_pos_ + EVENT_QUEUE_CAPACITY, std::memory_order_release);
+    dequeue_pos_++;
+
+    publish(event);
+    handled++;
+  }
+  return handled;
+}
+
+EventBusStats EventBus::stats() const
+{
+  EventBusStats s;
+  memcpy(s.dispatched, dispatched_, sizeof(s.dispatched));
+  s.handler_calls = handler_calls_;
+  s.posted = posted_.load(std::memory_order_relaxed);
+  s.dropped = dropped_.load(std::memory_order_relaxed);
+  s.queue_high_water = high_water_;
+  s.rejected_subscriptions = rejected_;
+  return s;
+}
+
+/***************************************************************************************************
+ * Event constructors
+ **************************************************************************************************/
+static Event make_event(EventType type, uint32_t now)
+{
+  Event event;
+  memset(&event, 0, sizeof(event));
+  event.type = type;
+  event.timestamp_ms = now;
+  return event;
+}
+
+Event event_time_tick(uint32_t now, uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t day, uint8_t day_of_week)
+{
+  Event event = make_event(EVT_TIME_TICK, now);
+  event.time.hours = hours;
+  event.time.minutes = minutes;
+  event.time.seconds = seconds;
+  event.time.day = day;
+  event.time.day_of_week = day_of_week;
+  return event;
+}
+
+Event event_light_sample(uint32_t now, float intensity)
+{
+  Event event = make_event(EVT_LIGHT_SAMPLE, now);
+  event.light.intensity = intensity;
+  return event;
+}
+
+Event event_env_sample(uint32_t now, float temperature, float humidity)
+{
+  Event event = make_event(EVT_ENV_SAMPLE, now);
+  event.env.temperature = temperature;
+  event.env.humidity = humidity;
+  return event;
+}
+
+Event event_config_changed(uint32_t now, uint32_t version, uint16_t fields, bool window_changed)
+{
+  Event event = make_event(EVT_CONFIG_CHANGED, now);
+  event.config.version = version;
+  event.config.fields = fields;
+  event.config.window_changed = window_changed;
+  return event;
+}
+
+Event event_button(uint32_t now, uint8_t pin)
+{
+  Event event = make_event(EVT_BUTTON, now);
+  event.button.pin = pin;
+  return event;
+}
+
+Event event_alarm_fired(uint32_t now, uint8_t index)
+{
+  Event event = make_event(EVT_ALARM_FIRED, now);
+  event.alarm.index = index;
+  return event;
+}
+
+const char *event_type_name(EventType type)
+{
+  switch (type)
+  {
+  case EVT_TIME_TICK:
+    return "time_tick";
+  case EVT_LIGHT_SAMPLE:
+    return "light_sample";
+  case EVT_ENV_SAMPLE:
+    return "env_sample";
+  case EVT_CONFIG_CHANGED:
+    return "config_changed";
+  case EVT_BUTTON:
+    return "button";
+  case EVT_ALARM_FIRED:
+    return "alarm_fired";
+  default:
+    return "unknown";
+  }
+}
+
+/***************************************************************************************************
+ * ButtonDebounce
+ **************************************************************************************************/
+void button_debounce_init(ButtonDebounce &button)
+{
+  button.down = false;
+  button.released_ms = 0;
+}
+
+bool button_debounce_edge(ButtonDebounce &button, uint32_t now, bool low)
+{
+  if (!low)
+  {
+    button.down = false;
+    button.released_ms = now;
+    return false;
+  }
+  if (button.down || now - button.released_ms < BUTTON_DEBOUNCE_MS)
+  {
+    return false;
+  }
+  button.down = true;
+  return true;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * EventBus
+ * Typed publish/subscribe without allocation. Subscribers are a const table fixed at build time;
+ * publish() fans an event out to them synchronously on the main loop, and post() queues it from
+ * any other context (ISR, timer, acquisition task) for the next drain(). The queue is a bounded
+ * lock-free ring (one CAS per post), so producers never block and a full queue drops the event and
+ * counts it instead.
+ **************************************************************************************************/
+
+#define EVENT_QUEUE_CAPACITY 32 // Power of two
+#define EVENT_MAX_HANDLERS 8    // Per event type
+
+enum EventType : uint8_t
+{
+  EVT_TIME_TICK,
+  EVT_LIGHT_SAMPLE,
+  EVT_ENV_SAMPLE,
+  EVT_CONFIG_CHANGED,
+  EVT_BUTTON,
+  EVT_ALARM_FIRED,
+  EVT_COUNT
+};
+
+struct TimeTick
+{
+  uint8_t hours;
+  uint8_t minutes;
+  uint8_t seconds;
+  uint8_t day;          // Day of month
+  uint8_t day_of_week;  // 0 = Sunday
+};
+
+struct LightSample
+{
+  float intensity; // 0-1
+};
+
+struct EnvSample
+{
+  float temperature;
+  float humidity;
+};
+
+struct ConfigChanged
+{
+  uint32_t version;
+  uint16_t fields;      // CONFIG_FIELD_* bits that were present in the update
+  bool window_changed;  // ts or tu changed
+};
+
+struct ButtonEvent
+{
+  uint8_t pin;
+};
+
+struct AlarmFired
+{
+  uint8_t index; // Alarm slot, or 0xFF for a snoozed alarm
+};
+
+struct Event
+{
+  EventType type;
+  uint32_t timestamp_ms;
+  union
+  {
+    TimeTick time;
+    LightSample light;
+    EnvSample env;
+    ConfigChanged config;
+    ButtonEvent button;
+    AlarmFired alarm;
+  };
+};
+
+typedef void (*EventHandler)(const Event &event);
+
+struct EventSubscription
+{
+  EventType type;
+  EventHandler handler;
+};
+
+struct EventBusStats
+{
+  uint32_t dispatched[EVT_COUNT]; // Events delivered, per type
+  uint32_t handler_calls;
+  uint32_t posted;                // Accepted by post()
+  uint32_t dropped;               // Rejected by post() because the queue was full
+  uint32_t queue_high_water;
+  uint8_t rejected_subscriptions; // Table entries beyond EVENT_MAX_HANDLERS
+};
+
+class EventBus
+{
+public:
+  EventBus(const EventSubscription *subscriptions, uint8_t count);
+
+  void publish(const Event &event);
+  bool post(const Event &event);
+  uint16_t drain(uint16_t max_events = EVENT_QUEUE_CAPACITY);
+
+  EventBusStats stats() const;
+
+private:
+  struct Slot
+  {
+    std::atomic<uint32_t> sequence;
+    Event event;
+  };
+
+  EventHandler handlers_[EVT_COUNT][EVENT_MAX_HANDLERS];
+  uint8_t handler_count_[EVT_COUNT];
+  uint8_t rejected_;
+
+  Slot slots_[EVENT_QUEUE_CAPACITY];
+  std::atomic<uint32_t> enqueue_pos_;
+  uint32_t dequeue_pos_; // Only drain() moves it
+
+  uint32_t dispatched_[EVT_COUNT];
+  uint32_t handler_calls_;
+  std::atomic<uint32_t> posted_;
+  std::atomic<uint32_t> dropped_;
+  uint32_t high_water_;
+};
+
+// Event constructors
+Event event_time_tick(uint32_t now, uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t day, uint8_t day_of_week);
+Event event_light_sample(uint32_t now, float intensity);
+Event event_env_sample(uint32_t now, float temperature, float humidity);
+Event event_config_changed(uint32_t now, uint32_t version, uint16_t fields, bool window_changed);
+Event event_button(uint32_t now, uint8_t pin);
+Event event_alarm_fired(uint32_t now, uint8_t index);
+
+const char *event_type_name(EventType type);
+
+/***************************************************************************************************
+ * ButtonDebounce
+ * Turns a push button's pin interrupts (on both edges) into one press per push. A low level is a
+ * press if the button was not already down and has been up for BUTTON_DEBOUNCE_MS; the bounce
+ * while it closes and the bounce while it opens again are dropped. A press is reported as soon as
+ * it closes, however short it is.
+ **************************************************************************************************/
+
+#define BUTTON_DEBOUNCE_MS 50
+
+struct ButtonDebounce
+{
+  bool down;
+  uint32_t released_ms;
+};
+
+void button_debounce_init(ButtonDebounce &button);
+bool button_debounce_edge(ButtonDebounce &button, uint32_t now, bool low); // True for a new press
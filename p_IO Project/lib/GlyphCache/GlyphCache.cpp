@@ -0,0 +1,83 @@
+#include "GlyphCache.h"
+
+#include <string.h>
+
+int glyph_index(char c)
+{
+  const char *p = c ? strchr(GLYPH_CHARS, c) : NULL;
+  return p ? (int)(p - GLYPH_CHARS) : -1;
+}
+
+bool glyph_cache_init(GlyphCache &cache, uint8_t size)
+{
+  memset(&cache, 0, sizeof(cache));
+  if (size < 1 || size > GLYPH_MAX_SIZE)
+    return false;
+  cache.size = size;
+  cache.width = 6 * size;
+  cache.pages = size;
+  return true;
+}
+
+/***************************************************************************************************
+ * glyph_cache_capture()
+ * Copies character c from the top-left corner of a framebuffer it was just drawn into, alone, at
+ * the cache's size.
+ **************************************************************************************************/
+void glyph_cache_capture(GlyphCache &cache, char c, const uint8_t *frame, int frame_width)
+{
+  int index = glyph_index(c);
+  if (index < 0)
+    return;
+  for (uint8_t p = 0; p < cache.pages; p++)
+    memcpy(&cache.bits[index][p * cache.width], frame + p * frame_width, cache.width);
+}
+
+/***************************************************************************************************
+ * glyph_draw()
+ * Draws text with its top-left corner at (x, y), clipped to the frame, and returns the x after
+ * the last character, like the GFX cursor.
+ **************************************************************************************************/
+int glyph_draw(const GlyphCache &cache, uint8_t *frame, int frame_width, int frame_height, int x, int y,
+               const char *text)
+{
+  const int frame_pages = frame_height / 8;
+  const int page = y >= 0 ? y / 8 : -((7 - y) / 8);
+  const int shift = y - page * 8;
+
+  for (; *text; text++, x += cache.width)
+  {
+    int index = glyph_index(*text);
+    if (index < 0 || x >= frame_width || x + cache.width <= 0)
+      continue;
+
+    int c0 = x < 0 ? -x : 0;
+    int c1 = x + cache.width > frame_width ? frame_width - x : cache.width;
+    for (int p = 0; p < cache.pages; p++)
+    {
+      const uint8_t *src = &cache.bits[index][p * cache.width];
+      int top = page + p;
+      if (shift == 0)
+      {
+        if (top < 0 || top >= frame_pages)
+          continue;
+        uint8_t *dst = frame + top * frame_width + x;
+        for (int c = c0; c < c1; c++)
+          dst[c] |= src[c];
+        continue;
+      }
+
+      // The glyph page straddles two frame pages
+      uint8_t *upper = top >= 0 && top < frame_pages ? frame + top * frame_width + x : NULL;
+      uint8_t *lower = top + 1 >= 0 && top + 1 < frame_pages ? frame + (top + 1) * frame_width + x : NULL;
+      for (int c = c0; c < c1; c++)
+      {
+        if (upper)
+          upper[c] |= (uint8_t)(src[c] << shift);
+        if (lower)
+          lower[c] |= (uint8_t)(src[c] >> (8 - shift));
+      }
+    }
+  }
+  return x;
+}
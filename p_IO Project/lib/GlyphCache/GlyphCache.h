@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * GlyphCache
+ * The big characters of the clock, alarm and time zone screens, pre-rendered once so a frame
+ * costs byte copies instead of Adafruit GFX's one fillRect per lit font pixel.
+ *
+ * At text size s a GFX character cell is 6s columns by 8s rows (5x8 font plus a spacing column),
+ * which is exactly s pages of the SSD1306 framebuffer, where each byte is 8 vertical pixels of
+ * one column (bit 0 on top). So a cached glyph is s pages of 6s column bytes. At boot the
+ * firmware draws each character with GFX into a cleared framebuffer and captures it, so the cache
+ * is the library's own font and scaling, pixel for pixel.
+ *
+ * glyph_draw() ORs glyphs into the framebuffer like GFX's transparent text (setTextColor(WHITE)):
+ * a plain byte OR per column when y is on a page boundary, a shifted pair of ORs otherwise.
+ * Characters outside GLYPH_CHARS are skipped as blank cells.
+ **************************************************************************************************/
+
+#define GLYPH_CHARS "0123456789:- hrsmin"
+#define GLYPH_COUNT (sizeof(GLYPH_CHARS) - 1)
+#define GLYPH_MAX_SIZE 3
+#define GLYPH_MAX_BYTES (6 * GLYPH_MAX_SIZE * GLYPH_MAX_SIZE)
+
+struct GlyphCache
+{
+  uint8_t size;  // GFX text size the glyphs were captured at
+  uint8_t width; // 6 * size columns, the spacing column included
+  uint8_t pages; // size pages of 8 rows
+  uint8_t bits[GLYPH_COUNT][GLYPH_MAX_BYTES]; // Page p, column c at [p * width + c]
+};
+
+int glyph_index(char c);
+bool glyph_cache_init(GlyphCache &cache, uint8_t size);
+void glyph_cache_capture(GlyphCache &cache, char c, const uint8_t *frame, int frame_width);
+int glyph_draw(const GlyphCache &cache, uint8_t *frame, int frame_width, int frame_height, int x, int y,
+               const char *text);
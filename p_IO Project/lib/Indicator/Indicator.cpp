@@ -0,0 +1,202 @@
+#include "Indicator.h"
+
+#include <stddef.h>
+
+/***************************************************************************************************
+ * Built-in patterns
+ **************************************************************************************************/
+static const IndicatorStep ENV_WARNING_STEPS[] = {
+    {STEP_LEVEL, 255, 200}, {STEP_REST, 0, 200}, {STEP_LEVEL, 255, 200}, {STEP_REST, 0, 200},
+    {STEP_LEVEL, 255, 200}, {STEP_REST, 0, 200}, {STEP_LEVEL, 255, 200}, {STEP_REST, 0, 1200}};
+const IndicatorPattern PATTERN_ENV_WARNING = {ENV_WARNING_STEPS, 8, 0};
+
+static const IndicatorStep ALARM_LIGHT_STEPS[] = {{STEP_LEVEL, 255, 60000}};
+const IndicatorPattern PATTERN_ALARM_LIGHT = {ALARM_LIGHT_STEPS, 1, 0};
+
+// Same notes and 220 ms + 20 ms cadence that ring_alarm() used to play with tone()/delay()
+static const IndicatorStep ALARM_MELODY_STEPS[] = {
+    {STEP_TONE, 262, 200}, {STEP_REST, 0, 40}, {STEP_TONE, 294, 200}, {STEP_REST, 0, 40},
+    {STEP_TONE, 330, 200}, {STEP_REST, 0, 40}, {STEP_TONE, 349, 200}, {STEP_REST, 0, 40},
+    {STEP_TONE, 392, 200}, {STEP_REST, 0, 40}, {STEP_TONE, 440, 200}, {STEP_REST, 0, 40},
+    {STEP_TONE, 494, 200}, {STEP_REST, 0, 40}, {STEP_TONE, 523, 200}, {STEP_REST, 0, 40}};
+const IndicatorPattern PATTERN_ALARM_MELODY = {ALARM_MELODY_STEPS, 16, 0};
+
+static const IndicatorStep SWITCH_BEEP_STEPS[] = {{STEP_TONE, 1000, 200}};
+const IndicatorPattern PATTERN_SWITCH_BEEP = {SWITCH_BEEP_STEPS, 1, 1};
+
+static const IndicatorStep BREATHE_STEPS[] = {{STEP_FADE, 255, 1000}, {STEP_FADE, 0, 1000}};
+const IndicatorPattern PATTERN_BREATHE = {BREATHE_STEPS, 2, 0};
+
+static const IndicatorStep BEEP_CODE_ERR_STEPS[] = {
+    {STEP_TONE, 2000, 80}, {STEP_REST, 0, 120}, {STEP_TONE, 2000, 80}, {STEP_REST, 0, 120},
+    {STEP_TONE, 2000, 80}, {STEP_REST, 0, 600}};
+const IndicatorPattern PATTERN_BEEP_CODE_ERR = {BEEP_CODE_ERR_STEPS, 6, 1};
+
+/***************************************************************************************************
+ * IndicatorSequencer
+ **************************************************************************************************/
+IndicatorSequencer::IndicatorSequencer(IndicatorDriver &driver) : driver_(driver), steps_applied_(0)
+{
+  for (uint8_t c = 0; c < INDICATOR_CHANNELS; c++)
+  {
+    ChannelState &ch = channels_[c];
+    for (uint8_t p = 0; p < INDICATOR_PRIORITIES; p++)
+      ch.requests[p] = NULL;
+    ch.pattern = NULL;
+    ch.priority = PRIORITY_IDLE;
+    ch.step = 0;
+    ch.loops = 0;
+    ch.token = 0;
+  }
+}
+
+/***************************************************************************************************
+ * play()
+ * Registers a pattern at a priority. It starts immediately if nothing more important is playing;
+ * replaying the pattern that is already running leaves it undisturbed.
+ **************************************************************************************************/
+void IndicatorSequencer::play(uint8_t channel, const IndicatorPattern *pattern, uint8_t priority)
+{
+  if (channel >= INDICATOR_CHANNELS || priority >= INDICATOR_PRIORITIES || !pattern || pattern->count == 0)
+    return;
+  channels_[channel].requests[priority] = pattern;
+  reevaluate(channel);
+}
+
+void IndicatorSequencer::stop(uint8_t channel, uint8_t priority)
+{
+  if (channel >= INDICATOR_CHANNELS || priority >= INDICATOR_PRIORITIES)
+    return;
+  channels_[channel].requests[priority] = NULL;
+  reevaluate(channel);
+}
+
+const IndicatorPattern *IndicatorSequencer::playing(uint8_t channel) const
+{
+  return channel < INDICATOR_CHANNELS ? channels_[channel].pattern : NULL;
+}
+
+uint8_t IndicatorSequencer::playing_priority(uint8_t channel) const
+{
+  return channel < INDICATOR_CHANNELS ? channels_[channel].priority : (uint8_t)PRIORITY_IDLE;
+}
+
+/***************************************************************************************************
+ * reevaluate()
+ * Switches the channel to its highest-priority request, or silences it when there is none.
+ **************************************************************************************************/
+void IndicatorSequencer::reevaluate(uint8_t channel)
+{
+  ChannelState &ch = channels_[channel];
+
+  int best = -1;
+  for (int p = INDICATOR_PRIORITIES - 1; p >= 0; p--)
+  {
+    if (ch.requests[p])
+    {
+      best = p;
+      break;
+    }
+  }
+
+  if (best < 0)
+  {
+    if (ch.pattern)
+    {
+      ch.pattern = NULL;
+      ch.priority = PRIORITY_IDLE;
+      ch.token++;
+      driver_.cancel(channel);
+      silence(channel);
+    }
+    return;
+  }
+
+  if (ch.pattern == ch.requests[best] && ch.priority == best)
+    return;
+
+  ch.pattern = ch.requests[best];
+  ch.priority = (uint8_t)best;
+  ch.step = 0;
+  ch.loops = 0;
+  ch.token++;
+  driver_.cancel(channel);
+  run_from(channel);
+}
+
+/***************************************************************************************************
+ * run_from()
+ * Applies the current step and arms the timer for its end. Zero-length steps are applied back to
+ * back; a finished pattern drops its request and hands the channel to the next one down.
+ **************************************************************************************************/
+void IndicatorSequencer::run_from(uint8_t channel)
+{
+  ChannelState &ch = channels_[channel];
+
+  for (uint8_t guard = 0; guard <= ch.pattern->count; guard++)
+  {
+    if (ch.step >= ch.pattern->count)
+    {
+      ch.step = 0;
+      ch.loops++;
+      if (ch.pattern->repeat != 0 && ch.loops >= ch.pattern->repeat)
+      {
+        ch.requests[ch.priority] = NULL;
+        ch.pattern = NULL;
+        ch.priority = PRIORITY_IDLE;
+        silence(channel);
+        reevaluate(channel);
+        return;
+      }
+    }
+
+    const IndicatorStep &step = ch.pattern->steps[ch.step];
+    switch (step.kind)
+    {
+    case STEP_LEVEL:
+      driver_.set_level(channel, (uint8_t)step.value);
+      break;
+    case STEP_FADE:
+      driver_.fade_to(channel, (uint8_t)step.value, step.duration_ms);
+      break;
+    case STEP_TONE:
+      driver_.set_tone(channel, step.value);
+      break;
+    case STEP_REST:
+      silence(channel);
+      break;
+    }
+    steps_applied_++;
+
+    if (step.duration_ms > 0)
+    {
+      driver_.schedule(channel, step.duration_ms, ch.token);
+      return;
+    }
+    ch.step++;
+  }
+}
+
+/***************************************************************************************************
+ * on_timer()
+ * Called from the driver's timer when a step ends. Tokens from cancelled timers are ignored.
+ **************************************************************************************************/
+void IndicatorSequencer::on_timer(uint8_t channel, uint32_t token)
+{
+  if (channel >= INDICATOR_CHANNELS)
+    return;
+  ChannelState &ch = channels_[channel];
+  if (!ch.pattern || token != ch.token)
+    return;
+
+  ch.step++;
+  run_from(channel);
+}
+
+void IndicatorSequencer::silence(uint8_t channel)
+{
+  if (channel == IND_BUZZER)
+    driver_.set_tone(channel, 0);
+  else
+    driver_.set_level(channel, 0);
+}
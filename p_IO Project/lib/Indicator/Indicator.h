@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+
+/***************************************************************************************************
+ * Indicator
+ * Plays declarative light/sound patterns on the LED and buzzer channels. A pattern is a list of
+ * steps (level, hardware fade, tone, rest); the sequencer applies one step, asks the driver for a
+ * one-shot timer and does nothing until that timer fires. Each channel keeps one request per
+ * priority and always plays the highest, so a medicine alarm pre-empts an environment warning and
+ * the warning resumes once the alarm is stopped.
+ *
+ * The hardware lives behind IndicatorDriver (LEDC + esp_timer on the ESP32), so the sequencer
+ * itself builds and runs on the host against a mock driver (`pio run -e indicatortest`).
+ **************************************************************************************************/
+
+#define INDICATOR_CHANNELS 3
+#define INDICATOR_PRIORITIES 4
+
+enum IndicatorChannel : uint8_t
+{
+  IND_LED_1 = 0,
+  IND_LED_2 = 1,
+  IND_BUZZER = 2
+};
+
+enum IndicatorPriority : uint8_t
+{
+  PRIORITY_IDLE = 0,
+  PRIORITY_ENV_WARNING = 1,
+  PRIORITY_NOTIFY = 2,
+  PRIORITY_MEDICINE_ALARM = 3
+};
+
+enum IndicatorStepKind : uint8_t
+{
+  STEP_LEVEL, // Jump to value (LED duty 0-255) and hold for duration_ms
+  STEP_FADE,  // Hardware fade to value over duration_ms
+  STEP_TONE,  // Buzzer at value Hz for duration_ms
+  STEP_REST   // Output off for duration_ms
+};
+
+struct IndicatorStep
+{
+  IndicatorStepKind kind;
+  uint16_t value;
+  uint16_t duration_ms;
+};
+
+struct IndicatorPattern
+{
+  const IndicatorStep *steps;
+  uint8_t count;
+  uint8_t repeat; // Times to play the step list, 0 = until stopped
+};
+
+// schedule() arms the channel's one-shot timer, replacing any armed one; when it fires the driver
+// calls on_timer() with that arming's token. A timer that fired before the channel was stopped or
+// re-armed must be delivered with its own token, never the new one.
+class IndicatorDriver
+{
+public:
+  virtual ~IndicatorDriver() {}
+  virtual void set_level(uint8_t channel, uint8_t duty) = 0;
+  virtual void fade_to(uint8_t channel, uint8_t duty, uint16_t duration_ms) = 0;
+  virtual void set_tone(uint8_t channel, uint16_t frequency) = 0; // 0 = silent
+  virtual void schedule(uint8_t channel, uint32_t delay_ms, uint32_t token) = 0;
+  virtual void cancel(uint8_t channel) = 0;
+};
+
+class IndicatorSequencer
+{
+public:
+  explicit IndicatorSequencer(IndicatorDriver &driver);
+
+  void play(uint8_t channel, const IndicatorPattern *pattern, uint8_t priority);
+  void stop(uint8_t channel, uint8_t priority);
+  void on_timer(uint8_t channel, uint32_t token);
+
+  const IndicatorPattern *playing(uint8_t channel) const;
+  uint8_t playing_priority(uint8_t channel) const;
+  uint32_t steps_applied() const { return steps_applied_; }
+
+private:
+  struct ChannelState
+  {
+    const IndicatorPattern *requests[INDICATOR_PRIORITIES];
+    const IndicatorPattern *pattern;
+    uint8_t priority;
+    uint8_t step;
+    uint8_t loops;
+    uint32_t token;
+  };
+
+  void reevaluate(uint8_t channel);
+  void run_from(uint8_t channel);
+  void silence(uint8_t channel);
+
+  IndicatorDriver &driver_;
+  ChannelState channels_[INDICATOR_CHANNELS];
+  uint32_t steps_applied_;
+};
+
+// Built-in patterns
+extern const IndicatorPattern PATTERN_ENV_WARNING;   // LED: four 200 ms blinks, 1 s pause
+extern const IndicatorPattern PATTERN_ALARM_LIGHT;   // LED: steady on
+extern const IndicatorPattern PATTERN_ALARM_MELODY;  // Buzzer: C major scale, looping
+extern const IndicatorPattern PATTERN_SWITCH_BEEP;   // Buzzer: one 1 kHz beep
+extern const IndicatorPattern PATTERN_BREATHE;       // LED: 1 s fade up, 1 s fade down
+extern const IndicatorPattern PATTERN_BEEP_CODE_ERR; // Buzzer: three short beeps
@@ -0,0 +1,496 @@
+#include "InputTrace.h"
+
+#include <math.h>
+#include <string.h>
+
+static size_t put_varint(uint8_t *out, uint32_t v)
+{
+  size_t n = 0;
+  while (v >= 0x80)
+  {
+    out[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+static uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static size_t put_float(uint8_t *out, float v)
+{
+  memcpy(out, &v, 4);
+  return 4;
+}
+
+// Value on the 0.1 grid that reads back bit-identical, as DHT readings are
+static bool grid_tenths(float v, int32_t lo, int32_t hi, int32_t &q)
+{
+  if (isnan(v) || v * 10.0f < lo || v * 10.0f > hi)
+    return false;
+  q = (int32_t)lroundf(v * 10.0f);
+  float back = q / 10.0f;
+  return memcmp(&back, &v, 4) == 0;
+}
+
+bool trace_tick_successor(const TimeTick &tick, TimeTick &next)
+{
+  next = tick;
+  if (++next.seconds < 60)
+    return true;
+  next.seconds = 0;
+  if (++next.minutes < 60)
+    return true;
+  next.minutes = 0;
+  return ++next.hours < 24;
+}
+
+/***************************************************************************************************
+ * TraceWriter
+ **************************************************************************************************/
+TraceWriter::TraceWriter(TraceSink &sink)
+    : sink_(sink), have_layout_(false), alarms_enabled_(false), have_alarms_enabled_(false), last_ms_(0),
+      last_epoch_(0), have_tick_(false), last_temperature_(0), last_humidity_(0), have_env_(false), bytes_(0)
+{
+  memset(&layout_, 0, sizeof(layout_));
+  memset(&last_tick_, 0, sizeof(last_tick_));
+}
+
+void TraceWriter::emit(const uint8_t *buffer, size_t n)
+{
+  sink_.trace_write(buffer, n);
+  bytes_ += n;
+}
+
+void TraceWriter::record(const uint8_t *buffer, size_t n)
+{
+  if (sink_.trace_reserve(n))
+    emit(buffer, n);
+}
+
+size_t TraceWriter::start(uint8_t *buffer, TraceRecordType type, uint32_t now_ms)
+{
+  buffer[0] = type;
+  size_t n = 1 + put_varint(buffer + 1, now_ms - last_ms_);
+  last_ms_ = now_ms;
+  return n;
+}
+
+void TraceWriter::epoch(uint32_t now_ms, uint32_t epoch)
+{
+  if (epoch == last_epoch_)
+    return;
+  uint8_t buffer[TRACE_MAX_RECORD];
+  size_t n = start(buffer, TRACE_EPOCH, now_ms);
+  n += put_varint(buffer + n, zigzag((int32_t)(epoch - last_epoch_)));
+  last_epoch_ = epoch;
+  record(buffer, n);
+}
+
+/***************************************************************************************************
+ * begin()
+ * Starts a trace. Called again after a reboot, it starts a new one in the same stream; the reader
+ * reports it as another BEGIN.
+ **************************************************************************************************/
+void TraceWriter::begin(uint32_t now_ms, const TraceBegin &layout)
+{
+  if (&layout != &layout_)
+    layout_ = layout;
+  have_layout_ = true;
+  last_ms_ = 0;
+  last_epoch_ = 0;
+  have_tick_ = false;
+  have_env_ = false;
+
+  uint8_t buffer[TRACE_MAX_RECORD];
+  memcpy(buffer, TRACE_MAGIC, 4);
+  buffer[4] = TRACE_VERSION;
+  size_t n = 5;
+  n += start(buffer + n, TRACE_BEGIN, now_ms);
+  buffer[n++] = layout.n_alarms;
+  buffer[n++] = layout.has_servo;
+  buffer[n++] = layout.light_log_blocks;
+  buffer[n++] = layout.env_log_blocks;
+  for (int i = 0; i < TRACE_MAX_ALARMS; i++)
+  {
+    buffer[n++] = layout.alarm_hours[i];
+    buffer[n++] = layout.alarm_minutes[i];
+  }
+  size_t id_length = strnlen(layout.device_id, DEVICE_ID_LEN - 1);
+  buffer[n++] = (uint8_t)id_length;
+  memcpy(buffer + n, layout.device_id, id_length);
+  n += id_length;
+  record(buffer, n);
+}
+
+void TraceWriter::restart(uint32_t now_ms)
+{
+  if (!have_layout_)
+    return;
+  begin(now_ms, layout_);
+  if (have_alarms_enabled_)
+    alarms_enabled(now_ms, alarms_enabled_);
+}
+
+void TraceWriter::tick(uint32_t now_ms, const TimeTick &tick)
+{
+  uint8_t buffer[TRACE_MAX_RECORD];
+  TimeTick expected;
+  bool next = have_tick_ && trace_tick_successor(last_tick_, expected) && memcmp(&expected, &tick, sizeof(tick)) == 0;
+  size_t n = start(buffer, next ? TRACE_TICK_NEXT : TRACE_TICK, now_ms);
+  if (!next)
+  {
+    buffer[n++] = tick.hours;
+    buffer[n++] = tick.minutes;
+    buffer[n++] = tick.seconds;
+    buffer[n++] = tick.day;
+    buffer[n++] = tick.day_of_week;
+  }
+  last_tick_ = tick;
+  have_tick_ = true;
+  record(buffer, n);
+}
+
+void TraceWriter::light(uint32_t now_ms, uint32_t epoch_s, float intensity)
+{
+  epoch(now_ms, epoch_s);
+  uint8_t buffer[TRACE_MAX_RECORD];
+  size_t n = start(buffer, TRACE_LIGHT, now_ms);
+  n += put_float(buffer + n, intensity);
+  record(buffer, n);
+}
+
+void TraceWriter::env(uint32_t now_ms, uint32_t epoch_s, float temperature, float humidity)
+{
+  epoch(now_ms, epoch_s);
+  uint8_t buffer[TRACE_MAX_RECORD];
+  int32_t qt, qh;
+  size_t n;
+  if (have_env_ && memcmp(&temperature, &last_temperature_, 4) == 0 && memcmp(&humidity, &last_humidity_, 4) == 0)
+  {
+    n = start(buffer, TRACE_ENV_SAME, now_ms);
+  }
+  else if (grid_tenths(temperature, -32768, 32767, qt) && grid_tenths(humidity, 0, 65535, qh))
+  {
+    n = start(buffer, TRACE_ENV_Q, now_ms);
+    buffer[n++] = (uint8_t)qt;
+    buffer[n++] = (uint8_t)(qt >> 8);
+    buffer[n++] = (uint8_t)qh;
+    buffer[n++] = (uint8_t)(qh >> 8);
+  }
+  else
+  {
+    n = start(buffer, TRACE_ENV, now_ms);
+    n += put_float(buffer + n, temperature);
+    n += put_float(buffer + n, humidity);
+  }
+  last_temperature_ = temperature;
+  last_humidity_ = humidity;
+  have_env_ = true;
+  record(buffer, n);
+}
+
+void TraceWriter::mqtt(uint32_t now_ms, uint32_t epoch_s, const char *topic, const uint8_t *payload, size_t length)
+{
+  epoch(now_ms, epoch_s);
+  uint8_t buffer[TRACE_MAX_RECORD];
+  size_t topic_length = strlen(topic);
+  size_t n = start(buffer, TRACE_MQTT, now_ms);
+  n += put_varint(buffer + n, (uint32_t)topic_length);
+  uint8_t length_bytes[5];
+  size_t length_n = put_varint(length_bytes, (uint32_t)length);
+  if (!sink_.trace_reserve(n + topic_length + length_n + length))
+    return;
+  emit(buffer, n);
+  emit((const uint8_t *)topic, topic_length);
+  emit(length_bytes, length_n);
+  emit(payload, length);
+}
+
+void TraceWriter::alarm_dismissed(uint32_t now_ms)
+{
+  uint8_t buffer[TRACE_MAX_RECORD];
+  record(buffer, start(buffer, TRACE_ALARM_DISMISS, now_ms));
+}
+
+void TraceWriter::alarm_snoozed(uint32_t now_ms)
+{
+  uint8_t buffer[TRACE_MAX_RECORD];
+  record(buffer, start(buffer, TRACE_ALARM_SNOOZE, now_ms));
+}
+
+void TraceWriter::set_alarm(uint32_t now_ms, uint8_t index, uint8_t hours, uint8_t minutes)
+{
+  uint8_t buffer[TRACE_MAX_RECORD];
+  size_t n = start(buffer, TRACE_SET_ALARM, now_ms);
+  buffer[n++] = index;
+  buffer[n++] = hours;
+  buffer[n++] = minutes;
+  if (index < TRACE_MAX_ALARMS)
+  {
+    layout_.alarm_hours[index] = hours;
+    layout_.alarm_minutes[index] = minutes;
+  }
+  record(buffer, n);
+}
+
+void TraceWriter::alarms_enabled(uint32_t now_ms, bool enabled)
+{
+  uint8_t buffer[TRACE_MAX_RECORD];
+  size_t n = start(buffer, TRACE_ALARMS_ENABLED, now_ms);
+  buffer[n++] = enabled;
+  alarms_enabled_ = enabled;
+  have_alarms_enabled_ = true;
+  record(buffer, n);
+}
+
+/***************************************************************************************************
+ * TraceReader
+ **************************************************************************************************/
+TraceReader::TraceReader(const uint8_t *data, size_t size)
+    : data_(data), size_(size), pos_(0), error_(NULL), now_ms_(0), epoch_(0), temperature_(0), humidity_(0)
+{
+  memset(&tick_, 0, sizeof(tick_));
+}
+
+bool TraceReader::varint(uint32_t &value)
+{
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7)
+  {
+    if (pos_ >= size_)
+      return false;
+    uint8_t b = data_[pos_++];
+    value |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool TraceReader::bytes(const uint8_t *&p, size_t n)
+{
+  if (size_ - pos_ < n)
+    return false;
+  p = data_ + pos_;
+  pos_ += n;
+  return true;
+}
+
+bool TraceReader::peek(TraceInput &input)
+{
+  TraceReader copy = *this;
+  return copy.next(input);
+}
+
+/***************************************************************************************************
+ * next()
+ * Decodes the next input. EPOCH records are folded into the inputs that follow them; a truncated
+ * last record (recorder still running) ends the trace without an error.
+ **************************************************************************************************/
+bool TraceReader::next(TraceInput &input)
+{
+  while (pos_ < size_ && !error_)
+  {
+    size_t record_start = pos_;
+    const uint8_t *p;
+
+    if (size_ - pos_ >= 5 && memcmp(data_ + pos_, TRACE_MAGIC, 4) == 0)
+    {
+      if (data_[pos_ + 4] != TRACE_VERSION)
+      {
+        error_ = "unsupported trace version";
+        return false;
+      }
+      pos_ += 5;
+      now_ms_ = 0;
+      epoch_ = 0;
+      if (pos_ >= size_ || data_[pos_] != TRACE_BEGIN)
+      {
+        error_ = "magic without BEGIN record";
+        return false;
+      }
+    }
+
+    uint8_t type = data_[pos_++];
+    uint32_t dt;
+    if (type == 0 || type >= TRACE_TYPE_COUNT)
+    {
+      error_ = "unknown record type";
+      pos_ = record_start;
+      return false;
+    }
+    if (!varint(dt))
+    {
+      pos_ = size_;
+      return false;
+    }
+    now_ms_ += dt;
+    input.now_ms = now_ms_;
+    input.epoch = epoch_;
+    input.type = (TraceRecordType)type;
+
+    bool complete = true;
+    switch (type)
+    {
+    case TRACE_BEGIN:
+    {
+      TraceBegin &b = input.begin;
+      memset(&b, 0, sizeof(b));
+      complete = bytes(p, 4 + 2 * TRACE_MAX_ALARMS + 1);
+      if (!complete)
+        break;
+      b.n_alarms = p[0];
+      b.has_servo = p[1] != 0;
+      b.light_log_blocks = p[2];
+      b.env_log_blocks = p[3];
+      for (int i = 0; i < TRACE_MAX_ALARMS; i++)
+      {
+        b.alarm_hours[i] = p[4 + 2 * i];
+        b.alarm_minutes[i] = p[5 + 2 * i];
+      }
+      uint8_t id_length = p[4 + 2 * TRACE_MAX_ALARMS];
+      if (id_length >= DEVICE_ID_LEN || b.n_alarms > TRACE_MAX_ALARMS)
+      {
+        error_ = "bad BEGIN record";
+        return false;
+      }
+      complete = bytes(p, id_length);
+      if (complete)
+        memcpy(b.device_id, p, id_length);
+      break;
+    }
+    case TRACE_EPOCH:
+    {
+      uint32_t z;
+      if (!varint(z))
+      {
+        pos_ = size_;
+        return false;
+      }
+      epoch_ += (uint32_t)unzigzag(z);
+      continue;
+    }
+    case TRACE_TICK:
+      complete = bytes(p, 5);
+      if (complete)
+      {
+        tick_.hours = p[0];
+        tick_.minutes = p[1];
+        tick_.seconds = p[2];
+        tick_.day = p[3];
+        tick_.day_of_week = p[4];
+        input.tick = tick_;
+      }
+      break;
+    case TRACE_TICK_NEXT:
+    {
+      TimeTick next;
+      trace_tick_successor(tick_, next);
+      tick_ = next;
+      input.tick = tick_;
+      input.type = TRACE_TICK;
+      break;
+    }
+    case TRACE_LIGHT:
+      complete = bytes(p, 4);
+      if (complete)
+        memcpy(&input.light, p, 4);
+      break;
+    case TRACE_ENV:
+      complete = bytes(p, 8);
+      if (complete)
+      {
+        memcpy(&temperature_, p, 4);
+        memcpy(&humidity_, p + 4, 4);
+      }
+      input.type = TRACE_ENV;
+      break;
+    case TRACE_ENV_Q:
+      complete = bytes(p, 4);
+      if (complete)
+      {
+        temperature_ = (int16_t)(p[0] | (p[1] << 8)) / 10.0f;
+        humidity_ = (uint16_t)(p[2] | (p[3] << 8)) / 10.0f;
+      }
+      input.type = TRACE_ENV;
+      break;
+    case TRACE_ENV_SAME:
+      input.type = TRACE_ENV;
+      break;
+    case TRACE_MQTT:
+    {
+      uint32_t length;
+      complete = varint(length) && bytes(input.topic, length);
+      input.topic_length = length;
+      complete = complete && varint(length) && bytes(input.payload, length);
+      input.payload_length = length;
+      break;
+    }
+    case TRACE_SET_ALARM:
+      complete = bytes(p, 3);
+      if (complete)
+      {
+        input.index = p[0];
+        input.hours = p[1];
+        input.minutes = p[2];
+      }
+      break;
+    case TRACE_ALARMS_ENABLED:
+      complete = bytes(p, 1);
+      if (complete)
+        input.enabled = p[0] != 0;
+      break;
+    default:
+      break;
+    }
+
+    if (!complete)
+    {
+      pos_ = size_;
+      return false;
+    }
+    if (input.type == TRACE_ENV)
+    {
+      input.temperature = temperature_;
+      input.humidity = humidity_;
+    }
+    return true;
+  }
+  return false;
+}
+
+const char *trace_record_name(TraceRecordType type)
+{
+  static const char *const names[] = {"?", "begin", "epoch", "tick", "tick", "light", "env", "env", "env", "mqtt",
+                                      "dismiss", "snooze", "set_alarm", "alarms_enabled"};
+  return type < TRACE_TYPE_COUNT ? names[type] : "?";
+}
+
+/***************************************************************************************************
+ * Transport chunks
+ **************************************************************************************************/
+size_t trace_chunk_header(uint8_t *out, uint16_t sequence)
+{
+  out[0] = (uint8_t)sequence;
+  out[1] = (uint8_t)(sequence >> 8);
+  return TRACE_CHUNK_HEADER;
+}
+
+bool trace_chunk_parse(const uint8_t *chunk, size_t size, uint16_t &sequence, const uint8_t *&data, size_t &length)
+{
+  if (size < TRACE_CHUNK_HEADER)
+    return false;
+  sequence = (uint16_t)(chunk[0] | (chunk[1] << 8));
+  data = chunk + TRACE_CHUNK_HEADER;
+  length = size - TRACE_CHUNK_HEADER;
+  return true;
+}
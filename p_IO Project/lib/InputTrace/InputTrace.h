@@ -0,0 +1,164 @@
+#pragma once
+
+#include <EventBus.h>
+#include <MediboxMqtt.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * InputTrace
+ * Compact, timestamped record of everything that reaches the firmware logic (lib/MediboxCore):
+ * time ticks, light and environment samples, MQTT messages and the user's alarm actions. With the
+ * trace and the same core, the host replay engine (src/host/replay) reproduces the box's servo
+ * angles, alarms and publishes exactly.
+ *
+ * A trace is "MBXT", a version byte, a BEGIN record with the board layout, then records. A record
+ * is a type byte, the milliseconds since the previous record as a varint, then its fields.
+ * Wall-clock time is carried by EPOCH records, written only when it moves. The common cases are
+ * shortened: a tick one second after the last one is a bare TICK_NEXT, and an environment reading
+ * that repeats or sits on the DHT's 0.1 grid is stored as such.
+ *
+ * Over MQTT or Serial the byte stream is cut into chunks that each start with a 16-bit sequence
+ * number (trace_chunk_*), so a lost chunk is detected instead of silently replaying wrong inputs.
+ **************************************************************************************************/
+
+#define TRACE_MAGIC "MBXT"
+#define TRACE_VERSION 1
+#define TRACE_MAX_ALARMS 4
+#define TRACE_MAX_RECORD 64 // Largest record apart from MQTT messages
+
+enum TraceRecordType : uint8_t
+{
+  TRACE_BEGIN = 1,
+  TRACE_EPOCH,      // Zig-zag varint change of the epoch seconds
+  TRACE_TICK,       // hours, minutes, seconds, day, day_of_week
+  TRACE_TICK_NEXT,  // One second after the previous tick, same day
+  TRACE_LIGHT,      // float intensity
+  TRACE_ENV,        // float temperature, float humidity
+  TRACE_ENV_Q,      // Both on the 0.1 grid: int16 temperature * 10, uint16 humidity * 10
+  TRACE_ENV_SAME,   // Same reading as the previous ENV
+  TRACE_MQTT,       // varint topic length, topic, varint payload length, payload
+  TRACE_ALARM_DISMISS,
+  TRACE_ALARM_SNOOZE,
+  TRACE_SET_ALARM,  // index, hours, minutes
+  TRACE_ALARMS_ENABLED, // 0 = all alarms disabled, 1 = enabled
+  TRACE_TYPE_COUNT
+};
+
+struct TraceBegin
+{
+  uint8_t n_alarms;
+  bool has_servo;
+  uint8_t light_log_blocks;
+  uint8_t env_log_blocks;
+  uint8_t alarm_hours[TRACE_MAX_ALARMS];
+  uint8_t alarm_minutes[TRACE_MAX_ALARMS];
+  char device_id[DEVICE_ID_LEN];
+};
+
+// One decoded input. Text fields point into the trace buffer and are not NUL-terminated.
+struct TraceInput
+{
+  TraceRecordType type; // TICK_NEXT, ENV_Q and ENV_SAME come out as TICK and ENV
+  uint32_t now_ms;      // millis() on the box
+  uint32_t epoch;       // time(nullptr) on the box
+  TimeTick tick;
+  float light;
+  float temperature;
+  float humidity;
+  const uint8_t *topic;
+  size_t topic_length;
+  const uint8_t *payload;
+  size_t payload_length;
+  uint8_t index;
+  uint8_t hours;
+  uint8_t minutes;
+  bool enabled;
+  TraceBegin begin;
+};
+
+// The writer asks for room for a whole record before writing it, possibly in several pieces, so a
+// sink that runs out of space drops records, never parts of one.
+class TraceSink
+{
+public:
+  virtual ~TraceSink() {}
+  virtual bool trace_reserve(size_t n) { (void)n; return true; } // False drops the record
+  virtual void trace_write(const uint8_t *data, size_t n) = 0;
+};
+
+class TraceWriter
+{
+public:
+  explicit TraceWriter(TraceSink &sink);
+
+  void begin(uint32_t now_ms, const TraceBegin &layout);
+  void tick(uint32_t now_ms, const TimeTick &tick);
+  void light(uint32_t now_ms, uint32_t epoch, float intensity);
+  void env(uint32_t now_ms, uint32_t epoch, float temperature, float humidity);
+  void mqtt(uint32_t now_ms, uint32_t epoch, const char *topic, const uint8_t *payload, size_t length);
+  void alarm_dismissed(uint32_t now_ms);
+  void alarm_snoozed(uint32_t now_ms);
+  void set_alarm(uint32_t now_ms, uint8_t index, uint8_t hours, uint8_t minutes);
+  void alarms_enabled(uint32_t now_ms, bool enabled);
+
+  // After the sink dropped records: a new BEGIN with the current alarms, so what follows decodes
+  // on its own. Sensor history and applied config are not carried over.
+  void restart(uint32_t now_ms);
+
+  uint32_t bytes_written() const { return bytes_; }
+
+private:
+  size_t start(uint8_t *buffer, TraceRecordType type, uint32_t now_ms);
+  void epoch(uint32_t now_ms, uint32_t epoch);
+  void emit(const uint8_t *buffer, size_t n);
+  void record(const uint8_t *buffer, size_t n);
+
+  TraceSink &sink_;
+  TraceBegin layout_; // As of begin(), with the alarms set since
+  bool have_layout_;
+  bool alarms_enabled_;
+  bool have_alarms_enabled_;
+  uint32_t last_ms_;
+  uint32_t last_epoch_;
+  TimeTick last_tick_;
+  bool have_tick_;
+  float last_temperature_;
+  float last_humidity_;
+  bool have_env_;
+  uint32_t bytes_;
+};
+
+class TraceReader
+{
+public:
+  TraceReader(const uint8_t *data, size_t size);
+
+  bool next(TraceInput &input); // False at the end of the trace or on an error
+  bool peek(TraceInput &input); // next() without consuming
+  const char *error() const { return error_; }
+  size_t offset() const { return pos_; }
+
+private:
+  bool varint(uint32_t &value);
+  bool bytes(const uint8_t *&p, size_t n);
+
+  const uint8_t *data_;
+  size_t size_;
+  size_t pos_;
+  const char *error_;
+  uint32_t now_ms_;
+  uint32_t epoch_;
+  TimeTick tick_;
+  float temperature_;
+  float humidity_;
+};
+
+// Next tick after `tick` when only the time of day moves; false at midnight (day rolls over)
+bool trace_tick_successor(const TimeTick &tick, TimeTick &next);
+const char *trace_record_name(TraceRecordType type);
+
+// Transport chunks: 16-bit little-endian sequence number, then trace bytes
+#define TRACE_CHUNK_HEADER 2
+size_t trace_chunk_header(uint8_t *out, uint16_t sequence);
+bool trace_chunk_parse(const uint8_t *chunk, size_t size, uint16_t &sequence, const uint8_t *&data, size_t &length);
@@ -0,0 +1,103 @@
+#include "LdrFilter.h"
+
+void ldr_filter_init(LdrFilterState &state, uint8_t log2_decim, uint8_t ema_shift)
+{
+  state.ema_q4 = 0;
+  state.ema_shift = ema_shift;
+  state.log2_decim = log2_decim;
+  state.primed = false;
+}
+
+static inline uint16_t min_u16(uint16_t a, uint16_t b)
+{
+  return a < b ? a : b;
+}
+
+static inline uint16_t max_u16(uint16_t a, uint16_t b)
+{
+  return a > b ? a : b;
+}
+
+/***************************************************************************************************
+ * median3_filter()
+ * out[i] = median(in[i-1], in[i], in[i+1]); the end points are copied through. Branch-free, so a
+ * burst of spikes costs the same as a clean one. in and out must not overlap.
+ **************************************************************************************************/
+void median3_filter(const uint16_t *in, uint16_t *out, size_t n)
+{
+  if (n < 3)
+  {
+    for (size_t i = 0; i < n; i++)
+      out[i] = in[i];
+    return;
+  }
+
+  out[0] = in[0];
+  for (size_t i = 1; i + 1 < n; i++)
+  {
+    uint16_t a = in[i - 1], b = in[i], c = in[i + 1];
+    out[i] = max_u16(min_u16(a, b), min_u16(max_u16(a, b), c));
+  }
+  out[n - 1] = in[n - 1];
+}
+
+/***************************************************************************************************
+ * box_decimate_q4()
+ * Averages consecutive groups of 2^log2_factor samples. Each output keeps LDR_FILTER_Q fractional
+ * bits (12-bit input -> 16-bit Q4 output). A trailing partial group is dropped.
+ * Returns the number of outputs written.
+ **************************************************************************************************/
+size_t box_decimate_q4(const uint16_t *in, size_t n, uint8_t log2_factor, uint16_t *out_q4)
+{
+  const size_t factor = (size_t)1 << log2_factor;
+  size_t outputs = 0;
+
+  for (size_t start = 0; start + factor <= n; start += factor)
+  {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < factor; i++)
+      sum += in[start + i];
+
+    // sum / 2^log2_factor * 2^Q, rounded
+    if (log2_factor >= LDR_FILTER_Q)
+    {
+      uint8_t shift = log2_factor - LDR_FILTER_Q;
+      out_q4[outputs++] = (uint16_t)((sum + ((1u << shift) >> 1)) >> shift);
+    }
+    else
+    {
+      out_q4[outputs++] = (uint16_t)(sum << (LDR_FILTER_Q - log2_factor));
+    }
+  }
+  return outputs;
+}
+
+/***************************************************************************************************
+ * ldr_filter_burst()
+ * Runs the full chain over one burst and returns the smoothed value in Q4 (raw * 16). scratch must
+ * hold n samples. Bursts shorter than one decimation group leave the state untouched.
+ **************************************************************************************************/
+uint16_t ldr_filter_burst(LdrFilterState &state, const uint16_t *samples, size_t n, uint16_t *scratch)
+{
+  if (n > LDR_FILTER_MAX_BURST)
+    n = LDR_FILTER_MAX_BURST;
+
+  median3_filter(samples, scratch, n);
+  // Decimating in place is safe: output i is written after inputs [i * factor, ...) were read
+  size_t outputs = box_decimate_q4(scratch, n, state.log2_decim, scratch);
+
+  for (size_t i = 0; i < outputs; i++)
+  {
+    int32_t x = scratch[i];
+    if (!state.primed)
+    {
+      state.ema_q4 = x;
+      state.primed = true;
+    }
+    else
+    {
+      state.ema_q4 += (x - state.ema_q4) >> state.ema_shift;
+    }
+  }
+  return (uint16_t)state.ema_q4;
+}
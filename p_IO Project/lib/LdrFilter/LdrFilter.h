@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * LdrFilter
+ * Fixed-point kernels that turn a burst of raw 12-bit ADC conversions into one clean reading:
+ *
+ *   1. median-of-3 across the burst removes single-sample spikes,
+ *   2. box decimation sums 2^k samples, keeping 4 extra fractional bits (Q4 = raw * 16),
+ *   3. an exponential moving average across bursts smooths what is left.
+ *
+ * No floating point and no allocation, so the same code runs in the acquisition task and on the
+ * host against recorded noise traces.
+ **************************************************************************************************/
+
+#define LDR_FILTER_Q 4                  // Fractional bits of filtered values
+#define LDR_FILTER_MAX_BURST 1024       // Largest burst ldr_filter_burst() accepts
+
+struct LdrFilterState
+{
+  int32_t ema_q4;     // Smoothed value, raw * 16
+  uint8_t ema_shift;  // Smoothing strength: weight of a new burst is 1 / 2^ema_shift
+  uint8_t log2_decim; // Box decimation factor 2^log2_decim
+  bool primed;        // False until the first burst seeds the average
+};
+
+void ldr_filter_init(LdrFilterState &state, uint8_t log2_decim, uint8_t ema_shift);
+void median3_filter(const uint16_t *in, uint16_t *out, size_t n);
+size_t box_decimate_q4(const uint16_t *in, size_t n, uint8_t log2_factor, uint16_t *out_q4);
+uint16_t ldr_filter_burst(LdrFilterState &state, const uint16_t *samples, size_t n, uint16_t *scratch);
@@ -0,0 +1,310 @@
+#include "MediboxConfig.h"
+
+#include <ArduinoJson.h>
+#include <stdio.h>
+#include <string.h>
+
+/***************************************************************************************************
+ * is_msgpack_map()
+ * A MessagePack map starts with a fixmap (0x80-0x8f), map16 (0xde) or map32 (0xdf) marker.
+ **************************************************************************************************/
+static bool is_msgpack_map(const uint8_t *payload, size_t length)
+{
+  if (length == 0)
+    return false;
+  uint8_t marker = payload[0];
+  return (marker >= 0x80 && marker <= 0x8f) || marker == 0xde || marker == 0xdf;
+}
+
+/***************************************************************************************************
+ * config_field_for_key()
+ * Maps a document key to its CONFIG_FIELD_* flag, or 0 for keys the device does not know.
+ **************************************************************************************************/
+static uint32_t config_field_for_key(const char *key)
+{
+  if (strcmp(key, "ts") == 0)
+    return CONFIG_FIELD_TS;
+  if (strcmp(key, "tu") == 0)
+    return CONFIG_FIELD_TU;
+  if (strcmp(key, "theta_offset") == 0)
+    return CONFIG_FIELD_THETA_OFFSET;
+  if (strcmp(key, "gamma") == 0)
+    return CONFIG_FIELD_GAMMA;
+  if (strcmp(key, "tmed") == 0)
+    return CONFIG_FIELD_TMED;
+  if (strcmp(key, "switch") == 0)
+    return CONFIG_FIELD_SWITCH;
+  if (strcmp(key, "temp_low") == 0)
+    return CONFIG_FIELD_TEMP_LOW;
+  if (strcmp(key, "temp_high") == 0)
+    return CONFIG_FIELD_TEMP_HIGH;
+  if (strcmp(key, "temp_hyst") == 0)
+    return CONFIG_FIELD_TEMP_HYST;
+  if (strcmp(key, "hum_low") == 0)
+    return CONFIG_FIELD_HUM_LOW;
+  if (strcmp(key, "hum_high") == 0)
+    return CONFIG_FIELD_HUM_HIGH;
+  if (strcmp(key, "hum_hyst") == 0)
+    return CONFIG_FIELD_HUM_HYST;
+  if (strcmp(key, "alert_dwell") == 0)
+    return CONFIG_FIELD_ALERT_DWELL;
+  return 0;
+}
+
+static void set_bad_key(ConfigUpdate &update, const char *key)
+{
+  size_t i = 0;
+  for (; key[i] != '\0' && i < sizeof(update.bad_key) - 1; i++)
+  {
+    // The key is echoed back inside the JSON ack, so keep it quote-free
+    update.bad_key[i] = (key[i] == '"' || key[i] == '\\') ? '_' : key[i];
+  }
+  update.bad_key[i] = '\0';
+}
+
+/***************************************************************************************************
+ * bad_threshold_key()
+ * Names the key that broke low < high, hysteresis >= 0 or 2 * hysteresis < high - low, preferring
+ * one the document set over one it left as it was. low_field is the pair's CONFIG_FIELD_*_LOW; the
+ * high and hysteresis flags follow it.
+ **************************************************************************************************/
+static const char *bad_threshold_key(const AlertThresholds &t, uint32_t fields, uint32_t low_field,
+                                     const char *const keys[3])
+{
+  bool low_set = fields & low_field;
+  bool high_set = fields & (low_field << 1);
+  bool hyst_set = fields & (low_field << 2);
+
+  if (!(t.hysteresis >= 0.0f))
+    return keys[2];
+  if (!(t.low < t.high))
+    return (high_set && !low_set) ? keys[1] : keys[0];
+  if (hyst_set)
+    return keys[2];
+  return (high_set && !low_set) ? keys[1] : keys[0];
+}
+
+/***************************************************************************************************
+ * config_defaults()
+ * Power-on configuration, matching the values the firmware has always started with.
+ **************************************************************************************************/
+MediboxConfig config_defaults()
+{
+  MediboxConfig config;
+  config.ts = 5;
+  config.tu = 120;
+  config.theta_offset = 30.0f;
+  config.gamma = 0.75f;
+  config.tmed = 30.0f;
+  config.temperature = {26.0f, 32.0f, 0.5f};
+  config.humidity = {60.0f, 80.0f, 2.0f};
+  config.alert_dwell_ms = 10000;
+  config.version = 0;
+  return config;
+}
+
+/***************************************************************************************************
+ * parse_config_update()
+ * Parses a JSON or MessagePack object holding any subset of ts, tu, theta_offset, gamma, tmed,
+ * switch, the alert thresholds (temp_low/high/hyst, hum_low/high/hyst) and alert_dwell (ms). The
+ * whole document is checked before returning CONFIG_OK, so the caller either applies every field in
+ * update.next or none of them.
+ **************************************************************************************************/
+ConfigStatus parse_config_update(const uint8_t *payload, size_t length, const MediboxConfig &current,
+                                 ConfigUpdate &update)
+{
+  update.fields = 0;
+  update.next = current;
+  update.main_switch = false;
+  update.bad_key[0] = '\0';
+
+  JsonDocument doc;
+  DeserializationError err = is_msgpack_map(payload, length)
+                                 ? deserializeMsgPack(doc, payload, length)
+                                 : deserializeJson(doc, payload, length);
+  if (err || !doc.is<JsonObjectConst>())
+  {
+    return CONFIG_BAD_DOCUMENT;
+  }
+
+  JsonObjectConst root = doc.as<JsonObjectConst>();
+  for (JsonPairConst kv : root)
+  {
+    const char *key = kv.key().c_str();
+    JsonVariantConst value = kv.value();
+    uint32_t field = config_field_for_key(key);
+
+    if (field == 0)
+    {
+      set_bad_key(update, key);
+      return CONFIG_UNKNOWN_KEY;
+    }
+
+    bool type_ok;
+    if (field == CONFIG_FIELD_SWITCH)
+      type_ok = value.is<int>() || value.is<bool>();
+    else if (field == CONFIG_FIELD_TS || field == CONFIG_FIELD_TU)
+      type_ok = value.is<int>(); // Whole seconds; 2.7 is refused rather than cut to 2
+    else
+      type_ok = value.is<float>();
+    if (!type_ok)
+    {
+      set_bad_key(update, key);
+      return CONFIG_BAD_TYPE;
+    }
+
+    switch (field)
+    {
+    case CONFIG_FIELD_TS:
+      update.next.ts = value.as<int>();
+      break;
+    case CONFIG_FIELD_TU:
+      update.next.tu = value.as<int>();
+      break;
+    case CONFIG_FIELD_THETA_OFFSET:
+      update.next.theta_offset = value.as<float>();
+      break;
+    case CONFIG_FIELD_GAMMA:
+      update.next.gamma = value.as<float>();
+      break;
+    case CONFIG_FIELD_TMED:
+      update.next.tmed = value.as<float>();
+      break;
+    case CONFIG_FIELD_SWITCH:
+      update.main_switch = value.is<bool>() ? value.as<bool>() : value.as<int>() != 0;
+      break;
+    case CONFIG_FIELD_TEMP_LOW:
+      update.next.temperature.low = value.as<float>();
+      break;
+    case CONFIG_FIELD_TEMP_HIGH:
+      update.next.temperature.high = value.as<float>();
+      break;
+    case CONFIG_FIELD_TEMP_HYST:
+      update.next.temperature.hysteresis = value.as<float>();
+      break;
+    case CONFIG_FIELD_HUM_LOW:
+      update.next.humidity.low = value.as<float>();
+      break;
+    case CONFIG_FIELD_HUM_HIGH:
+      update.next.humidity.high = value.as<float>();
+      break;
+    case CONFIG_FIELD_HUM_HYST:
+      update.next.humidity.hysteresis = value.as<float>();
+      break;
+    case CONFIG_FIELD_ALERT_DWELL:
+      if (!(value.as<float>() >= 0.0f && value.as<float>() <= CONFIG_MAX_ALERT_DWELL_MS))
+      {
+        set_bad_key(update, key);
+        return CONFIG_OUT_OF_RANGE;
+      }
+      update.next.alert_dwell_ms = value.as<uint32_t>();
+      break;
+    }
+    update.fields |= field;
+  }
+
+  if (update.fields == 0)
+  {
+    return CONFIG_EMPTY;
+  }
+
+  // Range checks run on the merged result so ts/tu are validated as a pair
+  const MediboxConfig &next = update.next;
+  if (next.ts < CONFIG_MIN_TS || next.ts > CONFIG_MAX_TS)
+  {
+    set_bad_key(update, "ts");
+    return CONFIG_OUT_OF_RANGE;
+  }
+  if (next.tu < next.ts || next.tu > CONFIG_MAX_TU)
+  {
+    set_bad_key(update, "tu");
+    return CONFIG_OUT_OF_RANGE;
+  }
+  if (!(next.theta_offset >= 0.0f && next.theta_offset <= 180.0f))
+  {
+    set_bad_key(update, "theta_offset");
+    return CONFIG_OUT_OF_RANGE;
+  }
+  if (!(next.gamma >= 0.0f && next.gamma <= 1.0f))
+  {
+    set_bad_key(update, "gamma");
+    return CONFIG_OUT_OF_RANGE;
+  }
+  if (!(next.tmed >= CONFIG_MIN_TMED && next.tmed <= CONFIG_MAX_TMED))
+  {
+    set_bad_key(update, "tmed");
+    return CONFIG_OUT_OF_RANGE;
+  }
+  if (!alert_thresholds_valid(next.temperature))
+  {
+    static const char *const keys[3] = {"temp_low", "temp_high", "temp_hyst"};
+    set_bad_key(update, bad_threshold_key(next.temperature, update.fields, CONFIG_FIELD_TEMP_LOW, keys));
+    return CONFIG_OUT_OF_RANGE;
+  }
+  if (!alert_thresholds_valid(next.humidity))
+  {
+    static const char *const keys[3] = {"hum_low", "hum_high", "hum_hyst"};
+    set_bad_key(update, bad_threshold_key(next.humidity, update.fields, CONFIG_FIELD_HUM_LOW, keys));
+    return CONFIG_OUT_OF_RANGE;
+  }
+
+  return CONFIG_OK;
+}
+
+/***************************************************************************************************
+ * config_window_changed()
+ * True when the update alters ts or tu, i.e. when the LDR buffer has to be resized.
+ **************************************************************************************************/
+bool config_window_changed(const ConfigUpdate &update, const MediboxConfig &current)
+{
+  return update.next.ts != current.ts || update.next.tu != current.tu;
+}
+
+/***************************************************************************************************
+ * format_config_ack()
+ * Writes the JSON acknowledgement published on medibox/<id>/config/ack. A nonzero window_s is the
+ * light window the box can actually hold when it is shorter than tu, and is added to an accepted
+ * config's ack.
+ **************************************************************************************************/
+size_t format_config_ack(char *buffer, size_t size, const MediboxConfig &config, ConfigStatus status,
+                         const ConfigUpdate &update, uint32_t window_s)
+{
+  int n;
+  if (status == CONFIG_OK && window_s)
+  {
+    n = snprintf(buffer, size, "{\"version\":%lu,\"ok\":true,\"window_s\":%lu}", (unsigned long)config.version,
+                 (unsigned long)window_s);
+  }
+  else if (status == CONFIG_OK)
+  {
+    n = snprintf(buffer, size, "{\"version\":%lu,\"ok\":true}", (unsigned long)config.version);
+  }
+  else
+  {
+    n = snprintf(buffer, size, "{\"version\":%lu,\"ok\":false,\"error\":\"%s\",\"key\":\"%s\"}",
+                 (unsigned long)config.version, config_status_name(status), update.bad_key);
+  }
+  if (n < 0)
+    return 0;
+  return (size_t)n < size ? (size_t)n : size - 1;
+}
+
+const char *config_status_name(ConfigStatus status)
+{
+  switch (status)
+  {
+  case CONFIG_OK:
+    return "ok";
+  case CONFIG_BAD_DOCUMENT:
+    return "bad_document";
+  case CONFIG_EMPTY:
+    return "empty";
+  case CONFIG_UNKNOWN_KEY:
+    return "unknown_key";
+  case CONFIG_BAD_TYPE:
+    return "bad_type";
+  case CONFIG_OUT_OF_RANGE:
+    return "out_of_range";
+  }
+  return "?";
+}
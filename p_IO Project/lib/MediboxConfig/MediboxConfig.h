@@ -0,0 +1,73 @@
+#pragma once
+
+#include <AlertEngine.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * MediboxConfig
+ * Runtime tunables that the dashboard can change over MQTT. Updates arrive as one document on
+ * medibox/<id>/config and are validated as a whole before any field is applied.
+ **************************************************************************************************/
+
+// Limits used when validating an incoming document
+#define CONFIG_MIN_TS 1
+#define CONFIG_MAX_TS 3600
+#define CONFIG_MAX_TU 86400
+#define CONFIG_MIN_TMED 1.0f
+#define CONFIG_MAX_TMED 100.0f
+#define CONFIG_MAX_ALERT_DWELL_MS 600000
+
+// Bit flags telling which fields a document carried
+#define CONFIG_FIELD_TS (1u << 0)
+#define CONFIG_FIELD_TU (1u << 1)
+#define CONFIG_FIELD_THETA_OFFSET (1u << 2)
+#define CONFIG_FIELD_GAMMA (1u << 3)
+#define CONFIG_FIELD_TMED (1u << 4)
+#define CONFIG_FIELD_SWITCH (1u << 5)
+#define CONFIG_FIELD_TEMP_LOW (1u << 6)
+#define CONFIG_FIELD_TEMP_HIGH (1u << 7)
+#define CONFIG_FIELD_TEMP_HYST (1u << 8)
+#define CONFIG_FIELD_HUM_LOW (1u << 9)
+#define CONFIG_FIELD_HUM_HIGH (1u << 10)
+#define CONFIG_FIELD_HUM_HYST (1u << 11)
+#define CONFIG_FIELD_ALERT_DWELL (1u << 12)
+
+struct MediboxConfig
+{
+  int ts;                      // Sampling interval (seconds)
+  int tu;                      // Upload interval (seconds)
+  float theta_offset;          // Minimum shade angle (degrees)
+  float gamma;                 // Controlling factor
+  float tmed;                  // Ideal storage temperature (C)
+  AlertThresholds temperature; // Healthy range and hysteresis (C)
+  AlertThresholds humidity;    // Healthy range and hysteresis (%)
+  uint32_t alert_dwell_ms;     // Time a reading must persist before an alert changes
+  uint32_t version;            // Bumped on every applied document
+};
+
+struct ConfigUpdate
+{
+  uint32_t fields;    // CONFIG_FIELD_* flags present in the document
+  MediboxConfig next; // Current config with the document's fields merged in
+  bool main_switch;   // Value of "switch" when CONFIG_FIELD_SWITCH is set
+  char bad_key[16];   // Offending key when the document is rejected
+};
+
+enum ConfigStatus
+{
+  CONFIG_OK,
+  CONFIG_BAD_DOCUMENT,
+  CONFIG_EMPTY,
+  CONFIG_UNKNOWN_KEY,
+  CONFIG_BAD_TYPE,
+  CONFIG_OUT_OF_RANGE
+};
+
+MediboxConfig config_defaults();
+ConfigStatus parse_config_update(const uint8_t *payload, size_t length, const MediboxConfig &current,
+                                 ConfigUpdate &update);
+bool config_window_changed(const ConfigUpdate &update, const MediboxConfig &current);
+size_t format_config_ack(char *buffer, size_t size, const MediboxConfig &config, ConfigStatus status,
+                         const ConfigUpdate &update, uint32_t window_s = 0);
+const char *config_status_name(ConfigStatus status);
@@ -0,0 +1,366 @@
+#include "MediboxCore.h"
+
+#include <BinLog.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+MediboxCore::MediboxCore(MediboxCoreIo &io)
+    : io_(io), trace_(NULL), config_(config_snapshot(config_defaults())), store_(config_defaults()), has_servo_(false), n_alarms_(0), alarm_enabled_(false),
+      snooze_hour_(25), snooze_minute_(0), light_window_short_(false), shade_light_(0), shade_temperature_(NAN)
+{
+  memset(&topics_, 0, sizeof(topics_));
+  memset(alarm_hours_, 0, sizeof(alarm_hours_));
+  memset(alarm_minutes_, 0, sizeof(alarm_minutes_));
+  memset(alarm_triggered_, 0, sizeof(alarm_triggered_));
+  memset(&last_tick_, 0, sizeof(last_tick_));
+  alert_reset(temp_alert_);
+  alert_reset(hum_alert_);
+}
+
+void MediboxCore::set_trace(TraceWriter *trace)
+{
+  trace_ = trace;
+}
+
+/***************************************************************************************************
+ * begin()
+ * Sets up the logs and the power-on alarms, and opens the trace with the layout so a replay can
+ * rebuild the same core.
+ **************************************************************************************************/
+void MediboxCore::begin(uint32_t now_ms, const CoreLayout &layout, const MediboxTopics &topics)
+{
+  topics_ = topics;
+  has_servo_ = layout.has_servo;
+  n_alarms_ = layout.n_alarms < CORE_MAX_ALARMS ? layout.n_alarms : CORE_MAX_ALARMS;
+  for (uint8_t i = 0; i < n_alarms_; i++)
+  {
+    alarm_hours_[i] = layout.alarm_hours[i];
+    alarm_minutes_[i] = layout.alarm_minutes[i];
+  }
+
+  sample_log_init(light_log_, layout.light_blocks, layout.light_log_blocks, 4095.0f); // One ADC step
+  sample_log_init(temp_log_, layout.temp_blocks, layout.env_log_blocks, 10.0f);       // DHT resolution, 0.1
+  sample_log_init(hum_log_, layout.hum_blocks, layout.env_log_blocks, 10.0f);
+  light_window_short_ = false;
+
+  if (trace_)
+  {
+    TraceBegin b;
+    memset(&b, 0, sizeof(b));
+    b.n_alarms = n_alarms_;
+    b.has_servo = has_servo_;
+    b.light_log_blocks = layout.light_log_blocks;
+    b.env_log_blocks = layout.env_log_blocks;
+    memcpy(b.alarm_hours, alarm_hours_, n_alarms_);
+    memcpy(b.alarm_minutes, alarm_minutes_, n_alarms_);
+    snprintf(b.device_id, sizeof(b.device_id), "%s", topics.device_id);
+    trace_->begin(now_ms, b);
+  }
+}
+
+/***************************************************************************************************
+ * time_tick()
+ * Fires each enabled alarm once when its minute comes, and a snoozed alarm when the snooze
+ * minute comes. io.alarm_fired() returns after the user answered, so the answer is applied
+ * before the next alarm is looked at.
+ **************************************************************************************************/
+void MediboxCore::time_tick(uint32_t now_ms, const TimeTick &tick)
+{
+  if (trace_)
+    trace_->tick(now_ms, tick);
+  last_tick_ = tick;
+
+  if (!alarm_enabled_)
+  {
+    return;
+  }
+
+  for (uint8_t i = 0; i < n_alarms_; i++)
+  {
+    if (!alarm_triggered_[i] && alarm_hours_[i] == tick.hours && alarm_minutes_[i] == tick.minutes)
+    {
+      alarm_triggered_[i] = true;
+      io_.alarm_fired(i);
+    }
+    if (alarm_triggered_[i] && snooze_hour_ == tick.hours && snooze_minute_ == tick.minutes)
+    {
+      alarm_triggered_[i] = true;
+      io_.alarm_fired(ALARM_SNOOZED);
+    }
+  }
+}
+
+void MediboxCore::alarm_dismissed(uint32_t now_ms)
+{
+  if (trace_)
+    trace_->alarm_dismissed(now_ms);
+  alarm_enabled_ = false;
+}
+
+// Rings again five minutes after the tick that fired it
+void MediboxCore::alarm_snoozed(uint32_t now_ms)
+{
+  if (trace_)
+    trace_->alarm_snoozed(now_ms);
+  snooze_hour_ = last_tick_.hours;
+  snooze_minute_ = last_tick_.minutes + 5;
+  alarm_enabled_ = true;
+}
+
+void MediboxCore::set_alarm(uint32_t now_ms, uint8_t index, uint8_t hours, uint8_t minutes)
+{
+  if (index >= n_alarms_)
+  {
+    return;
+  }
+  if (trace_)
+    trace_->set_alarm(now_ms, index, hours, minutes);
+  alarm_hours_[index] = hours;
+  alarm_minutes_[index] = minutes;
+}
+
+/***************************************************************************************************
+ * set_alarms_enabled()
+ * Enabling keeps the alarms that already rang today as they are; disabling also re-arms them.
+ **************************************************************************************************/
+void MediboxCore::set_alarms_enabled(uint32_t now_ms, bool enabled)
+{
+  if (trace_)
+    trace_->alarms_enabled(now_ms, enabled);
+  alarm_enabled_ = enabled;
+  if (!enabled)
+  {
+    memset(alarm_triggered_, 0, sizeof(alarm_triggered_));
+  }
+}
+
+/***************************************************************************************************
+ * light_sample()
+ * Stores the sample, publishes the new average (retained) and moves the shade.
+ **************************************************************************************************/
+void MediboxCore::light_sample(uint32_t now_ms, uint32_t epoch, float intensity)
+{
+  if (trace_)
+    trace_->light(now_ms, epoch, intensity);
+
+  sample_log_append(light_log_, epoch, intensity);
+  shade_light_ = light_average(epoch); // Decodes the whole log, so once per sample
+  check_light_window();
+
+  char buffer[10];
+  format_light_average(buffer, sizeof(buffer), shade_light_);
+  io_.publish(topics_.light, buffer, true);
+  LOG_DEBUG("Light average %s", buffer);
+
+  update_shade();
+}
+
+/***************************************************************************************************
+ * env_sample()
+ * Runs the alert state machines, stores the reading and moves the shade. Alerts are only raised
+ * or cleared on transitions; each one is published and switches the LED_2 warning.
+ **************************************************************************************************/
+void MediboxCore::env_sample(uint32_t now_ms, uint32_t epoch, float temperature, float humidity)
+{
+  if (trace_)
+    trace_->env(now_ms, epoch, temperature, humidity);
+
+  const MediboxConfig &config = config_.config;
+  AlertEvent temp_event = alert_update(temp_alert_, config.temperature, config.alert_dwell_ms, temperature, now_ms);
+  AlertEvent hum_event = alert_update(hum_alert_, config.humidity, config.alert_dwell_ms, humidity, now_ms);
+
+  if (temp_event.changed)
+  {
+    publish_alert_event("temperature", temp_event, epoch);
+  }
+  if (hum_event.changed)
+  {
+    publish_alert_event("humidity", hum_event, epoch);
+  }
+  if (temp_event.changed || hum_event.changed)
+  {
+    io_.env_warning(temp_alert_.level != ALERT_NORMAL || hum_alert_.level != ALERT_NORMAL);
+  }
+
+  if (!isnan(temperature) && !isnan(humidity))
+  {
+    sample_log_append(temp_log_, epoch, temperature);
+    sample_log_append(hum_log_, epoch, humidity);
+  }
+
+  shade_temperature_ = temperature;
+  update_shade();
+}
+
+/***************************************************************************************************
+ * publish_alert_event()
+ * Publishes a raise/clear event with its wall-clock timestamp on medibox/<id>/alert.
+ **************************************************************************************************/
+void MediboxCore::publish_alert_event(const char *metric, const AlertEvent &event, uint32_t epoch)
+{
+  char buffer[128];
+  format_alert_event(buffer, sizeof(buffer), metric, event, (long long)epoch);
+  io_.publish(topics_.alert, buffer, false);
+  if (event.level != ALERT_NORMAL)
+  {
+    LOG_WARN("Alert %s %s: %.2f (threshold %.2f)", metric, alert_level_name(event.level), event.value, event.threshold);
+  }
+  else
+  {
+    LOG_INFO("Alert %s cleared: %.2f", metric, event.value);
+  }
+}
+
+/***************************************************************************************************
+ * mqtt_message()
+ * Applies a config document as a whole, or rejects it as a whole, and acknowledges it. The
+ * config is versioned; io.config_changed() says whether ts or tu moved so the caller can retime
+ * sampling.
+ **************************************************************************************************/
+void MediboxCore::mqtt_message(uint32_t now_ms, uint32_t epoch, const char *topic, const uint8_t *payload,
+                               size_t length)
+{
+  if (trace_)
+    trace_->mqtt(now_ms, epoch, topic, payload, length);
+
+  if (strcmp(topic, topics_.config) != 0)
+  {
+    return;
+  }
+
+  ConfigUpdate update;
+  ConfigStatus status = parse_config_update(payload, length, config_.config, update);
+  if (status == CONFIG_OK)
+  {
+    bool window_changed = config_window_changed(update, config_.config);
+    MediboxConfig next = update.next;
+    next.version = config_.config.version + 1;
+    config_ = config_snapshot(next); // Derived values once per version
+    store_.publish(config_);
+
+    if (update.fields & CONFIG_FIELD_SWITCH)
+    {
+      io_.main_switch(update.main_switch);
+    }
+
+    ConfigChanged change = {config_.config.version, (uint16_t)update.fields, window_changed};
+    io_.config_changed(change);
+    shade_light_ = light_average(epoch);
+    update_shade();
+    check_light_window();
+  }
+  else
+  {
+    LOG_WARN("Rejected config: %s %s", config_status_name(status), update.bad_key);
+  }
+
+  uint32_t window_s = light_window_s();
+  char ack[96];
+  format_config_ack(ack, sizeof(ack), config_.config, status, update, window_s < config_.window_s ? window_s : 0);
+  io_.publish(topics_.config_ack, ack, false);
+}
+
+/***************************************************************************************************
+ * light_average()
+ * Average of the light samples from the last tu seconds.
+ **************************************************************************************************/
+float MediboxCore::light_average(uint32_t epoch) const
+{
+  float average;
+  uint32_t samples;
+  sample_log_average(light_log_, epoch - config_.window_s, average, samples);
+  return average;
+}
+
+/***************************************************************************************************
+ * light_window_s()
+ * How far back the light average can reach: tu, or less when the light log, at the rate it has
+ * been compressing, holds fewer than tu/ts samples. Older samples are evicted and the average
+ * covers what is left, so the shortfall is reported in the config ack and logged.
+ **************************************************************************************************/
+uint32_t MediboxCore::light_window_s() const
+{
+  uint32_t capacity = sample_log_capacity(light_log_);
+  uint64_t reach = (uint64_t)capacity * config_.sample_ms / 1000;
+  return capacity == 0 || reach >= config_.window_s ? config_.window_s : (uint32_t)reach;
+}
+
+void MediboxCore::check_light_window()
+{
+  uint32_t window_s = light_window_s();
+  bool short_window = window_s < config_.window_s;
+  if (short_window && !light_window_short_)
+  {
+    LOG_WARN("Light window: tu=%u s but the log holds about %u s at ts=%d", config_.window_s, window_s,
+             config_.config.ts);
+  }
+  else if (!short_window && light_window_short_)
+  {
+    LOG_INFO("Light window: the log holds tu=%u s again", config_.window_s);
+  }
+  light_window_short_ = short_window;
+}
+
+void MediboxCore::update_shade()
+{
+  if (!has_servo_)
+  {
+    return;
+  }
+  float theta = shade_angle(config_, shade_light_, shade_temperature_);
+  if (isnan(theta))
+  {
+    return; // No environment sample yet
+  }
+  io_.servo_write((int)theta);
+}
+
+/***************************************************************************************************
+ * format_alert_banner()
+ * One-line summary of the active alerts for the home screen, e.g. "TEMP HIGH HUM LOW".
+ * Returns false when nothing is active.
+ **************************************************************************************************/
+bool MediboxCore::format_alert_banner(char *buffer, size_t size) const
+{
+  buffer[0] = '\0';
+  if (temp_alert_.level == ALERT_NORMAL && hum_alert_.level == ALERT_NORMAL)
+  {
+    return false;
+  }
+
+  snprintf(buffer, size, "%s%s%s%s",
+           temp_alert_.level == ALERT_HIGH ? "TEMP HIGH " : "",
+           temp_alert_.level == ALERT_LOW ? "TEMP LOW " : "",
+           hum_alert_.level == ALERT_HIGH ? "HUM HIGH" : "",
+           hum_alert_.level == ALERT_LOW ? "HUM LOW" : "");
+  return true;
+}
+
+/***************************************************************************************************
+ * shade_angle()
+ * theta = theta_offset + (180 - theta_offset) * I * gamma * ln(ts / tu) * (T / Tmed), limited to
+ * 0-180. NAN while there is no temperature yet. ln(ts / tu) comes precomputed with the snapshot.
+ **************************************************************************************************/
+float shade_angle(const ConfigSnapshot &snapshot, float light, float temperature)
+{
+  if (isnan(temperature))
+  {
+    return NAN;
+  }
+
+  const MediboxConfig &config = snapshot.config;
+  float theta = config.theta_offset +
+                (180 - config.theta_offset) * light * config.gamma * snapshot.log_ratio * (temperature / config.tmed);
+
+  if (theta < 0)
+    return 0;
+  if (theta > 180)
+    return 180;
+  return theta;
+}
+
+float shade_angle(const MediboxConfig &config, float light, float temperature)
+{
+  return shade_angle(config_snapshot(config), light, temperature);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <AlertEngine.h>
+#include <ConfigStore.h>
+#include <EventBus.h>
+#include <InputTrace.h>
+#include <MediboxConfig.h>
+#include <MediboxMqtt.h>
+#include <SampleLog.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * MediboxCore
+ * The box's behaviour without its hardware: alarm scheduling, the sensor history and light
+ * average, environment alerts, the shade model and config updates. main.cpp feeds it inputs and
+ * implements MediboxCoreIo (servo, MQTT, indicator, the alarm screen); the host replay engine
+ * feeds it a recorded trace and records the outputs instead. With a TraceWriter attached, every
+ * input is recorded on its way in, so a trace holds exactly what the core saw.
+ *
+ * The core runs on the main loop and reads its own config directly. Each applied config is also
+ * published to a ConfigStore, from which other tasks take consistent snapshots without a lock.
+ **************************************************************************************************/
+
+#define CORE_MAX_ALARMS TRACE_MAX_ALARMS
+#define ALARM_SNOOZED 0xFF // AlarmFired index of a snoozed alarm coming back
+
+class MediboxCoreIo
+{
+public:
+  virtual ~MediboxCoreIo() {}
+  virtual void servo_write(int angle) = 0;
+  virtual void publish(const char *topic, const char *payload, bool retain) = 0;
+  virtual void alarm_fired(uint8_t index) = 0; // Returns once the alarm was dismissed or snoozed
+  virtual void env_warning(bool active) = 0;
+  virtual void main_switch(bool on) = 0;
+  virtual void config_changed(const ConfigChanged &change) = 0;
+};
+
+struct CoreLayout
+{
+  uint8_t n_alarms;
+  bool has_servo;
+  SampleBlock *light_blocks;
+  uint8_t light_log_blocks;
+  SampleBlock *temp_blocks;
+  SampleBlock *hum_blocks;
+  uint8_t env_log_blocks;
+  const uint8_t *alarm_hours; // Power-on alarm times, n_alarms each
+  const uint8_t *alarm_minutes;
+};
+
+class MediboxCore
+{
+public:
+  explicit MediboxCore(MediboxCoreIo &io);
+
+  void set_trace(TraceWriter *trace);
+  void begin(uint32_t now_ms, const CoreLayout &layout, const MediboxTopics &topics);
+
+  // Inputs
+  void time_tick(uint32_t now_ms, const TimeTick &tick);
+  void light_sample(uint32_t now_ms, uint32_t epoch, float intensity);
+  void env_sample(uint32_t now_ms, uint32_t epoch, float temperature, float humidity);
+  void mqtt_message(uint32_t now_ms, uint32_t epoch, const char *topic, const uint8_t *payload, size_t length);
+  void alarm_dismissed(uint32_t now_ms);
+  void alarm_snoozed(uint32_t now_ms);
+  void set_alarm(uint32_t now_ms, uint8_t index, uint8_t hours, uint8_t minutes);
+  void set_alarms_enabled(uint32_t now_ms, bool enabled);
+
+  // State the screens show
+  const MediboxConfig &config() const { return config_.config; }
+  const ConfigSnapshot &snapshot() const { return config_; }
+  const ConfigStore &config_store() const { return store_; }
+  bool alarms_enabled() const { return alarm_enabled_; }
+  uint8_t alarm_hours(uint8_t index) const { return alarm_hours_[index]; }
+  uint8_t alarm_minutes(uint8_t index) const { return alarm_minutes_[index]; }
+  bool format_alert_banner(char *buffer, size_t size) const;
+  float light_average(uint32_t epoch) const;
+  uint32_t light_window_s() const; // Seconds of light history the log can hold, at most tu
+
+private:
+  void publish_alert_event(const char *metric, const AlertEvent &event, uint32_t epoch);
+  void update_shade();
+  void check_light_window();
+
+  MediboxCoreIo &io_;
+  TraceWriter *trace_;
+  MediboxTopics topics_;
+  ConfigSnapshot config_; // Main loop's copy; store_ holds the same for other tasks
+  ConfigStore store_;
+  bool has_servo_;
+
+  uint8_t n_alarms_;
+  bool alarm_enabled_;
+  uint8_t alarm_hours_[CORE_MAX_ALARMS];
+  uint8_t alarm_minutes_[CORE_MAX_ALARMS];
+  bool alarm_triggered_[CORE_MAX_ALARMS];
+  int snooze_hour_; // 25 until the first snooze, so it never matches
+  int snooze_minute_;
+  TimeTick last_tick_;
+
+  AlertState temp_alert_;
+  AlertState hum_alert_;
+  SampleLog light_log_;
+  bool light_window_short_; // The log holds less than tu; warned once
+  SampleLog temp_log_;
+  SampleLog hum_log_;
+
+  // Latest inputs of the shade model
+  float shade_light_;
+  float shade_temperature_;
+};
+
+// Servo angle (0-180) for an average light level (0-1) and temperature
+float shade_angle(const ConfigSnapshot &snapshot, float light, float temperature);
+float shade_angle(const MediboxConfig &config, float light, float temperature);
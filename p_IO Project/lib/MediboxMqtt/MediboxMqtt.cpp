@@ -0,0 +1,74 @@
+#include "MediboxMqtt.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/***************************************************************************************************
+ * make_device_id()
+ * Derives a stable device id ("mbx-" + the station MAC in hex) so that every box gets its own
+ * client id and topic namespace without per-unit firmware edits.
+ **************************************************************************************************/
+void make_device_id(const uint8_t mac[6], char *device_id, size_t size)
+{
+  snprintf(device_id, size, "mbx-%02x%02x%02x%02x%02x%02x", mac[0], mac[1], mac[2], mac[3], mac[4],
+           mac[5]);
+}
+
+static bool build_topic(char (&topic)[MEDIBOX_TOPIC_LEN], const char *device_id, const char *leaf)
+{
+  int n = snprintf(topic, sizeof(topic), MEDIBOX_TOPIC_ROOT "/%s/%s", device_id, leaf);
+  return n > 0 && n < (int)sizeof(topic);
+}
+
+/***************************************************************************************************
+ * build_topics()
+ * Fills in every medibox/<device-id>/... topic. Returns false if the id does not fit.
+ **************************************************************************************************/
+bool build_topics(MediboxTopics &topics, const char *device_id)
+{
+  if (strlen(device_id) >= sizeof(topics.device_id))
+    return false;
+  strcpy(topics.device_id, device_id);
+
+  return build_topic(topics.light, device_id, "light") &&
+         build_topic(topics.config, device_id, "config") &&
+         build_topic(topics.config_ack, device_id, "config/ack") &&
+         build_topic(topics.alert, device_id, "alert") &&
+         build_topic(topics.log, device_id, "log") &&
+         build_topic(topics.trace, device_id, "trace") &&
+         build_topic(topics.journal, device_id, "journal") &&
+         build_topic(topics.journal_get, device_id, "journal/get");
+}
+
+/***************************************************************************************************
+ * device_id_from_topic()
+ * Extracts <device-id> from medibox/<device-id>/... Returns false for foreign topics.
+ **************************************************************************************************/
+bool device_id_from_topic(const char *topic, char *device_id, size_t size)
+{
+  const size_t root_len = strlen(MEDIBOX_TOPIC_ROOT "/");
+  if (strncmp(topic, MEDIBOX_TOPIC_ROOT "/", root_len) != 0)
+    return false;
+
+  const char *start = topic + root_len;
+  const char *end = strchr(start, '/');
+  size_t len = end ? (size_t)(end - start) : strlen(start);
+  if (len == 0 || len >= size)
+    return false;
+
+  memcpy(device_id, start, len);
+  device_id[len] = '\0';
+  return true;
+}
+
+/***************************************************************************************************
+ * format_light_average()
+ * Text payload published on the light topic, same "%4.2f" format the dashboard has always parsed.
+ **************************************************************************************************/
+size_t format_light_average(char *buffer, size_t size, float average)
+{
+  int n = snprintf(buffer, size, "%4.2f", average);
+  if (n < 0)
+    return 0;
+  return (size_t)n < size ? (size_t)n : size - 1;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * MediboxMqtt
+ * Device identity and the per-device topic namespace medibox/<device-id>/... shared by the
+ * firmware and the host tools, so a fleet of boxes can share one broker without colliding.
+ **************************************************************************************************/
+
+#define MEDIBOX_TOPIC_ROOT "medibox"
+#define DEVICE_ID_LEN 20 // "mbx-" + 12 hex digits of the MAC
+#define MEDIBOX_TOPIC_LEN 48
+
+struct MediboxTopics
+{
+  char device_id[DEVICE_ID_LEN];
+  char light[MEDIBOX_TOPIC_LEN];      // Retained light average (was ENTC-ADMIN-LIGHT)
+  char config[MEDIBOX_TOPIC_LEN];     // Incoming config documents
+  char config_ack[MEDIBOX_TOPIC_LEN]; // Config acknowledgements
+  char alert[MEDIBOX_TOPIC_LEN];      // Environment alert raise/clear events
+  char log[MEDIBOX_TOPIC_LEN];        // Binary log records (lib/BinLog wire form)
+  char trace[MEDIBOX_TOPIC_LEN];      // Input trace chunks (lib/InputTrace)
+  char journal[MEDIBOX_TOPIC_LEN];    // Adherence journal stream (lib/AdherenceJournal)
+  char journal_get[MEDIBOX_TOPIC_LEN]; // Journal stream requests, holding a cursor
+};
+
+void make_device_id(const uint8_t mac[6], char *device_id, size_t size);
+bool build_topics(MediboxTopics &topics, const char *device_id);
+bool device_id_from_topic(const char *topic, char *device_id, size_t size);
+size_t format_light_average(char *buffer, size_t size, float average);
@@ -0,0 +1,384 @@
+#include "SampleLog.h"
+
+#include <math.h>
+#include <string.h>
+
+// Worst case for one sample: 4 + 32 timestamp bits, 2 + 5 + 6 + 32 value bits (XOR)
+#define SAMPLE_MAX_BITS 81
+
+/***************************************************************************************************
+ * Bit I/O, most significant bit first
+ **************************************************************************************************/
+static void put_bits(SampleBlock &b, uint32_t value, uint8_t n)
+{
+  for (int i = n - 1; i >= 0; i--)
+  {
+    uint32_t byte = b.bits >> 3;
+    uint8_t mask = (uint8_t)(0x80 >> (b.bits & 7));
+    if ((value >> i) & 1)
+      b.data[byte] |= mask;
+    else
+      b.data[byte] &= (uint8_t)~mask;
+    b.bits++;
+  }
+}
+
+static uint32_t get_bits(const SampleBlock &b, uint32_t &pos, uint8_t n)
+{
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < n; i++)
+  {
+    value = value << 1 | ((b.data[pos >> 3] >> (7 - (pos & 7))) & 1);
+    pos++;
+  }
+  return value;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline uint8_t leading_zeros(uint32_t v)
+{
+  uint8_t n = 0;
+  for (uint32_t m = 0x80000000u; m && !(v & m); m >>= 1)
+    n++;
+  return n;
+}
+
+static inline uint8_t trailing_zeros(uint32_t v)
+{
+  uint8_t n = 0;
+  for (uint32_t m = 1; m && !(v & m); m <<= 1)
+    n++;
+  return n;
+}
+
+static uint32_t float_bits(float f)
+{
+  uint32_t u;
+  memcpy(&u, &f, sizeof(u));
+  return u;
+}
+
+static float bits_float(uint32_t u)
+{
+  float f;
+  memcpy(&f, &u, sizeof(f));
+  return f;
+}
+
+/***************************************************************************************************
+ * Integer coding: zig-zag, then the shortest bucket that holds it
+ *
+ *   0                          zero
+ *   10   + small bits          z < 2^small
+ *   110  + medium bits         z < 2^medium
+ *   1110 + large bits          z < 2^large
+ *   1111 + 32 bits             anything else
+ *
+ * Timestamps store the delta-of-delta (3/9/16 bits: a steady period is one bit, a second of
+ * jitter five); quantised values store the delta (2/6/12 bits: +-1 LSB of sensor noise is four).
+ **************************************************************************************************/
+struct Buckets
+{
+  uint8_t small;
+  uint8_t medium;
+  uint8_t large;
+};
+
+static const Buckets DOD_BUCKETS = {3, 9, 16};
+static const Buckets DELTA_BUCKETS = {2, 6, 12};
+
+static void put_int(SampleBlock &b, int32_t v, const Buckets &k)
+{
+  uint32_t z = zigzag(v);
+  if (z == 0)
+    put_bits(b, 0, 1);
+  else if (z < (1u << k.small))
+  {
+    put_bits(b, 0x2, 2);
+    put_bits(b, z, k.small);
+  }
+  else if (z < (1u << k.medium))
+  {
+    put_bits(b, 0x6, 3);
+    put_bits(b, z, k.medium);
+  }
+  else if (z < (1u << k.large))
+  {
+    put_bits(b, 0xE, 4);
+    put_bits(b, z, k.large);
+  }
+  else
+  {
+    put_bits(b, 0xF, 4);
+    put_bits(b, z, 32);
+  }
+}
+
+static int32_t get_int(const SampleBlock &b, uint32_t &pos, const Buckets &k)
+{
+  if (!get_bits(b, pos, 1))
+    return 0;
+  if (!get_bits(b, pos, 1))
+    return unzigzag(get_bits(b, pos, k.small));
+  if (!get_bits(b, pos, 1))
+    return unzigzag(get_bits(b, pos, k.medium));
+  if (!get_bits(b, pos, 1))
+    return unzigzag(get_bits(b, pos, k.large));
+  return unzigzag(get_bits(b, pos, 32));
+}
+
+/***************************************************************************************************
+ * Float value coding: XOR with the previous value (Gorilla)
+ *   0                                  identical
+ *   10 + meaningful bits               fits the previous leading/trailing-zero window
+ *   11 + 5 bits leading + 6 bits length + meaningful bits
+ **************************************************************************************************/
+static void put_xor(SampleLog &log, SampleBlock &b, uint32_t x)
+{
+  if (x == 0)
+  {
+    put_bits(b, 0, 1);
+    return;
+  }
+
+  uint8_t leading = leading_zeros(x);
+  uint8_t trailing = trailing_zeros(x);
+  if (leading > 31)
+    leading = 31;
+
+  if (log.last_leading != 0xFF && leading >= log.last_leading && trailing >= log.last_trailing)
+  {
+    put_bits(b, 0x2, 2);
+    put_bits(b, x >> log.last_trailing, 32 - log.last_leading - log.last_trailing);
+    return;
+  }
+
+  uint8_t length = 32 - leading - trailing;
+  put_bits(b, 0x3, 2);
+  put_bits(b, leading, 5);
+  put_bits(b, length - 1, 6); // 1-32 stored as 0-31
+  put_bits(b, x >> trailing, length);
+  log.last_leading = leading;
+  log.last_trailing = trailing;
+}
+
+static uint32_t get_xor(SampleLogIterator &it, const SampleBlock &b)
+{
+  if (!get_bits(b, it.bitpos, 1))
+    return 0;
+  if (!get_bits(b, it.bitpos, 1))
+  {
+    uint8_t length = 32 - it.leading - it.trailing;
+    return get_bits(b, it.bitpos, length) << it.trailing;
+  }
+  it.leading = (uint8_t)get_bits(b, it.bitpos, 5);
+  uint8_t length = (uint8_t)get_bits(b, it.bitpos, 6) + 1;
+  it.trailing = 32 - it.leading - length;
+  return get_bits(b, it.bitpos, length) << it.trailing;
+}
+
+static uint32_t quantize(const SampleLog &log, float value)
+{
+  if (log.scale == 0)
+    return float_bits(value);
+  return (uint32_t)(int32_t)lroundf(value * log.scale);
+}
+
+static float dequantize(const SampleLog &log, uint32_t q)
+{
+  if (log.scale == 0)
+    return bits_float(q);
+  return (float)(int32_t)q / log.scale;
+}
+
+/***************************************************************************************************
+ * sample_log_init()
+ * scale is the resolution kept: 4095 for a 0-1 LDR reading (one ADC step), 10 for 0.1 degC.
+ **************************************************************************************************/
+void sample_log_init(SampleLog &log, SampleBlock *storage, uint16_t block_count, float scale)
+{
+  log.blocks = storage;
+  log.capacity = block_count;
+  log.scale = scale;
+  sample_log_clear(log);
+}
+
+void sample_log_clear(SampleLog &log)
+{
+  log.first = 0;
+  log.used = 0;
+  log.count = 0;
+  log.evicted = 0;
+}
+
+static void start_block(SampleLog &log, uint32_t t, uint32_t q)
+{
+  if (log.used == log.capacity)
+  {
+    // Pool full: the oldest block makes room
+    log.count -= log.blocks[log.first].count;
+    log.evicted += log.blocks[log.first].count;
+    log.first = (uint16_t)((log.first + 1) % log.capacity);
+    log.used--;
+  }
+
+  SampleBlock &b = log.blocks[(log.first + log.used) % log.capacity];
+  log.used++;
+  b.t0 = t;
+  b.v0 = q;
+  b.count = 1;
+  b.bits = 0;
+
+  log.last_t = t;
+  log.last_delta = 0;
+  log.last_v = q;
+  log.last_leading = 0xFF;
+  log.last_trailing = 0;
+  log.count++;
+}
+
+/***************************************************************************************************
+ * sample_log_append()
+ * Timestamps are expected to be non-decreasing (e.g. epoch seconds); going backwards still
+ * round-trips, it just takes the 32-bit escape.
+ **************************************************************************************************/
+void sample_log_append(SampleLog &log, uint32_t t, float value)
+{
+  if (log.capacity == 0)
+    return;
+
+  uint32_t q = quantize(log, value);
+  if (log.used == 0)
+  {
+    start_block(log, t, q);
+    return;
+  }
+
+  SampleBlock &b = log.blocks[(log.first + log.used - 1) % log.capacity];
+  if (b.bits + SAMPLE_MAX_BITS > SAMPLE_BLOCK_DATA * 8 || b.count == 0xFFFF)
+  {
+    start_block(log, t, q);
+    return;
+  }
+
+  int32_t delta = (int32_t)(t - log.last_t);
+  put_int(b, delta - log.last_delta, DOD_BUCKETS);
+  if (log.scale == 0)
+    put_xor(log, b, q ^ log.last_v);
+  else
+    put_int(b, (int32_t)(q - log.last_v), DELTA_BUCKETS);
+
+  log.last_t = t;
+  log.last_delta = delta;
+  log.last_v = q;
+  b.count++;
+  log.count++;
+}
+
+size_t sample_log_bytes_used(const SampleLog &log)
+{
+  size_t bytes = 0;
+  for (uint16_t i = 0; i < log.used; i++)
+    bytes += 12 + (log.blocks[(log.first + i) % log.capacity].bits + 7) / 8;
+  return bytes;
+}
+
+/***************************************************************************************************
+ * sample_log_capacity()
+ * Samples the whole pool holds at the rate the filled blocks have been compressing, so a caller
+ * can tell how far back the log will reach. 0 until a block has filled.
+ **************************************************************************************************/
+uint32_t sample_log_capacity(const SampleLog &log)
+{
+  if (log.used < 2)
+    return 0;
+  const SampleBlock &newest = log.blocks[(log.first + log.used - 1) % log.capacity];
+  uint32_t filled = log.count - newest.count;
+  return (uint32_t)((uint64_t)filled * log.capacity / (log.used - 1));
+}
+
+/***************************************************************************************************
+ * Iteration, oldest sample first
+ **************************************************************************************************/
+void sample_log_iter_begin(const SampleLog &log, SampleLogIterator &it)
+{
+  it.log = &log;
+  it.block = 0;
+  it.index = 0;
+  it.bitpos = 0;
+}
+
+bool sample_log_next(SampleLogIterator &it, uint32_t &t, float &value)
+{
+  const SampleLog &log = *it.log;
+  while (it.block < log.used)
+  {
+    const SampleBlock &b = log.blocks[(log.first + it.block) % log.capacity];
+    if (it.index >= b.count)
+    {
+      it.block++;
+      it.index = 0;
+      it.bitpos = 0;
+      continue;
+    }
+
+    if (it.index == 0)
+    {
+      it.t = b.t0;
+      it.delta = 0;
+      it.v = b.v0;
+      it.leading = 0;
+      it.trailing = 0;
+    }
+    else
+    {
+      it.delta += get_int(b, it.bitpos, DOD_BUCKETS);
+      it.t += (uint32_t)it.delta;
+      if (log.scale == 0)
+        it.v ^= get_xor(it, b);
+      else
+        it.v += (uint32_t)get_int(b, it.bitpos, DELTA_BUCKETS);
+    }
+
+    it.index++;
+    t = it.t;
+    value = dequantize(log, it.v);
+    return true;
+  }
+  return false;
+}
+
+/***************************************************************************************************
+ * sample_log_average()
+ * Mean of the samples stamped at or after since. Returns false when there are none.
+ **************************************************************************************************/
+bool sample_log_average(const SampleLog &log, uint32_t since, float &average, uint32_t &samples)
+{
+  SampleLogIterator it;
+  sample_log_iter_begin(log, it);
+
+  double sum = 0;
+  samples = 0;
+  uint32_t t;
+  float v;
+  while (sample_log_next(it, t, v))
+  {
+    if ((int32_t)(t - since) >= 0)
+    {
+      sum += v;
+      samples++;
+    }
+  }
+
+  average = samples ? (float)(sum / samples) : 0.0f;
+  return samples > 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * SampleLog
+ * Compressed (timestamp, value) history in a fixed pool of blocks, Gorilla-style:
+ *
+ *   timestamps  zig-zag delta-of-delta, so a steady sampling period costs one bit per sample,
+ *   values      quantised (value * scale, rounded) and stored as zig-zag deltas in short
+ *               prefix-coded buckets; with scale 0 the raw float bits are XORed with the
+ *               previous value and only the changed window is stored.
+ *
+ * Each block starts from an uncompressed sample and decodes on its own, so when the pool is full
+ * the oldest block is dropped and the log keeps a sliding window of the newest samples. There is
+ * no allocation; the caller owns the block storage.
+ **************************************************************************************************/
+
+#define SAMPLE_BLOCK_BYTES 128
+#define SAMPLE_BLOCK_DATA (SAMPLE_BLOCK_BYTES - 12)
+
+struct SampleBlock
+{
+  uint32_t t0;       // First timestamp, uncompressed
+  uint32_t v0;       // First value: quantised int32, or float bits when scale is 0
+  uint16_t count;    // Samples in the block, including the first
+  uint16_t bits;     // Bits used in data
+  uint8_t data[SAMPLE_BLOCK_DATA];
+};
+static_assert(sizeof(SampleBlock) == SAMPLE_BLOCK_BYTES, "sample block must stay a fixed size");
+
+struct SampleLog
+{
+  SampleBlock *blocks;
+  uint16_t capacity; // Blocks in the pool
+  uint16_t first;    // Oldest block
+  uint16_t used;     // Blocks holding samples
+  float scale;       // Quantisation steps per unit, 0 = lossless float XOR
+  uint32_t count;    // Samples currently held
+  uint32_t evicted;  // Samples dropped with old blocks
+
+  // Encoder state of the newest block
+  uint32_t last_t;
+  int32_t last_delta;
+  uint32_t last_v;
+  uint8_t last_leading;
+  uint8_t last_trailing;
+};
+
+struct SampleLogIterator
+{
+  const SampleLog *log;
+  uint16_t block;     // Blocks visited so far
+  uint16_t index;     // Sample index within the current block
+  uint32_t bitpos;
+  uint32_t t;
+  int32_t delta;
+  uint32_t v;
+  uint8_t leading;
+  uint8_t trailing;
+};
+
+void sample_log_init(SampleLog &log, SampleBlock *storage, uint16_t block_count, float scale);
+void sample_log_clear(SampleLog &log);
+void sample_log_append(SampleLog &log, uint32_t t, float value);
+size_t sample_log_bytes_used(const SampleLog &log);
+uint32_t sample_log_capacity(const SampleLog &log);
+
+void sample_log_iter_begin(const SampleLog &log, SampleLogIterator &it);
+bool sample_log_next(SampleLogIterator &it, uint32_t &t, float &value);
+
+bool sample_log_average(const SampleLog &log, uint32_t since, float &average, uint32_t &samples);
@@ -0,0 +1,439 @@
+#include "TimeSync.h"
+
+#include <math.h>
+#include <string.h>
+
+#define NTP_UNIX_OFFSET_S 2208988800ULL // 1900-01-01 to 1970-01-01
+#define US_PER_S 1000000LL
+
+static void put_u64(uint8_t *p, uint64_t v)
+{
+  for (int i = 7; i >= 0; i--, v >>= 8)
+    p[i] = (uint8_t)v;
+}
+
+static uint64_t get_u64(const uint8_t *p)
+{
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++)
+    v = (v << 8) | p[i];
+  return v;
+}
+
+// Sorts in place; n is at most the number of sample pairs, so insertion sort is enough
+static double median(double *v, size_t n)
+{
+  for (size_t i = 1; i < n; i++)
+  {
+    double x = v[i];
+    size_t j = i;
+    for (; j > 0 && v[j - 1] > x; j--)
+      v[j] = v[j - 1];
+    v[j] = x;
+  }
+  return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+static uint32_t saturate_u32(uint64_t v)
+{
+  return v > UINT32_MAX ? UINT32_MAX : (uint32_t)v;
+}
+
+uint64_t ntp_from_unix_us(int64_t unix_us)
+{
+  uint64_t seconds = (uint64_t)(unix_us / US_PER_S) + NTP_UNIX_OFFSET_S; // Wraps into era 1 in 2036
+  uint64_t fraction = (((uint64_t)(unix_us % US_PER_S) << 32) + US_PER_S / 2) / US_PER_S;
+  return (seconds << 32) + fraction;
+}
+
+int64_t ntp_to_unix_us(uint64_t ntp)
+{
+  uint64_t seconds = ntp >> 32;
+  if (!(seconds & 0x80000000))
+    seconds += 0x100000000ULL; // Era 1, from 2036-02-07
+  uint64_t fraction = ntp & 0xFFFFFFFF;
+  return (int64_t)(seconds - NTP_UNIX_OFFSET_S) * US_PER_S + (int64_t)((fraction * US_PER_S + 0x80000000) >> 32);
+}
+
+void sntp_request(uint8_t packet[NTP_PACKET_SIZE], uint64_t cookie)
+{
+  memset(packet, 0, NTP_PACKET_SIZE);
+  packet[0] = (0 << 6) | (4 << 3) | 3; // No leap warning, version 4, client
+  put_u64(packet + 40, cookie);
+}
+
+SntpStatus sntp_reply(const uint8_t packet[NTP_PACKET_SIZE], uint64_t cookie, int64_t sent_us, int64_t received_us,
+                      SntpSample &sample)
+{
+  uint8_t leap = packet[0] >> 6;
+  uint8_t version = (packet[0] >> 3) & 7;
+  uint8_t mode = packet[0] & 7;
+  uint8_t stratum = packet[1];
+
+  if (get_u64(packet + 24) != cookie)
+    return SNTP_UNMATCHED;
+  if (mode != 4 || version < 3 || version > 4)
+    return SNTP_BAD;
+  if (stratum == 0)
+    return SNTP_KISS_OF_DEATH;
+  if (leap == 3 || stratum > 15)
+    return SNTP_BAD;
+
+  uint64_t receive = get_u64(packet + 32);
+  uint64_t transmit = get_u64(packet + 40);
+  if (receive == 0 || transmit == 0)
+    return SNTP_BAD;
+  int64_t t2 = ntp_to_unix_us(receive);
+  int64_t t3 = ntp_to_unix_us(transmit);
+  int64_t round_trip = received_us - sent_us;
+  if (t3 < t2 || round_trip < 0)
+    return SNTP_BAD;
+
+  int64_t delay = round_trip - (t3 - t2);
+  sample.local_us = sent_us + round_trip / 2;
+  sample.server_us = t2 + (t3 - t2) / 2;
+  sample.delay_us = delay < 0 ? 0 : saturate_u32((uint64_t)delay);
+  return SNTP_OK;
+}
+
+ClockFit::ClockFit()
+    : count_(0), outlier_run_(0), recent_count_(0), recent_next_(0), base_local_us_(0), base_offset_us_(0), skew_ppb_(0),
+      skew_measured_(false), phase_us_(0), skew_unc_ppb_(TIMESYNC_CRYSTAL_PPM * 1000)
+{
+}
+
+int64_t ClockFit::utc_us(int64_t local_us) const
+{
+  // Milliseconds times ppb, so days of extrapolation stay inside 64 bits
+  int64_t elapsed_ms = (local_us - base_local_us_) / 1000;
+  return local_us + base_offset_us_ + elapsed_ms * skew_ppb_ / 1000000;
+}
+
+uint32_t ClockFit::error_us(int64_t local_us) const
+{
+  if (!valid())
+    return UINT32_MAX;
+  int64_t elapsed_ms = (local_us - base_local_us_) / 1000;
+  if (elapsed_ms < 0)
+    elapsed_ms = -elapsed_ms;
+  return saturate_u32(phase_us_ + (uint64_t)elapsed_ms * skew_unc_ppb_ / 1000000);
+}
+
+/***************************************************************************************************
+ * ClockFit::add()
+ * Checks a sample before fitting it. One much slower than the lower quartile of recent delays
+ * (rejected ones included, so a path that stays slower is soon taken as it is) is not fitted. One
+ * outside three times the error bound, plus its own half delay, is an outlier; when the last
+ * TIMESYNC_RESET_OUTLIERS outliers agree with each other the time really moved, and the fit
+ * restarts from them. Outliers that disagree are independent bad replies and never add up.
+ **************************************************************************************************/
+SampleResult ClockFit::add(const SntpSample &sample)
+{
+  while (count_ > 0 && sample.local_us - samples_[0].local_us > (int64_t)TIMESYNC_MAX_AGE_S * US_PER_S)
+  {
+    memmove(&samples_[0], &samples_[1], (count_ - 1) * sizeof(samples_[0]));
+    count_--;
+  }
+
+  bool slow = false;
+  if (recent_count_ > 0)
+  {
+    double delays[TIMESYNC_SAMPLES];
+    for (uint8_t i = 0; i < recent_count_; i++)
+      delays[i] = recent_delays_[i];
+    median(delays, recent_count_); // Sorts
+    slow = sample.delay_us > 2 * delays[recent_count_ / 4] + TIMESYNC_MIN_SCATTER_US;
+  }
+  recent_delays_[recent_next_] = sample.delay_us;
+  recent_next_ = (recent_next_ + 1) % TIMESYNC_SAMPLES;
+  if (recent_count_ < TIMESYNC_SAMPLES)
+    recent_count_++;
+  if (slow)
+    return SAMPLE_SLOW;
+
+  SampleResult result = SAMPLE_ACCEPTED;
+  if (count_ > 0 && !fits(sample, sample.server_us - utc_us(sample.local_us)))
+  {
+    if (outlier_run_ > 0 && !agrees(outliers_[0], sample))
+      outlier_run_ = 0;
+    outliers_[outlier_run_++] = sample;
+    if (outlier_run_ < TIMESYNC_RESET_OUTLIERS)
+      return SAMPLE_OUTLIER;
+
+    // The drift is kept: the crystal did not change with the time
+    memcpy(samples_, outliers_, sizeof(outliers_));
+    count_ = TIMESYNC_RESET_OUTLIERS;
+    outlier_run_ = 0;
+    refit();
+    return SAMPLE_RESET;
+  }
+  outlier_run_ = 0;
+
+  if (count_ == TIMESYNC_SAMPLES)
+  {
+    memmove(&samples_[0], &samples_[1], (count_ - 1) * sizeof(samples_[0]));
+    count_--;
+  }
+  samples_[count_++] = sample;
+  refit();
+  return result;
+}
+
+bool ClockFit::fits(const SntpSample &sample, int64_t residual_us) const
+{
+  uint64_t limit = 3 * (uint64_t)error_us(sample.local_us) + sample.delay_us / 2;
+  return (uint64_t)(residual_us < 0 ? -residual_us : residual_us) <= limit;
+}
+
+// Two outliers tell the same story: their offsets from the line differ by no more than their delays
+bool ClockFit::agrees(const SntpSample &a, const SntpSample &b) const
+{
+  int64_t apart = (a.server_us - utc_us(a.local_us)) - (b.server_us - utc_us(b.local_us));
+  int64_t elapsed_ms = (b.local_us - a.local_us) / 1000;
+  uint64_t limit = (a.delay_us + b.delay_us) / 2 + 2 * TIMESYNC_MIN_SCATTER_US +
+                   (uint64_t)(elapsed_ms < 0 ? -elapsed_ms : elapsed_ms) * skew_unc_ppb_ / 1000000;
+  return (uint64_t)(apart < 0 ? -apart : apart) <= limit;
+}
+
+/***************************************************************************************************
+ * ClockFit::refit()
+ * Theil-Sen over the window, relative to the newest sample: x in seconds before it, y the change in
+ * server - local in microseconds, so slopes come out in ppm. Until there are three samples spanning
+ * TIMESYNC_MIN_SPAN_S the previous drift is kept (zero at first).
+ *
+ * The line goes through the newest sample, which has passed the outlier and delay checks: its
+ * error is at most half its delay, while the window's median intercept would lag a real change by
+ * half a window. The residuals about the median line measure how well a straight line predicts
+ * this crystal, and set the drift uncertainty.
+ **************************************************************************************************/
+void ClockFit::refit()
+{
+  const SntpSample &newest = samples_[count_ - 1];
+  int64_t newest_offset = newest.server_us - newest.local_us;
+
+  double x[TIMESYNC_SAMPLES], y[TIMESYNC_SAMPLES];
+  for (uint8_t i = 0; i < count_; i++)
+  {
+    x[i] = (double)(samples_[i].local_us - newest.local_us) / US_PER_S;
+    y[i] = (double)(samples_[i].server_us - samples_[i].local_us - newest_offset);
+  }
+  double span_s = (double)(newest.local_us - samples_[0].local_us) / US_PER_S;
+
+  skew_measured_ = false;
+  if (count_ >= 3 && span_s >= TIMESYNC_MIN_SPAN_S)
+  {
+    double slopes[TIMESYNC_SAMPLES * (TIMESYNC_SAMPLES - 1) / 2];
+    size_t n = 0;
+    for (uint8_t i = 0; i < count_; i++)
+    {
+      for (uint8_t j = i + 1; j < count_; j++)
+      {
+        if (x[j] - x[i] >= TIMESYNC_MIN_PAIR_S)
+          slopes[n++] = (y[j] - y[i]) / (x[j] - x[i]);
+      }
+    }
+    if (n > 0)
+    {
+      double ppm = median(slopes, n);
+      if (ppm > TIMESYNC_MAX_SKEW_PPM)
+        ppm = TIMESYNC_MAX_SKEW_PPM;
+      if (ppm < -TIMESYNC_MAX_SKEW_PPM)
+        ppm = -TIMESYNC_MAX_SKEW_PPM;
+      skew_ppb_ = (int32_t)lround(ppm * 1000);
+      skew_measured_ = true;
+    }
+  }
+
+  double ppm = skew_ppb_ / 1000.0;
+  double intercepts[TIMESYNC_SAMPLES];
+  for (uint8_t i = 0; i < count_; i++)
+    intercepts[i] = y[i] - ppm * x[i];
+  double intercept = median(intercepts, count_);
+
+  double residuals[TIMESYNC_SAMPLES];
+  for (uint8_t i = 0; i < count_; i++)
+    residuals[i] = fabs(y[i] - ppm * x[i] - intercept);
+  double scatter = 1.4826 * median(residuals, count_); // MAD as a standard deviation
+  if (scatter < TIMESYNC_MIN_SCATTER_US)
+    scatter = TIMESYNC_MIN_SCATTER_US;
+
+  base_local_us_ = newest.local_us;
+  base_offset_us_ = newest_offset;
+  phase_us_ = newest.delay_us / 2 + TIMESYNC_MIN_SCATTER_US;
+  if (skew_measured_)
+  {
+    // Two end points each off by the scatter, over the span; the crystal wanders on top of that
+    skew_unc_ppb_ = TIMESYNC_WANDER_PPB + saturate_u32((uint64_t)(2 * scatter / span_s * 1000));
+  }
+  else
+  {
+    skew_unc_ppb_ = TIMESYNC_CRYSTAL_PPM * 1000;
+  }
+}
+
+TimeSync::TimeSync(NtpTransport &transport)
+    : transport_(transport), waiting_(false), lost_(false), sent_us_(0), cookie_(0), next_poll_us_(0),
+      interval_s_(TIMESYNC_POLL_MIN_S), retry_s_(TIMESYNC_RETRY_S), slew_us_(0), slew_start_us_(0)
+{
+  memset(&stats_, 0, sizeof(stats_));
+}
+
+void TimeSync::poll(int64_t local_us)
+{
+  if (!waiting_)
+  {
+    if (local_us >= next_poll_us_)
+      send_request(local_us);
+    return;
+  }
+
+  uint8_t packet[NTP_PACKET_SIZE];
+  size_t n;
+  while (waiting_ && (n = transport_.receive(packet, sizeof(packet))) > 0)
+    take_reply(packet, n, local_us);
+
+  if (waiting_ && local_us - sent_us_ >= (int64_t)TIMESYNC_TIMEOUT_MS * 1000)
+  {
+    waiting_ = false;
+    lost_ = true;
+    stats_.timeouts++;
+    retry(local_us);
+  }
+}
+
+void TimeSync::send_request(int64_t local_us)
+{
+  uint8_t packet[NTP_PACKET_SIZE];
+  stats_.requests++;
+  cookie_ = (uint64_t)local_us ^ ((uint64_t)stats_.requests << 40); // Never repeats, never zero
+  sntp_request(packet, cookie_);
+  if (!transport_.send(packet, sizeof(packet)))
+  {
+    lost_ = true;
+    stats_.timeouts++;
+    retry(local_us);
+    return;
+  }
+  waiting_ = true;
+  sent_us_ = local_us;
+}
+
+void TimeSync::take_reply(const uint8_t *packet, size_t n, int64_t local_us)
+{
+  SntpSample sample;
+  SntpStatus status = n < NTP_PACKET_SIZE ? SNTP_BAD : sntp_reply(packet, cookie_, sent_us_, local_us, sample);
+  if (status == SNTP_UNMATCHED)
+  {
+    stats_.bad_replies++; // A late reply to an earlier request; keep waiting for ours
+    return;
+  }
+
+  waiting_ = false;
+  stats_.replies++;
+  if (lost_)
+  {
+    lost_ = false;
+    retry_s_ = TIMESYNC_RETRY_S; // Reachable again: the backoff was for the outage
+  }
+  if (status == SNTP_KISS_OF_DEATH)
+  {
+    stats_.kiss_of_death++;
+    interval_s_ = interval_s_ * 2 > TIMESYNC_POLL_MAX_S ? TIMESYNC_POLL_MAX_S : interval_s_ * 2;
+    next_poll_us_ = local_us + (int64_t)interval_s_ * US_PER_S;
+  }
+  else if (status == SNTP_BAD)
+  {
+    stats_.bad_replies++;
+    retry(local_us);
+  }
+  else
+  {
+    apply(sample, local_us);
+  }
+}
+
+/***************************************************************************************************
+ * TimeSync::apply()
+ * Fits a sample, stretches or shortens the poll interval, and slews the shown time onto the new
+ * line unless the correction is large (or this is the first sync), in which case it is stepped.
+ **************************************************************************************************/
+void TimeSync::apply(const SntpSample &sample, int64_t local_us)
+{
+  bool was_synced = synced();
+  int64_t shown = was_synced ? now_us(local_us) : 0;
+
+  switch (fit_.add(sample))
+  {
+  case SAMPLE_SLOW:
+    stats_.slow++;
+    retry(local_us);
+    return;
+  case SAMPLE_OUTLIER:
+    stats_.outliers++;
+    if (interval_s_ > TIMESYNC_POLL_MIN_S)
+      interval_s_ /= 2;
+    retry(local_us);
+    return;
+  case SAMPLE_RESET:
+    stats_.resets++;
+    interval_s_ = TIMESYNC_POLL_MIN_S;
+    break;
+  case SAMPLE_ACCEPTED:
+    stats_.accepted++;
+    if (fit_.skew_measured())
+    {
+      int64_t twice = sample.local_us + 2 * (int64_t)interval_s_ * US_PER_S;
+      int64_t once = sample.local_us + (int64_t)interval_s_ * US_PER_S;
+      if (fit_.error_us(twice) <= TIMESYNC_TARGET_US && interval_s_ < TIMESYNC_POLL_MAX_S)
+        interval_s_ *= 2;
+      else if (fit_.error_us(once) > TIMESYNC_TARGET_US && interval_s_ > TIMESYNC_POLL_MIN_S)
+        interval_s_ /= 2;
+    }
+    break;
+  }
+
+  int64_t correction = shown - fit_.utc_us(local_us);
+  if (!was_synced || correction > TIMESYNC_STEP_US || correction < -TIMESYNC_STEP_US)
+  {
+    stats_.steps++;
+    slew_us_ = 0;
+  }
+  else
+  {
+    slew_us_ = correction;
+    slew_start_us_ = local_us;
+  }
+
+  retry_s_ = TIMESYNC_RETRY_S;
+  next_poll_us_ = local_us + (int64_t)interval_s_ * US_PER_S;
+}
+
+// Lost, rejected or unusable reply: ask again soon, backing off up to the poll interval
+void TimeSync::retry(int64_t local_us)
+{
+  next_poll_us_ = local_us + (int64_t)retry_s_ * US_PER_S;
+  retry_s_ = retry_s_ * 2 > interval_s_ ? interval_s_ : retry_s_ * 2;
+}
+
+int64_t TimeSync::slew_left_us(int64_t local_us) const
+{
+  if (slew_us_ == 0)
+    return 0;
+  int64_t paid = (local_us - slew_start_us_) * TIMESYNC_SLEW_PPM / US_PER_S;
+  if (slew_us_ > 0)
+    return paid >= slew_us_ ? 0 : slew_us_ - paid;
+  return paid >= -slew_us_ ? 0 : slew_us_ + paid;
+}
+
+int64_t TimeSync::now_us(int64_t local_us) const
+{
+  if (!synced())
+    return 0;
+  return fit_.utc_us(local_us) + slew_left_us(local_us);
+}
+
+uint32_t TimeSync::error_us(int64_t local_us) const
+{
+  int64_t slew = slew_left_us(local_us);
+  return saturate_u32((uint64_t)fit_.error_us(local_us) + (uint64_t)(slew < 0 ? -slew : slew));
+}
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/***************************************************************************************************
+ * TimeSync
+ * UTC kept from a local monotonic microsecond clock (esp_timer on the box, driven by the crystal)
+ * and occasional SNTP samples, with the crystal's drift measured and compensated, so the clock
+ * stays right between polls and while offline.
+ *
+ * A sample pairs a local instant with the server's time at that instant (the midpoints of the
+ * request and the reply) and the round-trip delay. ClockFit fits server - local against local over
+ * the last TIMESYNC_SAMPLES samples with a Theil-Sen line: the drift is the median of the pairwise
+ * slopes, so a few bad replies cannot pull it, and the line runs through the newest sample. A reply
+ * much slower than recent ones is not fitted (its midpoint can be off by half the delay), and a
+ * sample far outside the current error bound is held as an outlier; TIMESYNC_RESET_OUTLIERS of
+ * them in a row that agree with each other mean the time really moved, and the fit restarts.
+ *
+ * A new fit that differs from the time already shown by less than TIMESYNC_STEP_US is slewed in at
+ * TIMESYNC_SLEW_PPM instead of stepped, so the shown time never jumps or runs backwards after the
+ * first sync.
+ *
+ * error_us() is an estimated bound on the error of the shown time: half the newest sample's delay
+ * (the most an asymmetric path can hide), the drift uncertainty (the residual spread about the line
+ * over the window's span, plus TIMESYNC_WANDER_PPB) times the time since that sample, and the slew
+ * still to apply. The poll interval doubles, from TIMESYNC_POLL_MIN_S up to TIMESYNC_POLL_MAX_S,
+ * while the bound expected at the next poll stays under TIMESYNC_TARGET_US, and halves when it
+ * would not or a reply disagrees with the fit.
+ *
+ * TimeSync runs the SNTP (RFC 4330) client exchange over an NtpTransport: UDP on the box, a
+ * simulated server on the host.
+ **************************************************************************************************/
+
+#define TIMESYNC_SAMPLES 12
+#define TIMESYNC_POLL_MIN_S 64
+#define TIMESYNC_POLL_MAX_S 65536      // About 18 hours
+#define TIMESYNC_RETRY_S 4             // After a lost or rejected reply; doubles up to the poll interval
+#define TIMESYNC_TIMEOUT_MS 2000
+#define TIMESYNC_TARGET_US 100000      // Error bound the poll interval is stretched against
+#define TIMESYNC_STEP_US 128000        // Larger corrections are stepped, smaller ones slewed
+#define TIMESYNC_SLEW_PPM 500
+#define TIMESYNC_MAX_SKEW_PPM 500      // Fitted drift is clamped to this
+#define TIMESYNC_CRYSTAL_PPM 50        // Drift uncertainty until the drift has been measured
+#define TIMESYNC_WANDER_PPB 1000       // Drift uncertainty added for the crystal's temperature swing
+#define TIMESYNC_MIN_SCATTER_US 1000   // Timestamping in the main loop
+#define TIMESYNC_MIN_SPAN_S 240        // Samples must span this long before the drift is fitted
+#define TIMESYNC_MIN_PAIR_S 32         // Sample pairs closer than this give no slope
+#define TIMESYNC_MAX_AGE_S (14 * 24 * 3600)
+#define TIMESYNC_RESET_OUTLIERS 3
+
+#define NTP_PORT 123
+#define NTP_PACKET_SIZE 48
+
+struct SntpSample
+{
+  int64_t local_us;  // Local clock midway between request and reply
+  int64_t server_us; // Server's UTC at that instant, microseconds since 1970
+  uint32_t delay_us; // Round trip minus the server's own processing time
+};
+
+enum SampleResult : uint8_t
+{
+  SAMPLE_ACCEPTED,
+  SAMPLE_SLOW,    // Delay well above recent ones; not fitted
+  SAMPLE_OUTLIER, // Outside the error bound; not fitted
+  SAMPLE_RESET    // The last TIMESYNC_RESET_OUTLIERS samples agreed on a new time; fit restarted
+};
+
+class ClockFit
+{
+public:
+  ClockFit();
+
+  SampleResult add(const SntpSample &sample);
+  bool valid() const { return count_ > 0; }
+
+  int64_t utc_us(int64_t local_us) const;
+  uint32_t error_us(int64_t local_us) const;
+  int32_t skew_ppb() const { return skew_ppb_; } // Local clock slow by this much when positive
+  bool skew_measured() const { return skew_measured_; }
+  uint8_t count() const { return count_; }
+
+private:
+  void refit();
+  bool fits(const SntpSample &sample, int64_t residual_us) const;
+  bool agrees(const SntpSample &a, const SntpSample &b) const;
+
+  SntpSample samples_[TIMESYNC_SAMPLES]; // Oldest first
+  uint8_t count_;
+  SntpSample outliers_[TIMESYNC_RESET_OUTLIERS]; // Outliers in a row that agree with each other
+  uint8_t outlier_run_;
+  uint32_t recent_delays_[TIMESYNC_SAMPLES]; // Every sample's delay, rejected ones included
+  uint8_t recent_count_;
+  uint8_t recent_next_;
+
+  int64_t base_local_us_; // Newest sample, where the line is anchored
+  int64_t base_offset_us_; // Fitted server - local at base_local_us_
+  int32_t skew_ppb_;
+  bool skew_measured_;
+  uint32_t phase_us_;    // Error at the anchor: half its delay plus timestamping
+  uint32_t skew_unc_ppb_;
+};
+
+class NtpTransport
+{
+public:
+  virtual ~NtpTransport() {}
+  virtual bool send(const uint8_t *packet, size_t n) = 0; // To the server
+  virtual size_t receive(uint8_t *packet, size_t size) = 0; // 0 when nothing has arrived
+};
+
+struct TimeSyncStats
+{
+  uint32_t requests;
+  uint32_t replies;      // Matched replies, good or not
+  uint32_t timeouts;     // No reply within TIMESYNC_TIMEOUT_MS, or the request could not be sent
+  uint32_t bad_replies;  // Unsynchronised server, bad mode or stratum, or unmatched
+  uint32_t kiss_of_death; // Server asked us to poll less
+  uint32_t accepted;
+  uint32_t slow;
+  uint32_t outliers;
+  uint32_t resets;
+  uint32_t steps; // The first sync included
+};
+
+class TimeSync
+{
+public:
+  explicit TimeSync(NtpTransport &transport);
+
+  void poll(int64_t local_us); // Often; sends a request when one is due and takes the reply
+
+  bool synced() const { return fit_.valid(); }
+  int64_t now_us(int64_t local_us) const;   // UTC microseconds since 1970, slewed
+  uint32_t error_us(int64_t local_us) const; // UINT32_MAX until synced
+  int32_t skew_ppb() const { return fit_.skew_ppb(); }
+  uint32_t poll_interval_s() const { return interval_s_; }
+
+  TimeSyncStats stats() const { return stats_; }
+
+private:
+  void send_request(int64_t local_us);
+  void take_reply(const uint8_t *packet, size_t n, int64_t local_us);
+  void apply(const SntpSample &sample, int64_t local_us);
+  void retry(int64_t local_us);
+  int64_t slew_left_us(int64_t local_us) const;
+
+  NtpTransport &transport_;
+  ClockFit fit_;
+
+  bool waiting_;
+  bool lost_; // The last request went unanswered
+  int64_t sent_us_;
+  uint64_t cookie_; // Our transmit timestamp, echoed by the server as the originate timestamp
+  int64_t next_poll_us_;
+  uint32_t interval_s_;
+  uint32_t retry_s_;
+
+  int64_t slew_us_;       // Shown minus fitted time at slew_start_us_, paid off at TIMESYNC_SLEW_PPM
+  int64_t slew_start_us_;
+
+  TimeSyncStats stats_;
+};
+
+enum SntpStatus : uint8_t
+{
+  SNTP_OK,
+  SNTP_UNMATCHED, // Originate timestamp is not our cookie: a stale or forged reply
+  SNTP_BAD,       // Wrong mode or version, unsynchronised server, missing timestamps
+  SNTP_KISS_OF_DEATH
+};
+
+uint64_t ntp_from_unix_us(int64_t unix_us);
+int64_t ntp_to_unix_us(uint64_t ntp); // Era by RFC 4330: seconds with the top bit clear are after 2036
+void sntp_request(uint8_t packet[NTP_PACKET_SIZE], uint64_t cookie);
+SntpStatus sntp_reply(const uint8_t packet[NTP_PACKET_SIZE], uint64_t cookie, int64_t sent_us, int64_t received_us,
+                      SntpSample &sample);
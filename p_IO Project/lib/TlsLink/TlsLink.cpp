@@ -0,0 +1,279 @@
+// mbedTLS 3 marks most struct fields private; the certificate's DER is read below
+#define MBEDTLS_ALLOW_PRIVATE_ACCESS
+
+#include "TlsLink.h"
+
+#include <mbedtls/sha256.h>
+#include <mbedtls/version.h>
+#include <string.h>
+
+/***************************************************************************************************
+ * certificate_sha256()
+ * SHA-256 of a certificate's DER encoding, on mbedTLS 2 (the IDF 4 Arduino core, older distros)
+ * and 3 (IDF 5, current distros), where the _ret variants are gone.
+ **************************************************************************************************/
+static int certificate_sha256(const mbedtls_x509_crt *crt, uint8_t digest[TLS_PIN_LEN])
+{
+  const mbedtls_x509_buf &der = crt->raw;
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+  return mbedtls_sha256(der.p, der.len, digest, 0);
+#else
+  return mbedtls_sha256_ret(der.p, der.len, digest, 0);
+#endif
+}
+
+TlsLink::TlsLink()
+    : pinned_(false), ready_(false), have_session_(false), connected_(false), saw_certificate_(false),
+      last_resumed_(false), clock_(NULL), yield_(NULL)
+{
+  memset(&stats_, 0, sizeof(stats_));
+  mbedtls_ssl_init(&ssl_);
+  mbedtls_ssl_config_init(&conf_);
+  mbedtls_ctr_drbg_init(&drbg_);
+  mbedtls_entropy_init(&entropy_);
+  mbedtls_x509_crt_init(&ca_);
+  mbedtls_ssl_session_init(&session_);
+}
+
+TlsLink::~TlsLink()
+{
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_x509_crt_free(&ca_);
+  mbedtls_ssl_free(&ssl_);
+  mbedtls_ssl_config_free(&conf_);
+  mbedtls_ctr_drbg_free(&drbg_);
+  mbedtls_entropy_free(&entropy_);
+}
+
+/***************************************************************************************************
+ * begin()
+ * One-time setup: RNG, CA, verification policy and the SSL context with its record buffers.
+ **************************************************************************************************/
+bool TlsLink::begin(const char *ca_pem, const uint8_t *pin, const char *server_name, TlsClockFn clock,
+                    TlsYieldFn yield)
+{
+  static const char PERSONALIZATION[] = "medibox-tls";
+  int ret;
+
+  clock_ = clock;
+  yield_ = yield;
+  pinned_ = pin != NULL;
+  if (pinned_)
+    memcpy(pin_, pin, TLS_PIN_LEN);
+
+  if ((ret = mbedtls_ctr_drbg_seed(&drbg_, mbedtls_entropy_func, &entropy_, (const unsigned char *)PERSONALIZATION,
+                                   sizeof(PERSONALIZATION) - 1)) != 0 ||
+      (ret = mbedtls_x509_crt_parse(&ca_, (const unsigned char *)ca_pem, strlen(ca_pem) + 1)) != 0 ||
+      (ret = mbedtls_ssl_config_defaults(&conf_, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                         MBEDTLS_SSL_PRESET_DEFAULT)) != 0)
+  {
+    stats_.last_error = ret;
+    return false;
+  }
+
+  mbedtls_ssl_conf_authmode(&conf_, MBEDTLS_SSL_VERIFY_REQUIRED);
+  mbedtls_ssl_conf_ca_chain(&conf_, &ca_, NULL);
+  mbedtls_ssl_conf_verify(&conf_, verify, this);
+  mbedtls_ssl_conf_rng(&conf_, mbedtls_ctr_drbg_random, &drbg_);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+  mbedtls_ssl_conf_session_tickets(&conf_, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+  // MQTT packets here are a few hundred bytes; ask the broker for small records
+  mbedtls_ssl_conf_max_frag_len(&conf_, MBEDTLS_SSL_MAX_FRAG_LEN_4096);
+#endif
+
+  if ((ret = mbedtls_ssl_setup(&ssl_, &conf_)) != 0 || (ret = mbedtls_ssl_set_hostname(&ssl_, server_name)) != 0)
+  {
+    stats_.last_error = ret;
+    return false;
+  }
+
+  ready_ = true;
+  return true;
+}
+
+/***************************************************************************************************
+ * verify()
+ * Runs for each certificate in the chain the broker sends, after mbedTLS has checked it against
+ * the CA. The leaf is additionally held to the pin.
+ **************************************************************************************************/
+int TlsLink::verify(void *self, mbedtls_x509_crt *crt, int depth, uint32_t *flags)
+{
+  TlsLink *link = (TlsLink *)self;
+  link->saw_certificate_ = true;
+
+  if (depth == 0 && link->pinned_)
+  {
+    uint8_t digest[TLS_PIN_LEN];
+    if (certificate_sha256(crt, digest) != 0 || memcmp(digest, link->pin_, TLS_PIN_LEN) != 0)
+    {
+      link->stats_.pin_failures++;
+      *flags |= MBEDTLS_X509_BADCERT_NOT_TRUSTED;
+    }
+  }
+  return 0;
+}
+
+/***************************************************************************************************
+ * handshake()
+ * Starts a connection on an open transport, offering the saved session. A resumed handshake is
+ * recognised by the broker not sending its certificate.
+ **************************************************************************************************/
+bool TlsLink::handshake(void *io, TlsSendFn send, TlsRecvFn recv, uint32_t timeout_ms)
+{
+  if (!ready_)
+    return false;
+
+  mbedtls_ssl_session_reset(&ssl_); // Keeps the record buffers allocated by begin()
+  mbedtls_ssl_set_bio(&ssl_, io, send, recv, NULL);
+  if (have_session_)
+    mbedtls_ssl_set_session(&ssl_, &session_);
+
+  saw_certificate_ = false;
+  uint32_t start = clock_();
+  int ret;
+  while ((ret = mbedtls_ssl_handshake(&ssl_)) != 0)
+  {
+    if ((ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) ||
+        clock_() - start > timeout_ms * 1000)
+    {
+      stats_.failed_handshakes++;
+      stats_.last_error = ret;
+      // A rejected ticket or a pin failure must not be offered again
+      forget_session();
+      return false;
+    }
+    if (yield_)
+      yield_();
+  }
+  uint32_t elapsed = clock_() - start;
+
+  last_resumed_ = have_session_ && !saw_certificate_;
+  if (last_resumed_)
+  {
+    stats_.resumed_handshakes++;
+    stats_.last_resumed_us = elapsed;
+  }
+  else
+  {
+    stats_.full_handshakes++;
+    stats_.last_full_us = elapsed;
+  }
+
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_ssl_session_init(&session_);
+  have_session_ = mbedtls_ssl_get_session(&ssl_, &session_) == 0;
+  connected_ = true;
+  return true;
+}
+
+int TlsLink::read(unsigned char *data, size_t len)
+{
+  if (!connected_)
+    return -1;
+  int ret = mbedtls_ssl_read(&ssl_, data, len);
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+    return 0;
+  if (ret <= 0)
+    connected_ = false; // Closed by the peer or failed
+  return ret;
+}
+
+/***************************************************************************************************
+ * write()
+ * Writes all of data. A transport that stays full for TLS_WRITE_TIMEOUT_MS counts as dead.
+ **************************************************************************************************/
+int TlsLink::write(const unsigned char *data, size_t len)
+{
+  if (!connected_)
+    return -1;
+  uint32_t start = clock_();
+  size_t done = 0;
+  while (done < len)
+  {
+    int ret = mbedtls_ssl_write(&ssl_, data + done, len - done);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+    {
+      if (clock_() - start > TLS_WRITE_TIMEOUT_MS * 1000)
+      {
+        connected_ = false;
+        return MBEDTLS_ERR_SSL_TIMEOUT;
+      }
+      if (yield_)
+        yield_();
+      continue;
+    }
+    if (ret < 0)
+    {
+      connected_ = false;
+      return ret;
+    }
+    done += ret;
+  }
+  return (int)done;
+}
+
+size_t TlsLink::available()
+{
+  if (!connected_)
+    return 0;
+  // Let mbedTLS pull a record in if the transport has one
+  int ret = mbedtls_ssl_read(&ssl_, NULL, 0);
+  if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE)
+    connected_ = false;
+  return mbedtls_ssl_get_bytes_avail(&ssl_);
+}
+
+/***************************************************************************************************
+ * close()
+ * Sends close_notify. The session stays saved for the next handshake.
+ **************************************************************************************************/
+void TlsLink::close()
+{
+  if (connected_)
+    mbedtls_ssl_close_notify(&ssl_);
+  connected_ = false;
+}
+
+void TlsLink::forget_session()
+{
+  mbedtls_ssl_session_free(&session_);
+  mbedtls_ssl_session_init(&session_);
+  have_session_ = false;
+}
+
+/***************************************************************************************************
+ * tls_parse_pin()
+ * Hex SHA-256 as printed by `openssl x509 -fingerprint -sha256` (colons optional) to bytes.
+ **************************************************************************************************/
+bool tls_parse_pin(const char *hex, uint8_t *pin)
+{
+  int n = 0;
+  int nibble = -1;
+  for (const char *p = hex; *p; p++)
+  {
+    int v;
+    if (*p >= '0' && *p <= '9')
+      v = *p - '0';
+    else if (*p >= 'a' && *p <= 'f')
+      v = *p - 'a' + 10;
+    else if (*p >= 'A' && *p <= 'F')
+      v = *p - 'A' + 10;
+    else if (*p == ':' || *p == ' ')
+      continue;
+    else
+      return false;
+
+    if (nibble < 0)
+    {
+      nibble = v;
+      continue;
+    }
+    if (n >= TLS_PIN_LEN)
+      return false;
+    pin[n++] = (uint8_t)(nibble << 4 | v);
+    nibble = -1;
+  }
+  return n == TLS_PIN_LEN && nibble < 0;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+/***************************************************************************************************
+ * TlsLink
+ * A TLS client session over any byte transport, built straight on mbedTLS so the parts that
+ * WiFiClientSecure hides are under our control:
+ *
+ *  - Pinning: the broker certificate must chain to the configured CA and, when a pin is set, the
+ *    leaf certificate's SHA-256 must match it.
+ *  - Resumption: the session (ID and ticket) from the last handshake is offered on the next one,
+ *    so a reconnect skips the certificate exchange and the public-key operations.
+ *  - One allocation: the SSL context and its record buffers are set up once in begin() and only
+ *    reset between connections, so reconnecting does not churn the heap.
+ *
+ * The transport is a pair of callbacks (WiFiClient on the ESP32, a socket on the host). A
+ * non-blocking transport answers WANT_READ/WANT_WRITE; handshake() and write() then call the yield
+ * callback between retries, so the calling task sleeps instead of spinning, and give up after
+ * their timeout.
+ **************************************************************************************************/
+
+#define TLS_PIN_LEN 32 // SHA-256
+#define TLS_WRITE_TIMEOUT_MS 5000
+
+typedef int (*TlsSendFn)(void *io, const unsigned char *data, size_t len);
+typedef int (*TlsRecvFn)(void *io, unsigned char *data, size_t len); // MBEDTLS_ERR_SSL_WANT_READ when idle
+typedef uint32_t (*TlsClockFn)();                                     // Microseconds
+typedef void (*TlsYieldFn)();                                         // Sleep briefly between retries
+
+struct TlsStats
+{
+  uint32_t full_handshakes;
+  uint32_t resumed_handshakes;
+  uint32_t failed_handshakes;
+  uint32_t pin_failures;
+  uint32_t last_full_us;
+  uint32_t last_resumed_us;
+  int last_error; // mbedTLS error code of the last failure
+};
+
+class TlsLink
+{
+public:
+  TlsLink();
+  ~TlsLink();
+
+  // ca_pem: NUL-terminated PEM. pin: SHA-256 of the broker's DER certificate, or NULL.
+  // yield: NULL for a blocking transport.
+  bool begin(const char *ca_pem, const uint8_t *pin, const char *server_name, TlsClockFn clock,
+             TlsYieldFn yield);
+
+  bool handshake(void *io, TlsSendFn send, TlsRecvFn recv, uint32_t timeout_ms);
+  int read(unsigned char *data, size_t len);
+  int write(const unsigned char *data, size_t len);
+  size_t available();
+  void close();
+  void forget_session();
+
+  bool last_resumed() const { return last_resumed_; }
+  const TlsStats &stats() const { return stats_; }
+
+private:
+  static int verify(void *self, mbedtls_x509_crt *crt, int depth, uint32_t *flags);
+
+  mbedtls_ssl_context ssl_;
+  mbedtls_ssl_config conf_;
+  mbedtls_ctr_drbg_context drbg_;
+  mbedtls_entropy_context entropy_;
+  mbedtls_x509_crt ca_;
+  mbedtls_ssl_session session_;
+
+  uint8_t pin_[TLS_PIN_LEN];
+  bool pinned_;
+  bool ready_;
+  bool have_session_;
+  bool connected_;
+  bool saw_certificate_; // Set by verify(): only a full handshake sends the certificate
+  bool last_resumed_;
+  TlsClockFn clock_;
+  TlsYieldFn yield_;
+  TlsStats stats_;
+};
+
+bool tls_parse_pin(const char *hex, uint8_t *pin);
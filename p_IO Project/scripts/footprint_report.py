@@ -0,0 +1,46 @@
+# PlatformIO post-build script: flash/RAM footprint of the firmware for the current board profile.
+# Prints a summary after every build and keeps one line per env in footprint.txt next to
+# platformio.ini, so profiles can be compared side by side (`pio run` builds every env).
+
+Import("env")
+
+import os
+import subprocess
+
+# ESP32 sections grouped by the memory they occupy
+FLASH_SECTIONS = (".flash.text", ".flash.rodata", ".flash.appdesc", ".iram0.text", ".iram0.vectors", ".dram0.data")
+RAM_SECTIONS = (".dram0.data", ".dram0.bss", ".noinit")
+
+
+def section_sizes(elf):
+    out = subprocess.check_output([env.subst("$SIZETOOL"), "-A", elf], text=True)
+    sizes = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0].startswith(".") and fields[1].isdigit():
+            sizes[fields[0]] = int(fields[1])
+    return sizes
+
+
+def footprint_report(source, target, env):
+    sizes = section_sizes(str(source[0]))
+    flash = sum(sizes.get(s, 0) for s in FLASH_SECTIONS)
+    ram = sum(sizes.get(s, 0) for s in RAM_SECTIONS)
+    iram = sizes.get(".iram0.text", 0) + sizes.get(".iram0.vectors", 0)
+    name = env["PIOENV"]
+    flags = " ".join(f for f in env.get("CPPDEFINES", []) if isinstance(f, str) and f.startswith("MEDIBOX_BOARD_"))
+
+    line = "%-16s flash %8d  ram %7d  iram %7d  %s" % (name, flash, ram, iram, flags or "MEDIBOX_BOARD_REV_A")
+    print("Footprint: " + line)
+
+    report = os.path.join(env.subst("$PROJECT_DIR"), "footprint.txt")
+    lines = []
+    if os.path.exists(report):
+        with open(report) as f:
+            lines = [l for l in f.read().splitlines() if l and not l.startswith(name + " ")]
+    lines.append(line)
+    with open(report, "w") as f:
+        f.write("\n".join(sorted(lines)) + "\n")
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", footprint_report)
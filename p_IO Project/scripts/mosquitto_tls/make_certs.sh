@@ -0,0 +1,74 @@
+#!/bin/sh
+# Self-signed CA + broker certificate for testing the TLS transport against a local mosquitto.
+#
+#   scripts/mosquitto_tls/make_certs.sh <broker-ip> [out-dir]
+#   mosquitto -c <out-dir>/mosquitto.conf
+#
+# Writes ca.crt/ca.key, server.crt/server.key and mosquitto.conf to out-dir (default: certs/ next
+# to this script) and regenerates include/MqttTlsCredentials.h with the CA, the broker address and
+# the certificate pin. Then build with `pio run -e esp32dev_tls`.
+set -eu
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 <broker-ip> [out-dir]" >&2
+  exit 1
+fi
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+BROKER_IP=$1
+OUT=${2:-$HERE/certs}
+NAME=medibox-broker
+HEADER=$HERE/../../include/MqttTlsCredentials.h
+
+mkdir -p "$OUT"
+cd "$OUT"
+
+# EC P-256 keeps the ESP32 handshake cheap compared to RSA-2048
+openssl ecparam -name prime256v1 -genkey -noout -out ca.key
+openssl req -x509 -new -key ca.key -sha256 -days 3650 -subj "/CN=Medibox Test CA" -out ca.crt
+
+openssl ecparam -name prime256v1 -genkey -noout -out server.key
+openssl req -new -key server.key -subj "/CN=$NAME" -out server.csr
+printf "subjectAltName=DNS:%s,IP:%s\nextendedKeyUsage=serverAuth\n" "$NAME" "$BROKER_IP" > server.ext
+openssl x509 -req -in server.csr -CA ca.crt -CAkey ca.key -CAcreateserial -sha256 -days 825 \
+  -extfile server.ext -out server.crt
+rm -f server.csr server.ext ca.srl
+
+# mbedTLS on the ESP32 speaks TLS 1.2; OpenSSL issues session tickets and caches session IDs by
+# default, so both resumption paths are available.
+cat > mosquitto.conf <<CONF
+listener 8883
+cafile $OUT/ca.crt
+certfile $OUT/server.crt
+keyfile $OUT/server.key
+tls_version tlsv1.2
+allow_anonymous true
+CONF
+
+PIN=$(openssl x509 -in server.crt -noout -fingerprint -sha256 | cut -d= -f2 | tr -d :)
+CA_PEM=$(sed 's/$/\\n" \\/; s/^/    "/' ca.crt)
+
+cat > "$HEADER" <<H
+#pragma once
+
+/***************************************************************************************************
+ * MqttTlsCredentials
+ * Broker identity for the TLS transport (-DMEDIBOX_MQTT_TLS). Regenerate with
+ * scripts/mosquitto_tls/make_certs.sh <broker-ip>, which also writes a matching mosquitto.conf.
+ **************************************************************************************************/
+
+#define MQTT_TLS_HOST "$BROKER_IP"
+#define MQTT_TLS_PORT 8883
+#define MQTT_TLS_SERVER_NAME "$NAME" // Must match the broker certificate's CN/SAN
+
+// CA that signed the broker certificate (PEM)
+#define MQTT_TLS_CA_PEM \\
+$CA_PEM
+    ""
+
+// SHA-256 of the broker certificate (DER), hex; empty to rely on the CA alone
+#define MQTT_TLS_PIN_SHA256 "$PIN"
+H
+
+echo "Certificates in $OUT, credentials in $HEADER"
+echo "Start the broker with: mosquitto -c $OUT/mosquitto.conf"
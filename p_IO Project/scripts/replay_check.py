@@ -0,0 +1,24 @@
+# PlatformIO post-build script for the replay env: runs the committed synthetic trace through the
+# freshly built replay engine and fails the build when its outputs differ from the golden file.
+# After an intended change to the firmware logic, refresh the golden with
+#   .pio/build/replay/program run src/host/replay/synth_6h.trc --golden src/host/replay/synth_6h.golden --update
+
+Import("env")
+
+import os
+import subprocess
+
+TRACE = os.path.join("src", "host", "replay", "synth_6h.trc")
+GOLDEN = os.path.join("src", "host", "replay", "synth_6h.golden")
+
+
+def replay_check(source, target, env):
+    project = env.subst("$PROJECT_DIR")
+    program = str(target[0])
+    result = subprocess.run([program, "run", TRACE, "--golden", GOLDEN], cwd=project)
+    if result.returncode != 0:
+        print("Replay: outputs differ from %s" % GOLDEN)
+    return result.returncode
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}${PROGSUFFIX}", replay_check)
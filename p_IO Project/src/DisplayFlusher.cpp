@@ -0,0 +1,130 @@
+#include <Arduino.h>
+#include <DisplayFlusher.h>
+#include <Wire.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#define FRAME_BYTES (128 * 64 / 8)
+#define I2C_CHUNK 64 // Data bytes per transaction, well inside the Wire buffer
+
+static Adafruit_SSD1306 *panel;
+static uint8_t panel_address;
+static TaskHandle_t flush_task;
+static portMUX_TYPE frame_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// pending is filled by display_flush(); sending is owned by the flush task. They swap under
+// frame_lock, so neither side ever copies while the other reads.
+static uint8_t frame_a[FRAME_BYTES];
+static uint8_t frame_b[FRAME_BYTES];
+static uint8_t *pending = frame_a;
+static uint8_t *sending = frame_b;
+static bool pending_full = false;
+
+static DisplayFlushStats stats; // Both sides update it, so under frame_lock too
+
+static void send_commands(const uint8_t *cmds, size_t n)
+{
+  Wire.beginTransmission(panel_address);
+  Wire.write((uint8_t)0x00); // Co = 0, D/C = 0: command stream
+  Wire.write(cmds, n);
+  Wire.endTransmission();
+}
+
+/***************************************************************************************************
+ * send_frame()
+ * Full-screen write in horizontal addressing mode, same sequence as Adafruit_SSD1306::display().
+ **************************************************************************************************/
+static void send_frame(const uint8_t *frame)
+{
+  static const uint8_t window[] = {SSD1306_PAGEADDR, 0, 0xFF, SSD1306_COLUMNADDR, 0, 127};
+  send_commands(window, sizeof(window));
+
+  for (size_t offset = 0; offset < FRAME_BYTES; offset += I2C_CHUNK)
+  {
+    Wire.beginTransmission(panel_address);
+    Wire.write((uint8_t)0x40); // Co = 0, D/C = 1: data stream
+    Wire.write(frame + offset, I2C_CHUNK);
+    Wire.endTransmission();
+  }
+}
+
+/***************************************************************************************************
+ * display_flush_task()
+ * Sleeps until a frame is pending, takes the newest one and streams it to the panel.
+ **************************************************************************************************/
+static void display_flush_task(void *)
+{
+  while (true)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    portENTER_CRITICAL(&frame_lock);
+    bool have_frame = pending_full;
+    if (have_frame)
+    {
+      uint8_t *tmp = sending;
+      sending = pending;
+      pending = tmp;
+      pending_full = false;
+    }
+    portEXIT_CRITICAL(&frame_lock);
+
+    if (!have_frame)
+    {
+      continue;
+    }
+
+    uint32_t start = micros();
+    send_frame(sending);
+    uint32_t elapsed = micros() - start;
+
+    portENTER_CRITICAL(&frame_lock);
+    stats.flushed++;
+    stats.last_flush_us = elapsed;
+    if (elapsed > stats.max_flush_us)
+    {
+      stats.max_flush_us = elapsed;
+    }
+    portEXIT_CRITICAL(&frame_lock);
+  }
+}
+
+/***************************************************************************************************
+ * display_flusher_begin()
+ * Call after display.begin(). From here on only the flush task talks to the panel over Wire.
+ **************************************************************************************************/
+void display_flusher_begin(Adafruit_SSD1306 &display, uint8_t i2c_address)
+{
+  panel = &display;
+  panel_address = i2c_address;
+  Wire.setClock(DISPLAY_I2C_HZ);
+  xTaskCreatePinnedToCore(display_flush_task, "oled_flush", 2048, nullptr, 1, &flush_task, 0);
+}
+
+/***************************************************************************************************
+ * display_flush()
+ * Drop-in replacement for display.display(): copies the framebuffer (1 KB, a few microseconds)
+ * and wakes the flush task. Never waits for the bus.
+ **************************************************************************************************/
+void display_flush()
+{
+  portENTER_CRITICAL(&frame_lock);
+  if (pending_full)
+  {
+    stats.coalesced++;
+  }
+  memcpy(pending, panel->getBuffer(), FRAME_BYTES);
+  pending_full = true;
+  stats.submitted++;
+  portEXIT_CRITICAL(&frame_lock);
+
+  xTaskNotifyGive(flush_task);
+}
+
+DisplayFlushStats display_flush_stats()
+{
+  portENTER_CRITICAL(&frame_lock);
+  DisplayFlushStats copy = stats;
+  portEXIT_CRITICAL(&frame_lock);
+  return copy;
+}
@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include <IndicatorEsp32.h>
+#include <driver/ledc.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// High LEDC channels (low-speed group) so they stay clear of ESP32Servo's allocations
+#define LEDC_CH_LED_1 12
+#define LEDC_CH_LED_2 13
+#define LEDC_CH_BUZZER 14
+#define LEDC_LED_FREQ 5000
+#define LEDC_LED_BITS 8
+
+static const uint8_t LEDC_CHANNELS[INDICATOR_CHANNELS] = {LEDC_CH_LED_1, LEDC_CH_LED_2, LEDC_CH_BUZZER};
+
+/***************************************************************************************************
+ * LedcIndicatorDriver
+ * Every call runs with indicator_lock held, either from the main loop or the esp_timer task.
+ **************************************************************************************************/
+class LedcIndicatorDriver : public IndicatorDriver
+{
+public:
+  void set_level(uint8_t channel, uint8_t duty) override
+  {
+    ledcWrite(LEDC_CHANNELS[channel], duty);
+  }
+
+  void fade_to(uint8_t channel, uint8_t duty, uint16_t duration_ms) override
+  {
+    // Arduino channels 8-15 are the low-speed group, channel number modulo 8
+    ledc_channel_t ch = (ledc_channel_t)(LEDC_CHANNELS[channel] % 8);
+    ledc_set_fade_with_time(LEDC_LOW_SPEED_MODE, ch, duty, duration_ms);
+    ledc_fade_start(LEDC_LOW_SPEED_MODE, ch, LEDC_FADE_NO_WAIT);
+  }
+
+  void set_tone(uint8_t channel, uint16_t frequency) override
+  {
+    ledcWriteTone(LEDC_CHANNELS[channel], frequency);
+  }
+
+  void schedule(uint8_t channel, uint32_t delay_ms, uint32_t token) override
+  {
+    armed_tokens[channel] = token;
+    esp_timer_stop(timers[channel]);
+    esp_timer_start_once(timers[channel], (uint64_t)delay_ms * 1000ULL);
+  }
+
+  void cancel(uint8_t channel) override
+  {
+    esp_timer_stop(timers[channel]);
+  }
+
+  esp_timer_handle_t timers[INDICATOR_CHANNELS];
+  volatile uint32_t armed_tokens[INDICATOR_CHANNELS]; // Token of the channel's latest schedule()
+};
+
+static LedcIndicatorDriver driver;
+static IndicatorSequencer sequencer(driver);
+static SemaphoreHandle_t indicator_lock;
+
+/***************************************************************************************************
+ * on_indicator_timer()
+ * esp_timer callback at the end of a step; advances that channel's pattern by one step. The token
+ * of the arming that fired is taken before waiting for the lock, so a callback held up while
+ * indicator_play() or indicator_stop() ran carries the old token and the sequencer drops it, even
+ * when the new pattern arms no timer. If the channel was re-armed before the token was read, the
+ * timer is active again (a one-shot timer is inactive once fired) and the callback is dropped here.
+ **************************************************************************************************/
+static void on_indicator_timer(void *arg)
+{
+  uint8_t channel = (uint8_t)(uintptr_t)arg;
+  uint32_t token = driver.armed_tokens[channel];
+  xSemaphoreTake(indicator_lock, portMAX_DELAY);
+  if (esp_timer_is_active(driver.timers[channel]))
+  {
+    xSemaphoreGive(indicator_lock);
+    return;
+  }
+  sequencer.on_timer(channel, token);
+  xSemaphoreGive(indicator_lock);
+}
+
+/***************************************************************************************************
+ * indicator_begin()
+ * Attaches the pins to their LEDC channels and creates the step timers.
+ **************************************************************************************************/
+void indicator_begin(int led_1_pin, int led_2_pin, int buzzer_pin)
+{
+  indicator_lock = xSemaphoreCreateMutex();
+
+  ledcSetup(LEDC_CH_LED_1, LEDC_LED_FREQ, LEDC_LED_BITS);
+  ledcSetup(LEDC_CH_LED_2, LEDC_LED_FREQ, LEDC_LED_BITS);
+  ledcAttachPin(led_1_pin, LEDC_CH_LED_1);
+  ledcAttachPin(led_2_pin, LEDC_CH_LED_2);
+  ledcAttachPin(buzzer_pin, LEDC_CH_BUZZER);
+  ledcWriteTone(LEDC_CH_BUZZER, 0);
+  ledc_fade_func_install(0);
+
+  static const char *names[INDICATOR_CHANNELS] = {"ind_led1", "ind_led2", "ind_buzzer"};
+  for (uint8_t c = 0; c < INDICATOR_CHANNELS; c++)
+  {
+    esp_timer_create_args_t args = {};
+    args.callback = on_indicator_timer;
+    args.arg = (void *)(uintptr_t)c;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = names[c];
+    esp_timer_create(&args, &driver.timers[c]);
+    driver.armed_tokens[c] = 0;
+  }
+}
+
+void indicator_play(uint8_t channel, const IndicatorPattern *pattern, uint8_t priority)
+{
+  xSemaphoreTake(indicator_lock, portMAX_DELAY);
+  sequencer.play(channel, pattern, priority);
+  xSemaphoreGive(indicator_lock);
+}
+
+void indicator_stop(uint8_t channel, uint8_t priority)
+{
+  xSemaphoreTake(indicator_lock, portMAX_DELAY);
+  sequencer.stop(channel, priority);
+  xSemaphoreGive(indicator_lock);
+}
@@ -0,0 +1,160 @@
+#include <Arduino.h>
+#include <BinLog.h>
+#include <JournalStore.h>
+#include <LittleFS.h>
+#include <time.h>
+
+#define JOURNAL_STREAM_READ 6 // Records read per batch; the JSON holds as many as fit
+
+/***************************************************************************************************
+ * LittleFsJournal
+ * JournalFs on LittleFS. Every append opens, writes and closes the file, so each batch is committed
+ * by LittleFS as a whole. rename() removes the target first; the journal finishes such a rename at
+ * the next boot if power is lost in between.
+ **************************************************************************************************/
+class LittleFsJournal : public JournalFs
+{
+public:
+  int32_t size(const char *name) override
+  {
+    if (!LittleFS.exists(name))
+      return -1;
+    File f = LittleFS.open(name, FILE_READ);
+    if (!f)
+      return -1;
+    int32_t n = (int32_t)f.size();
+    f.close();
+    return n;
+  }
+
+  bool read(const char *name, uint32_t offset, uint8_t *data, size_t n) override
+  {
+    File f = LittleFS.open(name, FILE_READ);
+    if (!f)
+      return false;
+    bool ok = f.seek(offset) && f.read(data, n) == n;
+    f.close();
+    return ok;
+  }
+
+  bool append(const char *name, const uint8_t *data, size_t n) override
+  {
+    File f = LittleFS.open(name, FILE_APPEND);
+    if (!f)
+      return false;
+    bool ok = f.write(data, n) == n;
+    f.close();
+    return ok;
+  }
+
+  bool rename(const char *from, const char *to) override
+  {
+    if (LittleFS.exists(to))
+      LittleFS.remove(to);
+    return LittleFS.rename(from, to);
+  }
+
+  bool remove(const char *name) override
+  {
+    return LittleFS.remove(name);
+  }
+};
+
+static LittleFsJournal fs;
+static AdherenceJournal journal(fs);
+static JournalStoreStats stats;
+static bool streaming = false;
+static uint32_t stream_cursor = 0;
+
+void journal_store_begin()
+{
+  stats.mounted = LittleFS.begin(true); // Formats the partition the first time
+  if (!stats.mounted)
+  {
+    LOG_ERROR("Journal: LittleFS mount failed, events stay in RAM");
+    return;
+  }
+  if (!journal.begin())
+  {
+    LOG_ERROR("Journal: cannot read %s", JOURNAL_FILE);
+    return;
+  }
+  JournalStats js = journal.stats();
+  if (js.recovered_bytes)
+  {
+    LOG_WARN("Journal: cut %u bytes of torn tail", js.recovered_bytes);
+  }
+  LOG_INFO("Journal: records %u to %u", journal.first_seq(), journal.end_seq() - 1);
+}
+
+void journal_store_record(JournalKind kind, uint8_t alarm, uint32_t latency_ms)
+{
+  journal.record(millis(), (uint32_t)time(nullptr), kind, alarm, latency_ms);
+}
+
+/***************************************************************************************************
+ * journal_store_request()
+ * MQTT callback. Commits what is buffered, so the stream includes the latest alarm, and starts
+ * streaming from the cursor.
+ **************************************************************************************************/
+void journal_store_request(const uint8_t *payload, size_t length)
+{
+  char text[12];
+  size_t n = length < sizeof(text) - 1 ? length : sizeof(text) - 1;
+  memcpy(text, payload, n);
+  text[n] = '\0';
+  stream_cursor = (uint32_t)strtoul(text, NULL, 10);
+  if (stats.mounted)
+  {
+    journal.commit();
+  }
+  streaming = true;
+}
+
+/***************************************************************************************************
+ * journal_store_poll()
+ * Main loop. Commits a due batch, then sends at most one stream message.
+ **************************************************************************************************/
+void journal_store_poll(PubSubClient &client, const char *topic)
+{
+  if (stats.mounted)
+  {
+    uint32_t start = micros();
+    if (journal.poll(millis()))
+    {
+      uint32_t took = micros() - start;
+      stats.max_commit_us = took > stats.max_commit_us ? took : stats.max_commit_us;
+    }
+  }
+
+  if (!streaming || !client.connected())
+  {
+    return;
+  }
+
+  JournalRecord records[JOURNAL_STREAM_READ];
+  uint32_t next;
+  size_t n = journal.read(stream_cursor, records, JOURNAL_STREAM_READ, next);
+  bool end = next == journal.end_seq();
+  char json[JOURNAL_MQTT_BATCH];
+  size_t included;
+  size_t length = format_journal_batch(json, sizeof(json), records, n, next, end, included);
+  if (length && client.publish(topic, json))
+  {
+    stream_cursor = next - (uint32_t)(n - included);
+    stats.streamed += included;
+    streaming = !(end && included == n);
+  }
+}
+
+JournalStats journal_store_journal_stats()
+{
+  return journal.stats();
+}
+
+JournalStoreStats journal_store_stats()
+{
+  stats.first_seq = journal.first_seq();
+  stats.end_seq = journal.end_seq();
+  return stats;
+}
@@ -0,0 +1,147 @@
+#include <Arduino.h>
+#include <LdrAcquisition.h>
+#include <LdrFilter.h>
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// LDR_PIN (GPIO36) is ADC1 channel 0
+#define LDR_ADC_CHANNEL ADC1_CHANNEL_0
+#define LDR_ADC_ATTEN ADC_ATTEN_DB_11
+#define LDR_SAMPLE_FREQ_HZ 20000 // Lowest rate the ESP32 digital controller supports
+#define LDR_BURST_SAMPLES 256
+#define LDR_LOG2_DECIM 6         // 64 conversions per decimated point
+#define LDR_EMA_SHIFT 3          // Each decimated point moves the average by 1/8
+#define LDR_FULL_SCALE_MV 3100   // Usable top of the 11 dB range
+#define LDR_DEFAULT_VREF 1100    // Used when the eFuse holds no calibration
+
+static esp_adc_cal_characteristics_t adc_chars;
+static LdrFilterState filter_state;
+static uint8_t dma_buffer[LDR_BURST_SAMPLES * SOC_ADC_DIGI_RESULT_BYTES];
+static uint16_t burst[LDR_BURST_SAMPLES];
+static uint16_t scratch[LDR_BURST_SAMPLES];
+static const ConfigStore *config_store = nullptr;
+
+// Written by the acquisition task, read by the loop; aligned 32-bit stores are atomic on the ESP32
+static volatile uint32_t latest_mv = 0;
+static volatile float latest_normalized = 0;
+static volatile uint32_t bursts = 0;
+
+/***************************************************************************************************
+ * ldr_acquisition_task()
+ * Blocks on the DMA pool, filters every burst and accumulates the calibrated results. Once per
+ * sampling period it publishes their mean. The period is re-read from the config store whenever
+ * a new config version is applied, which also starts a new period.
+ **************************************************************************************************/
+static void ldr_acquisition_task(void *)
+{
+  uint32_t version = config_store->version();
+  ConfigSnapshot snapshot;
+  config_store->read(snapshot);
+  uint32_t period_start = millis() - snapshot.sample_ms; // The first burst is published on its own
+  uint32_t period_mv = 0;
+  uint32_t period_bursts = 0;
+
+  while (true)
+  {
+    uint32_t bytes = 0;
+    if (adc_digi_read_bytes(dma_buffer, sizeof(dma_buffer), &bytes, portMAX_DELAY) != ESP_OK)
+    {
+      continue;
+    }
+
+    size_t n = 0;
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= bytes; i += SOC_ADC_DIGI_RESULT_BYTES)
+    {
+      adc_digi_output_data_t *out = (adc_digi_output_data_t *)&dma_buffer[i];
+      if (out->type1.channel == LDR_ADC_CHANNEL)
+      {
+        burst[n++] = out->type1.data;
+      }
+    }
+    if (n == 0)
+    {
+      continue;
+    }
+
+    uint16_t filtered_q4 = ldr_filter_burst(filter_state, burst, n, scratch);
+    uint32_t raw = (filtered_q4 + (1u << (LDR_FILTER_Q - 1))) >> LDR_FILTER_Q;
+    uint32_t mv = esp_adc_cal_raw_to_voltage(raw, &adc_chars);
+    period_mv += mv;
+    period_bursts++;
+    bursts = bursts + 1;
+
+    uint32_t now = millis();
+    if (config_store->version() != version)
+    {
+      version = config_store->version();
+      config_store->read(snapshot);
+      period_start = now - snapshot.sample_ms; // Publish now, then run on the new period
+    }
+    if (now - period_start < snapshot.sample_ms)
+    {
+      continue;
+    }
+
+    mv = (period_mv + period_bursts / 2) / period_bursts;
+    latest_mv = mv;
+    latest_normalized = mv >= LDR_FULL_SCALE_MV ? 1.0f : (float)mv / LDR_FULL_SCALE_MV;
+    period_start = now;
+    period_mv = 0;
+    period_bursts = 0;
+  }
+}
+
+/***************************************************************************************************
+ * ldr_acquisition_begin()
+ * Characterises ADC1 from eFuse, configures continuous conversion of the LDR channel and starts
+ * the acquisition task, which reads the sampling period from store.
+ **************************************************************************************************/
+void ldr_acquisition_begin(const ConfigStore &store)
+{
+  config_store = &store;
+  esp_adc_cal_characterize(ADC_UNIT_1, LDR_ADC_ATTEN, ADC_WIDTH_BIT_12, LDR_DEFAULT_VREF, &adc_chars);
+  ldr_filter_init(filter_state, LDR_LOG2_DECIM, LDR_EMA_SHIFT);
+
+  adc_digi_init_config_t dma_config = {};
+  dma_config.max_store_buf_size = sizeof(dma_buffer) * 4;
+  dma_config.conv_num_each_intr = LDR_BURST_SAMPLES;
+  dma_config.adc1_chan_mask = BIT(LDR_ADC_CHANNEL);
+  dma_config.adc2_chan_mask = 0;
+  adc_digi_initialize(&dma_config);
+
+  static adc_digi_pattern_config_t pattern = {};
+  pattern.atten = LDR_ADC_ATTEN;
+  pattern.channel = LDR_ADC_CHANNEL;
+  pattern.unit = 0;
+  pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+
+  adc_digi_configuration_t digi_config = {};
+  digi_config.conv_limit_en = true;
+  digi_config.conv_limit_num = 250;
+  digi_config.pattern_num = 1;
+  digi_config.adc_pattern = &pattern;
+  digi_config.sample_freq_hz = LDR_SAMPLE_FREQ_HZ;
+  digi_config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  digi_config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+  adc_digi_controller_configure(&digi_config);
+  adc_digi_start();
+
+  xTaskCreatePinnedToCore(ldr_acquisition_task, "ldr_acq", 3072, nullptr, 1, nullptr, 0);
+}
+
+float ldr_latest_normalized()
+{
+  return latest_normalized;
+}
+
+uint32_t ldr_latest_millivolts()
+{
+  return latest_mv;
+}
+
+uint32_t ldr_burst_count()
+{
+  return bursts;
+}
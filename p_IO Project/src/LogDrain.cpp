@@ -0,0 +1,154 @@
+#include <Arduino.h>
+#include <LogDrain.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static LogDrainStats stats;
+
+#if defined(MEDIBOX_LOG_MQTT)
+// Filled by the drain task, emptied by log_mqtt_sink_poll() on the main loop
+static portMUX_TYPE batch_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t batch[LOG_MQTT_BATCH];
+static size_t batch_used = 0;
+static uint32_t batch_records = 0;
+
+static void sink_append(const LogRecord &record)
+{
+  if (record.level > MEDIBOX_LOG_MQTT_LEVEL)
+  {
+    return;
+  }
+
+  uint8_t wire[BINLOG_WIRE_MAX];
+  size_t n = binlog_encode(record, wire, sizeof(wire));
+
+  portENTER_CRITICAL(&batch_lock);
+  bool fits = batch_used + n <= sizeof(batch);
+  if (fits)
+  {
+    memcpy(batch + batch_used, wire, n);
+    batch_used += n;
+    batch_records++;
+  }
+  portEXIT_CRITICAL(&batch_lock);
+
+  if (!fits)
+  {
+    portENTER_CRITICAL(&stats_lock);
+    stats.mqtt_dropped++;
+    portEXIT_CRITICAL(&stats_lock);
+  }
+}
+#endif
+
+static uint32_t clock_ms()
+{
+  return millis();
+}
+
+/***************************************************************************************************
+ * log_drain_task()
+ * Empties the ring every LOG_DRAIN_PERIOD_MS. Serial.println may block on a full UART FIFO, which
+ * only delays this task; producers keep writing into the ring meanwhile.
+ **************************************************************************************************/
+static void log_drain_task(void *)
+{
+  LogRecord record;
+  char line[BINLOG_TEXT_MAX];
+  uint32_t reported_drops = 0;
+
+  while (true)
+  {
+    uint32_t start = micros();
+    uint32_t printed = 0;
+    while (binlog.pop(record))
+    {
+      binlog_format_line(record, record.fmt, line, sizeof(line));
+      Serial.println(line);
+      printed++;
+#if defined(MEDIBOX_LOG_MQTT)
+      sink_append(record);
+#endif
+    }
+
+    uint32_t dropped = binlog.stats().dropped;
+    if (dropped != reported_drops)
+    {
+      snprintf(line, sizeof(line), "[log] %u messages dropped", (unsigned)(dropped - reported_drops));
+      Serial.println(line);
+      reported_drops = dropped;
+    }
+
+    uint32_t elapsed = micros() - start;
+    portENTER_CRITICAL(&stats_lock);
+    stats.printed += printed;
+    if (elapsed > stats.max_drain_us)
+    {
+      stats.max_drain_us = elapsed;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+
+    vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_PERIOD_MS));
+  }
+}
+
+/***************************************************************************************************
+ * log_drain_begin()
+ * Call right after Serial.begin(). Records logged before this wait in the ring.
+ **************************************************************************************************/
+void log_drain_begin()
+{
+  binlog.set_clock(clock_ms);
+  xTaskCreatePinnedToCore(log_drain_task, "log_drain", 3072, nullptr, tskIDLE_PRIORITY + 1, nullptr, 0);
+}
+
+/***************************************************************************************************
+ * log_mqtt_sink_poll()
+ * Main loop. Publishes whatever the drain task batched since the last call as one message; while
+ * the client is disconnected the batch is discarded and counted.
+ **************************************************************************************************/
+void log_mqtt_sink_poll(PubSubClient &client, const char *topic)
+{
+#if defined(MEDIBOX_LOG_MQTT)
+  uint8_t payload[LOG_MQTT_BATCH];
+  size_t n;
+  uint32_t records;
+
+  portENTER_CRITICAL(&batch_lock);
+  n = batch_used;
+  records = batch_records;
+  memcpy(payload, batch, n);
+  batch_used = 0;
+  batch_records = 0;
+  portEXIT_CRITICAL(&batch_lock);
+
+  if (n == 0)
+  {
+    return;
+  }
+
+  bool sent = client.connected() && client.publish(topic, payload, n);
+  portENTER_CRITICAL(&stats_lock);
+  if (sent)
+  {
+    stats.mqtt_records += records;
+  }
+  else
+  {
+    stats.mqtt_dropped += records;
+  }
+  portEXIT_CRITICAL(&stats_lock);
+#else
+  (void)client;
+  (void)topic;
+#endif
+}
+
+LogDrainStats log_drain_stats()
+{
+  portENTER_CRITICAL(&stats_lock);
+  LogDrainStats copy = stats;
+  portEXIT_CRITICAL(&stats_lock);
+  return copy;
+}
@@ -0,0 +1,233 @@
+#include <Arduino.h>
+#include <BinLog.h>
+#include <MqttTransport.h>
+#include <WiFi.h>
+
+#if MQTT_TLS_ENABLED
+
+#include <MqttTlsCredentials.h>
+#include <TlsLink.h>
+#include <mbedtls/net_sockets.h>
+
+static_assert(sizeof(MQTT_TLS_CA_PEM) > 1, "MEDIBOX_MQTT_TLS needs a CA: run scripts/mosquitto_tls/make_certs.sh");
+
+#define TLS_HANDSHAKE_TIMEOUT_MS 15000
+
+static uint32_t clock_us()
+{
+  return micros();
+}
+
+static void yield_tick()
+{
+  delay(1); // Lets the idle task run, so a slow broker does not trip the task watchdog
+}
+
+static int tcp_send(void *io, const unsigned char *data, size_t len)
+{
+  WiFiClient *tcp = (WiFiClient *)io;
+  if (!tcp->connected())
+    return MBEDTLS_ERR_NET_CONN_RESET;
+  size_t n = tcp->write(data, len);
+  return n > 0 ? (int)n : MBEDTLS_ERR_SSL_WANT_WRITE;
+}
+
+static int tcp_recv(void *io, unsigned char *data, size_t len)
+{
+  WiFiClient *tcp = (WiFiClient *)io;
+  int n = tcp->available();
+  if (n <= 0)
+    return tcp->connected() ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_CONN_RESET;
+  return tcp->read(data, (size_t)n < len ? (size_t)n : len);
+}
+
+struct HandshakeHeap
+{
+  uint32_t before;     // Free heap when the handshake started
+  uint32_t after;      // Free heap once connected (difference = held by the session)
+  uint32_t low_water;  // Lowest free heap since boot, read right after the handshake
+};
+
+/***************************************************************************************************
+ * TlsClient
+ * Client over a WiFiClient and a TlsLink. The link (and its record buffers) lives as long as the
+ * firmware; stop() only closes the TCP connection and keeps the session for the next connect().
+ **************************************************************************************************/
+class TlsClient : public Client
+{
+public:
+  TlsLink link;
+  HandshakeHeap heap;
+
+  int connect(IPAddress ip, uint16_t port) override
+  {
+    stop();
+    return tcp_.connect(ip, port) && handshake();
+  }
+
+  int connect(const char *host, uint16_t port) override
+  {
+    stop();
+    return tcp_.connect(host, port) && handshake();
+  }
+
+  size_t write(uint8_t b) override { return write(&b, 1); }
+
+  size_t write(const uint8_t *buf, size_t size) override
+  {
+    int n = link.write(buf, size);
+    return n > 0 ? (size_t)n : 0;
+  }
+
+  int available() override { return (peeked_ >= 0 ? 1 : 0) + (int)link.available(); }
+
+  int read() override
+  {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+  }
+
+  int read(uint8_t *buf, size_t size) override
+  {
+    if (size == 0)
+      return 0;
+    size_t got = 0;
+    if (peeked_ >= 0)
+    {
+      buf[got++] = (uint8_t)peeked_;
+      peeked_ = -1;
+    }
+    if (got < size)
+    {
+      int n = link.read(buf + got, size - got);
+      if (n > 0)
+        got += n;
+    }
+    return got > 0 ? (int)got : -1;
+  }
+
+  int peek() override
+  {
+    if (peeked_ < 0)
+    {
+      uint8_t b;
+      if (link.read(&b, 1) == 1)
+        peeked_ = b;
+    }
+    return peeked_;
+  }
+
+  void flush() override {}
+
+  void stop() override
+  {
+    link.close();
+    tcp_.stop();
+    peeked_ = -1;
+  }
+
+  uint8_t connected() override { return tcp_.connected() || peeked_ >= 0 || link.available() > 0; }
+  operator bool() override { return connected(); }
+
+private:
+  bool handshake()
+  {
+    tcp_.setNoDelay(true);
+    heap.before = ESP.getFreeHeap();
+    bool ok = link.handshake(&tcp_, tcp_send, tcp_recv, TLS_HANDSHAKE_TIMEOUT_MS);
+    heap.after = ESP.getFreeHeap();
+    heap.low_water = ESP.getMinFreeHeap();
+    if (!ok)
+      tcp_.stop();
+    mqtt_transport_report();
+    return ok;
+  }
+
+  WiFiClient tcp_;
+  int peeked_ = -1;
+};
+
+static TlsClient tls_client;
+
+/***************************************************************************************************
+ * mqtt_transport_begin()
+ * Seeds the RNG, parses the CA and allocates the SSL context once, before the first connect.
+ **************************************************************************************************/
+bool mqtt_transport_begin()
+{
+  uint8_t pin[TLS_PIN_LEN];
+  bool pinned = sizeof(MQTT_TLS_PIN_SHA256) > 1;
+  if (pinned && !tls_parse_pin(MQTT_TLS_PIN_SHA256, pin))
+  {
+    LOG_ERROR("TLS: MQTT_TLS_PIN_SHA256 is not a SHA-256 hex string");
+    return false;
+  }
+
+  uint32_t before = ESP.getFreeHeap();
+  if (!tls_client.link.begin(MQTT_TLS_CA_PEM, pinned ? pin : NULL, MQTT_TLS_SERVER_NAME, clock_us, yield_tick))
+  {
+    LOG_ERROR("TLS: setup failed, mbedTLS error -0x%04x", -tls_client.link.stats().last_error);
+    return false;
+  }
+  LOG_INFO("TLS: context ready, bytes preallocated: %u%s", before - ESP.getFreeHeap(), pinned ? ", certificate pinned" : "");
+  return true;
+}
+
+Client &mqtt_transport()
+{
+  return tls_client;
+}
+
+const char *mqtt_broker_host(const char *)
+{
+  return MQTT_TLS_HOST;
+}
+
+uint16_t mqtt_broker_port(uint16_t)
+{
+  return MQTT_TLS_PORT;
+}
+
+/***************************************************************************************************
+ * mqtt_transport_report()
+ * One line per handshake: full vs resumed timing, heap held by the session and the low-water mark.
+ **************************************************************************************************/
+void mqtt_transport_report()
+{
+  const TlsStats &s = tls_client.link.stats();
+  const HandshakeHeap &h = tls_client.heap;
+  LOG_INFO("TLS: full %u (last %u ms) resumed %u (last %u ms) failed %u pin_fail %u err -0x%04x | "
+           "heap before %u after %u low %u",
+           s.full_handshakes, s.last_full_us / 1000, s.resumed_handshakes, s.last_resumed_us / 1000,
+           s.failed_handshakes, s.pin_failures, -s.last_error, h.before, h.after, h.low_water);
+}
+
+#else
+
+static WiFiClient plain_client;
+
+bool mqtt_transport_begin()
+{
+  return true;
+}
+
+Client &mqtt_transport()
+{
+  return plain_client;
+}
+
+const char *mqtt_broker_host(const char *plain_host)
+{
+  return plain_host;
+}
+
+uint16_t mqtt_broker_port(uint16_t plain_port)
+{
+  return plain_port;
+}
+
+void mqtt_transport_report()
+{
+}
+
+#endif
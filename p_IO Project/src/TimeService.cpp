@@ -0,0 +1,143 @@
+#include <Arduino.h>
+#include <BinLog.h>
+#include <TimeService.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <esp_timer.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+/***************************************************************************************************
+ * UdpNtp
+ * NtpTransport on a WiFiUDP socket. The server name is resolved on every send, so a DNS change is
+ * followed; nothing is sent while Wi-Fi is down, which TimeSync counts as a lost request.
+ **************************************************************************************************/
+class UdpNtp : public NtpTransport
+{
+public:
+  UdpNtp() : server_(NULL), open_(false) {}
+
+  void begin(const char *server)
+  {
+    server_ = server;
+    open_ = udp_.begin(TIME_SERVICE_LOCAL_PORT) == 1;
+  }
+
+  bool send(const uint8_t *packet, size_t n) override
+  {
+    if (!open_ || WiFi.status() != WL_CONNECTED || !udp_.beginPacket(server_, NTP_PORT))
+      return false;
+    udp_.write(packet, n);
+    return udp_.endPacket() == 1;
+  }
+
+  size_t receive(uint8_t *packet, size_t size) override
+  {
+    if (!open_ || udp_.parsePacket() <= 0)
+      return 0;
+    int n = udp_.read(packet, size);
+    return n > 0 ? (size_t)n : 0;
+  }
+
+private:
+  WiFiUDP udp_;
+  const char *server_;
+  bool open_;
+};
+
+static UdpNtp transport;
+static TimeSync time_sync(transport);
+static uint32_t clock_steps = 0;
+static uint32_t clock_slews = 0;
+static uint32_t logged_steps = 0;
+
+void time_service_begin(const char *server)
+{
+  transport.begin(server);
+  LOG_INFO("Time: SNTP to %s", server);
+}
+
+/***************************************************************************************************
+ * time_service_poll()
+ * Polls TimeSync and brings the system clock to its time: stepped at the first sync and after a
+ * correction TimeSync steps too, slewed otherwise. A new slew starts once the last one has
+ * finished, so the difference it corrects is measured against a clock that has settled.
+ **************************************************************************************************/
+void time_service_poll()
+{
+  time_sync.poll(esp_timer_get_time());
+  if (!time_sync.synced())
+    return;
+
+  int64_t local = esp_timer_get_time();
+  int64_t now = time_sync.now_us(local);
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  int64_t offset = now - ((int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+  if (clock_steps == 0 || llabs(offset) > TIMESYNC_STEP_US)
+  {
+    struct timeval zero = {0, 0};
+    adjtime(&zero, NULL); // Drop any slew still running
+    tv.tv_sec = (time_t)(now / 1000000);
+    tv.tv_usec = (suseconds_t)(now % 1000000);
+    settimeofday(&tv, NULL);
+    clock_steps++;
+  }
+  else if (llabs(offset) >= TIME_SERVICE_SLEW_US)
+  {
+    struct timeval delta;
+    adjtime(NULL, &delta);
+    if (delta.tv_sec == 0 && delta.tv_usec == 0) // The last slew has finished
+    {
+      delta.tv_sec = (time_t)(offset / 1000000);
+      delta.tv_usec = (suseconds_t)(offset % 1000000);
+      adjtime(&delta, NULL);
+      clock_slews++;
+    }
+  }
+
+  TimeSyncStats stats = time_sync.stats();
+  if (stats.steps != logged_steps)
+  {
+    logged_steps = stats.steps;
+    LOG_INFO("Time: clock set, error within %u ms", time_sync.error_us(local) / 1000);
+  }
+}
+
+bool time_service_synced()
+{
+  return time_sync.synced();
+}
+
+/***************************************************************************************************
+ * time_service_set_utc_offset()
+ * Sets the local time zone as a POSIX TZ string, which counts hours west of UTC: UTC+05:30 is
+ * "UTC-05:30".
+ **************************************************************************************************/
+void time_service_set_utc_offset(int offset_s)
+{
+  int west = -offset_s;
+  char tz[16];
+  snprintf(tz, sizeof(tz), "UTC%c%02d:%02d", west < 0 ? '-' : '+', abs(west) / 3600, abs(west) % 3600 / 60);
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+TimeSyncStats time_service_sync_stats()
+{
+  return time_sync.stats();
+}
+
+TimeServiceStats time_service_stats()
+{
+  int64_t local = esp_timer_get_time();
+  TimeServiceStats stats;
+  stats.synced = time_sync.synced();
+  stats.error_ms = time_sync.synced() ? time_sync.error_us(local) / 1000 : UINT32_MAX;
+  stats.drift_ppb = time_sync.skew_ppb();
+  stats.poll_interval_s = time_sync.poll_interval_s();
+  stats.clock_steps = clock_steps;
+  stats.clock_slews = clock_slews;
+  return stats;
+}
@@ -0,0 +1,168 @@
+#include <Arduino.h>
+#include <TraceRecorder.h>
+
+static TraceRecorderStats stats;
+
+#if defined(MEDIBOX_TRACE)
+struct TraceChunk
+{
+  uint16_t used;
+  uint32_t opened_ms;
+  uint8_t data[TRACE_CHUNK_SIZE];
+};
+
+// chunks[head] is the oldest unsent chunk; the newest one is still being filled
+static TraceChunk chunks[TRACE_CHUNKS];
+static uint8_t head = 0;
+static uint8_t count = 0;
+static uint16_t sequence = 0;
+static bool stopped = false; // The ring overflowed; records are dropped until it has drained
+
+static TraceChunk *new_chunk()
+{
+  if (count == TRACE_CHUNKS)
+  {
+    return NULL;
+  }
+  TraceChunk &c = chunks[(head + count) % TRACE_CHUNKS];
+  c.used = trace_chunk_header(c.data, sequence++);
+  c.opened_ms = millis();
+  count++;
+  return &c;
+}
+
+/***************************************************************************************************
+ * TraceChunkSink
+ * Appends to the newest chunk, opening another when it is full. A record that does not fit in the
+ * free space is dropped whole and the sequence number skips one, so the host sees a gap after the
+ * last complete record; trace_recorder_poll() restarts the trace once the ring has drained.
+ **************************************************************************************************/
+class TraceChunkSink : public TraceSink
+{
+public:
+  bool trace_reserve(size_t n) override
+  {
+    if (!stopped)
+    {
+      size_t space = (size_t)(TRACE_CHUNKS - count) * (TRACE_CHUNK_SIZE - TRACE_CHUNK_HEADER);
+      if (count)
+      {
+        space += TRACE_CHUNK_SIZE - chunks[(head + count - 1) % TRACE_CHUNKS].used;
+      }
+      if (n <= space)
+      {
+        return true;
+      }
+      stopped = true;
+      sequence++;
+    }
+    stats.bytes_dropped += n;
+    return false;
+  }
+
+  void trace_write(const uint8_t *data, size_t n) override
+  {
+    while (n > 0)
+    {
+      TraceChunk *c = count ? &chunks[(head + count - 1) % TRACE_CHUNKS] : NULL;
+      if (!c || c->used == TRACE_CHUNK_SIZE)
+      {
+        c = new_chunk(); // trace_reserve() made sure there is one
+      }
+
+      size_t take = TRACE_CHUNK_SIZE - c->used;
+      if (take > n)
+      {
+        take = n;
+      }
+      memcpy(c->data + c->used, data, take);
+      c->used += take;
+      data += take;
+      n -= take;
+      stats.bytes_recorded += take;
+    }
+  }
+};
+
+static TraceChunkSink sink;
+static TraceWriter writer(sink);
+
+#if defined(MEDIBOX_TRACE_SERIAL)
+static bool send_chunk(const TraceChunk &c)
+{
+  static const char HEX_DIGITS[] = "0123456789abcdef";
+  char line[8 + 2 * TRACE_CHUNK_SIZE + 1];
+  size_t n = 0;
+  memcpy(line, "#TRACE ", 7);
+  n = 7;
+  for (uint16_t i = 0; i < c.used; i++)
+  {
+    line[n++] = HEX_DIGITS[c.data[i] >> 4];
+    line[n++] = HEX_DIGITS[c.data[i] & 0x0F];
+  }
+  line[n++] = '\n';
+  Serial.write((const uint8_t *)line, n); // One write, so log lines do not split it
+  return true;
+}
+#endif
+#endif
+
+TraceWriter *trace_recorder_begin()
+{
+#if defined(MEDIBOX_TRACE)
+  return &writer;
+#else
+  return NULL;
+#endif
+}
+
+/***************************************************************************************************
+ * trace_recorder_poll()
+ * Main loop. Sends the oldest chunk once it is full, or once it has waited TRACE_FLUSH_MS; one
+ * chunk per call. While the client is disconnected chunks stay queued. After an overflow, once the
+ * backlog is sent, the trace restarts in a new chunk with a fresh BEGIN.
+ **************************************************************************************************/
+void trace_recorder_poll(PubSubClient &client, const char *topic)
+{
+#if defined(MEDIBOX_TRACE)
+  if (stopped && count == 0)
+  {
+    stopped = false;
+    writer.restart(millis());
+    stats.restarts++;
+  }
+
+  if (count == 0)
+  {
+    return;
+  }
+  TraceChunk &c = chunks[head];
+  bool ready = count > 1 || c.used == TRACE_CHUNK_SIZE || millis() - c.opened_ms >= TRACE_FLUSH_MS;
+  if (!ready)
+  {
+    return;
+  }
+
+#if defined(MEDIBOX_TRACE_SERIAL)
+  (void)client;
+  (void)topic;
+  bool sent = send_chunk(c);
+#else
+  bool sent = client.connected() && client.publish(topic, c.data, c.used);
+#endif
+  if (sent)
+  {
+    head = (head + 1) % TRACE_CHUNKS;
+    count--;
+    stats.chunks_sent++;
+  }
+#else
+  (void)client;
+  (void)topic;
+#endif
+}
+
+TraceRecorderStats trace_recorder_stats()
+{
+  return stats;
+}
@@ -0,0 +1,121 @@
+/***************************************************************************************************
+ * Event bus benchmark (host build, `pio run -e busbench`)
+ *
+ * Measures what lib/EventBus costs per event:
+ *   publish  synchronous fan-out to 1, 4 and 8 subscribers
+ *   queue    post() + drain() round trip from one thread
+ *   contend  producer threads posting while the main thread drains; a producer that finds the
+ *            queue full retries, so every event must come out exactly once
+ *
+ *   program [events]
+ **************************************************************************************************/
+#include <EventBus.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+static volatile uint32_t sink;
+static void handler(const Event &event) { sink += event.timestamp_ms; }
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void bench_publish(uint32_t n, uint8_t subscribers)
+{
+  std::vector<EventSubscription> table(subscribers, EventSubscription{EVT_LIGHT_SAMPLE, handler});
+  EventBus bus(table.data(), subscribers);
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < n; i++)
+    bus.publish(event_light_sample(i, 0.5f));
+  double elapsed = seconds_since(start);
+
+  EventBusStats stats = bus.stats();
+  printf("publish  %u subscriber%s  %6.1f ns/event  %6.1f ns/handler  (%u dispatched)\n", subscribers,
+         subscribers == 1 ? " " : "s", elapsed * 1e9 / n, elapsed * 1e9 / stats.handler_calls,
+         stats.dispatched[EVT_LIGHT_SAMPLE]);
+}
+
+static void bench_queue(uint32_t n)
+{
+  const EventSubscription table[] = {{EVT_BUTTON, handler}};
+  EventBus bus(table, 1);
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    bus.post(event_button(i, 32));
+    if ((i & 7) == 7)
+      bus.drain();
+  }
+  bus.drain();
+  double elapsed = seconds_since(start);
+
+  EventBusStats stats = bus.stats();
+  printf("queue    1 thread       %6.1f ns/event  (posted %u, dropped %u, high water %u)\n", elapsed * 1e9 / n,
+         stats.posted, stats.dropped, stats.queue_high_water);
+}
+
+static bool bench_contended(uint32_t n, int producers)
+{
+  const EventSubscription table[] = {{EVT_BUTTON, handler}, {EVT_ENV_SAMPLE, handler}};
+  EventBus bus(table, 2);
+  std::atomic<int> running(producers);
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++)
+  {
+    threads.emplace_back([&bus, &running, n, p]() {
+      for (uint32_t i = 0; i < n; i++)
+      {
+        Event event = p & 1 ? event_env_sample(i, 21.0f, 40.0f) : event_button(i, (uint8_t)p);
+        while (!bus.post(event))
+          std::this_thread::yield();
+      }
+      running--;
+    });
+  }
+
+  uint32_t drained = 0;
+  while (running.load() > 0)
+  {
+    uint16_t handled = bus.drain();
+    drained += handled;
+    if (handled == 0)
+      std::this_thread::yield();
+  }
+  drained += bus.drain();
+  double elapsed = seconds_since(start);
+  for (auto &t : threads)
+    t.join();
+
+  EventBusStats stats = bus.stats();
+  uint32_t total = n * producers;
+  bool consistent = stats.posted == total && drained == total &&
+                    stats.dispatched[EVT_BUTTON] + stats.dispatched[EVT_ENV_SAMPLE] == stats.posted;
+  printf("contend  %d producers    %6.1f ns/event  (posted %u, queue full %u times, drained %u) %s\n", producers,
+         elapsed * 1e9 / total, stats.posted, stats.dropped, drained, consistent ? "ok" : "MISMATCH");
+  return consistent;
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t n = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 10000000;
+
+  bench_publish(n, 1);
+  bench_publish(n, 4);
+  bench_publish(n, EVENT_MAX_HANDLERS);
+  bench_queue(n);
+  bool ok = bench_contended(n / 4, 3);
+
+  printf("sizeof(Event) %zu bytes, queue %zu bytes\n", sizeof(Event), sizeof(EventBus));
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+/***************************************************************************************************
+ * Button debounce test (host build, `pio run -e buttontest`)
+ *
+ * Plays pin edge sequences through ButtonDebounce into an EventBus, as the firmware's pin
+ * interrupts do, and counts the button events drained on the other side:
+ *   tap      an 80 ms tap with contact bounce at both ends is one press, stamped when it closed
+ *   hold     a two second hold whose release bounces is one press
+ *   double   two taps 150 ms apart are two presses
+ *   release  bounce right after a release is not a press
+ **************************************************************************************************/
+#include <EventBus.h>
+
+#include <stdio.h>
+
+#include <vector>
+
+struct Edge
+{
+  uint32_t at_ms;
+  bool low;
+};
+
+static std::vector<Event> received;
+static void on_button(const Event &event) { received.push_back(event); }
+
+static const EventSubscription SUBSCRIPTIONS[] = {{EVT_BUTTON, on_button}};
+
+// Closes at start_ms and opens after length_ms, bouncing for a few ms at both ends
+static void push(std::vector<Edge> &edges, uint32_t start_ms, uint32_t length_ms)
+{
+  static const uint32_t BOUNCE[] = {0, 1, 2, 4, 5};
+  for (int i = 0; i < 5; i++)
+    edges.push_back({start_ms + BOUNCE[i], i % 2 == 0});
+  for (int i = 0; i < 5; i++)
+    edges.push_back({start_ms + length_ms + BOUNCE[i], i % 2 != 0});
+}
+
+static size_t play(const std::vector<Edge> &edges)
+{
+  EventBus bus(SUBSCRIPTIONS, 1);
+  ButtonDebounce button;
+  button_debounce_init(button);
+  received.clear();
+  for (const Edge &edge : edges)
+  {
+    if (button_debounce_edge(button, edge.at_ms, edge.low))
+      bus.post(event_button(edge.at_ms, 0));
+  }
+  bus.drain();
+  return received.size();
+}
+
+static bool report(const char *name, bool ok, const char *detail)
+{
+  printf("%-8s %s (%s)\n", name, ok ? "ok" : "FAILED", detail);
+  return ok;
+}
+
+static bool test_tap()
+{
+  std::vector<Edge> edges;
+  push(edges, 1000, 80);
+  size_t presses = play(edges);
+  bool ok = presses == 1 && received[0].timestamp_ms == 1000;
+
+  char detail[64];
+  snprintf(detail, sizeof(detail), "%zu press(es) from %zu edges", presses, edges.size());
+  return report("tap", ok, detail);
+}
+
+static bool test_hold()
+{
+  std::vector<Edge> edges;
+  push(edges, 1000, 2000);
+  size_t presses = play(edges);
+
+  char detail[64];
+  snprintf(detail, sizeof(detail), "%zu press(es) from %zu edges", presses, edges.size());
+  return report("hold", presses == 1, detail);
+}
+
+static bool test_double()
+{
+  std::vector<Edge> edges;
+  push(edges, 1000, 60);
+  push(edges, 1150, 60);
+  size_t presses = play(edges);
+  bool ok = presses == 2 && received[1].timestamp_ms == 1150;
+
+  char detail[64];
+  snprintf(detail, sizeof(detail), "%zu press(es) from %zu edges", presses, edges.size());
+  return report("double", ok, detail);
+}
+
+static bool test_release()
+{
+  std::vector<Edge> edges;
+  push(edges, 1000, 120);
+  edges.push_back({1140, true}); // A late bounce 15 ms after the contacts opened
+  edges.push_back({1141, false});
+  size_t presses = play(edges);
+  return report("release", presses == 1, "late release bounce ignored");
+}
+
+int main()
+{
+  bool ok = test_tap();
+  ok &= test_hold();
+  ok &= test_double();
+  ok &= test_release();
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+/***************************************************************************************************
+ * Config store stress test (host build, `pio run -e configstress`)
+ *
+ * One writer thread publishes config versions back to back into lib/ConfigStore while reader
+ * threads take snapshots as fast as they can. Every field of version v is a function of v, so a
+ * reader can rebuild the whole snapshot, derived values included, from the version it got and
+ * compare it byte for byte: a torn snapshot (ts from one version, tu or the window from another)
+ * cannot pass. Readers also check that versions never go backwards. Exits 1 on any bad snapshot.
+ *
+ *   program [seconds] [readers]
+ **************************************************************************************************/
+#include <ConfigStore.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Version v of the config; every field moves with v and stays inside the documented ranges
+static MediboxConfig make_config(uint32_t v)
+{
+  MediboxConfig c;
+  memset(&c, 0, sizeof(c));
+  c.ts = CONFIG_MIN_TS + (int)(v % CONFIG_MAX_TS);
+  c.tu = c.ts * (1 + (int)(v % 24));
+  c.theta_offset = (float)(v % 181);
+  c.gamma = (float)(v % 101) / 100;
+  c.tmed = CONFIG_MIN_TMED + (float)(v % 100);
+  c.temperature.low = 20 + (float)(v % 7);
+  c.temperature.high = 30 + (float)(v % 5);
+  c.temperature.hysteresis = (float)(v % 3) / 2;
+  c.humidity.low = 50 + (float)(v % 11);
+  c.humidity.high = 70 + (float)(v % 13);
+  c.humidity.hysteresis = (float)(v % 4);
+  c.alert_dwell_ms = v % (CONFIG_MAX_ALERT_DWELL_MS + 1);
+  c.version = v;
+  return c;
+}
+
+struct ReaderResult
+{
+  uint64_t reads;
+  uint64_t bad;       // Snapshot does not match the version it claims
+  uint64_t backwards; // Older version than the previous read
+  uint32_t versions;  // Distinct versions seen
+};
+
+static void reader(const ConfigStore &store, const std::atomic<bool> &stop, ReaderResult &result)
+{
+  memset(&result, 0, sizeof(result));
+  uint32_t last = 0;
+  ConfigSnapshot snapshot;
+  while (!stop.load(std::memory_order_relaxed))
+  {
+    store.read(snapshot);
+    result.reads++;
+
+    uint32_t v = snapshot.config.version;
+    ConfigSnapshot expected = config_snapshot(make_config(v));
+    if (memcmp(&snapshot, &expected, sizeof(snapshot)) != 0)
+      result.bad++;
+    if (v < last)
+      result.backwards++;
+    if (v != last)
+      result.versions++;
+    last = v;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  double seconds = argc > 1 ? atof(argv[1]) : 2.0;
+  int readers = argc > 2 ? atoi(argv[2]) : 3;
+  if (seconds <= 0 || readers < 1)
+  {
+    fprintf(stderr, "usage: configstress [seconds] [readers]\n");
+    return 2;
+  }
+
+  ConfigStore store(make_config(0));
+  std::atomic<bool> stop(false);
+  std::vector<ReaderResult> results(readers);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < readers; i++)
+    threads.emplace_back(reader, std::cref(store), std::cref(stop), std::ref(results[i]));
+
+  // The writer builds each snapshot before publishing, as MediboxCore does
+  uint32_t version = 0;
+  auto start = std::chrono::steady_clock::now();
+  auto end = start + std::chrono::duration<double>(seconds);
+  while (std::chrono::steady_clock::now() < end)
+  {
+    for (int i = 0; i < 256; i++)
+      store.publish(config_snapshot(make_config(++version)));
+  }
+  stop.store(true);
+  for (std::thread &t : threads)
+    t.join();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  ReaderResult total;
+  memset(&total, 0, sizeof(total));
+  for (const ReaderResult &r : results)
+  {
+    total.reads += r.reads;
+    total.bad += r.bad;
+    total.backwards += r.backwards;
+    total.versions += r.versions;
+  }
+
+  ConfigStoreStats stats = store.stats();
+  printf("%d readers, %.1f s: %u versions published (%.2f M/s), %llu reads (%.2f M/s), %u read retries\n",
+         readers, elapsed, stats.published, stats.published / elapsed / 1e6, (unsigned long long)total.reads,
+         total.reads / elapsed / 1e6, stats.retries);
+  printf("distinct versions seen per reader: %.0f on average\n", (double)total.versions / readers);
+  printf("torn snapshots: %llu, versions going backwards: %llu\n", (unsigned long long)total.bad,
+         (unsigned long long)total.backwards);
+
+  bool ok = total.bad == 0 && total.backwards == 0 && stats.published == version;
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,300 @@
+/***************************************************************************************************
+ * Glyph cache benchmark (host build, `pio run -e glyphbench`)
+ *
+ * Renders the big text of the clock, alarm and time zone screens into an SSD1306 framebuffer two
+ * ways and compares the frames and the time per render:
+ *
+ *   gfx    the Adafruit GFX path as the firmware ran it: print() -> write() -> drawChar(), one
+ *          writeFillRect() per lit font pixel, down to Adafruit_SSD1306::drawFastVLineInternal()'s
+ *          masked byte writes, with the same virtual calls
+ *   cache  lib/GlyphCache, captured from the gfx path the way the firmware captures it at boot
+ *
+ * The font table below is the part of Adafruit GFX's glcdfont.c these screens use. The firmware
+ * does not need it: it captures whatever font the library has.
+ *
+ *   program [renders]
+ **************************************************************************************************/
+#include <GlyphCache.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#define WIDTH 128
+#define HEIGHT 64
+
+struct FontGlyph
+{
+  char c;
+  uint8_t columns[5];
+};
+
+static const FontGlyph FONT[] = {
+    {' ', {0x00, 0x00, 0x00, 0x00, 0x00}}, {'-', {0x08, 0x08, 0x08, 0x08, 0x08}},
+    {'0', {0x3E, 0x51, 0x49, 0x45, 0x3E}}, {'1', {0x00, 0x42, 0x7F, 0x40, 0x00}},
+    {'2', {0x72, 0x49, 0x49, 0x49, 0x46}}, {'3', {0x21, 0x41, 0x49, 0x4D, 0x33}},
+    {'4', {0x18, 0x14, 0x12, 0x7F, 0x10}}, {'5', {0x27, 0x45, 0x45, 0x45, 0x39}},
+    {'6', {0x3C, 0x4A, 0x49, 0x49, 0x31}}, {'7', {0x41, 0x21, 0x11, 0x09, 0x07}},
+    {'8', {0x36, 0x49, 0x49, 0x49, 0x36}}, {'9', {0x46, 0x49, 0x49, 0x29, 0x1E}},
+    {':', {0x00, 0x00, 0x14, 0x00, 0x00}}, {'h', {0x7F, 0x08, 0x04, 0x04, 0x78}},
+    {'i', {0x00, 0x44, 0x7D, 0x40, 0x00}}, {'m', {0x7C, 0x04, 0x18, 0x04, 0x78}},
+    {'n', {0x7C, 0x08, 0x04, 0x04, 0x78}}, {'r', {0x7C, 0x08, 0x04, 0x04, 0x08}},
+    {'s', {0x48, 0x54, 0x54, 0x54, 0x24}},
+};
+
+static const uint8_t *font_columns(char c)
+{
+  for (const FontGlyph &g : FONT)
+  {
+    if (g.c == c)
+      return g.columns;
+  }
+  return FONT[0].columns;
+}
+
+/***************************************************************************************************
+ * GfxDisplay
+ * The GFX text path reduced to what these screens use (rotation 0, transparent background, white
+ * text), keeping the library's call structure so the per-pixel overhead is the same.
+ **************************************************************************************************/
+class GfxDisplay
+{
+public:
+  GfxDisplay() : cursor_x(0), cursor_y(0), text_size(1), fill_rects(0) { clear(); }
+  virtual ~GfxDisplay() {}
+
+  void clear() { memset(buffer, 0, sizeof(buffer)); }
+  void set_cursor(int x, int y) { cursor_x = x, cursor_y = y; }
+  void set_text_size(uint8_t s) { text_size = s; }
+
+  void print(const char *text)
+  {
+    while (*text)
+      write((uint8_t)*text++);
+  }
+
+  virtual size_t write(uint8_t c)
+  {
+    if (c == '\n')
+    {
+      cursor_x = 0;
+      cursor_y += text_size * 8;
+    }
+    else if (c != '\r')
+    {
+      draw_char(cursor_x, cursor_y, c, text_size);
+      cursor_x += text_size * 6;
+    }
+    return 1;
+  }
+
+  void draw_char(int x, int y, uint8_t c, uint8_t size)
+  {
+    if (x >= WIDTH || y >= HEIGHT || x + 6 * size - 1 < 0 || y + 8 * size - 1 < 0)
+      return;
+    const uint8_t *columns = font_columns((char)c);
+    for (int8_t i = 0; i < 5; i++)
+    {
+      uint8_t line = columns[i];
+      for (int8_t j = 0; j < 8; j++, line >>= 1)
+      {
+        if (line & 1)
+        {
+          if (size == 1)
+            write_pixel(x + i, y + j);
+          else
+            write_fill_rect(x + i * size, y + j * size, size, size);
+        }
+      }
+    }
+  }
+
+  virtual void write_pixel(int x, int y)
+  {
+    if (x >= 0 && x < WIDTH && y >= 0 && y < HEIGHT)
+      buffer[x + (y / 8) * WIDTH] |= (uint8_t)(1 << (y & 7));
+  }
+
+  virtual void write_fill_rect(int x, int y, int w, int h) { fill_rect(x, y, w, h); }
+
+  virtual void fill_rect(int x, int y, int w, int h)
+  {
+    fill_rects++;
+    for (int i = x; i < x + w; i++)
+      write_fast_vline(i, y, h);
+  }
+
+  virtual void write_fast_vline(int x, int y, int h) { draw_fast_vline(x, y, h); }
+  virtual void draw_fast_vline(int x, int y, int h) { draw_fast_vline_internal(x, y, h); }
+
+  // Adafruit_SSD1306::drawFastVLineInternal() for SSD1306_WHITE
+  void draw_fast_vline_internal(int16_t x, int16_t y_in, int16_t h_in)
+  {
+    if (x < 0 || x >= WIDTH)
+      return;
+    if (y_in < 0)
+    {
+      h_in += y_in;
+      y_in = 0;
+    }
+    if (y_in + h_in > HEIGHT)
+      h_in = HEIGHT - y_in;
+    if (h_in <= 0)
+      return;
+
+    uint8_t y = (uint8_t)y_in, h = (uint8_t)h_in;
+    uint8_t *p = &buffer[(y / 8) * WIDTH + x];
+    uint8_t mod = y & 7;
+    if (mod)
+    {
+      mod = 8 - mod;
+      static const uint8_t premask[8] = {0x00, 0x80, 0xC0, 0xE0, 0xF0, 0xF8, 0xFC, 0xFE};
+      uint8_t mask = premask[mod];
+      if (h < mod)
+        mask &= (0xFF >> (mod - h));
+      *p |= mask;
+      p += WIDTH;
+    }
+    if (h >= mod)
+    {
+      h -= mod;
+      while (h >= 8)
+      {
+        *p = 0xFF;
+        p += WIDTH;
+        h -= 8;
+      }
+      if (h)
+      {
+        static const uint8_t postmask[8] = {0x00, 0x01, 0x03, 0x07, 0x0F, 0x1F, 0x3F, 0x7F};
+        *p |= postmask[h & 7];
+      }
+    }
+  }
+
+  uint8_t buffer[WIDTH * HEIGHT / 8];
+  int cursor_x, cursor_y;
+  uint8_t text_size;
+  uint32_t fill_rects;
+};
+
+struct Case
+{
+  const char *screen;
+  const char *text;
+  uint8_t size;
+  int x, y;
+};
+
+// The texts and positions of display_time(), set_alarm() and set_time_zone()
+static const Case CASES[] = {
+    {"clock", "12:38", 3, 10, 16},
+    {"alarm", "07:45", 2, 20, 20},
+    {"tz hour", "-12 hrs", 2, 20, 20},
+    {"tz min", "35 min", 2, 10, 20},
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// As the firmware does at boot: each character alone at (0, 0) of a cleared frame
+static void capture(GlyphCache &cache, GfxDisplay &gfx, uint8_t size)
+{
+  glyph_cache_init(cache, size);
+  for (const char *c = GLYPH_CHARS; *c; c++)
+  {
+    gfx.clear();
+    gfx.draw_char(0, 0, (uint8_t)*c, size);
+    glyph_cache_capture(cache, *c, gfx.buffer, WIDTH);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t renders = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 10) : 200000;
+  if (renders == 0)
+    renders = 1;
+
+  GfxDisplay gfx;
+  static GlyphCache caches[GLYPH_MAX_SIZE + 1];
+  for (uint8_t size = 2; size <= GLYPH_MAX_SIZE; size++)
+    capture(caches[size], gfx, size);
+  printf("cache: %zu characters at sizes 2 and 3, %zu bytes each\n\n", (size_t)GLYPH_COUNT, sizeof(GlyphCache));
+
+  bool ok = true;
+  volatile uint8_t sink = 0;
+  printf("screen   text      size  fillRects     gfx ns   cache ns  speedup  frames\n");
+  for (const Case &k : CASES)
+  {
+    const GlyphCache &cache = caches[k.size];
+    uint8_t expected[sizeof(gfx.buffer)], actual[sizeof(gfx.buffer)];
+
+    // Also draw over a patterned background, as the text is ORed onto what is already there
+    for (int pattern = 0; pattern < 2; pattern++)
+    {
+      gfx.clear();
+      if (pattern)
+        for (size_t i = 0; i < sizeof(gfx.buffer); i++)
+          gfx.buffer[i] = (uint8_t)(i * 37);
+      memcpy(actual, gfx.buffer, sizeof(actual));
+      gfx.set_cursor(k.x, k.y);
+      gfx.set_text_size(k.size);
+      gfx.print(k.text);
+      memcpy(expected, gfx.buffer, sizeof(expected));
+      glyph_draw(cache, actual, WIDTH, HEIGHT, k.x, k.y, k.text);
+      ok &= memcmp(expected, actual, sizeof(actual)) == 0;
+    }
+    bool same = memcmp(expected, actual, sizeof(actual)) == 0;
+
+    gfx.fill_rects = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < renders; i++)
+    {
+      gfx.buffer[(i & 127) + 384] = 0; // Keep the compiler from hoisting the work out of the loop
+      gfx.set_cursor(k.x, k.y);
+      gfx.print(k.text);
+      sink ^= gfx.buffer[i & 1023];
+    }
+    double gfx_ns = seconds_since(start) * 1e9 / renders;
+    uint32_t rects = gfx.fill_rects / renders;
+
+    start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < renders; i++)
+    {
+      actual[(i & 127) + 384] = 0;
+      glyph_draw(cache, actual, WIDTH, HEIGHT, k.x, k.y, k.text);
+      sink ^= actual[i & 1023];
+    }
+    double cache_ns = seconds_since(start) * 1e9 / renders;
+
+    printf("%-8s %-9s %4u %10u %10.0f %10.0f %7.1fx  %s\n", k.screen, k.text, k.size, rects, gfx_ns, cache_ns,
+           gfx_ns / cache_ns, same ? "identical" : "DIFFER");
+  }
+
+  // Clipping at every edge, against the gfx path
+  uint32_t clipped = 0, clip_errors = 0;
+  for (int y = -30; y <= HEIGHT + 4; y += 3)
+  {
+    for (int x = -40; x <= WIDTH + 4; x += 7)
+    {
+      uint8_t size = 2 + (uint8_t)((x + y) & 1);
+      gfx.clear();
+      gfx.set_cursor(x, y);
+      gfx.set_text_size(size);
+      gfx.print("09:-1");
+      uint8_t actual[sizeof(gfx.buffer)] = {};
+      glyph_draw(caches[size], actual, WIDTH, HEIGHT, x, y, "09:-1");
+      clip_errors += memcmp(gfx.buffer, actual, sizeof(actual)) != 0;
+      clipped++;
+    }
+  }
+  printf("\nclipping: %u positions, %u differ\n", clipped, clip_errors);
+  ok &= clip_errors == 0;
+
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,320 @@
+/***************************************************************************************************
+ * Indicator sequencer test (host build, `pio run -e indicatortest`)
+ *
+ * Runs lib/Indicator against a mock LEDC driver on a simulated millisecond clock:
+ *   melody   the alarm melody plays its notes on the 240 ms cadence, one timer per step
+ *   steps    zero-length steps run back to back, fades reach the driver, repeat counts end the pattern
+ *   preempt  the medicine alarm takes over an environment warning, which restarts when it stops
+ *   once     a one-shot beep over a lower-priority pattern ends and hands the channel back
+ *   stale    a timer that fired just before play() re-armed the channel does not advance the new run
+ *   stopped  a timer that fired just before stop() neither restarts the stopped pattern nor advances
+ *            the one that resumes
+ *   breathe  the breathe pattern hands both fades to the hardware and loops
+ *   beepcode the error beep code sounds its three beeps once and ends
+ **************************************************************************************************/
+#include <Indicator.h>
+
+#include <stdio.h>
+
+#include <vector>
+
+/***************************************************************************************************
+ * MockDriver
+ * Records outputs and keeps one pending timer per channel. A fired timer delivers the token it was
+ * armed with, as the ESP32 driver does by reading the armed token before it waits for the lock.
+ **************************************************************************************************/
+struct ToneChange
+{
+  uint32_t at_ms;
+  uint16_t frequency;
+};
+
+class MockDriver : public IndicatorDriver
+{
+public:
+  MockDriver() : now_ms(0), fades(0), last_fade_ms(0), timers_armed(0)
+  {
+    for (uint8_t c = 0; c < INDICATOR_CHANNELS; c++)
+    {
+      level[c] = 0;
+      tone[c] = 0;
+      armed[c] = false;
+      due_ms[c] = 0;
+      token[c] = 0;
+    }
+  }
+
+  void set_level(uint8_t channel, uint8_t duty) override { level[channel] = duty; }
+
+  void fade_to(uint8_t channel, uint8_t duty, uint16_t duration_ms) override
+  {
+    level[channel] = duty; // Where the hardware fade ends
+    last_fade_ms = duration_ms;
+    fades++;
+  }
+
+  void set_tone(uint8_t channel, uint16_t frequency) override
+  {
+    if (channel == IND_BUZZER && frequency != tone[channel])
+      tones.push_back({now_ms, frequency});
+    tone[channel] = frequency;
+  }
+
+  void schedule(uint8_t channel, uint32_t delay_ms, uint32_t armed_token) override
+  {
+    armed[channel] = true;
+    due_ms[channel] = now_ms + delay_ms;
+    token[channel] = armed_token;
+    timers_armed++;
+  }
+
+  void cancel(uint8_t channel) override { armed[channel] = false; }
+
+  // Fires every timer due up to until_ms, in time order, then moves the clock to until_ms
+  void run_until(IndicatorSequencer &sequencer, uint32_t until_ms)
+  {
+    for (;;)
+    {
+      int next = -1;
+      for (uint8_t c = 0; c < INDICATOR_CHANNELS; c++)
+      {
+        if (armed[c] && due_ms[c] <= until_ms && (next < 0 || due_ms[c] < due_ms[next]))
+          next = c;
+      }
+      if (next < 0)
+        break;
+      now_ms = due_ms[next];
+      armed[next] = false;
+      sequencer.on_timer((uint8_t)next, token[next]);
+    }
+    now_ms = until_ms;
+  }
+
+  uint32_t now_ms;
+  uint8_t level[INDICATOR_CHANNELS];
+  uint16_t tone[INDICATOR_CHANNELS];
+  bool armed[INDICATOR_CHANNELS];
+  uint32_t due_ms[INDICATOR_CHANNELS];
+  uint32_t token[INDICATOR_CHANNELS];
+  uint32_t fades;
+  uint16_t last_fade_ms;
+  uint32_t timers_armed;
+  std::vector<ToneChange> tones;
+};
+
+static bool report(const char *name, bool ok, const char *detail)
+{
+  printf("%-8s %s (%s)\n", name, ok ? "ok" : "FAILED", detail);
+  return ok;
+}
+
+static bool test_melody()
+{
+  static const uint16_t notes[] = {262, 294, 330, 349, 392, 440, 494, 523};
+  MockDriver driver;
+  IndicatorSequencer sequencer(driver);
+
+  sequencer.play(IND_BUZZER, &PATTERN_ALARM_MELODY, PRIORITY_MEDICINE_ALARM);
+  driver.run_until(sequencer, 2 * 8 * 240 - 1);
+
+  bool ok = driver.tones.size() == 2 * 2 * 8;
+  for (size_t i = 0; ok && i < driver.tones.size(); i++)
+  {
+    const ToneChange &change = driver.tones[i];
+    uint32_t note = (uint32_t)(i / 2);
+    if (i % 2 == 0)
+      ok = change.frequency == notes[note % 8] && change.at_ms == note * 240;
+    else
+      ok = change.frequency == 0 && change.at_ms == note * 240 + 200;
+  }
+  ok &= driver.timers_armed == sequencer.steps_applied() && driver.armed[IND_BUZZER];
+
+  char detail[96];
+  snprintf(detail, sizeof(detail), "%u tone changes, %u steps, %u timers", (unsigned)driver.tones.size(),
+           sequencer.steps_applied(), driver.timers_armed);
+  return report("melody", ok, detail);
+}
+
+static bool test_steps()
+{
+  static const IndicatorStep STEPS[] = {{STEP_LEVEL, 100, 0}, {STEP_FADE, 0, 500}, {STEP_REST, 0, 0}};
+  static const IndicatorPattern PATTERN = {STEPS, 3, 2};
+  MockDriver driver;
+  IndicatorSequencer sequencer(driver);
+
+  sequencer.play(IND_LED_1, &PATTERN, PRIORITY_NOTIFY);
+  bool ok = driver.fades == 1 && driver.last_fade_ms == 500 && driver.armed[IND_LED_1] &&
+            driver.due_ms[IND_LED_1] == 500;
+  driver.run_until(sequencer, 499);
+  ok &= driver.fades == 1;
+  driver.run_until(sequencer, 500);
+  ok &= driver.fades == 2 && driver.due_ms[IND_LED_1] == 1000;
+  driver.run_until(sequencer, 2000);
+  ok &= sequencer.playing(IND_LED_1) == NULL && !driver.armed[IND_LED_1] && driver.level[IND_LED_1] == 0;
+  ok &= sequencer.steps_applied() == 6 && driver.timers_armed == 2;
+
+  char detail[96];
+  snprintf(detail, sizeof(detail), "%u steps in %u timers, %u fades", sequencer.steps_applied(),
+           driver.timers_armed, driver.fades);
+  return report("steps", ok, detail);
+}
+
+static bool test_preempt()
+{
+  MockDriver driver;
+  IndicatorSequencer sequencer(driver);
+
+  sequencer.play(IND_LED_1, &PATTERN_ENV_WARNING, PRIORITY_ENV_WARNING);
+  driver.run_until(sequencer, 500); // Third step: on again
+  bool ok = driver.level[IND_LED_1] == 255 && driver.due_ms[IND_LED_1] == 600;
+
+  sequencer.play(IND_LED_1, &PATTERN_ALARM_LIGHT, PRIORITY_MEDICINE_ALARM);
+  ok &= sequencer.playing(IND_LED_1) == &PATTERN_ALARM_LIGHT && driver.due_ms[IND_LED_1] == 60500;
+  driver.run_until(sequencer, 30000);
+  ok &= driver.level[IND_LED_1] == 255 && sequencer.playing_priority(IND_LED_1) == PRIORITY_MEDICINE_ALARM;
+
+  // A lower priority request while the alarm plays waits its turn
+  sequencer.play(IND_LED_1, &PATTERN_ENV_WARNING, PRIORITY_ENV_WARNING);
+  ok &= sequencer.playing(IND_LED_1) == &PATTERN_ALARM_LIGHT;
+
+  sequencer.stop(IND_LED_1, PRIORITY_MEDICINE_ALARM);
+  ok &= sequencer.playing(IND_LED_1) == &PATTERN_ENV_WARNING && driver.level[IND_LED_1] == 255 &&
+        driver.due_ms[IND_LED_1] == 30200;
+  driver.run_until(sequencer, 30200);
+  ok &= driver.level[IND_LED_1] == 0;
+
+  sequencer.stop(IND_LED_1, PRIORITY_ENV_WARNING);
+  ok &= sequencer.playing(IND_LED_1) == NULL && !driver.armed[IND_LED_1] && driver.level[IND_LED_1] == 0;
+  return report("preempt", ok, "alarm over warning, warning resumed from its first step");
+}
+
+static bool test_once()
+{
+  MockDriver driver;
+  IndicatorSequencer sequencer(driver);
+
+  sequencer.play(IND_BUZZER, &PATTERN_ALARM_MELODY, PRIORITY_ENV_WARNING);
+  driver.run_until(sequencer, 100);
+  sequencer.play(IND_BUZZER, &PATTERN_SWITCH_BEEP, PRIORITY_NOTIFY);
+  bool ok = driver.tone[IND_BUZZER] == 1000 && driver.due_ms[IND_BUZZER] == 300;
+
+  driver.run_until(sequencer, 300);
+  ok &= sequencer.playing(IND_BUZZER) == &PATTERN_ALARM_MELODY && driver.tone[IND_BUZZER] == 262;
+
+  // Playing the beep again starts it over; it was dropped when it finished
+  sequencer.play(IND_BUZZER, &PATTERN_SWITCH_BEEP, PRIORITY_NOTIFY);
+  ok &= sequencer.playing(IND_BUZZER) == &PATTERN_SWITCH_BEEP && driver.tone[IND_BUZZER] == 1000;
+  return report("once", ok, "beep over the melody, melody back after 200 ms");
+}
+
+static bool test_stale()
+{
+  MockDriver driver;
+  IndicatorSequencer sequencer(driver);
+
+  sequencer.play(IND_BUZZER, &PATTERN_ALARM_MELODY, PRIORITY_MEDICINE_ALARM);
+  driver.run_until(sequencer, 199);
+
+  // The first note's timer fires, but its callback is held up while the alarm is restarted
+  driver.now_ms = 200;
+  driver.armed[IND_BUZZER] = false;
+  uint32_t fired = driver.token[IND_BUZZER];
+  sequencer.stop(IND_BUZZER, PRIORITY_MEDICINE_ALARM);
+  sequencer.play(IND_BUZZER, &PATTERN_ALARM_MELODY, PRIORITY_MEDICINE_ALARM);
+  uint32_t applied = sequencer.steps_applied();
+
+  sequencer.on_timer(IND_BUZZER, fired);
+  bool ok = sequencer.steps_applied() == applied && driver.tone[IND_BUZZER] == 262 &&
+            driver.armed[IND_BUZZER] && driver.due_ms[IND_BUZZER] == 400;
+
+  driver.run_until(sequencer, 400);
+  ok &= driver.tone[IND_BUZZER] == 0 && driver.due_ms[IND_BUZZER] == 440;
+  return report("stale", ok, "first note of the restarted melody played in full");
+}
+
+static bool test_stopped()
+{
+  MockDriver driver;
+  IndicatorSequencer sequencer(driver);
+
+  // The warning's first blink ends, but its callback is held up while the warning is stopped
+  sequencer.play(IND_LED_1, &PATTERN_ENV_WARNING, PRIORITY_ENV_WARNING);
+  driver.run_until(sequencer, 199);
+  driver.now_ms = 200;
+  driver.armed[IND_LED_1] = false;
+  uint32_t fired = driver.token[IND_LED_1];
+  sequencer.stop(IND_LED_1, PRIORITY_ENV_WARNING);
+  uint32_t applied = sequencer.steps_applied();
+  sequencer.on_timer(IND_LED_1, fired);
+  bool ok = sequencer.steps_applied() == applied && sequencer.playing(IND_LED_1) == NULL &&
+            !driver.armed[IND_LED_1] && driver.level[IND_LED_1] == 0;
+
+  // The alarm light's step ends as the alarm is stopped and the warning underneath resumes
+  sequencer.play(IND_LED_1, &PATTERN_ENV_WARNING, PRIORITY_ENV_WARNING);
+  sequencer.play(IND_LED_1, &PATTERN_ALARM_LIGHT, PRIORITY_MEDICINE_ALARM);
+  driver.run_until(sequencer, 60199);
+  driver.now_ms = 60200;
+  driver.armed[IND_LED_1] = false;
+  fired = driver.token[IND_LED_1];
+  sequencer.stop(IND_LED_1, PRIORITY_MEDICINE_ALARM);
+  applied = sequencer.steps_applied();
+  sequencer.on_timer(IND_LED_1, fired);
+  ok &= sequencer.steps_applied() == applied && sequencer.playing(IND_LED_1) == &PATTERN_ENV_WARNING &&
+        driver.level[IND_LED_1] == 255 && driver.due_ms[IND_LED_1] == 60400;
+
+  driver.run_until(sequencer, 60400);
+  ok &= driver.level[IND_LED_1] == 0 && driver.due_ms[IND_LED_1] == 60600;
+  return report("stopped", ok, "stale callbacks after stop dropped, resumed warning blinks in full");
+}
+
+static bool test_breathe()
+{
+  MockDriver driver;
+  IndicatorSequencer sequencer(driver);
+
+  sequencer.play(IND_LED_2, &PATTERN_BREATHE, PRIORITY_NOTIFY);
+  bool ok = driver.fades == 1 && driver.last_fade_ms == 1000 && driver.level[IND_LED_2] == 255 &&
+            driver.due_ms[IND_LED_2] == 1000;
+  driver.run_until(sequencer, 1000);
+  ok &= driver.fades == 2 && driver.level[IND_LED_2] == 0 && driver.due_ms[IND_LED_2] == 2000;
+  driver.run_until(sequencer, 10000);
+  ok &= driver.fades == 11 && driver.level[IND_LED_2] == 255 && sequencer.playing(IND_LED_2) == &PATTERN_BREATHE;
+
+  char detail[96];
+  snprintf(detail, sizeof(detail), "%u fades in 10 s, %u timers", driver.fades, driver.timers_armed);
+  return report("breathe", ok, detail);
+}
+
+static bool test_beep_code()
+{
+  static const uint32_t changes_ms[] = {0, 80, 200, 280, 400, 480};
+  MockDriver driver;
+  IndicatorSequencer sequencer(driver);
+
+  sequencer.play(IND_BUZZER, &PATTERN_BEEP_CODE_ERR, PRIORITY_NOTIFY);
+  driver.run_until(sequencer, 1079);
+  bool ok = sequencer.playing(IND_BUZZER) == &PATTERN_BEEP_CODE_ERR;
+  driver.run_until(sequencer, 5000);
+  ok &= sequencer.playing(IND_BUZZER) == NULL && !driver.armed[IND_BUZZER] && driver.tones.size() == 6;
+  for (size_t i = 0; ok && i < driver.tones.size(); i++)
+    ok = driver.tones[i].at_ms == changes_ms[i] && driver.tones[i].frequency == (i % 2 == 0 ? 2000 : 0);
+
+  char detail[96];
+  snprintf(detail, sizeof(detail), "%u tone changes, %u steps", (unsigned)driver.tones.size(),
+           sequencer.steps_applied());
+  return report("beepcode", ok, detail);
+}
+
+int main()
+{
+  bool ok = test_melody();
+  ok &= test_steps();
+  ok &= test_preempt();
+  ok &= test_once();
+  ok &= test_stale();
+  ok &= test_stopped();
+  ok &= test_breathe();
+  ok &= test_beep_code();
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,397 @@
+/***************************************************************************************************
+ * Adherence journal test (host build, `pio run -e journaltest`)
+ *
+ * Runs lib/AdherenceJournal against a directory standing in for LittleFS:
+ *   batch    records wait in RAM until a batch is full or JOURNAL_COMMIT_MS passed
+ *   reopen   a new journal on the same files continues the sequence and reads everything back
+ *   torn     a half-written record and a corrupt one at the tail are cut off at boot
+ *   tmp      a recovery interrupted before its rename is redone or finished
+ *   rotate   the journal rolls over into the old file; cursors span both and skip what is gone
+ *   faults   failed and partial appends are retried without gaps, duplicates or busy retries
+ *   power    power cut at random byte counts: every boot sees a gap-free prefix of what was written
+ *   stream   MQTT batches fit the packet and their cursors chain without repeats
+ *
+ *   program [dir]   (default: a fresh directory under /tmp)
+ **************************************************************************************************/
+#include <AdherenceJournal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+/***************************************************************************************************
+ * DirFs
+ * JournalFs over a host directory. fail_appends makes the next appends fail; short_append makes the
+ * next one write only that many bytes and fail, like a write cut by a reset.
+ **************************************************************************************************/
+class DirFs : public JournalFs
+{
+public:
+  explicit DirFs(const std::string &dir) : dir_(dir), appends(0), fail_appends(0), short_append(-1) {}
+
+  std::string path(const char *name) const { return dir_ + name; }
+
+  int32_t size(const char *name) override
+  {
+    struct stat st;
+    return stat(path(name).c_str(), &st) == 0 ? (int32_t)st.st_size : -1;
+  }
+
+  bool read(const char *name, uint32_t offset, uint8_t *data, size_t n) override
+  {
+    FILE *f = fopen(path(name).c_str(), "rb");
+    if (!f)
+      return false;
+    bool ok = fseek(f, offset, SEEK_SET) == 0 && fread(data, 1, n, f) == n;
+    fclose(f);
+    return ok;
+  }
+
+  bool append(const char *name, const uint8_t *data, size_t n) override
+  {
+    if (fail_appends > 0)
+    {
+      fail_appends--;
+      return false;
+    }
+    appends++;
+    FILE *f = fopen(path(name).c_str(), "ab");
+    if (!f)
+      return false;
+    size_t want = n;
+    if (short_append >= 0)
+    {
+      want = (size_t)short_append < n ? (size_t)short_append : n;
+      short_append = -1;
+    }
+    bool ok = fwrite(data, 1, want, f) == want && want == n;
+    fclose(f);
+    return ok;
+  }
+
+  bool rename(const char *from, const char *to) override
+  {
+    return ::rename(path(from).c_str(), path(to).c_str()) == 0;
+  }
+
+  bool remove(const char *name) override
+  {
+    return ::remove(path(name).c_str()) == 0;
+  }
+
+  void clear()
+  {
+    remove(JOURNAL_FILE);
+    remove(JOURNAL_OLD_FILE);
+    remove(JOURNAL_TMP_FILE);
+  }
+
+  void raw_append(const char *name, const void *data, size_t n)
+  {
+    FILE *f = fopen(path(name).c_str(), "ab");
+    fwrite(data, 1, n, f);
+    fclose(f);
+  }
+
+  void cut(const char *name, uint32_t length)
+  {
+    if (truncate(path(name).c_str(), length) != 0)
+      perror("truncate");
+  }
+
+  std::string dir_;
+  uint32_t appends;
+  int fail_appends;
+  int short_append;
+};
+
+// The n-th event of a deterministic day: fired, then an answer with a latency
+static void record_event(AdherenceJournal &journal, uint32_t i, uint32_t now_ms)
+{
+  JournalKind kind = i % 2 == 0 ? JOURNAL_FIRED : (JournalKind)(1 + (i / 2) % 3);
+  journal.record(now_ms, 1760000000 + i * 60, kind, (uint8_t)(i / 2 % 3), (i % 7) * 1300);
+}
+
+// Reads the whole journal and checks the records are numbered without gaps from first_seq()
+static bool read_all(AdherenceJournal &journal, std::vector<JournalRecord> &out)
+{
+  out.clear();
+  uint32_t cursor = 0, next = 0;
+  JournalRecord batch[5];
+  while (true)
+  {
+    size_t n = journal.read(cursor, batch, 5, next);
+    if (n == 0)
+      break;
+    out.insert(out.end(), batch, batch + n);
+    cursor = next;
+  }
+  for (size_t i = 0; i < out.size(); i++)
+  {
+    if (out[i].seq != journal.first_seq() + i)
+      return false;
+  }
+  return out.size() == journal.end_seq() - journal.first_seq();
+}
+
+static bool report(const char *name, bool ok, const char *detail)
+{
+  printf("%-8s %s (%s)\n", name, ok ? "ok" : "FAILED", detail);
+  return ok;
+}
+
+static bool test_batch(DirFs &fs)
+{
+  fs.clear();
+  AdherenceJournal journal(fs);
+  bool ok = journal.begin();
+  for (uint32_t i = 0; i < 5; i++)
+    record_event(journal, i, 1000 + i);
+  ok &= !journal.poll(2000) && fs.size(JOURNAL_FILE) == -1;
+  ok &= journal.poll(1000 + JOURNAL_COMMIT_MS) && journal.end_seq() == 6 && journal.pending() == 0;
+  for (uint32_t i = 5; i < 5 + JOURNAL_BATCH; i++)
+    record_event(journal, i, 100000);
+  ok &= journal.poll(100001) && journal.end_seq() == 6 + JOURNAL_BATCH;
+
+  JournalStats stats = journal.stats();
+  char detail[96];
+  snprintf(detail, sizeof(detail), "%u events in %u writes", stats.committed, stats.commits);
+  return report("batch", ok && stats.commits == 2 && fs.appends == 2, detail);
+}
+
+static bool test_reopen(DirFs &fs)
+{
+  AdherenceJournal journal(fs);
+  std::vector<JournalRecord> records;
+  bool ok = journal.begin() && read_all(journal, records) && records.size() == 5 + JOURNAL_BATCH;
+  ok &= records.size() > 3 && records[0].kind == JOURNAL_FIRED && records[0].latency_ds == JOURNAL_NO_LATENCY &&
+        records[3].kind == JOURNAL_SNOOZED && records[3].latency_ds == 39 && records[3].alarm == 1;
+
+  record_event(journal, 100, 0);
+  ok &= journal.commit() && journal.end_seq() == 7 + JOURNAL_BATCH;
+  return report("reopen", ok, "sequence continues after a reboot");
+}
+
+static bool test_torn(DirFs &fs)
+{
+  int32_t before = fs.size(JOURNAL_FILE);
+  JournalRecord bad = {(uint32_t)(7 + JOURNAL_BATCH), 1, JOURNAL_DISMISSED, 0, 10};
+  uint8_t bytes[JOURNAL_RECORD_SIZE];
+  journal_encode(bad, bytes);
+  bytes[5] ^= 0x40; // Corrupt, CRC no longer matches
+  fs.raw_append(JOURNAL_FILE, bytes, sizeof(bytes));
+  fs.raw_append(JOURNAL_FILE, bytes, 7); // And half a record after it
+
+  AdherenceJournal journal(fs);
+  std::vector<JournalRecord> records;
+  bool ok = journal.begin() && fs.size(JOURNAL_FILE) == before && read_all(journal, records);
+  ok &= journal.stats().recovered_bytes == JOURNAL_RECORD_SIZE + 7 && journal.end_seq() == 7 + JOURNAL_BATCH;
+  record_event(journal, 101, 0);
+  ok &= journal.commit() && read_all(journal, records);
+  return report("torn", ok, "23 bytes cut off, appends resume");
+}
+
+static bool test_tmp(DirFs &fs)
+{
+  int32_t before = fs.size(JOURNAL_FILE);
+  fs.raw_append(JOURNAL_TMP_FILE, "partial copy", 12);
+  fs.raw_append(JOURNAL_FILE, "xyz", 3);
+
+  AdherenceJournal journal(fs);
+  std::vector<JournalRecord> records;
+  bool ok = journal.begin() && fs.size(JOURNAL_TMP_FILE) == -1 && fs.size(JOURNAL_FILE) == before &&
+            read_all(journal, records);
+
+  // Cut between removing the journal and renaming the finished copy over it
+  fs.cut(JOURNAL_FILE, (uint32_t)before - JOURNAL_RECORD_SIZE);
+  AdherenceJournal shorter(fs);
+  ok &= shorter.begin() && shorter.end_seq() == journal.end_seq() - 1;
+  fs.rename(JOURNAL_FILE, JOURNAL_TMP_FILE);
+  AdherenceJournal renamed(fs);
+  ok &= renamed.begin() && fs.size(JOURNAL_TMP_FILE) == -1 && renamed.end_seq() == shorter.end_seq() &&
+        read_all(renamed, records);
+  return report("tmp", ok, "stale copy discarded, finished copy renamed into place");
+}
+
+static bool test_rotate(DirFs &fs)
+{
+  fs.clear();
+  AdherenceJournal journal(fs);
+  bool ok = journal.begin();
+  const uint32_t per_file = JOURNAL_MAX_BYTES / JOURNAL_RECORD_SIZE;
+  uint32_t total = per_file * 2 + per_file / 2;
+  for (uint32_t i = 0; i < total; i++)
+  {
+    record_event(journal, i, i);
+    if (journal.pending() == JOURNAL_BATCH)
+      ok &= journal.commit();
+  }
+  ok &= journal.commit();
+
+  std::vector<JournalRecord> records;
+  ok &= read_all(journal, records) && journal.stats().rotations == 2 && journal.end_seq() == total + 1;
+  ok &= journal.first_seq() > 1 && records.size() <= 2 * per_file;
+
+  // An old cursor starts at the oldest kept record; a reboot finds the same span
+  uint32_t next = 0;
+  JournalRecord r;
+  ok &= journal.read(1, &r, 1, next) == 1 && r.seq == journal.first_seq() && next == r.seq + 1;
+  AdherenceJournal again(fs);
+  ok &= again.begin() && again.first_seq() == journal.first_seq() && again.end_seq() == journal.end_seq();
+
+  char detail[96];
+  snprintf(detail, sizeof(detail), "%u written, %zu kept from seq %u", total, records.size(), journal.first_seq());
+  return report("rotate", ok, detail);
+}
+
+static bool test_faults(DirFs &fs)
+{
+  fs.clear();
+  AdherenceJournal journal(fs);
+  bool ok = journal.begin();
+  for (uint32_t i = 0; i < JOURNAL_BATCH; i++)
+    record_event(journal, i, 0);
+
+  fs.fail_appends = 1;
+  ok &= !journal.poll(1) && journal.pending() == JOURNAL_BATCH;
+  uint32_t appends = fs.appends;
+  ok &= !journal.poll(2) && fs.appends == appends; // Waits before retrying
+  ok &= journal.poll(1 + JOURNAL_COMMIT_MS) && journal.end_seq() == JOURNAL_BATCH + 1;
+
+  for (uint32_t i = 0; i < JOURNAL_BATCH; i++)
+    record_event(journal, 100 + i, 0);
+  fs.short_append = JOURNAL_RECORD_SIZE * 3 + 5; // Three records and a bit reach the file
+  ok &= !journal.commit();
+  ok &= journal.commit(); // Rescans, cuts the partial record, writes the other five
+
+  std::vector<JournalRecord> records;
+  ok &= read_all(journal, records) && records.size() == JOURNAL_BATCH * 2;
+  for (size_t k = JOURNAL_BATCH; k < records.size(); k++)
+    ok &= records[k].epoch == 1760000000 + (100 + k - JOURNAL_BATCH) * 60;
+  AdherenceJournal again(fs);
+  ok &= again.begin() && again.end_seq() == journal.end_seq() && again.stats().recovered_bytes == 0;
+  return report("faults", ok, "retry after a failed write, partial write completed without duplicates");
+}
+
+static bool test_power(DirFs &fs, uint32_t rounds)
+{
+  std::mt19937 rng(41);
+  uint32_t boots = 0, cut_records = 0;
+  bool ok = true;
+  for (uint32_t round = 0; round < rounds && ok; round++)
+  {
+    fs.clear();
+    std::vector<uint32_t> epochs; // epoch of every committed record, by seq - 1
+    uint32_t i = 0;
+    for (int boot = 0; boot < 6 && ok; boot++, boots++)
+    {
+      AdherenceJournal journal(fs);
+      std::vector<JournalRecord> records;
+      ok &= journal.begin() && read_all(journal, records) && journal.end_seq() <= epochs.size() + 1;
+      for (const JournalRecord &r : records)
+        ok &= r.seq <= epochs.size() && r.epoch == epochs[r.seq - 1];
+      cut_records += (uint32_t)(epochs.size() + 1 - journal.end_seq());
+      epochs.resize(journal.end_seq() - 1);
+
+      uint32_t n = rng() % 40;
+      for (uint32_t k = 0; k < n; k++, i++)
+      {
+        record_event(journal, i, 0);
+        epochs.push_back(1760000000 + i * 60);
+        if (journal.pending() == JOURNAL_BATCH)
+          ok &= journal.commit();
+      }
+      ok &= journal.commit();
+
+      int32_t size = fs.size(JOURNAL_FILE);
+      if (size > 0 && rng() % 2)
+        fs.cut(JOURNAL_FILE, rng() % (uint32_t)size); // Power lost: the file keeps only some bytes
+    }
+  }
+  char detail[96];
+  snprintf(detail, sizeof(detail), "%u boots after random cuts, %u records lost with the cuts", boots, cut_records);
+  return report("power", ok, detail);
+}
+
+static bool test_stream(DirFs &fs)
+{
+  fs.clear();
+  AdherenceJournal journal(fs);
+  bool ok = journal.begin();
+  for (uint32_t i = 0; i < 50; i++)
+  {
+    record_event(journal, i, 0);
+    journal.poll(0);
+  }
+  ok &= journal.commit();
+
+  // As the firmware does: read a few, send what fits, continue from "next"
+  uint32_t cursor = journal.first_seq(), messages = 0, events = 0, longest = 0;
+  bool end = false;
+  while (!end && messages < 100)
+  {
+    JournalRecord records[6];
+    uint32_t next;
+    size_t n = journal.read(cursor, records, 6, next);
+    size_t included;
+    char json[200];
+    size_t len = format_journal_batch(json, sizeof(json), records, n, next, next == journal.end_seq(), included);
+    ok &= len > 0 && (included > 0 || n == 0);
+    const char *p = strstr(json, "\"next\":");
+    uint32_t continue_at = p ? (uint32_t)strtoul(p + 7, NULL, 10) : 0;
+    ok &= continue_at == cursor + included || (n == 0 && continue_at == next);
+    end = strstr(json, "\"end\":true") != NULL;
+    if (messages == 0)
+      printf("         first message: %s\n", json);
+    cursor = continue_at;
+    events += (uint32_t)included;
+    longest = len > longest ? (uint32_t)len : longest;
+    messages++;
+  }
+  ok &= end && events == 50 && cursor == journal.end_seq();
+
+  char detail[96];
+  snprintf(detail, sizeof(detail), "50 events in %u messages, longest %u bytes", messages, longest);
+  return report("stream", ok, detail);
+}
+
+int main(int argc, char **argv)
+{
+  std::string dir;
+  if (argc > 1)
+  {
+    dir = argv[1];
+  }
+  else
+  {
+    char tmpl[] = "/tmp/journaltest.XXXXXX";
+    if (!mkdtemp(tmpl))
+    {
+      perror("mkdtemp");
+      return 2;
+    }
+    dir = tmpl;
+  }
+  DirFs fs(dir);
+  printf("journal files in %s\n", dir.c_str());
+
+  bool ok = test_batch(fs);
+  ok &= test_reopen(fs);
+  ok &= test_torn(fs);
+  ok &= test_tmp(fs);
+  ok &= test_rotate(fs);
+  ok &= test_faults(fs);
+  ok &= test_power(fs, 200);
+  ok &= test_stream(fs);
+  fs.clear();
+  if (argc <= 1)
+    rmdir(dir.c_str());
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
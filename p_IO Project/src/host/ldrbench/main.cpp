@@ -0,0 +1,161 @@
+/***************************************************************************************************
+ * LDR filter benchmark (host build, `pio run -e ldrbench`)
+ *
+ * Runs the acquisition kernels from lib/LdrFilter over a noise trace and reports how much noise
+ * they remove and how fast they run.
+ *
+ *   program [trace.txt] [--burst N] [--decim LOG2] [--ema SHIFT]
+ *
+ * A trace is one raw 12-bit conversion per line, e.g. captured from the board at the DMA rate.
+ * Without a trace a synthetic one is generated: a slow light ramp plus Gaussian noise and
+ * occasional large spikes, roughly what the ESP32 ADC produces on a long LDR lead.
+ **************************************************************************************************/
+#include <LdrFilter.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+
+struct Trace
+{
+  std::vector<uint16_t> raw;
+  std::vector<double> truth; // Empty for recorded traces
+};
+
+static bool load_trace(const char *path, Trace &trace)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  unsigned value;
+  while (fscanf(f, "%u", &value) == 1)
+    trace.raw.push_back((uint16_t)(value > 4095 ? 4095 : value));
+  fclose(f);
+  return !trace.raw.empty();
+}
+
+static void synth_trace(Trace &trace, size_t n)
+{
+  std::mt19937 rng(1234);
+  std::normal_distribution<double> noise(0.0, 25.0);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  for (size_t i = 0; i < n; i++)
+  {
+    double truth = 1500.0 + 1000.0 * sin((double)i / (double)n * 6.283);
+    double x = truth + noise(rng);
+    if (uniform(rng) < 0.01)
+      x += uniform(rng) < 0.5 ? -600.0 : 600.0;
+    x = x < 0 ? 0 : (x > 4095 ? 4095 : x);
+    trace.raw.push_back((uint16_t)lround(x));
+    trace.truth.push_back(truth);
+  }
+}
+
+static double rms(const std::vector<double> &errors)
+{
+  double sum = 0;
+  for (double e : errors)
+    sum += e * e;
+  return errors.empty() ? 0.0 : sqrt(sum / errors.size());
+}
+
+int main(int argc, char **argv)
+{
+  const char *trace_path = nullptr;
+  size_t burst = 256;
+  int log2_decim = 6;
+  int ema_shift = 3;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--burst") == 0 && i + 1 < argc)
+      burst = (size_t)atoi(argv[++i]);
+    else if (strcmp(argv[i], "--decim") == 0 && i + 1 < argc)
+      log2_decim = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--ema") == 0 && i + 1 < argc)
+      ema_shift = atoi(argv[++i]);
+    else if (argv[i][0] != '-')
+      trace_path = argv[i];
+    else
+    {
+      fprintf(stderr, "usage: %s [trace.txt] [--burst N] [--decim LOG2] [--ema SHIFT]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (burst == 0 || burst > LDR_FILTER_MAX_BURST || log2_decim < 0 || log2_decim > 10 ||
+      ((size_t)1 << log2_decim) > burst)
+  {
+    fprintf(stderr, "burst must be 1..%d and at least 2^decim\n", LDR_FILTER_MAX_BURST);
+    return 2;
+  }
+
+  Trace trace;
+  if (trace_path)
+  {
+    if (!load_trace(trace_path, trace))
+    {
+      fprintf(stderr, "cannot read trace %s\n", trace_path);
+      return 1;
+    }
+  }
+  else
+  {
+    synth_trace(trace, 1 << 20);
+  }
+  size_t bursts = trace.raw.size() / burst;
+
+  // Accuracy: one filtered value per burst against the single-sample reading it replaces
+  LdrFilterState state;
+  ldr_filter_init(state, (uint8_t)log2_decim, (uint8_t)ema_shift);
+  std::vector<uint16_t> scratch(burst);
+  std::vector<double> raw_error, filtered_error, raw_step, filtered_step;
+  double prev_raw = 0, prev_filtered = 0;
+
+  for (size_t b = 0; b < bursts; b++)
+  {
+    const uint16_t *samples = &trace.raw[b * burst];
+    double filtered = ldr_filter_burst(state, samples, burst, scratch.data()) / (double)(1 << LDR_FILTER_Q);
+    double single = samples[burst - 1];
+
+    if (!trace.truth.empty())
+    {
+      double truth = trace.truth[b * burst + burst - 1];
+      raw_error.push_back(single - truth);
+      filtered_error.push_back(filtered - truth);
+    }
+    if (b > 0)
+    {
+      raw_step.push_back(single - prev_raw);
+      filtered_step.push_back(filtered - prev_filtered);
+    }
+    prev_raw = single;
+    prev_filtered = filtered;
+  }
+
+  printf("trace: %zu samples (%s), burst=%zu decim=%d ema=1/%d\n", trace.raw.size(),
+         trace_path ? trace_path : "synthetic", burst, 1 << log2_decim, 1 << ema_shift);
+  if (!trace.truth.empty())
+    printf("error vs truth (LSB rms):   single read %.2f, filtered %.2f\n", rms(raw_error), rms(filtered_error));
+  printf("reading-to-reading jitter:  single read %.2f, filtered %.2f LSB rms\n", rms(raw_step), rms(filtered_step));
+
+  // Throughput over the whole trace, repeated until it runs long enough to time
+  const int repeats = (int)(8000000 / trace.raw.size()) + 1;
+  uint32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeats; r++)
+  {
+    ldr_filter_init(state, (uint8_t)log2_decim, (uint8_t)ema_shift);
+    for (size_t b = 0; b < bursts; b++)
+      sink += ldr_filter_burst(state, &trace.raw[b * burst], burst, scratch.data());
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  double samples = (double)repeats * bursts * burst;
+  printf("throughput: %.1f Msamples/s, %.2f ns/sample, %.2f us/burst (checksum %u)\n", samples / seconds / 1e6,
+         seconds * 1e9 / samples, seconds * 1e6 / ((double)repeats * bursts), sink);
+  return 0;
+}
@@ -0,0 +1,490 @@
+/***************************************************************************************************
+ * Medibox fleet load generator (host build, `pio run -e loadgen`)
+ *
+ * Simulates many boxes against a local broker. Each simulated box uses the firmware's own topic
+ * namespace, light payload format and config handling (MediboxMqtt / MediboxConfig), publishes its
+ * retained light average on a fixed interval and answers config documents with an ack.
+ * A controller client subscribes to the whole fleet, measures publish-to-delivery latency and
+ * config round trips, and reports broker throughput at the end of the run.
+ *
+ *   .pio/build/loadgen/program --boxes 2000 --threads 8 --interval 1000 --duration 60
+ **************************************************************************************************/
+#include <MediboxConfig.h>
+#include <MediboxMqtt.h>
+#include <mosquitto.h>
+
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+struct LoadgenOptions
+{
+  const char *host = "127.0.0.1";
+  int port = 1883;
+  int boxes = 1000;
+  int threads = 0;        // 0 = one per core
+  int interval_ms = 1000; // Light publish interval per box
+  int duration_s = 30;
+  int configs_per_s = 20; // Config documents sent by the controller
+  int qos = 0;
+};
+
+struct SimBox
+{
+  struct mosquitto *mosq;
+  MediboxTopics topics;
+  MediboxConfig config;
+  int index;
+  bool connected;
+  uint64_t next_publish_ns;
+  float phase;
+};
+
+struct RunStats
+{
+  std::atomic<uint64_t> published{0};
+  std::atomic<uint64_t> delivered{0};
+  std::atomic<uint64_t> configs_sent{0};
+  std::atomic<uint64_t> acks{0};
+  std::atomic<uint64_t> connect_failures{0};
+  std::atomic<int> connected{0};
+};
+
+static LoadgenOptions options;
+static RunStats stats;
+static std::atomic<bool> stop_requested{false};
+
+// Send timestamps indexed by box, read back by the controller when the message arrives
+static std::unique_ptr<std::atomic<uint64_t>[]> light_sent_ns;
+static std::unique_ptr<std::atomic<uint64_t>[]> config_sent_ns;
+
+// Only touched from the controller's network thread while the run is active
+static std::vector<uint32_t> delivery_latency_us;
+static std::vector<uint32_t> config_rtt_us;
+static std::mutex results_mutex;
+
+static uint64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/***************************************************************************************************
+ * sim_device_id()
+ * Simulated boxes get locally administered MACs 02:00:00:xx:xx:xx so the index is recoverable
+ * from the device id in any topic.
+ **************************************************************************************************/
+static void sim_device_id(int index, char *device_id, size_t size)
+{
+  uint8_t mac[6] = {0x02, 0x00, 0x00, (uint8_t)(index >> 16), (uint8_t)(index >> 8), (uint8_t)index};
+  make_device_id(mac, device_id, size);
+}
+
+static int box_index_from_topic(const char *topic)
+{
+  char device_id[DEVICE_ID_LEN];
+  if (!device_id_from_topic(topic, device_id, sizeof(device_id)) || strlen(device_id) != 16)
+    return -1;
+  int index = (int)strtol(device_id + 10, nullptr, 16);
+  return index < options.boxes ? index : -1;
+}
+
+/***************************************************************************************************
+ * Simulated box callbacks
+ * Run on the worker thread that owns the box, exactly like the firmware's single loop.
+ **************************************************************************************************/
+static void box_on_connect(struct mosquitto *mosq, void *obj, int rc)
+{
+  SimBox *box = (SimBox *)obj;
+  if (rc != 0)
+  {
+    stats.connect_failures++;
+    return;
+  }
+  box->connected = true;
+  stats.connected++;
+  mosquitto_subscribe(mosq, nullptr, box->topics.config, 1);
+}
+
+static void box_on_disconnect(struct mosquitto *, void *obj, int)
+{
+  SimBox *box = (SimBox *)obj;
+  if (box->connected)
+  {
+    box->connected = false;
+    stats.connected--;
+  }
+}
+
+static void box_on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *msg)
+{
+  SimBox *box = (SimBox *)obj;
+  if (strcmp(msg->topic, box->topics.config) != 0)
+    return;
+
+  ConfigUpdate update;
+  ConfigStatus status =
+      parse_config_update((const uint8_t *)msg->payload, (size_t)msg->payloadlen, box->config, update);
+  if (status == CONFIG_OK)
+  {
+    box->config = update.next;
+    box->config.version++;
+  }
+
+  char ack[96];
+  size_t len = format_config_ack(ack, sizeof(ack), box->config, status, update);
+  mosquitto_publish(mosq, nullptr, box->topics.config_ack, (int)len, ack, 1, false);
+}
+
+/***************************************************************************************************
+ * publish_light()
+ * Synthetic daylight curve plus noise, formatted exactly like publish_light_average().
+ **************************************************************************************************/
+static void publish_light(SimBox &box, uint64_t now, std::minstd_rand &rng)
+{
+  std::uniform_real_distribution<float> noise(-0.05f, 0.05f);
+  float t = (float)(now / 1000000ULL) / 60000.0f;
+  float light = 0.5f + 0.4f * sinf(t + box.phase) + noise(rng);
+  light = std::min(1.0f, std::max(0.0f, light));
+
+  char payload[16];
+  size_t len = format_light_average(payload, sizeof(payload), light);
+
+  light_sent_ns[box.index].store(now, std::memory_order_relaxed);
+  if (mosquitto_publish(box.mosq, nullptr, box.topics.light, (int)len, payload, options.qos, true) ==
+      MOSQ_ERR_SUCCESS)
+  {
+    stats.published++;
+  }
+}
+
+/***************************************************************************************************
+ * run_worker()
+ * Owns a slice of the fleet and drives all of its sockets from one poll() loop.
+ **************************************************************************************************/
+static void run_worker(std::vector<SimBox> *fleet, int begin, int end, uint64_t start_ns)
+{
+  const uint64_t interval_ns = (uint64_t)options.interval_ms * 1000000ULL;
+  std::minstd_rand rng(begin + 1);
+  std::vector<struct pollfd> fds(end - begin);
+
+  for (int i = begin; i < end; i++)
+  {
+    SimBox &box = (*fleet)[i];
+    // Stagger the first publish so the fleet does not fire in lock-step
+    box.next_publish_ns = start_ns + interval_ns * (uint64_t)i / (uint64_t)options.boxes;
+    if (mosquitto_connect(box.mosq, options.host, options.port, 60) != MOSQ_ERR_SUCCESS)
+    {
+      stats.connect_failures++;
+    }
+  }
+
+  while (!stop_requested.load(std::memory_order_relaxed))
+  {
+    uint64_t now = now_ns();
+    for (int i = begin; i < end; i++)
+    {
+      SimBox &box = (*fleet)[i];
+      if (box.connected && now >= box.next_publish_ns)
+      {
+        publish_light(box, now, rng);
+        box.next_publish_ns += interval_ns;
+      }
+
+      struct pollfd &fd = fds[i - begin];
+      fd.fd = mosquitto_socket(box.mosq);
+      fd.events = POLLIN | (mosquitto_want_write(box.mosq) ? POLLOUT : 0);
+      fd.revents = 0;
+    }
+
+    poll(fds.data(), fds.size(), 2);
+
+    for (int i = begin; i < end; i++)
+    {
+      SimBox &box = (*fleet)[i];
+      struct pollfd &fd = fds[i - begin];
+      if (fd.fd < 0)
+      {
+        mosquitto_reconnect(box.mosq);
+        continue;
+      }
+      if (fd.revents & (POLLIN | POLLHUP | POLLERR))
+        mosquitto_loop_read(box.mosq, 1);
+      if (fd.revents & POLLOUT)
+        mosquitto_loop_write(box.mosq, 1);
+      mosquitto_loop_misc(box.mosq);
+    }
+  }
+
+  for (int i = begin; i < end; i++)
+  {
+    mosquitto_disconnect((*fleet)[i].mosq);
+  }
+}
+
+/***************************************************************************************************
+ * Controller callbacks
+ * Runs on libmosquitto's network thread; matches arrivals to the recorded send timestamps.
+ **************************************************************************************************/
+static void controller_on_connect(struct mosquitto *mosq, void *, int rc)
+{
+  if (rc == 0)
+  {
+    mosquitto_subscribe(mosq, nullptr, MEDIBOX_TOPIC_ROOT "/+/light", options.qos);
+    mosquitto_subscribe(mosq, nullptr, MEDIBOX_TOPIC_ROOT "/+/config/ack", 1);
+  }
+}
+
+static void controller_on_message(struct mosquitto *, void *, const struct mosquitto_message *msg)
+{
+  if (msg->retain)
+    return; // Retained copies from a previous run carry no timing information
+
+  uint64_t now = now_ns();
+  int index = box_index_from_topic(msg->topic);
+  if (index < 0)
+    return;
+
+  bool matches = false;
+  mosquitto_topic_matches_sub(MEDIBOX_TOPIC_ROOT "/+/light", msg->topic, &matches);
+  if (matches)
+  {
+    uint64_t sent = light_sent_ns[index].load(std::memory_order_relaxed);
+    stats.delivered++;
+    if (sent != 0 && now > sent)
+    {
+      std::lock_guard<std::mutex> lock(results_mutex);
+      delivery_latency_us.push_back((uint32_t)std::min<uint64_t>((now - sent) / 1000, UINT32_MAX));
+    }
+    return;
+  }
+
+  uint64_t sent = config_sent_ns[index].exchange(0, std::memory_order_relaxed);
+  stats.acks++;
+  if (sent != 0 && now > sent)
+  {
+    std::lock_guard<std::mutex> lock(results_mutex);
+    config_rtt_us.push_back((uint32_t)std::min<uint64_t>((now - sent) / 1000, UINT32_MAX));
+  }
+}
+
+/***************************************************************************************************
+ * send_random_config()
+ * Pushes a small config document to a random box, the same shape the dashboard sends.
+ **************************************************************************************************/
+static void send_random_config(struct mosquitto *controller, std::minstd_rand &rng)
+{
+  std::uniform_int_distribution<int> pick(0, options.boxes - 1);
+  std::uniform_int_distribution<int> tu(60, 600);
+  int index = pick(rng);
+
+  char device_id[DEVICE_ID_LEN];
+  MediboxTopics topics;
+  sim_device_id(index, device_id, sizeof(device_id));
+  build_topics(topics, device_id);
+
+  char doc[48];
+  int len = snprintf(doc, sizeof(doc), "{\"ts\":5,\"tu\":%d,\"gamma\":0.75}", tu(rng));
+  config_sent_ns[index].store(now_ns(), std::memory_order_relaxed);
+  if (mosquitto_publish(controller, nullptr, topics.config, len, doc, 1, false) == MOSQ_ERR_SUCCESS)
+  {
+    stats.configs_sent++;
+  }
+}
+
+static double percentile_ms(std::vector<uint32_t> &samples, double p)
+{
+  if (samples.empty())
+    return 0.0;
+  size_t k = (size_t)std::min<double>(samples.size() - 1, p * (samples.size() - 1) + 0.5);
+  std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+  return samples[k] / 1000.0;
+}
+
+static void print_latency(const char *label, std::vector<uint32_t> &samples)
+{
+  if (samples.empty())
+  {
+    printf("%-24s no samples\n", label);
+    return;
+  }
+  double p50 = percentile_ms(samples, 0.50);
+  double p90 = percentile_ms(samples, 0.90);
+  double p99 = percentile_ms(samples, 0.99);
+  double max = *std::max_element(samples.begin(), samples.end()) / 1000.0;
+  printf("%-24s n=%zu p50=%.2f p90=%.2f p99=%.2f max=%.2f ms\n", label, samples.size(), p50, p90, p99,
+         max);
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s [--host H] [--port P] [--boxes N] [--threads T] [--interval MS]\n"
+          "          [--duration S] [--configs-per-s C] [--qos 0|1]\n",
+          argv0);
+}
+
+static bool parse_options(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const char *arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    const char *value = argv[++i];
+
+    if (strcmp(arg, "--host") == 0)
+      options.host = value;
+    else if (strcmp(arg, "--port") == 0)
+      options.port = atoi(value);
+    else if (strcmp(arg, "--boxes") == 0)
+      options.boxes = atoi(value);
+    else if (strcmp(arg, "--threads") == 0)
+      options.threads = atoi(value);
+    else if (strcmp(arg, "--interval") == 0)
+      options.interval_ms = atoi(value);
+    else if (strcmp(arg, "--duration") == 0)
+      options.duration_s = atoi(value);
+    else if (strcmp(arg, "--configs-per-s") == 0)
+      options.configs_per_s = atoi(value);
+    else if (strcmp(arg, "--qos") == 0)
+      options.qos = atoi(value);
+    else
+      return false;
+  }
+  return options.boxes > 0 && options.boxes <= 0xffffff && options.interval_ms > 0 && options.duration_s > 0;
+}
+
+static void on_signal(int)
+{
+  stop_requested = true;
+}
+
+int main(int argc, char **argv)
+{
+  if (!parse_options(argc, argv))
+  {
+    usage(argv[0]);
+    return 2;
+  }
+  if (options.threads <= 0)
+    options.threads = (int)std::max(1u, std::thread::hardware_concurrency());
+  options.threads = std::min(options.threads, options.boxes);
+
+  signal(SIGINT, on_signal);
+  mosquitto_lib_init();
+
+  light_sent_ns.reset(new std::atomic<uint64_t>[options.boxes]());
+  config_sent_ns.reset(new std::atomic<uint64_t>[options.boxes]());
+
+  std::vector<SimBox> fleet(options.boxes);
+  for (int i = 0; i < options.boxes; i++)
+  {
+    SimBox &box = fleet[i];
+    char device_id[DEVICE_ID_LEN];
+    sim_device_id(i, device_id, sizeof(device_id));
+    build_topics(box.topics, device_id);
+    box.config = config_defaults();
+    box.index = i;
+    box.connected = false;
+    box.phase = (float)i;
+    box.mosq = mosquitto_new(box.topics.device_id, true, &box);
+    if (!box.mosq)
+    {
+      fprintf(stderr, "mosquitto_new failed for box %d\n", i);
+      return 1;
+    }
+    mosquitto_connect_callback_set(box.mosq, box_on_connect);
+    mosquitto_disconnect_callback_set(box.mosq, box_on_disconnect);
+    mosquitto_message_callback_set(box.mosq, box_on_message);
+  }
+
+  struct mosquitto *controller = mosquitto_new("medibox-loadgen-controller", true, nullptr);
+  mosquitto_connect_callback_set(controller, controller_on_connect);
+  mosquitto_message_callback_set(controller, controller_on_message);
+  int rc = mosquitto_connect(controller, options.host, options.port, 60);
+  if (rc != MOSQ_ERR_SUCCESS)
+  {
+    fprintf(stderr, "controller connect to %s:%d failed: %s\n", options.host, options.port,
+            mosquitto_strerror(rc));
+    return 1;
+  }
+  mosquitto_loop_start(controller);
+
+  printf("Simulating %d boxes on %d threads against %s:%d (interval %d ms, %d s)\n", options.boxes,
+         options.threads, options.host, options.port, options.interval_ms, options.duration_s);
+
+  uint64_t start_ns = now_ns();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < options.threads; t++)
+  {
+    int begin = (int)((int64_t)options.boxes * t / options.threads);
+    int end = (int)((int64_t)options.boxes * (t + 1) / options.threads);
+    workers.emplace_back(run_worker, &fleet, begin, end, start_ns);
+  }
+
+  std::minstd_rand rng(42);
+  const uint64_t run_ns = (uint64_t)options.duration_s * 1000000000ULL;
+  uint64_t next_config_ns = start_ns;
+  uint64_t next_report_ns = start_ns + 1000000000ULL;
+  while (!stop_requested && now_ns() - start_ns < run_ns)
+  {
+    uint64_t now = now_ns();
+    if (options.configs_per_s > 0 && now >= next_config_ns)
+    {
+      send_random_config(controller, rng);
+      next_config_ns += 1000000000ULL / options.configs_per_s;
+    }
+    if (now >= next_report_ns)
+    {
+      printf("  t=%3llus connected=%d published=%llu delivered=%llu\n",
+             (unsigned long long)((now - start_ns) / 1000000000ULL), stats.connected.load(),
+             (unsigned long long)stats.published.load(), (unsigned long long)stats.delivered.load());
+      fflush(stdout);
+      next_report_ns += 1000000000ULL;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  double elapsed_s = (now_ns() - start_ns) / 1e9;
+
+  stop_requested = true;
+  for (std::thread &worker : workers)
+    worker.join();
+
+  // Give in-flight deliveries a moment before closing the controller
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  mosquitto_disconnect(controller);
+  mosquitto_loop_stop(controller, false);
+
+  std::lock_guard<std::mutex> lock(results_mutex);
+  uint64_t published = stats.published.load();
+  uint64_t delivered = stats.delivered.load();
+  printf("\nboxes=%d threads=%d elapsed=%.1fs connect_failures=%llu\n", options.boxes, options.threads,
+         elapsed_s, (unsigned long long)stats.connect_failures.load());
+  printf("%-24s %llu (%.0f msg/s)\n", "published", (unsigned long long)published, published / elapsed_s);
+  printf("%-24s %llu (%.0f msg/s, %.2f%% of published)\n", "delivered", (unsigned long long)delivered,
+         delivered / elapsed_s, published ? 100.0 * delivered / published : 0.0);
+  printf("%-24s %llu sent, %llu acked\n", "config documents", (unsigned long long)stats.configs_sent.load(),
+         (unsigned long long)stats.acks.load());
+  print_latency("publish->delivery", delivery_latency_us);
+  print_latency("config round trip", config_rtt_us);
+
+  for (SimBox &box : fleet)
+    mosquitto_destroy(box.mosq);
+  mosquitto_destroy(controller);
+  mosquitto_lib_cleanup();
+  return 0;
+}
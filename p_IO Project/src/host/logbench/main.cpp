@@ -0,0 +1,172 @@
+/***************************************************************************************************
+ * Sample log benchmark (host build, `pio run -e logbench`)
+ *
+ * Feeds traces through lib/SampleLog and reports compression against the firmware's old float
+ * buffer, encode/decode throughput and the worst round-trip error.
+ *
+ *   program [trace.txt scale] ...
+ *
+ * A trace is one "timestamp value" pair per line (epoch seconds), e.g. exported from the telemetry
+ * store with `telemetry query --dump`. scale is the quantisation the firmware uses for that
+ * metric (4095 light, 10 temperature/humidity, 0 for lossless float XOR). Without arguments,
+ * synthetic light, temperature and humidity traces sampled every 5 s are used, plus a trace of
+ * random jumps and clock steps that checks every bucket edge round-trips.
+ **************************************************************************************************/
+#include <SampleLog.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+struct Trace
+{
+  std::string name;
+  float scale;
+  std::vector<uint32_t> t;
+  std::vector<float> v;
+};
+
+static bool load_trace(const char *path, float scale, Trace &trace)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  trace.name = path;
+  trace.scale = scale;
+  double t, v;
+  while (fscanf(f, "%lf %lf", &t, &v) == 2)
+  {
+    trace.t.push_back((uint32_t)t);
+    trace.v.push_back((float)v);
+  }
+  fclose(f);
+  return !trace.t.empty();
+}
+
+/***************************************************************************************************
+ * synth_traces()
+ * A day-shaped light curve with cloud noise (quantised to ADC steps the way LdrAcquisition
+ * reports it), slow temperature and humidity drifts read at DHT22 resolution, and sampling
+ * jitter of a second now and then.
+ **************************************************************************************************/
+static void synth_traces(std::vector<Trace> &traces, size_t n)
+{
+  std::mt19937 rng(42);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  Trace light{"synthetic light", 4095.0f, {}, {}};
+  Trace temp{"synthetic temperature", 10.0f, {}, {}};
+  Trace hum{"synthetic humidity", 10.0f, {}, {}};
+  Trace raw{"synthetic temperature (float XOR)", 0.0f, {}, {}};
+  Trace steps{"synthetic steps and gaps (bucket edges)", 100.0f, {}, {}};
+
+  uint32_t t = 1760000000;
+  double cloud = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    t += uniform(rng) < 0.02 ? 6 : 5;
+    double day = fmod((double)t, 86400.0) / 86400.0;
+    cloud = 0.995 * cloud + 0.005 * noise(rng);
+    double sun = std::max(0.0, sin((day - 0.25) * 2 * M_PI));
+    double l = std::min(1.0, std::max(0.0, 0.05 + 0.8 * sun + 0.1 * cloud));
+
+    light.t.push_back(t);
+    light.v.push_back(roundf((float)l * 4095.0f) / 4095.0f);
+    float tc = (float)(27.0 + 3.0 * sin((day - 0.3) * 2 * M_PI) + 0.05 * noise(rng));
+    temp.t.push_back(t);
+    temp.v.push_back(roundf(tc * 10.0f) / 10.0f);
+    raw.t.push_back(t);
+    raw.v.push_back(roundf(tc * 10.0f) / 10.0f);
+    hum.t.push_back(t);
+    hum.v.push_back(roundf((float)(65.0 - 10.0 * sin((day - 0.3) * 2 * M_PI) + 0.2 * noise(rng)) * 10.0f) / 10.0f);
+
+    // Every bucket size in both directions, including reboots (clock steps) and sensor dropouts
+    int magnitude = (int)(uniform(rng) * 6);
+    int32_t jump = (int32_t)(uniform(rng) * (1 << (magnitude * 4))) * (uniform(rng) < 0.5 ? -1 : 1);
+    uint32_t ts = steps.t.empty() ? t : steps.t.back() + (uint32_t)(5 + (uniform(rng) < 0.1 ? jump : 0));
+    float prev = steps.v.empty() ? 0.0f : steps.v.back();
+    if (fabsf(prev + (float)jump / 100.0f) > 50000.0f) // Stay where float holds 0.01 exactly
+      jump = -jump;
+    steps.t.push_back(ts);
+    steps.v.push_back(roundf((prev + (float)jump / 100.0f) * 100.0f) / 100.0f);
+  }
+
+  traces.push_back(light);
+  traces.push_back(temp);
+  traces.push_back(hum);
+  traces.push_back(raw);
+  traces.push_back(steps);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void bench(const Trace &trace)
+{
+  size_t n = trace.t.size();
+  std::vector<SampleBlock> storage(n / 8 + 16); // Never fills, so every sample is kept
+  SampleLog log;
+  sample_log_init(log, storage.data(), (uint16_t)std::min<size_t>(storage.size(), 65535), trace.scale);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; i++)
+    sample_log_append(log, trace.t[i], trace.v[i]);
+  double encode_s = seconds_since(start);
+
+  SampleLogIterator it;
+  sample_log_iter_begin(log, it);
+  uint32_t t;
+  float v;
+  size_t i = 0;
+  double max_error = 0;
+  bool times_ok = true;
+  start = std::chrono::steady_clock::now();
+  while (sample_log_next(it, t, v))
+  {
+    if (i < n)
+    {
+      max_error = std::max(max_error, (double)fabsf(v - trace.v[i]));
+      times_ok &= t == trace.t[i];
+    }
+    i++;
+  }
+  double decode_s = seconds_since(start);
+
+  size_t bytes = sample_log_bytes_used(log);
+  size_t pool = (size_t)log.used * sizeof(SampleBlock);
+  printf("%s\n", trace.name.c_str());
+  printf("  samples %zu (decoded %zu, evicted %u)  timestamps %s  max error %.6f\n", n, i, log.evicted,
+         times_ok ? "exact" : "MISMATCH", max_error);
+  printf("  %.2f bits/sample (%.2f incl. block slack)  %.1fx vs float[]  %.1fx vs float+timestamp\n",
+         bytes * 8.0 / n, pool * 8.0 / n, 4.0 * n / pool, 8.0 * n / pool);
+  printf("  encode %.1f Msamples/s  decode %.1f Msamples/s\n", n / encode_s / 1e6, i / decode_s / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+  std::vector<Trace> traces;
+  for (int a = 1; a + 1 < argc; a += 2)
+  {
+    Trace trace;
+    if (!load_trace(argv[a], (float)atof(argv[a + 1]), trace))
+    {
+      fprintf(stderr, "cannot read %s\n", argv[a]);
+      return 1;
+    }
+    traces.push_back(trace);
+  }
+  if (traces.empty())
+    synth_traces(traces, 500000);
+
+  for (const Trace &trace : traces)
+    bench(trace);
+  return 0;
+}
@@ -0,0 +1,348 @@
+/***************************************************************************************************
+ * Binary log decoder (host build, `pio run -e logdecode`)
+ *
+ * Turns lib/BinLog wire records back into text. A record carries the address of its format string,
+ * so the decoder needs the ELF the board was flashed with (.pio/build/esp32dev/firmware.elf); the
+ * string is read from whichever loaded section holds that address.
+ *
+ *   program firmware.elf [capture.bin]   decode a capture (stdin without a file), e.g.
+ *                                        mosquitto_sub -t 'medibox/+/log' -N > capture.bin
+ *   program --self-test [records]        format round trip, compile-time filtering, concurrent
+ *                                        producers, and the cost of a LOG_* call vs snprintf
+ **************************************************************************************************/
+#include <BinLog.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/***************************************************************************************************
+ * Elf32
+ * Just enough of the ELF format to map an address to bytes: the loaded, file-backed sections.
+ **************************************************************************************************/
+struct Elf32
+{
+  struct Section
+  {
+    uint32_t addr;
+    uint32_t size;
+    uint32_t offset;
+  };
+  std::vector<uint8_t> data;
+  std::vector<Section> sections;
+
+  static uint32_t u32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+  static uint16_t u16(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+
+  bool load(const char *path)
+  {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+      return false;
+    uint8_t buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+      data.insert(data.end(), buffer, buffer + n);
+    fclose(f);
+
+    if (data.size() < 52 || memcmp(data.data(), "\x7f" "ELF", 4) != 0 || data[4] != 1 || data[5] != 1)
+      return false; // Not a little-endian ELF32
+
+    uint32_t shoff = u32(&data[0x20]);
+    uint16_t shentsize = u16(&data[0x2E]);
+    uint16_t shnum = u16(&data[0x30]);
+    for (uint16_t i = 0; i < shnum; i++)
+    {
+      size_t at = shoff + (size_t)i * shentsize;
+      if (at + 40 > data.size())
+        return false;
+      const uint8_t *sh = &data[at];
+      uint32_t type = u32(sh + 4), flags = u32(sh + 8);
+      Section s = {u32(sh + 12), u32(sh + 20), u32(sh + 16)};
+      const uint32_t SHT_NOBITS = 8, SHF_ALLOC = 2;
+      if ((flags & SHF_ALLOC) && type != SHT_NOBITS && s.size > 0 && (size_t)s.offset + s.size <= data.size())
+        sections.push_back(s);
+    }
+    return true;
+  }
+
+  const char *string_at(uint32_t addr) const
+  {
+    for (const Section &s : sections)
+    {
+      if (addr < s.addr || addr - s.addr >= s.size)
+        continue;
+      const char *p = (const char *)&data[s.offset + (addr - s.addr)];
+      if (memchr(p, '\0', s.size - (addr - s.addr)))
+        return p;
+    }
+    return NULL;
+  }
+};
+
+static int decode(const char *elf_path, const char *capture_path)
+{
+  Elf32 elf;
+  if (!elf.load(elf_path))
+  {
+    fprintf(stderr, "%s: not a readable little-endian ELF32 file\n", elf_path);
+    return 2;
+  }
+
+  FILE *in = capture_path ? fopen(capture_path, "rb") : stdin;
+  if (!in)
+  {
+    perror(capture_path);
+    return 2;
+  }
+
+  std::vector<uint8_t> buffer;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+    buffer.insert(buffer.end(), chunk, chunk + n);
+  if (in != stdin)
+    fclose(in);
+
+  size_t pos = 0, records = 0, skipped = 0, unresolved = 0;
+  char line[BINLOG_TEXT_MAX];
+  while (pos < buffer.size())
+  {
+    LogRecord r;
+    uint32_t fmt_address;
+    size_t used = binlog_decode(&buffer[pos], buffer.size() - pos, r, fmt_address);
+    if (used == 0)
+    {
+      pos++; // Resynchronise on the next magic byte
+      skipped++;
+      continue;
+    }
+    pos += used;
+    records++;
+
+    const char *fmt = elf.string_at(fmt_address);
+    if (!fmt)
+    {
+      unresolved++;
+      printf("[%u.%03u] %c <format 0x%08x not in ELF>\n", r.timestamp_ms / 1000, r.timestamp_ms % 1000,
+             log_level_name(r.level)[0], fmt_address);
+      continue;
+    }
+    binlog_format_line(r, fmt, line, sizeof(line));
+    puts(line);
+  }
+
+  fprintf(stderr, "%zu records, %zu unresolved, %zu bytes skipped\n", records, unresolved, skipped);
+  return unresolved || skipped ? 1 : 0;
+}
+
+/***************************************************************************************************
+ * Self-test
+ **************************************************************************************************/
+static std::vector<const char *> known_formats;
+
+static const char *resolve(uint32_t address)
+{
+  for (const char *fmt : known_formats)
+    if ((uint32_t)(uintptr_t)fmt == address)
+      return fmt;
+  return NULL;
+}
+
+// Logs through the ring, round-trips the record through the wire form and compares the text with
+// what printf would print for the same call.
+template <typename... Args>
+static bool check_case(const char *expected, const char *fmt, Args... args)
+{
+  known_formats.push_back(fmt);
+  binlog.write(LOG_LEVEL_INFO, fmt, args...);
+
+  LogRecord popped, decoded;
+  uint8_t wire[BINLOG_WIRE_MAX];
+  uint32_t address;
+  char text[BINLOG_TEXT_MAX];
+  bool ok = binlog.pop(popped);
+  size_t n = ok ? binlog_encode(popped, wire, sizeof(wire)) : 0;
+  ok = ok && n > 0 && binlog_decode(wire, n, decoded, address) == n && resolve(address) == fmt;
+  if (ok)
+    binlog_format(resolve(address), decoded.args, decoded.length, text, sizeof(text));
+  ok = ok && strcmp(text, expected) == 0;
+  if (!ok)
+    printf("  FAIL %-28s got \"%s\" want \"%s\"\n", fmt, text, expected);
+  return ok;
+}
+
+static bool test_format()
+{
+  static const char long_text[] = "0123456789012345678901234567890123456789012345678901234567890123456789";
+  const char payload[] = {'{', '"', 't', 's', '"', ':', '5', '}', 'X', 'X'};
+  const int64_t big = -1234567890123LL;
+  bool ok = true;
+
+  ok &= check_case("plain text", "plain text");
+  ok &= check_case("100% sure", "100%% sure");
+  ok &= check_case("v7: ts=5 tu=-120", "v%u: ts=%d tu=%d", (uint32_t)7, 5, -120);
+  ok &= check_case("[  42] [42   ] [00042]", "[%4d] [%-5d] [%05d]", 42, 42, 42);
+  ok &= check_case("ffffffff 0x1f 755", "%x %#x %o", -1, 31, 0755);
+  ok &= check_case("-1234567890123 18446744073709551615", "%lld %llu", big, (unsigned long long)-1);
+  ok &= check_case("%ld of 32 bits: 123456", "%%ld of 32 bits: %ld", (long)123456);
+  ok &= check_case("t=21.50 h=4.0e+01 g=0.125", "t=%.2f h=%.1e g=%g", 21.5f, 40.0, 0.125);
+  ok &= check_case("c=A s=medibox/mbx-01/config", "c=%c s=%s", 'A', "medibox/mbx-01/config");
+  ok &= check_case("[{\"ts\":5}]", "[%s]", log_str(payload, 8));
+  ok &= check_case("[     right] [left      ]", "[%10s] [%-10s]", "right", "left");
+  ok &= check_case("null (null)", "null %s", (const char *)NULL);
+  ok &= check_case("missing <?>", "missing %d");
+  ok &= check_case("wrong kind <?>", "wrong kind %s", 5);
+  ok &= check_case("star <?>", "star %*d", 5, 3);
+
+  char cut[BINLOG_MAX_STRING + 1];
+  memcpy(cut, long_text, BINLOG_MAX_STRING);
+  cut[BINLOG_MAX_STRING] = '\0';
+  std::string expected = std::string(cut) + " " + cut + " <?>";
+  ok &= check_case(expected.c_str(), "%s %s %s", long_text, long_text, long_text);
+  BinLogStats stats = binlog.stats();
+  printf("format   %s (%u records, %u truncated)\n", ok ? "ok" : "FAILED", stats.written, stats.truncated);
+  return ok;
+}
+
+static bool test_filtering()
+{
+  uint32_t before = binlog.stats().written;
+  LOG_DEBUG("compiled out at MEDIBOX_LOG_LEVEL %d", MEDIBOX_LOG_LEVEL);
+  LOG_INFO("kept");
+  LogRecord r;
+  bool ok = binlog.stats().written == before + 1 && binlog.pop(r) && r.level == LOG_LEVEL_INFO && !binlog.pop(r);
+  printf("filter   %s (DEBUG dropped at compile time, INFO kept)\n", ok ? "ok" : "FAILED");
+  return ok;
+}
+
+// Producers log (thread, sequence) pairs while the main thread drains. Every record that was not
+// counted as dropped must come out once, intact and in per-thread order.
+static bool test_concurrent(uint32_t n, int producers)
+{
+  BinLogStats start_stats = binlog.stats();
+  std::atomic<int> running(producers);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++)
+  {
+    threads.emplace_back([&running, n, p]() {
+      for (uint32_t i = 0; i < n; i++)
+      {
+        LOG_WARN("producer %d seq %u check %u", p, i, i * 2654435761u);
+        if ((i & 63) == 0)
+          std::this_thread::yield(); // Let the drain keep up some of the time on one core
+      }
+      running--;
+    });
+  }
+
+  std::vector<int64_t> last(producers, -1);
+  uint32_t popped = 0, corrupt = 0, reordered = 0;
+  LogRecord r;
+  auto drain = [&]() {
+    while (binlog.pop(r))
+    {
+      popped++;
+      int32_t p;
+      uint32_t seq, check;
+      if (r.length != 15 || r.args[0] != LOG_ARG_I32 || r.args[5] != LOG_ARG_U32 || r.args[10] != LOG_ARG_U32)
+      {
+        corrupt++;
+        continue;
+      }
+      memcpy(&p, r.args + 1, 4);
+      memcpy(&seq, r.args + 6, 4);
+      memcpy(&check, r.args + 11, 4);
+      if (p < 0 || p >= producers || check != seq * 2654435761u)
+      {
+        corrupt++;
+        continue;
+      }
+      if ((int64_t)seq <= last[p])
+        reordered++;
+      last[p] = seq;
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  while (running.load() > 0)
+  {
+    drain();
+    std::this_thread::yield();
+  }
+  for (auto &t : threads)
+    t.join();
+  drain();
+  double elapsed = seconds_since(start);
+
+  BinLogStats stats = binlog.stats();
+  uint32_t written = stats.written - start_stats.written;
+  uint32_t dropped = stats.dropped - start_stats.dropped;
+  uint32_t total = n * producers;
+  bool ok = written + dropped == total && popped == written && corrupt == 0 && reordered == 0;
+  printf("contend  %d producers  %6.1f ns/record  (written %u, dropped %u, popped %u, corrupt %u, "
+         "reordered %u) %s\n",
+         producers, elapsed * 1e9 / total, written, dropped, popped, corrupt, reordered, ok ? "ok" : "MISMATCH");
+  return ok;
+}
+
+// What the loop pays per message: a deferred LOG_* call against formatting it in place
+static void bench_call_cost(uint32_t n)
+{
+  LogRecord r;
+  volatile uint32_t sink = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < n; i++)
+  {
+    LOG_INFO("Applied config v%u: ts=%d tu=%d gamma=%.2f", i, 5, 120, 0.75f);
+    if ((i & (BINLOG_SLOTS / 2 - 1)) == 0)
+      while (binlog.pop(r))
+        sink += r.length;
+  }
+  while (binlog.pop(r))
+    sink += r.length;
+  double deferred = seconds_since(start);
+
+  char text[BINLOG_TEXT_MAX];
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < n; i++)
+    sink += snprintf(text, sizeof(text), "Applied config v%u: ts=%d tu=%d gamma=%.2f", i, 5, 120, 0.75);
+  double formatted = seconds_since(start);
+
+  printf("cost     LOG_INFO %6.1f ns/call (incl. pop), snprintf %6.1f ns/call; a 45-char line at 115200 "
+         "baud is %u us of UART time\n",
+         deferred * 1e9 / n, formatted * 1e9 / n, 45 * 10 * 1000000 / 115200);
+}
+
+static int self_test(uint32_t n)
+{
+  bool ok = test_format();
+  ok &= test_filtering();
+  ok &= test_concurrent(n / 4, 3);
+  bench_call_cost(n);
+  printf("sizeof(LogRecord) %zu bytes, ring %zu bytes\n", sizeof(LogRecord), sizeof(BinLog));
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 1 && strcmp(argv[1], "--self-test") == 0)
+    return self_test(argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1000000);
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s firmware.elf [capture.bin] | --self-test [records]\n", argv[0]);
+    return 2;
+  }
+  return decode(argv[1], argc > 2 ? argv[2] : NULL);
+}
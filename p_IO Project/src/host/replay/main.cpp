@@ -0,0 +1,638 @@
+/***************************************************************************************************
+ * Input trace replay (host build, `pio run -e replay`)
+ *
+ * Feeds a trace recorded with -DMEDIBOX_TRACE (lib/InputTrace) through lib/MediboxCore, the logic
+ * the box runs, and writes down what the box did: servo moves, alarms, publishes, the warning LED,
+ * the main switch and applied configs, one line each, stamped with the box's millis(). Against a
+ * golden file it is a regression test for changes to the firmware logic.
+ *
+ *   program run <trace> [--golden <file> [--update]]
+ *   program synth <out.trc> [--hours 24] [--seed 1] [--capture]
+ *
+ * <trace> is either the raw stream (as synth writes it) or a capture of the recorder's chunks: hex
+ * lines from `mosquitto_sub -t 'medibox/<id>/trace' -F %x`, or a Serial log with "#TRACE <hex>"
+ * lines among the log lines. Start the capture before the box boots; a missing chunk ends the
+ * replay there, while the recorder's restart after its ring overflowed starts it over. Without
+ * --golden the outputs go to stdout; with it, the first differences are shown and the exit status
+ * is 1. --update rewrites the golden file instead.
+ *
+ * synth drives the core with a day of made-up inputs (light curve, temperature and humidity
+ * drifts that cross the alert thresholds, alarm edits, snoozes and dismissals) and records the
+ * trace the firmware would have produced, raw or, with --capture, as "#TRACE" lines.
+ *
+ * Outputs depend on float arithmetic, so keep goldens made on the host; the ESP32's FPU can round
+ * an angle or an average's last digit differently.
+ *
+ * synth_6h.trc next to this file is `synth --hours 6` and synth_6h.golden its outputs; every
+ * `pio run -e replay` checks them (scripts/replay_check.py).
+ **************************************************************************************************/
+#include <BinLog.h>
+#include <InputTrace.h>
+#include <MediboxCore.h>
+#include <MediboxMqtt.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+/***************************************************************************************************
+ * Trace loading
+ **************************************************************************************************/
+static bool read_file(const char *path, std::vector<uint8_t> &data)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  uint8_t buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    data.insert(data.end(), buffer, buffer + n);
+  fclose(f);
+  return true;
+}
+
+static int hex_value(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static bool decode_hex(const std::string &text, std::vector<uint8_t> &out)
+{
+  if (text.size() < 2 * TRACE_CHUNK_HEADER || text.size() % 2)
+    return false;
+  out.clear();
+  for (size_t i = 0; i < text.size(); i += 2)
+  {
+    int hi = hex_value(text[i]), lo = hex_value(text[i + 1]);
+    if (hi < 0 || lo < 0)
+      return false;
+    out.push_back((uint8_t)(hi << 4 | lo));
+  }
+  return true;
+}
+
+/***************************************************************************************************
+ * assemble_capture()
+ * Joins captured chunks into the raw stream. Sequence numbers restart at a reboot, where the
+ * chunk starts with a new trace. A jump to a chunk that starts a new trace is the recorder
+ * restarting after its ring overflowed: the replay starts over there. Any other jump means a chunk
+ * was lost, and the stream is cut there, since everything after it would decode against the wrong
+ * state.
+ **************************************************************************************************/
+static bool assemble_capture(const std::vector<uint8_t> &file, std::vector<uint8_t> &stream, std::string &warning)
+{
+  std::string text(file.begin(), file.end());
+  size_t pos = 0, chunks = 0;
+  uint16_t expected = 0;
+  std::vector<uint8_t> chunk;
+
+  while (pos < text.size())
+  {
+    size_t end = text.find('\n', pos);
+    if (end == std::string::npos)
+      end = text.size();
+    std::string line = text.substr(pos, end - pos);
+    pos = end + 1;
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+      line.pop_back();
+    size_t marker = line.find("#TRACE ");
+    if (marker != std::string::npos)
+      line = line.substr(marker + 7);
+    if (!decode_hex(line, chunk))
+      continue; // A log line
+
+    uint16_t sequence;
+    const uint8_t *data;
+    size_t length;
+    trace_chunk_parse(chunk.data(), chunk.size(), sequence, data, length);
+    bool boot = length >= 4 && memcmp(data, TRACE_MAGIC, 4) == 0;
+    if (chunks > 0 && sequence != expected && !boot)
+    {
+      char buffer[96];
+      snprintf(buffer, sizeof(buffer), "chunk %u missing (got %u); replaying up to it", expected, sequence);
+      warning = buffer;
+      break;
+    }
+    if (chunks > 0 && sequence != expected && sequence != 0)
+    {
+      char buffer[96];
+      snprintf(buffer, sizeof(buffer), "records lost before chunk %u; the replay starts over there", sequence);
+      warning = buffer;
+    }
+    if (chunks == 0 && !boot)
+      continue; // Joined mid-trace; wait for a boot
+    stream.insert(stream.end(), data, data + length);
+    expected = (uint16_t)(sequence + 1);
+    chunks++;
+  }
+  return chunks > 0;
+}
+
+static bool load_trace(const char *path, std::vector<uint8_t> &stream, std::string &warning)
+{
+  std::vector<uint8_t> file;
+  if (!read_file(path, file))
+    return false;
+  if (file.size() >= 4 && memcmp(file.data(), TRACE_MAGIC, 4) == 0)
+  {
+    stream.swap(file);
+    return true;
+  }
+  return assemble_capture(file, stream, warning);
+}
+
+/***************************************************************************************************
+ * Replay
+ **************************************************************************************************/
+class Replay : public MediboxCoreIo
+{
+public:
+  explicit Replay(TraceReader &reader) : reader_(reader), now_ms_(0), servo_(-1), boots_(0), inputs_(0) {}
+
+  bool run();
+  const std::string &output() const { return out_; }
+  uint64_t trace_ms() const { return trace_ms_; }
+  uint32_t inputs() const { return inputs_; }
+  uint32_t boots() const { return boots_; }
+
+  void servo_write(int angle) override
+  {
+    if (angle != servo_)
+      emit("servo %d", angle);
+    servo_ = angle;
+  }
+
+  void publish(const char *topic, const char *payload, bool retain) override
+  {
+    emit("publish %s %s%s", topic, payload, retain ? " retained" : "");
+  }
+
+  // On the box the alarm screen blocks until a button; the answer is the next record
+  void alarm_fired(uint8_t index) override
+  {
+    if (index == ALARM_SNOOZED)
+      emit("alarm snoozed");
+    else
+      emit("alarm %u", index);
+
+    TraceInput input;
+    if (reader_.peek(input) && (input.type == TRACE_ALARM_DISMISS || input.type == TRACE_ALARM_SNOOZE))
+    {
+      reader_.next(input);
+      dispatch(input);
+    }
+    else
+    {
+      emit("alarm unanswered");
+    }
+  }
+
+  void env_warning(bool active) override
+  {
+    emit("warning %s", active ? "on" : "off");
+  }
+
+  void main_switch(bool on) override
+  {
+    emit("switch %s", on ? "on" : "off");
+  }
+
+  void config_changed(const ConfigChanged &change) override
+  {
+    const MediboxConfig &c = core_->config();
+    emit("config v%u fields=%x window=%d ts=%d tu=%d", change.version, change.fields, change.window_changed, c.ts, c.tu);
+  }
+
+private:
+  void emit(const char *format, ...)
+  {
+    char line[512];
+    int n = snprintf(line, sizeof(line), "%u ", now_ms_);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(line + n, sizeof(line) - n, format, args);
+    va_end(args);
+    out_ += line;
+    out_ += '\n';
+  }
+
+  void boot(const TraceBegin &b);
+  void dispatch(const TraceInput &input);
+
+  TraceReader &reader_;
+  std::unique_ptr<MediboxCore> core_;
+  std::vector<SampleBlock> light_blocks_, temp_blocks_, hum_blocks_;
+  std::string out_;
+  uint32_t now_ms_;
+  uint32_t boot_ms_;
+  uint64_t trace_ms_ = 0;
+  int servo_;
+  uint32_t boots_;
+  uint32_t inputs_;
+};
+
+void Replay::boot(const TraceBegin &b)
+{
+  if (boots_ > 0)
+    trace_ms_ += now_ms_ - boot_ms_;
+  boots_++;
+  boot_ms_ = now_ms_;
+  servo_ = -1;
+  emit("boot %s alarms=%u servo=%d", b.device_id, b.n_alarms, b.has_servo);
+
+  light_blocks_.assign(b.light_log_blocks, SampleBlock());
+  temp_blocks_.assign(b.env_log_blocks, SampleBlock());
+  hum_blocks_.assign(b.env_log_blocks, SampleBlock());
+  CoreLayout layout = {b.n_alarms, b.has_servo,
+                       light_blocks_.data(), b.light_log_blocks,
+                       temp_blocks_.data(), hum_blocks_.data(), b.env_log_blocks,
+                       b.alarm_hours, b.alarm_minutes};
+  MediboxTopics topics;
+  build_topics(topics, b.device_id);
+  core_.reset(new MediboxCore(*this));
+  core_->begin(now_ms_, layout, topics);
+}
+
+void Replay::dispatch(const TraceInput &input)
+{
+  now_ms_ = input.now_ms;
+  inputs_++;
+  switch (input.type)
+  {
+  case TRACE_BEGIN:
+    boot(input.begin);
+    break;
+  case TRACE_TICK:
+    core_->time_tick(input.now_ms, input.tick);
+    break;
+  case TRACE_LIGHT:
+    core_->light_sample(input.now_ms, input.epoch, input.light);
+    break;
+  case TRACE_ENV:
+    core_->env_sample(input.now_ms, input.epoch, input.temperature, input.humidity);
+    break;
+  case TRACE_MQTT:
+  {
+    std::string topic((const char *)input.topic, input.topic_length);
+    core_->mqtt_message(input.now_ms, input.epoch, topic.c_str(), input.payload, input.payload_length);
+    break;
+  }
+  case TRACE_ALARM_DISMISS:
+    core_->alarm_dismissed(input.now_ms);
+    break;
+  case TRACE_ALARM_SNOOZE:
+    core_->alarm_snoozed(input.now_ms);
+    break;
+  case TRACE_SET_ALARM:
+    core_->set_alarm(input.now_ms, input.index, input.hours, input.minutes);
+    break;
+  case TRACE_ALARMS_ENABLED:
+    core_->set_alarms_enabled(input.now_ms, input.enabled);
+    break;
+  default:
+    break;
+  }
+}
+
+bool Replay::run()
+{
+  TraceInput input;
+  while (reader_.next(input))
+  {
+    if (!core_ && input.type != TRACE_BEGIN)
+    {
+      fprintf(stderr, "trace does not start with a BEGIN record\n");
+      return false;
+    }
+    dispatch(input);
+  }
+  if (boots_ > 0)
+    trace_ms_ += now_ms_ - boot_ms_;
+  if (reader_.error())
+  {
+    fprintf(stderr, "trace error at byte %zu: %s\n", reader_.offset(), reader_.error());
+    return false;
+  }
+  return true;
+}
+
+/***************************************************************************************************
+ * diff_lines()
+ * Prints the first differing lines of the golden and the replay. Returns the number of them.
+ **************************************************************************************************/
+static size_t diff_lines(const std::string &golden, const std::string &replay)
+{
+  size_t differences = 0, line = 1, g = 0, r = 0;
+  while (g < golden.size() || r < replay.size())
+  {
+    g = std::min(g, golden.size());
+    r = std::min(r, replay.size());
+    size_t g_end = golden.find('\n', g), r_end = replay.find('\n', r);
+    if (g_end == std::string::npos)
+      g_end = golden.size();
+    if (r_end == std::string::npos)
+      r_end = replay.size();
+    std::string a = golden.substr(g, g_end - g), b = replay.substr(r, r_end - r);
+    if (a != b)
+    {
+      if (differences < 10)
+        printf("line %zu\n  golden: %s\n  replay: %s\n", line, g < golden.size() ? a.c_str() : "<end>",
+               r < replay.size() ? b.c_str() : "<end>");
+      differences++;
+    }
+    g = g_end + 1;
+    r = r_end + 1;
+    line++;
+  }
+  return differences;
+}
+
+static int run(const char *path, const char *golden_path, bool update)
+{
+  std::vector<uint8_t> stream;
+  std::string warning;
+  if (!load_trace(path, stream, warning))
+  {
+    fprintf(stderr, "cannot read a trace from %s\n", path);
+    return 2;
+  }
+  if (!warning.empty())
+    fprintf(stderr, "warning: %s\n", warning.c_str());
+
+  TraceReader reader(stream.data(), stream.size());
+  Replay replay(reader);
+  auto start = std::chrono::steady_clock::now();
+  bool ok = replay.run();
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  fprintf(stderr, "%zu bytes, %u inputs, %u boot(s), %.1f h of box time in %.3f s (%.0fx real time)\n",
+          stream.size(), replay.inputs(), replay.boots(), replay.trace_ms() / 3.6e6, wall,
+          replay.trace_ms() / 1000.0 / (wall > 0 ? wall : 1e-9));
+  if (!ok)
+    return 2;
+
+  if (!golden_path)
+  {
+    fwrite(replay.output().data(), 1, replay.output().size(), stdout);
+    return 0;
+  }
+  if (update)
+  {
+    FILE *f = fopen(golden_path, "w");
+    if (!f)
+    {
+      fprintf(stderr, "cannot write %s\n", golden_path);
+      return 2;
+    }
+    fwrite(replay.output().data(), 1, replay.output().size(), f);
+    fclose(f);
+    fprintf(stderr, "updated %s\n", golden_path);
+    return 0;
+  }
+
+  std::vector<uint8_t> golden;
+  if (!read_file(golden_path, golden))
+  {
+    fprintf(stderr, "cannot read %s (use --update to create it)\n", golden_path);
+    return 2;
+  }
+  size_t differences = diff_lines(std::string(golden.begin(), golden.end()), replay.output());
+  printf("%s: %zu differing line(s)\n", differences ? "FAIL" : "PASS", differences);
+  return differences ? 1 : 0;
+}
+
+/***************************************************************************************************
+ * Synthetic traces
+ **************************************************************************************************/
+class FileSink : public TraceSink
+{
+public:
+  FileSink(FILE *f, bool capture) : f_(f), capture_(capture), sequence_(0) {}
+  ~FileSink() { flush(); }
+
+  void trace_write(const uint8_t *data, size_t n) override
+  {
+    if (!capture_)
+    {
+      fwrite(data, 1, n, f_);
+      return;
+    }
+    pending_.insert(pending_.end(), data, data + n);
+    while (pending_.size() >= 198)
+      chunk(198);
+  }
+
+  void flush()
+  {
+    if (capture_ && !pending_.empty())
+      chunk(pending_.size());
+  }
+
+private:
+  void chunk(size_t n)
+  {
+    uint8_t header[TRACE_CHUNK_HEADER];
+    trace_chunk_header(header, sequence_++);
+    fprintf(f_, "[%6u.000] D Light average 0.50\n#TRACE ", sequence_);
+    for (size_t i = 0; i < TRACE_CHUNK_HEADER; i++)
+      fprintf(f_, "%02x", header[i]);
+    for (size_t i = 0; i < n; i++)
+      fprintf(f_, "%02x", pending_[i]);
+    fputc('\n', f_);
+    pending_.erase(pending_.begin(), pending_.begin() + n);
+  }
+
+  FILE *f_;
+  bool capture_;
+  uint16_t sequence_;
+  std::vector<uint8_t> pending_;
+};
+
+// Stands in for the user at the alarm screen
+class SynthIo : public MediboxCoreIo
+{
+public:
+  explicit SynthIo(std::mt19937 &rng) : core(NULL), now_ms(0), rng_(rng) {}
+
+  void servo_write(int) override {}
+  void publish(const char *, const char *, bool) override {}
+  void env_warning(bool) override {}
+  void main_switch(bool) override {}
+  void config_changed(const ConfigChanged &) override {}
+
+  void alarm_fired(uint8_t) override
+  {
+    now_ms += 3000 + rng_() % 20000; // Time to reach the box
+    if (rng_() % 3 == 0)
+      core->alarm_snoozed(now_ms);
+    else
+      core->alarm_dismissed(now_ms);
+  }
+
+  MediboxCore *core;
+  uint32_t now_ms;
+
+private:
+  std::mt19937 &rng_;
+};
+
+/***************************************************************************************************
+ * synth()
+ * One loop pass per second like the firmware's: the tick, then light every ts seconds, the DHT
+ * every 2 s, and now and then a user or the dashboard doing something.
+ **************************************************************************************************/
+static int synth(const char *path, double hours, unsigned seed, bool capture)
+{
+  FILE *f = fopen(path, capture ? "w" : "wb");
+  if (!f)
+  {
+    fprintf(stderr, "cannot write %s\n", path);
+    return 2;
+  }
+
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  FileSink sink(f, capture);
+  TraceWriter writer(sink);
+  SynthIo io(rng);
+  MediboxCore core(io);
+  io.core = &core;
+  core.set_trace(&writer);
+
+  static SampleBlock light_blocks[64], temp_blocks[32], hum_blocks[32];
+  static const uint8_t alarm_hours[] = {0, 1, 0};
+  static const uint8_t alarm_minutes[] = {1, 10, 0};
+  CoreLayout layout = {3, true, light_blocks, 64, temp_blocks, hum_blocks, 32, alarm_hours, alarm_minutes};
+  MediboxTopics topics;
+  uint8_t mac[6] = {0x24, 0x0a, 0xc4, 0x12, 0x34, (uint8_t)seed};
+  char device_id[DEVICE_ID_LEN];
+  make_device_id(mac, device_id, sizeof(device_id));
+  build_topics(topics, device_id);
+
+  io.now_ms = 4200; // Boot, Wi-Fi and NTP
+  core.begin(io.now_ms, layout, topics);
+  core.set_alarms_enabled(io.now_ms + 15000, true);
+
+  time_t epoch = 1760000000 - 1760000000 % 86400 + 30; // Midnight UTC, plus a bit
+  uint32_t last_light = 0, last_env = 0;
+  double cloud = 0;
+  uint32_t seconds = (uint32_t)(hours * 3600);
+  for (uint32_t s = 0; s < seconds; s++, epoch++)
+  {
+    io.now_ms += 1000 + (rng() % 5 == 0 ? 1 : 0); // The loop drifts a little against wall-clock time
+
+    struct tm t;
+    gmtime_r(&epoch, &t);
+    TimeTick tick = {(uint8_t)t.tm_hour, (uint8_t)t.tm_min, (uint8_t)t.tm_sec, (uint8_t)t.tm_mday,
+                     (uint8_t)t.tm_wday};
+    core.time_tick(io.now_ms, tick);
+
+    double day = (epoch % 86400) / 86400.0;
+    if (io.now_ms - last_light >= core.snapshot().sample_ms)
+    {
+      last_light = io.now_ms;
+      cloud = 0.98 * cloud + 0.02 * noise(rng);
+      double sun = std::max(0.0, sin((day - 0.25) * 2 * M_PI));
+      double l = std::min(1.0, std::max(0.0, 0.05 + 0.8 * sun + 0.2 * cloud));
+      core.light_sample(io.now_ms, (uint32_t)epoch, roundf((float)l * 4095.0f) / 4095.0f);
+    }
+    if (io.now_ms - last_env >= 2000)
+    {
+      last_env = io.now_ms;
+      float temperature = (float)(28.0 + 5.0 * sin((day - 0.3) * 2 * M_PI) + 0.1 * noise(rng));
+      float humidity = (float)(68.0 - 12.0 * sin((day - 0.3) * 2 * M_PI) + 0.5 * noise(rng));
+      if (rng() % 2000 == 0)
+        temperature = humidity = NAN; // DHT read failure
+      else
+      {
+        temperature = roundf(temperature * 10.0f) / 10.0f;
+        humidity = roundf(humidity * 10.0f) / 10.0f;
+      }
+      core.env_sample(io.now_ms, (uint32_t)epoch, temperature, humidity);
+    }
+
+    // Dashboard config changes and alarm edits, a few times a day
+    if (rng() % 10800 == 0)
+    {
+      char payload[64];
+      int n = snprintf(payload, sizeof(payload), "{\"ts\":%u,\"tu\":%u,\"gamma\":%.2f}", 2 + (unsigned)(rng() % 10),
+                       30 + (unsigned)(rng() % 300), 0.5 + (rng() % 50) / 100.0);
+      core.mqtt_message(io.now_ms + 300, (uint32_t)epoch, topics.config, (const uint8_t *)payload, n);
+    }
+    if (rng() % 14400 == 0)
+    {
+      uint8_t index = rng() % 3;
+      core.set_alarm(io.now_ms + 500, index, (uint8_t)((t.tm_hour + 1) % 24), (uint8_t)(rng() % 60));
+      if (rng() % 4 == 0)
+        core.set_alarms_enabled(io.now_ms + 800, false);
+      core.set_alarms_enabled(io.now_ms + 900, true);
+    }
+  }
+
+  sink.flush();
+  fclose(f);
+  fprintf(stderr, "wrote %s: %u bytes for %.1f h (%.1f bytes/min)\n", path, writer.bytes_written(), hours,
+          writer.bytes_written() / (hours * 60));
+  return 0;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: replay run <trace> [--golden <file> [--update]]\n"
+                  "       replay synth <out.trc> [--hours 24] [--seed 1] [--capture]\n");
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    usage();
+    return 2;
+  }
+
+  const char *golden = NULL;
+  bool update = false, capture = false;
+  double hours = 24;
+  unsigned seed = 1;
+  for (int a = 3; a < argc; a++)
+  {
+    if (!strcmp(argv[a], "--golden") && a + 1 < argc)
+      golden = argv[++a];
+    else if (!strcmp(argv[a], "--update"))
+      update = true;
+    else if (!strcmp(argv[a], "--hours") && a + 1 < argc)
+      hours = atof(argv[++a]);
+    else if (!strcmp(argv[a], "--seed") && a + 1 < argc)
+      seed = (unsigned)atoi(argv[++a]);
+    else if (!strcmp(argv[a], "--capture"))
+      capture = true;
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+
+  if (!strcmp(argv[1], "run"))
+    return run(argv[2], golden, update);
+  if (!strcmp(argv[1], "synth"))
+    return synth(argv[2], hours, seed, capture);
+  usage();
+  return 2;
+}
@@ -0,0 +1,700 @@
+/***************************************************************************************************
+ * Shade model parameter sweep (host build, `pio run -e shadesweep`)
+ *
+ * Runs the firmware's shade model (shade_angle() from lib/MediboxCore) and its light averaging
+ * (lib/SampleLog over the last tu seconds, in the box's light log size) over a light and
+ * temperature trace, for every combination of a parameter grid, and ranks the combinations:
+ *
+ *   error    RMS distance in degrees, over time, from a reference angle: the model with the
+ *            reference parameters applied to the instantaneous light, i.e. where the shade
+ *            should be right now
+ *   travel   degrees the servo moves per hour
+ *   moves    changes of the commanded angle per minute (each one drives the servo)
+ *   score    error + travel_weight * travel + moves_weight * moves, lower is better
+ *
+ *   program [--trace day.trc | --light light.txt --temp temp.txt] [grid] [options]
+ *
+ *   --ts, --tu, --offset, --gamma, --tmed   lo:hi:step or one value (defaults below)
+ *   --reference ts,tu,offset,gamma,tmed     reference parameters (firmware defaults)
+ *   --weights travel,moves                  score weights (0.01, 1)
+ *   --log-blocks N                          light log size in blocks (rev-a: 8)
+ *   --top N  --threads N
+ *
+ * A trace is an input trace recorded with -DMEDIBOX_TRACE (its light and environment samples),
+ * or "timestamp value" text files as exported by `telemetry query --dump`. Between samples the
+ * last value holds. Without one, a synthetic day is used. Combinations the box would reject
+ * (tu < ts, out-of-range values) are skipped.
+ *
+ * The angle depends on ts and tu through the averaged light and on the other three parameters
+ * only through the formula. So each (ts, tu) pair is simulated once, second by second as the box
+ * samples, into the run of (light average, temperature) pairs the servo sees; repeats are merged
+ * and the reference angle is folded into each run's mean and spread. theta_offset, gamma and Tmed
+ * are then evaluated 64 combinations at a time in structure-of-arrays loops the compiler
+ * vectorises, on all cores. A check at start-up compares the vector path against shade_angle()
+ * and the averages against sample_log_average(). Build with -ffp-contract=off so they match
+ * bit for bit, and -fno-trapping-math so the float-to-int truncation of the angle vectorises
+ * (neither changes a result). Throughput is about 1.7 G angle evaluations per second per core.
+ **************************************************************************************************/
+#include <InputTrace.h>
+#include <MediboxConfig.h>
+#include <MediboxCore.h>
+#include <SampleLog.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define LANES 64
+
+struct Range
+{
+  double lo, hi, step;
+};
+
+static bool parse_range(const char *text, Range &range)
+{
+  int n = sscanf(text, "%lf:%lf:%lf", &range.lo, &range.hi, &range.step);
+  if (n == 1)
+  {
+    range.hi = range.lo;
+    range.step = 1;
+    return true;
+  }
+  return n == 3 && range.step > 0 && range.hi >= range.lo;
+}
+
+static std::vector<double> expand(const Range &range)
+{
+  std::vector<double> values;
+  for (int i = 0;; i++)
+  {
+    double v = range.lo + i * range.step;
+    if (v > range.hi + range.step * 1e-6)
+      break;
+    values.push_back(v);
+  }
+  return values;
+}
+
+/***************************************************************************************************
+ * Signals, one value per second
+ **************************************************************************************************/
+struct Signal
+{
+  uint32_t t0;
+  std::vector<float> light;
+  std::vector<float> temp;
+};
+
+struct Samples
+{
+  std::vector<uint32_t> t;
+  std::vector<float> v;
+};
+
+static void hold(const Samples &s, uint32_t t0, size_t n, std::vector<float> &out)
+{
+  out.assign(n, s.v.empty() ? NAN : s.v[0]);
+  size_t k = 0;
+  float value = out.empty() ? NAN : out[0];
+  for (size_t i = 0; i < n; i++)
+  {
+    while (k < s.t.size() && s.t[k] <= t0 + i)
+      value = s.v[k++];
+    out[i] = value;
+  }
+}
+
+static bool build_signal(const Samples &light, const Samples &temp, Signal &signal)
+{
+  if (light.t.empty() || temp.t.empty())
+    return false;
+  uint32_t t0 = std::min(light.t.front(), temp.t.front());
+  uint32_t t1 = std::max(light.t.back(), temp.t.back());
+  signal.t0 = t0;
+  hold(light, t0, t1 - t0 + 1, signal.light);
+  hold(temp, t0, t1 - t0 + 1, signal.temp);
+  return true;
+}
+
+static bool load_text(const char *path, Samples &s)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+  double t, v;
+  while (fscanf(f, "%lf %lf", &t, &v) == 2)
+  {
+    s.t.push_back((uint32_t)t);
+    s.v.push_back((float)v);
+  }
+  fclose(f);
+  return !s.t.empty();
+}
+
+static bool load_input_trace(const char *path, Samples &light, Samples &temp)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  std::vector<uint8_t> data;
+  uint8_t buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    data.insert(data.end(), buffer, buffer + n);
+  fclose(f);
+
+  TraceReader reader(data.data(), data.size());
+  TraceInput input;
+  while (reader.next(input))
+  {
+    if (input.type == TRACE_LIGHT)
+    {
+      light.t.push_back(input.epoch);
+      light.v.push_back(input.light);
+    }
+    else if (input.type == TRACE_ENV && !std::isnan(input.temperature))
+    {
+      temp.t.push_back(input.epoch);
+      temp.v.push_back(input.temperature);
+    }
+  }
+  if (reader.error())
+    fprintf(stderr, "%s: %s at byte %zu\n", path, reader.error(), reader.offset());
+  return !light.t.empty() && !temp.t.empty();
+}
+
+/***************************************************************************************************
+ * synth_signal()
+ * A day of light with drifting cloud cover and a temperature that follows it slowly, read at
+ * DHT22 resolution.
+ **************************************************************************************************/
+static void synth_signal(Signal &signal, uint32_t seconds)
+{
+  std::mt19937 rng(7);
+  std::normal_distribution<double> noise(0.0, 1.0);
+  signal.t0 = 1760000000 - 1760000000 % 86400;
+  signal.light.resize(seconds);
+  signal.temp.resize(seconds);
+  double cloud = 0, drift = 0;
+  for (uint32_t i = 0; i < seconds; i++)
+  {
+    double day = (i % 86400) / 86400.0;
+    cloud = 0.995 * cloud + 0.03 * noise(rng);
+    drift = 0.9995 * drift + 0.002 * noise(rng);
+    double sun = std::max(0.0, sin((day - 0.25) * 2 * M_PI));
+    double l = std::min(1.0, std::max(0.0, 0.05 + 0.8 * sun + 0.15 * cloud));
+    signal.light[i] = roundf((float)l * 4095.0f) / 4095.0f;
+    signal.temp[i] = roundf((float)(28.0 + 4.0 * sin((day - 0.3) * 2 * M_PI) + drift) * 10.0f) / 10.0f;
+  }
+}
+
+/***************************************************************************************************
+ * Simulation of one (ts, tu) pair
+ **************************************************************************************************/
+struct Run
+{
+  float light;       // Light average the servo was driven with
+  float temperature;
+  float seconds;     // How long it held
+  float mean;        // Mean reference angle over the run
+  float spread;      // Sum of squared deviations of the reference from the mean
+};
+
+struct Pair
+{
+  int ts, tu;
+  float ratio; // As shade_angle() computes it
+  std::vector<Run> runs;
+  double seconds;
+};
+
+static MediboxConfig make_config(int ts, int tu, float offset, float gamma, float tmed)
+{
+  MediboxConfig c = config_defaults();
+  c.ts = ts;
+  c.tu = tu;
+  c.theta_offset = offset;
+  c.gamma = gamma;
+  c.tmed = tmed;
+  return c;
+}
+
+/***************************************************************************************************
+ * simulate_pair()
+ * Second by second, as the firmware loop runs: a light sample every ts seconds into a light log
+ * of the box's size, an environment sample every 2 s, and the servo updated after each. The
+ * average over the last tu seconds comes from prefix sums over the samples the log still holds;
+ * light values are multiples of 1/4095, so double sums are exact and match
+ * sample_log_average() to the bit (checked when `check` is set).
+ **************************************************************************************************/
+static void simulate_pair(const Signal &signal, int ts, int tu, uint16_t log_blocks, const MediboxConfig &reference,
+                          Pair &pair, bool check, size_t &mismatches)
+{
+  std::vector<SampleBlock> blocks(log_blocks);
+  SampleLog log;
+  sample_log_init(log, blocks.data(), log_blocks, 4095.0f);
+
+  pair.ts = ts;
+  pair.tu = tu;
+  pair.ratio = logf((float)ts / tu);
+  pair.runs.clear();
+  pair.seconds = 0;
+
+  std::vector<uint32_t> times;
+  std::vector<double> prefix(1, 0.0);
+  float light = 0, temperature = NAN, last_reference = NAN;
+  bool have_run = false;
+  double sum = 0, sum2 = 0, count = 0;
+
+  size_t n = signal.light.size();
+  for (size_t i = 0; i < n; i++)
+  {
+    uint32_t epoch = signal.t0 + (uint32_t)i;
+    bool changed = false;
+
+    if (i % ts == 0)
+    {
+      float v = signal.light[i];
+      sample_log_append(log, epoch, v);
+      times.push_back(epoch);
+      prefix.push_back(prefix.back() + (double)((float)(int32_t)lroundf(v * 4095.0f) / 4095.0f));
+
+      size_t held_from = times.size() - log.count;
+      size_t from = std::lower_bound(times.begin() + held_from, times.end(), epoch - tu) - times.begin();
+      size_t samples = times.size() - from;
+      float average = samples ? (float)((prefix.back() - prefix[from]) / samples) : 0.0f;
+      if (check)
+      {
+        float expected;
+        uint32_t expected_samples;
+        sample_log_average(log, epoch - tu, expected, expected_samples);
+        mismatches += memcmp(&expected, &average, 4) != 0;
+      }
+      changed = changed || average != light;
+      light = average;
+    }
+    if (i % 2 == 0)
+    {
+      float t = signal.temp[i];
+      changed = changed || !(t == temperature);
+      temperature = t;
+    }
+
+    // A new run when the servo is driven with something new; NAN leaves it where it is
+    if (changed && !std::isnan(temperature) &&
+        (!have_run || pair.runs.back().light != light || pair.runs.back().temperature != temperature))
+    {
+      if (have_run)
+      {
+        Run &r = pair.runs.back();
+        r.seconds = (float)count;
+        r.mean = (float)(sum / count);
+        r.spread = (float)std::max(0.0, sum2 - sum * sum / count);
+      }
+      pair.runs.push_back(Run{light, temperature, 0, 0, 0});
+      have_run = true;
+      sum = sum2 = count = 0;
+    }
+
+    float ideal = shade_angle(reference, signal.light[i], signal.temp[i]);
+    if (!std::isnan(ideal))
+      last_reference = ideal;
+    if (have_run && !std::isnan(last_reference))
+    {
+      sum += last_reference;
+      sum2 += (double)last_reference * last_reference;
+      count++;
+      pair.seconds++;
+    }
+  }
+  if (have_run)
+  {
+    Run &r = pair.runs.back();
+    r.seconds = (float)count;
+    r.mean = count ? (float)(sum / count) : 0.0f;
+    r.spread = count ? (float)std::max(0.0, sum2 - sum * sum / count) : 0.0f;
+  }
+}
+
+/***************************************************************************************************
+ * Scoring
+ **************************************************************************************************/
+struct Result
+{
+  float score, error, travel, moves;
+  int ts, tu;
+  float offset, gamma, tmed;
+};
+
+struct ScoreWeights
+{
+  float travel, moves;
+};
+
+static bool worse(const Result &a, const Result &b)
+{
+  return a.score < b.score;
+}
+
+/***************************************************************************************************
+ * evaluate_block()
+ * LANES combinations of theta_offset, gamma and Tmed over one pair's runs. The angle is computed
+ * with the exact expression and evaluation order of shade_angle(); everything else is plain
+ * per-lane float arithmetic without branches, so each inner loop becomes vector instructions.
+ * The float sums are moved into doubles every FLUSH_RUNS runs, while they are still exact (travel,
+ * changes) or well inside float precision (error).
+ **************************************************************************************************/
+#define FLUSH_RUNS 4096
+
+static inline float block_angle(float offset, float gamma, float tmed, float ratio, float light, float temperature)
+{
+  float theta = offset + (180 - offset) * light * gamma * ratio * (temperature / tmed);
+  theta = theta < 0 ? 0 : theta;
+  theta = theta > 180 ? 180 : theta;
+  return (float)(int)theta;
+}
+
+static void evaluate_block(const Pair &pair, const float *__restrict offset, const float *__restrict gamma,
+                           const float *__restrict tmed, float *error, float *travel, float *moves, int *first_angle)
+{
+  alignas(64) float previous[LANES];
+  alignas(64) float distance[LANES], changes[LANES], partial[LANES];
+  alignas(64) double total_distance[LANES] = {}, total_changes[LANES] = {}, squared[LANES] = {};
+  const float ratio = pair.ratio;
+  const Run *runs = pair.runs.data();
+  const size_t n = pair.runs.size();
+
+  // The first run sets the starting angle; it moves nothing
+  for (int l = 0; l < LANES; l++)
+  {
+    previous[l] = n ? block_angle(offset[l], gamma[l], tmed[l], ratio, runs[0].light, runs[0].temperature) : 0;
+    float off = previous[l] - (n ? runs[0].mean : 0);
+    squared[l] = n ? runs[0].seconds * off * off + runs[0].spread : 0;
+  }
+  if (first_angle)
+  {
+    for (int l = 0; l < LANES; l++)
+      first_angle[l] = (int)previous[l];
+  }
+
+  for (size_t start = 1; start < n; start += FLUSH_RUNS)
+  {
+    const size_t end = std::min(n, start + FLUSH_RUNS);
+    for (int l = 0; l < LANES; l++)
+      distance[l] = changes[l] = partial[l] = 0;
+
+    for (size_t r = start; r < end; r++)
+    {
+      const float light = runs[r].light, temperature = runs[r].temperature;
+      const float seconds = runs[r].seconds, mean = runs[r].mean, spread = runs[r].spread;
+      for (int l = 0; l < LANES; l++)
+      {
+        float angle = block_angle(offset[l], gamma[l], tmed[l], ratio, light, temperature);
+        float d = angle - previous[l];
+        distance[l] += fabsf(d);
+        changes[l] += d != 0 ? 1.0f : 0.0f;
+        previous[l] = angle;
+        float off = angle - mean;
+        partial[l] += seconds * off * off + spread;
+      }
+    }
+
+    for (int l = 0; l < LANES; l++)
+    {
+      total_distance[l] += distance[l];
+      total_changes[l] += changes[l];
+      squared[l] += partial[l];
+    }
+  }
+
+  double hours = pair.seconds / 3600.0;
+  for (int l = 0; l < LANES; l++)
+  {
+    error[l] = pair.seconds ? (float)sqrt(squared[l] / pair.seconds) : 0.0f;
+    travel[l] = hours ? (float)(total_distance[l] / hours) : 0.0f;
+    moves[l] = hours ? (float)(total_changes[l] / (hours * 60)) : 0.0f;
+  }
+}
+
+// The same metrics one combination at a time through shade_angle(), for the check and the defaults
+static void evaluate_scalar(const Pair &pair, const MediboxConfig &config, float &error, float &travel, float &moves,
+                            std::vector<int> *angles)
+{
+  double squared = 0, distance = 0, changes = 0;
+  int previous = 0;
+  for (size_t r = 0; r < pair.runs.size(); r++)
+  {
+    const Run &run = pair.runs[r];
+    int angle = (int)shade_angle(config, run.light, run.temperature);
+    if (angles)
+      angles->push_back(angle);
+    if (r)
+    {
+      distance += abs(angle - previous);
+      changes += angle != previous;
+    }
+    previous = angle;
+    squared += run.seconds * ((float)angle - run.mean) * ((float)angle - run.mean) + run.spread;
+  }
+  double hours = pair.seconds / 3600.0;
+  error = pair.seconds ? (float)sqrt(squared / pair.seconds) : 0.0f;
+  travel = hours ? (float)(distance / hours) : 0.0f;
+  moves = hours ? (float)(changes / (hours * 60)) : 0.0f;
+}
+
+/***************************************************************************************************
+ * check_kernel()
+ * Every angle of one block against shade_angle(), run by run.
+ **************************************************************************************************/
+static size_t check_kernel(const Pair &pair, const std::vector<float> &offsets, const std::vector<float> &gammas,
+                           const std::vector<float> &tmeds)
+{
+  Pair one = pair;
+  size_t mismatches = 0;
+  for (size_t r = 0; r < pair.runs.size() && r < 4096; r++)
+  {
+    one.runs.assign(1, pair.runs[r]);
+    alignas(64) float error[LANES], travel[LANES], moves[LANES];
+    alignas(64) int angle[LANES];
+    evaluate_block(one, offsets.data(), gammas.data(), tmeds.data(), error, travel, moves, angle);
+    for (int l = 0; l < LANES; l++)
+    {
+      MediboxConfig c = make_config(pair.ts, pair.tu, offsets[l], gammas[l], tmeds[l]);
+      mismatches += (int)shade_angle(c, pair.runs[r].light, pair.runs[r].temperature) != angle[l];
+    }
+  }
+  return mismatches;
+}
+
+static void usage()
+{
+  fprintf(stderr, "usage: shadesweep [--trace day.trc | --light light.txt --temp temp.txt]\n"
+                  "                  [--ts R] [--tu R] [--offset R] [--gamma R] [--tmed R]   (R = lo:hi:step)\n"
+                  "                  [--reference ts,tu,offset,gamma,tmed] [--weights travel,moves]\n"
+                  "                  [--log-blocks N] [--top N] [--threads N]\n");
+}
+
+int main(int argc, char **argv)
+{
+  const char *trace_path = NULL, *light_path = NULL, *temp_path = NULL;
+  Range ts_range = {1, 30, 1}, tu_range = {30, 600, 30};
+  Range offset_range = {0, 60, 4}, gamma_range = {0.05, 1, 0.05}, tmed_range = {20, 40, 1};
+  MediboxConfig reference = config_defaults();
+  ScoreWeights weights = {0.01f, 1.0f};
+  int log_blocks = 8, top = 20;
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (int a = 1; a < argc; a++)
+  {
+    bool more = a + 1 < argc;
+    bool ok = true;
+    if (!strcmp(argv[a], "--trace") && more)
+      trace_path = argv[++a];
+    else if (!strcmp(argv[a], "--light") && more)
+      light_path = argv[++a];
+    else if (!strcmp(argv[a], "--temp") && more)
+      temp_path = argv[++a];
+    else if (!strcmp(argv[a], "--ts") && more)
+      ok = parse_range(argv[++a], ts_range);
+    else if (!strcmp(argv[a], "--tu") && more)
+      ok = parse_range(argv[++a], tu_range);
+    else if (!strcmp(argv[a], "--offset") && more)
+      ok = parse_range(argv[++a], offset_range);
+    else if (!strcmp(argv[a], "--gamma") && more)
+      ok = parse_range(argv[++a], gamma_range);
+    else if (!strcmp(argv[a], "--tmed") && more)
+      ok = parse_range(argv[++a], tmed_range);
+    else if (!strcmp(argv[a], "--reference") && more)
+      ok = sscanf(argv[++a], "%d,%d,%f,%f,%f", &reference.ts, &reference.tu, &reference.theta_offset,
+                  &reference.gamma, &reference.tmed) == 5;
+    else if (!strcmp(argv[a], "--weights") && more)
+      ok = sscanf(argv[++a], "%f,%f", &weights.travel, &weights.moves) == 2;
+    else if (!strcmp(argv[a], "--log-blocks") && more)
+      log_blocks = atoi(argv[++a]);
+    else if (!strcmp(argv[a], "--top") && more)
+      top = atoi(argv[++a]);
+    else if (!strcmp(argv[a], "--threads") && more)
+      threads = (unsigned)std::max(1, atoi(argv[++a]));
+    else
+      ok = false;
+    if (!ok)
+    {
+      usage();
+      return 2;
+    }
+  }
+  if (log_blocks < 1 || log_blocks > 65535 || top < 1)
+  {
+    usage();
+    return 2;
+  }
+
+  Signal signal;
+  Samples light, temp;
+  if (trace_path)
+  {
+    if (!load_input_trace(trace_path, light, temp) || !build_signal(light, temp, signal))
+    {
+      fprintf(stderr, "no light and environment samples in %s\n", trace_path);
+      return 1;
+    }
+  }
+  else if (light_path || temp_path)
+  {
+    if (!light_path || !temp_path || !load_text(light_path, light) || !load_text(temp_path, temp) ||
+        !build_signal(light, temp, signal))
+    {
+      fprintf(stderr, "need readable --light and --temp traces\n");
+      return 1;
+    }
+  }
+  else
+  {
+    synth_signal(signal, 86400);
+  }
+
+  // The grid, minus what the box would reject
+  std::vector<std::pair<int, int>> windows;
+  for (double ts : expand(ts_range))
+    for (double tu : expand(tu_range))
+      if (ts >= CONFIG_MIN_TS && ts <= CONFIG_MAX_TS && tu >= ts && tu <= CONFIG_MAX_TU)
+        windows.push_back(std::make_pair((int)ts, (int)tu));
+
+  std::vector<float> offsets, gammas, tmeds;
+  for (double o : expand(offset_range))
+    for (double g : expand(gamma_range))
+      for (double m : expand(tmed_range))
+        if (o >= 0 && o <= 180 && g >= 0 && g <= 1 && m >= CONFIG_MIN_TMED && m <= CONFIG_MAX_TMED)
+        {
+          offsets.push_back((float)o);
+          gammas.push_back((float)g);
+          tmeds.push_back((float)m);
+        }
+  size_t combos = offsets.size();
+  if (windows.empty() || combos == 0)
+  {
+    fprintf(stderr, "the grid is empty once out-of-range values are removed\n");
+    return 2;
+  }
+  size_t blocks = (combos + LANES - 1) / LANES;
+  offsets.resize(blocks * LANES, offsets.back()); // Padding lanes repeat the last combination
+  gammas.resize(blocks * LANES, gammas.back());
+  tmeds.resize(blocks * LANES, tmeds.back());
+
+  printf("%zu s of trace, %zu (ts, tu) pairs x %zu (offset, gamma, Tmed) = %zu combinations, %u threads\n",
+         signal.light.size(), windows.size(), combos, windows.size() * combos, threads);
+
+  auto start = std::chrono::steady_clock::now();
+
+  // Simulate every pair, checking the first against the firmware's own averaging
+  std::vector<Pair> pairs(windows.size());
+  std::atomic<size_t> next(0), average_mismatches(0);
+  auto simulate = [&]() {
+    size_t p;
+    while ((p = next++) < pairs.size())
+    {
+      size_t mismatches = 0;
+      simulate_pair(signal, windows[p].first, windows[p].second, (uint16_t)log_blocks, reference, pairs[p], p == 0,
+                    mismatches);
+      average_mismatches += mismatches;
+    }
+  };
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < threads; t++)
+    pool.emplace_back(simulate);
+  for (auto &t : pool)
+    t.join();
+  pool.clear();
+  double simulated = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  size_t runs = 0;
+  for (const Pair &p : pairs)
+    runs += p.runs.size();
+  size_t angle_mismatches = check_kernel(pairs[0], offsets, gammas, tmeds);
+  printf("model check: averages vs sample_log_average() %s, angles vs shade_angle() %s\n",
+         average_mismatches ? "DIFFER" : "match", angle_mismatches ? "DIFFER" : "match");
+
+  // Sweep: (pair, block) work items, a top-N heap per thread
+  std::vector<Result> best;
+  std::mutex best_lock;
+  next = 0;
+  size_t items = pairs.size() * blocks;
+  auto sweep = [&]() {
+    std::priority_queue<Result, std::vector<Result>, decltype(&worse)> heap(worse);
+    alignas(64) float error[LANES], travel[LANES], moves[LANES];
+    size_t item;
+    while ((item = next++) < items)
+    {
+      const Pair &pair = pairs[item / blocks];
+      size_t base = (item % blocks) * LANES;
+      evaluate_block(pair, &offsets[base], &gammas[base], &tmeds[base], error, travel, moves, NULL);
+      for (int l = 0; l < LANES && base + l < combos; l++)
+      {
+        Result r = {error[l] + weights.travel * travel[l] + weights.moves * moves[l],
+                    error[l], travel[l], moves[l], pair.ts, pair.tu, offsets[base + l], gammas[base + l],
+                    tmeds[base + l]};
+        if ((int)heap.size() < top)
+          heap.push(r);
+        else if (r.score < heap.top().score)
+        {
+          heap.pop();
+          heap.push(r);
+        }
+      }
+    }
+    std::lock_guard<std::mutex> guard(best_lock);
+    while (!heap.empty())
+    {
+      best.push_back(heap.top());
+      heap.pop();
+    }
+  };
+  auto sweep_start = std::chrono::steady_clock::now();
+  for (unsigned t = 0; t < threads; t++)
+    pool.emplace_back(sweep);
+  for (auto &t : pool)
+    t.join();
+  double swept = std::chrono::duration<double>(std::chrono::steady_clock::now() - sweep_start).count();
+
+  std::sort(best.begin(), best.end(), worse);
+  if ((int)best.size() > top)
+    best.resize(top);
+
+  printf("simulated %zu pairs into %zu servo runs in %.2f s; swept %zu combinations in %.2f s "
+         "(%.3f M/s, %.2f G angle evaluations/s)\n\n",
+         pairs.size(), runs, simulated, windows.size() * combos, swept, windows.size() * combos / swept / 1e6,
+         (double)runs * blocks * LANES / swept / 1e9);
+
+  printf("rank   score  error  travel/h  moves/min    ts     tu  offset  gamma   Tmed\n");
+  for (size_t i = 0; i < best.size(); i++)
+  {
+    const Result &r = best[i];
+    printf("%4zu %7.2f %6.2f %9.1f %10.3f %5d %6d %7.2f %6.3f %6.2f\n", i + 1, r.score, r.error, r.travel, r.moves,
+           r.ts, r.tu, r.offset, r.gamma, r.tmed);
+  }
+
+  // Where the box stands today
+  MediboxConfig defaults = config_defaults();
+  Pair pair;
+  size_t unused = 0;
+  simulate_pair(signal, defaults.ts, defaults.tu, (uint16_t)log_blocks, reference, pair, false, unused);
+  float error, travel, moves;
+  evaluate_scalar(pair, defaults, error, travel, moves, NULL);
+  printf("\nfirmware defaults: score %.2f  error %.2f  travel/h %.1f  moves/min %.3f  (ts %d tu %d offset %.2f "
+         "gamma %.3f Tmed %.2f)\n",
+         error + weights.travel * travel + weights.moves * moves, error, travel, moves, defaults.ts, defaults.tu,
+         defaults.theta_offset, defaults.gamma, defaults.tmed);
+  return average_mismatches || angle_mismatches ? 1 : 0;
+}
@@ -0,0 +1,466 @@
+/***************************************************************************************************
+ * Medibox telemetry store (host build, `pio run -e telemetry`)
+ *
+ *   program ingest <root> [--host H] [--port P] [--capture FILE]
+ *       Subscribes to medibox/+/+ (and the legacy ENTC-ADMIN-LIGHT) on a broker and appends every
+ *       numeric payload to the segment store. --capture also records the raw messages for replay.
+ *   program query <root> <device> <metric> [--from S] [--to S] [--raw]
+ *       Summarises (count/min/max/mean) or dumps a time range. Times are unix seconds.
+ *   program bench <capture> <root> [--repeat N]
+ *       Replays a capture through the decode/append path and reports ingest and scan rates.
+ *   program synth <capture> [--devices N] [--hours H] [--interval MS]
+ *       Writes a synthetic capture in the same format, for benchmarking without a fleet.
+ *
+ * Capture format: one message per line, "<unix-ms> <topic> <payload>".
+ **************************************************************************************************/
+#include "segment_store.h"
+
+#include <MediboxMqtt.h>
+#include <mosquitto.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <cmath>
+#include <set>
+#include <string>
+#include <vector>
+
+#define LEGACY_LIGHT_TOPIC "ENTC-ADMIN-LIGHT"
+
+struct CapturedMessage
+{
+  int64_t timestamp_ms;
+  std::string topic;
+  std::string payload;
+};
+
+struct IngestContext
+{
+  SegmentStore *store;
+  FILE *capture;
+  uint64_t stored;
+  uint64_t skipped;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static int64_t wall_clock_ms()
+{
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+static double steady_seconds()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/***************************************************************************************************
+ * decode_telemetry()
+ * Maps a topic and its text payload to (device, metric, value). Only single-level leaves with a
+ * numeric payload are telemetry; config documents and acks are skipped.
+ **************************************************************************************************/
+static bool decode_telemetry(const char *topic, const char *payload, size_t length, std::string &device,
+                             std::string &metric, float &value)
+{
+  if (strcmp(topic, LEGACY_LIGHT_TOPIC) == 0)
+  {
+    device = "legacy";
+    metric = "light";
+  }
+  else
+  {
+    char device_id[DEVICE_ID_LEN];
+    if (!device_id_from_topic(topic, device_id, sizeof(device_id)))
+      return false;
+    const char *leaf = topic + strlen(MEDIBOX_TOPIC_ROOT "/") + strlen(device_id);
+    if (*leaf != '/' || leaf[1] == '\0' || strchr(leaf + 1, '/') != nullptr)
+      return false;
+    device = device_id;
+    metric = leaf + 1;
+  }
+
+  char text[32];
+  if (length == 0 || length >= sizeof(text))
+    return false;
+  memcpy(text, payload, length);
+  text[length] = '\0';
+
+  char *end = nullptr;
+  value = strtof(text, &end);
+  while (end && (*end == ' ' || *end == '\r' || *end == '\n'))
+    end++;
+  return end != text && *end == '\0' && std::isfinite(value);
+}
+
+static bool ingest_message(IngestContext &ctx, int64_t timestamp_ms, const char *topic, const char *payload,
+                           size_t length)
+{
+  std::string device, metric;
+  float value;
+  if (!decode_telemetry(topic, payload, length, device, metric, value) ||
+      !ctx.store->append(device, metric, timestamp_ms, value))
+  {
+    ctx.skipped++;
+    return false;
+  }
+  ctx.stored++;
+  return true;
+}
+
+/***************************************************************************************************
+ * ingest
+ **************************************************************************************************/
+static void on_connect(struct mosquitto *mosq, void *, int rc)
+{
+  if (rc != 0)
+  {
+    fprintf(stderr, "broker refused connection: %s\n", mosquitto_strerror(rc));
+    return;
+  }
+  mosquitto_subscribe(mosq, nullptr, MEDIBOX_TOPIC_ROOT "/+/+", 0);
+  mosquitto_subscribe(mosq, nullptr, LEGACY_LIGHT_TOPIC, 0);
+}
+
+static void on_message(struct mosquitto *, void *obj, const struct mosquitto_message *msg)
+{
+  if (msg->retain)
+    return; // The broker's last value from before this run, not a new sample
+
+  IngestContext &ctx = *(IngestContext *)obj;
+  int64_t now = wall_clock_ms();
+  const char *payload = (const char *)msg->payload;
+
+  if (ctx.capture && memchr(payload, '\n', msg->payloadlen) == nullptr)
+  {
+    fprintf(ctx.capture, "%lld %s %.*s\n", (long long)now, msg->topic, msg->payloadlen, payload);
+  }
+  ingest_message(ctx, now, msg->topic, payload, (size_t)msg->payloadlen);
+}
+
+static void on_signal(int)
+{
+  stop_requested = 1;
+}
+
+static int cmd_ingest(int argc, char **argv)
+{
+  if (argc < 1)
+    return 2;
+  const char *host = "127.0.0.1";
+  int port = 1883;
+  const char *capture_path = nullptr;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (strcmp(argv[i], "--host") == 0)
+      host = argv[i + 1];
+    else if (strcmp(argv[i], "--port") == 0)
+      port = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--capture") == 0)
+      capture_path = argv[i + 1];
+    else
+      return 2;
+  }
+
+  SegmentStore store(argv[0]);
+  IngestContext ctx = {&store, nullptr, 0, 0};
+  if (capture_path && !(ctx.capture = fopen(capture_path, "a")))
+  {
+    perror(capture_path);
+    return 1;
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  mosquitto_lib_init();
+  struct mosquitto *mosq = mosquitto_new(nullptr, true, &ctx);
+  mosquitto_connect_callback_set(mosq, on_connect);
+  mosquitto_message_callback_set(mosq, on_message);
+  int rc = mosquitto_connect(mosq, host, port, 60);
+  if (rc != MOSQ_ERR_SUCCESS)
+  {
+    fprintf(stderr, "connect to %s:%d failed: %s\n", host, port, mosquitto_strerror(rc));
+    return 1;
+  }
+
+  printf("Ingesting from %s:%d into %s\n", host, port, store.root().c_str());
+  double last_report = steady_seconds();
+  uint64_t last_stored = 0;
+  while (!stop_requested)
+  {
+    rc = mosquitto_loop(mosq, 100, 1);
+    if (rc != MOSQ_ERR_SUCCESS)
+    {
+      sleep(1);
+      mosquitto_reconnect(mosq);
+    }
+
+    double now = steady_seconds();
+    if (now - last_report >= 10.0)
+    {
+      printf("stored=%llu skipped=%llu (%.0f msg/s)\n", (unsigned long long)ctx.stored,
+             (unsigned long long)ctx.skipped, (ctx.stored - last_stored) / (now - last_report));
+      fflush(stdout);
+      store.flush();
+      if (ctx.capture)
+        fflush(ctx.capture);
+      last_report = now;
+      last_stored = ctx.stored;
+    }
+  }
+
+  mosquitto_disconnect(mosq);
+  mosquitto_destroy(mosq);
+  mosquitto_lib_cleanup();
+  store.close_all();
+  if (ctx.capture)
+    fclose(ctx.capture);
+  printf("stored=%llu skipped=%llu\n", (unsigned long long)ctx.stored, (unsigned long long)ctx.skipped);
+  return 0;
+}
+
+/***************************************************************************************************
+ * query
+ **************************************************************************************************/
+static int cmd_query(int argc, char **argv)
+{
+  if (argc < 3)
+    return 2;
+  int64_t from_ms = 0;
+  int64_t to_ms = INT64_MAX;
+  bool raw = false;
+  for (int i = 3; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--raw") == 0)
+      raw = true;
+    else if (strcmp(argv[i], "--from") == 0 && i + 1 < argc)
+      from_ms = (int64_t)(atof(argv[++i]) * 1000.0);
+    else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc)
+      to_ms = (int64_t)(atof(argv[++i]) * 1000.0);
+    else
+      return 2;
+  }
+
+  SegmentStore store(argv[0]);
+  if (raw)
+  {
+    std::vector<int64_t> timestamps;
+    std::vector<float> values;
+    if (!store.dump(argv[1], argv[2], from_ms, to_ms, timestamps, values))
+    {
+      fprintf(stderr, "no data for %s/%s\n", argv[1], argv[2]);
+      return 1;
+    }
+    for (size_t i = 0; i < timestamps.size(); i++)
+      printf("%lld.%03lld %g\n", (long long)(timestamps[i] / 1000), (long long)(timestamps[i] % 1000), values[i]);
+    return 0;
+  }
+
+  RangeSummary summary;
+  double start = steady_seconds();
+  if (!store.summarize(argv[1], argv[2], from_ms, to_ms, summary))
+  {
+    fprintf(stderr, "no data for %s/%s\n", argv[1], argv[2]);
+    return 1;
+  }
+  double elapsed = steady_seconds() - start;
+  printf("segments=%d count=%llu min=%g max=%g mean=%g (%.3f ms)\n", summary.segments,
+         (unsigned long long)summary.count, summary.min, summary.max,
+         summary.count ? summary.sum / summary.count : 0.0, elapsed * 1000.0);
+  return 0;
+}
+
+/***************************************************************************************************
+ * bench
+ **************************************************************************************************/
+static bool load_capture(const char *path, std::vector<CapturedMessage> &messages)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+
+  char line[512];
+  while (fgets(line, sizeof(line), f))
+  {
+    char *topic = strchr(line, ' ');
+    if (!topic)
+      continue;
+    char *payload = strchr(topic + 1, ' ');
+    if (!payload)
+      continue;
+    *topic++ = '\0';
+    *payload++ = '\0';
+    payload[strcspn(payload, "\r\n")] = '\0';
+    messages.push_back({atoll(line), topic, payload});
+  }
+  fclose(f);
+  return true;
+}
+
+static int cmd_bench(int argc, char **argv)
+{
+  if (argc < 2)
+    return 2;
+  int repeat = 1;
+  if (argc >= 4 && strcmp(argv[2], "--repeat") == 0)
+    repeat = std::max(1, atoi(argv[3]));
+
+  std::vector<CapturedMessage> messages;
+  if (!load_capture(argv[0], messages) || messages.empty())
+  {
+    fprintf(stderr, "cannot read capture %s\n", argv[0]);
+    return 1;
+  }
+
+  int64_t first_ms = messages.front().timestamp_ms;
+  int64_t last_ms = messages.back().timestamp_ms;
+  for (const CapturedMessage &m : messages)
+  {
+    first_ms = std::min(first_ms, m.timestamp_ms);
+    last_ms = std::max(last_ms, m.timestamp_ms);
+  }
+  // Each repeat is shifted past the previous one so appends stay in time order
+  int64_t shift_ms = (last_ms - first_ms) + SEGMENT_DEFAULT_PARTITION_MS;
+
+  SegmentStore store(argv[1]);
+  IngestContext ctx = {&store, nullptr, 0, 0};
+  size_t payload_bytes = 0;
+
+  double start = steady_seconds();
+  for (int r = 0; r < repeat; r++)
+  {
+    for (const CapturedMessage &m : messages)
+    {
+      ingest_message(ctx, m.timestamp_ms + r * shift_ms, m.topic.c_str(), m.payload.data(), m.payload.size());
+      payload_bytes += m.payload.size();
+    }
+  }
+  store.close_all();
+  double ingest_s = steady_seconds() - start;
+
+  uint64_t total = (uint64_t)messages.size() * repeat;
+  printf("ingest: %llu messages (%llu stored, %llu skipped) in %.3f s\n", (unsigned long long)total,
+         (unsigned long long)ctx.stored, (unsigned long long)ctx.skipped, ingest_s);
+  printf("        %.0f msg/s, %.1f ns/msg, %.2f MB/s payload\n", total / ingest_s, ingest_s * 1e9 / total,
+         payload_bytes / ingest_s / 1e6);
+
+  // Full-range scan of every series that was written
+  std::set<std::pair<std::string, std::string>> series;
+  for (const CapturedMessage &m : messages)
+  {
+    std::string device, metric;
+    float value;
+    if (decode_telemetry(m.topic.c_str(), m.payload.data(), m.payload.size(), device, metric, value))
+      series.insert({device, metric});
+  }
+
+  uint64_t rows = 0;
+  start = steady_seconds();
+  for (const auto &s : series)
+  {
+    RangeSummary summary;
+    store.summarize(s.first, s.second, INT64_MIN / 2, INT64_MAX / 2, summary);
+    rows += summary.count;
+  }
+  double scan_s = steady_seconds() - start;
+  printf("scan:   %zu series, %llu rows in %.3f s (%.1f Mrows/s)\n", series.size(), (unsigned long long)rows,
+         scan_s, rows / scan_s / 1e6);
+  return 0;
+}
+
+/***************************************************************************************************
+ * synth
+ **************************************************************************************************/
+static int cmd_synth(int argc, char **argv)
+{
+  if (argc < 1)
+    return 2;
+  int devices = 100;
+  double hours = 1.0;
+  int interval_ms = 1000;
+  for (int i = 1; i + 1 < argc; i += 2)
+  {
+    if (strcmp(argv[i], "--devices") == 0)
+      devices = atoi(argv[i + 1]);
+    else if (strcmp(argv[i], "--hours") == 0)
+      hours = atof(argv[i + 1]);
+    else if (strcmp(argv[i], "--interval") == 0)
+      interval_ms = atoi(argv[i + 1]);
+    else
+      return 2;
+  }
+  if (devices <= 0 || interval_ms <= 0)
+    return 2;
+
+  FILE *f = fopen(argv[0], "w");
+  if (!f)
+  {
+    perror(argv[0]);
+    return 1;
+  }
+
+  std::vector<MediboxTopics> topics(devices);
+  for (int d = 0; d < devices; d++)
+  {
+    uint8_t mac[6] = {0x02, 0x00, 0x00, (uint8_t)(d >> 16), (uint8_t)(d >> 8), (uint8_t)d};
+    char device_id[DEVICE_ID_LEN];
+    make_device_id(mac, device_id, sizeof(device_id));
+    build_topics(topics[d], device_id);
+  }
+
+  int64_t start_ms = wall_clock_ms();
+  int64_t end_ms = start_ms + (int64_t)(hours * 3600.0 * 1000.0);
+  uint64_t lines = 0;
+  for (int64_t t = start_ms; t < end_ms; t += interval_ms)
+  {
+    for (int d = 0; d < devices; d++)
+    {
+      float light = 0.5f + 0.4f * sinf((float)(t - start_ms) / 3.6e6f + d) + 0.02f * ((d * 7 + t) % 5);
+      char payload[16];
+      format_light_average(payload, sizeof(payload), light);
+      fprintf(f, "%lld %s %s\n", (long long)(t + d % interval_ms), topics[d].light, payload);
+      lines++;
+    }
+  }
+  fclose(f);
+  printf("wrote %llu messages to %s\n", (unsigned long long)lines, argv[0]);
+  return 0;
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr,
+          "usage: %s ingest <root> [--host H] [--port P] [--capture FILE]\n"
+          "       %s query <root> <device> <metric> [--from S] [--to S] [--raw]\n"
+          "       %s bench <capture> <root> [--repeat N]\n"
+          "       %s synth <capture> [--devices N] [--hours H] [--interval MS]\n",
+          argv0, argv0, argv0, argv0);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  int rc = 2;
+  if (strcmp(argv[1], "ingest") == 0)
+    rc = cmd_ingest(argc - 2, argv + 2);
+  else if (strcmp(argv[1], "query") == 0)
+    rc = cmd_query(argc - 2, argv + 2);
+  else if (strcmp(argv[1], "bench") == 0)
+    rc = cmd_bench(argc - 2, argv + 2);
+  else if (strcmp(argv[1], "synth") == 0)
+    rc = cmd_synth(argc - 2, argv + 2);
+
+  if (rc == 2)
+    usage(argv[0]);
+  return rc;
+}
@@ -0,0 +1,394 @@
+#include "segment_store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+
+static size_t align64(size_t n)
+{
+  return (n + 63) & ~(size_t)63;
+}
+
+size_t segment_file_size(uint32_t capacity)
+{
+  return sizeof(SegmentHeader) + align64((size_t)capacity * sizeof(int64_t)) +
+         align64((size_t)capacity * sizeof(float));
+}
+
+static bool make_dirs(const std::string &path)
+{
+  for (size_t pos = 1; pos <= path.size(); pos++)
+  {
+    if (pos == path.size() || path[pos] == '/')
+    {
+      std::string part = path.substr(0, pos);
+      if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST)
+        return false;
+    }
+  }
+  return true;
+}
+
+/***************************************************************************************************
+ * Path components come from MQTT topics, so anything that could escape the store root is
+ * rejected instead of sanitised.
+ **************************************************************************************************/
+static bool safe_component(const std::string &name)
+{
+  if (name.empty() || name == "." || name == "..")
+    return false;
+  return name.find('/') == std::string::npos;
+}
+
+/***************************************************************************************************
+ * map_segment()
+ * Maps an existing segment file and points the column pointers into it.
+ **************************************************************************************************/
+bool map_segment(const std::string &path, bool writable, MappedSegment &segment)
+{
+  int fd = open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SegmentHeader))
+  {
+    close(fd);
+    return false;
+  }
+
+  void *base = mmap(nullptr, st.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+  {
+    close(fd);
+    return false;
+  }
+
+  SegmentHeader *header = (SegmentHeader *)base;
+  if (memcmp(header->magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) != 0 || header->version != SEGMENT_VERSION ||
+      segment_file_size(header->capacity) != (size_t)st.st_size)
+  {
+    munmap(base, st.st_size);
+    close(fd);
+    return false;
+  }
+
+  segment.path = path;
+  segment.fd = fd;
+  segment.base = (uint8_t *)base;
+  segment.size = st.st_size;
+  segment.header = header;
+  segment.timestamps = (int64_t *)(segment.base + sizeof(SegmentHeader));
+  segment.values = (float *)(segment.base + sizeof(SegmentHeader) + align64((size_t)header->capacity * sizeof(int64_t)));
+  return true;
+}
+
+void unmap_segment(MappedSegment &segment)
+{
+  if (segment.base)
+    munmap(segment.base, segment.size);
+  if (segment.fd >= 0)
+    close(segment.fd);
+  segment = MappedSegment();
+}
+
+/***************************************************************************************************
+ * create_segment()
+ * Creates and sizes a new, empty segment file. Pages are only backed by disk once written.
+ **************************************************************************************************/
+static bool create_segment(const std::string &path, int64_t start_ms, int64_t span_ms, uint32_t capacity)
+{
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return errno == EEXIST;
+
+  SegmentHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+  header.version = SEGMENT_VERSION;
+  header.start_ms = start_ms;
+  header.span_ms = span_ms;
+  header.capacity = capacity;
+
+  bool ok = ftruncate(fd, segment_file_size(capacity)) == 0 &&
+            pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header);
+  close(fd);
+  if (!ok)
+    unlink(path.c_str());
+  return ok;
+}
+
+static std::string segment_name(int64_t start_ms, int sequence)
+{
+  char name[48];
+  snprintf(name, sizeof(name), "%lld-%d.seg", (long long)start_ms, sequence);
+  return name;
+}
+
+SegmentStore::SegmentStore(const std::string &root, int64_t partition_ms, uint32_t capacity)
+    : root_(root), partition_ms_(partition_ms), capacity_((capacity + 15) & ~15u)
+{
+}
+
+SegmentStore::~SegmentStore()
+{
+  close_all();
+}
+
+bool SegmentStore::open_writer(Writer &writer, const std::string &dir, int64_t start_ms, int sequence)
+{
+  unmap_segment(writer.segment);
+
+  // Reopen the newest existing segment of this partition, or start a fresh one
+  while (true)
+  {
+    std::string path = dir + "/" + segment_name(start_ms, sequence);
+    if (!create_segment(path, start_ms, partition_ms_, capacity_))
+      return false;
+    if (!map_segment(path, true, writer.segment))
+      return false;
+    if (writer.segment.header->count < writer.segment.header->capacity)
+      break;
+    unmap_segment(writer.segment);
+    sequence++;
+  }
+  writer.sequence = sequence;
+  return true;
+}
+
+/***************************************************************************************************
+ * append()
+ * Appends one row to the partition that contains timestamp_ms.
+ **************************************************************************************************/
+bool SegmentStore::append(const std::string &device, const std::string &metric, int64_t timestamp_ms, float value)
+{
+  if (!safe_component(device) || !safe_component(metric))
+    return false;
+
+  int64_t start_ms = timestamp_ms - ((timestamp_ms % partition_ms_) + partition_ms_) % partition_ms_;
+  std::string key = device + "/" + metric;
+  Writer &writer = writers_[key];
+
+  SegmentHeader *header = writer.segment.header;
+  if (!header || header->start_ms != start_ms)
+  {
+    std::string dir = root_ + "/" + key;
+    if (!make_dirs(dir) || !open_writer(writer, dir, start_ms, 0))
+    {
+      writers_.erase(key);
+      return false;
+    }
+    header = writer.segment.header;
+  }
+  else if (header->count >= header->capacity)
+  {
+    if (!open_writer(writer, root_ + "/" + key, start_ms, writer.sequence + 1))
+    {
+      writers_.erase(key);
+      return false;
+    }
+    header = writer.segment.header;
+  }
+
+  uint32_t row = header->count;
+  if (row > 0 && timestamp_ms < writer.segment.timestamps[row - 1])
+    header->flags |= SEGMENT_FLAG_UNSORTED;
+  writer.segment.timestamps[row] = timestamp_ms;
+  writer.segment.values[row] = value;
+  __atomic_store_n(&header->count, row + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+void SegmentStore::flush()
+{
+  for (auto &entry : writers_)
+  {
+    MappedSegment &segment = entry.second.segment;
+    if (segment.base)
+      msync(segment.base, segment.size, MS_ASYNC);
+  }
+}
+
+void SegmentStore::close_all()
+{
+  for (auto &entry : writers_)
+  {
+    MappedSegment &segment = entry.second.segment;
+    if (segment.base)
+      msync(segment.base, segment.size, MS_SYNC);
+    unmap_segment(segment);
+  }
+  writers_.clear();
+}
+
+/***************************************************************************************************
+ * segments_in_range()
+ * Lists the segment files whose partition overlaps [from_ms, to_ms), oldest first.
+ **************************************************************************************************/
+std::vector<std::string> SegmentStore::segments_in_range(const std::string &device, const std::string &metric,
+                                                         int64_t from_ms, int64_t to_ms) const
+{
+  std::vector<std::pair<std::pair<int64_t, int>, std::string>> found;
+  if (!safe_component(device) || !safe_component(metric))
+    return {};
+
+  std::string dir = root_ + "/" + device + "/" + metric;
+  DIR *d = opendir(dir.c_str());
+  if (!d)
+    return {};
+
+  while (struct dirent *entry = readdir(d))
+  {
+    long long start = 0;
+    int sequence = 0;
+    char suffix[8] = {0};
+    if (sscanf(entry->d_name, "%lld-%d.%4s", &start, &sequence, suffix) != 3 || strcmp(suffix, "seg") != 0)
+      continue;
+    if (start >= to_ms || start + partition_ms_ <= from_ms)
+      continue;
+    found.push_back({{start, sequence}, dir + "/" + entry->d_name});
+  }
+  closedir(d);
+
+  std::sort(found.begin(), found.end());
+  std::vector<std::string> paths;
+  for (auto &item : found)
+    paths.push_back(item.second);
+  return paths;
+}
+
+/***************************************************************************************************
+ * row_range()
+ * Rows of a sorted segment that fall inside [from_ms, to_ms), found by binary search.
+ **************************************************************************************************/
+static void row_range(const MappedSegment &segment, uint32_t count, int64_t from_ms, int64_t to_ms, uint32_t &begin,
+                      uint32_t &end)
+{
+  const int64_t *ts = segment.timestamps;
+  begin = (uint32_t)(std::lower_bound(ts, ts + count, from_ms) - ts);
+  end = (uint32_t)(std::lower_bound(ts + begin, ts + count, to_ms) - ts);
+}
+
+/***************************************************************************************************
+ * summarize_rows()
+ * Reduction over a contiguous value column. Eight independent accumulators keep the loop free of
+ * cross-iteration dependencies so the compiler can keep it in vector registers.
+ **************************************************************************************************/
+static void summarize_rows(const float *values, uint32_t n, RangeSummary &summary)
+{
+  if (n == 0)
+    return;
+
+  float lo[8], hi[8], acc[8];
+  for (int l = 0; l < 8; l++)
+  {
+    lo[l] = std::numeric_limits<float>::infinity();
+    hi[l] = -std::numeric_limits<float>::infinity();
+    acc[l] = 0.0f;
+  }
+
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    for (int l = 0; l < 8; l++)
+    {
+      float v = values[i + l];
+      lo[l] = v < lo[l] ? v : lo[l];
+      hi[l] = v > hi[l] ? v : hi[l];
+      acc[l] += v;
+    }
+  }
+  for (; i < n; i++)
+  {
+    float v = values[i];
+    lo[0] = v < lo[0] ? v : lo[0];
+    hi[0] = v > hi[0] ? v : hi[0];
+    acc[0] += values[i];
+  }
+
+  float mn = lo[0], mx = hi[0];
+  double sum = 0.0;
+  for (int l = 0; l < 8; l++)
+  {
+    mn = std::min(mn, lo[l]);
+    mx = std::max(mx, hi[l]);
+    sum += acc[l];
+  }
+
+  summary.min = summary.count == 0 ? mn : std::min(summary.min, mn);
+  summary.max = summary.count == 0 ? mx : std::max(summary.max, mx);
+  summary.sum += sum;
+  summary.count += n;
+}
+
+bool SegmentStore::summarize(const std::string &device, const std::string &metric, int64_t from_ms, int64_t to_ms,
+                             RangeSummary &summary) const
+{
+  summary = RangeSummary();
+  std::vector<float> scratch;
+
+  for (const std::string &path : segments_in_range(device, metric, from_ms, to_ms))
+  {
+    MappedSegment segment;
+    if (!map_segment(path, false, segment))
+      continue;
+
+    uint32_t count = __atomic_load_n(&segment.header->count, __ATOMIC_ACQUIRE);
+    if (segment.header->flags & SEGMENT_FLAG_UNSORTED)
+    {
+      // Rare path: gather matching rows, then reduce them like a sorted range
+      scratch.clear();
+      for (uint32_t i = 0; i < count; i++)
+      {
+        int64_t t = segment.timestamps[i];
+        if (t >= from_ms && t < to_ms)
+          scratch.push_back(segment.values[i]);
+      }
+      summarize_rows(scratch.data(), (uint32_t)scratch.size(), summary);
+    }
+    else
+    {
+      uint32_t begin, end;
+      row_range(segment, count, from_ms, to_ms, begin, end);
+      summarize_rows(segment.values + begin, end - begin, summary);
+    }
+    summary.segments++;
+    unmap_segment(segment);
+  }
+  return summary.segments > 0;
+}
+
+bool SegmentStore::dump(const std::string &device, const std::string &metric, int64_t from_ms, int64_t to_ms,
+                        std::vector<int64_t> &timestamps, std::vector<float> &values) const
+{
+  bool any = false;
+  for (const std::string &path : segments_in_range(device, metric, from_ms, to_ms))
+  {
+    MappedSegment segment;
+    if (!map_segment(path, false, segment))
+      continue;
+
+    uint32_t count = __atomic_load_n(&segment.header->count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < count; i++)
+    {
+      int64_t t = segment.timestamps[i];
+      if (t >= from_ms && t < to_ms)
+      {
+        timestamps.push_back(t);
+        values.push_back(segment.values[i]);
+      }
+    }
+    any = true;
+    unmap_segment(segment);
+  }
+  return any;
+}
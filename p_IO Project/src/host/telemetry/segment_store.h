@@ -0,0 +1,97 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+/***************************************************************************************************
+ * SegmentStore
+ * Append-only columnar storage for medibox telemetry, one directory per device and metric:
+ *
+ *   <root>/<device-id>/<metric>/<partition-start-ms>-<seq>.seg
+ *
+ * Each segment covers one time partition and is a memory-mapped file holding a 64-byte header,
+ * a column of int64 millisecond timestamps and a column of float values. Both columns start on a
+ * 64-byte boundary so range scans run over plain contiguous arrays.
+ **************************************************************************************************/
+
+#define SEGMENT_MAGIC "MBXSEG1"
+#define SEGMENT_VERSION 1
+#define SEGMENT_FLAG_UNSORTED (1u << 0) // An append went backwards in time
+#define SEGMENT_DEFAULT_PARTITION_MS (3600LL * 1000LL)
+#define SEGMENT_DEFAULT_CAPACITY 65536u
+
+struct SegmentHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  int64_t start_ms;
+  int64_t span_ms;
+  uint32_t capacity;
+  uint32_t count; // Published with release ordering after the row is written
+  uint8_t reserved[24];
+};
+static_assert(sizeof(SegmentHeader) == 64, "segment header must stay one cache line");
+
+struct MappedSegment
+{
+  std::string path;
+  int fd = -1;
+  uint8_t *base = nullptr;
+  size_t size = 0;
+  SegmentHeader *header = nullptr;
+  int64_t *timestamps = nullptr;
+  float *values = nullptr;
+};
+
+struct RangeSummary
+{
+  uint64_t count = 0;
+  float min = 0.0f;
+  float max = 0.0f;
+  double sum = 0.0;
+  int segments = 0;
+};
+
+class SegmentStore
+{
+public:
+  SegmentStore(const std::string &root, int64_t partition_ms = SEGMENT_DEFAULT_PARTITION_MS,
+               uint32_t capacity = SEGMENT_DEFAULT_CAPACITY);
+  ~SegmentStore();
+
+  bool append(const std::string &device, const std::string &metric, int64_t timestamp_ms, float value);
+  void flush();
+  void close_all();
+
+  bool summarize(const std::string &device, const std::string &metric, int64_t from_ms, int64_t to_ms,
+                 RangeSummary &summary) const;
+  bool dump(const std::string &device, const std::string &metric, int64_t from_ms, int64_t to_ms,
+            std::vector<int64_t> &timestamps, std::vector<float> &values) const;
+
+  const std::string &root() const { return root_; }
+
+private:
+  struct Writer
+  {
+    MappedSegment segment;
+    int sequence = 0;
+  };
+
+  bool open_writer(Writer &writer, const std::string &dir, int64_t start_ms, int sequence);
+  std::vector<std::string> segments_in_range(const std::string &device, const std::string &metric,
+                                             int64_t from_ms, int64_t to_ms) const;
+
+  std::string root_;
+  int64_t partition_ms_;
+  uint32_t capacity_;
+  std::map<std::string, Writer> writers_; // Keyed by "<device>/<metric>"
+};
+
+bool map_segment(const std::string &path, bool writable, MappedSegment &segment);
+void unmap_segment(MappedSegment &segment);
+size_t segment_file_size(uint32_t capacity);
@@ -0,0 +1,413 @@
+/***************************************************************************************************
+ * Time sync simulation (host build, `pio run -e timesync`)
+ *
+ * Runs lib/TimeSync against a simulated box clock and an NTP stand-in, in simulated time:
+ *   codec    NTP timestamps round-trip across the 2036 era, replies are matched and checked
+ *   week     a crystal 37 ppm off with a daily 1 ppm temperature swing, a lossy path with delay
+ *            spikes and false replies, and a day offline; the error, the error bound and the
+ *            request count are compared with stepping to an hourly SNTP reply (configTime())
+ *   slew     a 60 ms change in the server's time is slewed in without the clock going backwards
+ *   step     a 10 s jump is rejected as an outlier twice, then taken as real and stepped
+ *
+ *   program [days] [seed]
+ **************************************************************************************************/
+#include <TimeSync.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+
+#define SIM_START_US (1767225600LL * 1000000) // 2026-01-01 00:00 UTC
+#define DAY_US (86400LL * 1000000)
+#define WARMUP_US (10LL * 60 * 1000000) // Errors are scored after the first ten minutes
+
+/***************************************************************************************************
+ * SimClock
+ * True UTC and the box's local microsecond clock, which runs drift_ppm fast plus a daily swing.
+ **************************************************************************************************/
+struct SimClock
+{
+  SimClock(double drift_ppm, double swing_ppm) : true_us(SIM_START_US), local(0), drift(drift_ppm), swing(swing_ppm)
+  {
+  }
+
+  double ppm() const
+  {
+    return drift + swing * sin(2 * M_PI * (double)(true_us - SIM_START_US) / DAY_US);
+  }
+
+  void advance_to(int64_t t)
+  {
+    local += (double)(t - true_us) * (1 + ppm() * 1e-6);
+    true_us = t;
+  }
+
+  int64_t local_us() const { return (int64_t)local; }
+
+  int64_t true_us;
+  double local;
+  double drift;
+  double swing;
+};
+
+/***************************************************************************************************
+ * NtpStandIn
+ * A stratum 1 server on the far side of a simulated path. Each request gets a reply built from the
+ * true time, with separate uplink and downlink delays (so the path is asymmetric), occasional loss,
+ * delay spikes and false replies. One reply is in flight at a time, as the client waits for it.
+ **************************************************************************************************/
+class NtpStandIn : public NtpTransport
+{
+public:
+  NtpStandIn(SimClock &clock, uint32_t seed)
+      : clock_(clock), rng_(seed), loss(0), spikes(0), false_replies(0), server_offset_us(0), offline(false),
+        pending_(false), arrival_us_(0)
+  {
+  }
+
+  bool send(const uint8_t *packet, size_t n) override
+  {
+    if (n != NTP_PACKET_SIZE || (packet[0] & 7) != 3)
+      return false;
+    if (offline || uniform() < loss)
+      return true; // Lost on the way
+
+    int64_t up = path_delay(9000);
+    int64_t down = path_delay(13000);
+    int64_t t2 = clock_.true_us + up + server_offset_us;
+    if (uniform() < false_replies)
+      t2 += (uniform() < 0.5 ? -1 : 1) * (int64_t)(1000000 + uniform() * 4000000);
+    int64_t t3 = t2 + 40;
+
+    memset(reply_, 0, sizeof(reply_));
+    reply_[0] = (0 << 6) | (4 << 3) | 4; // Version 4, server
+    reply_[1] = 1;
+    reply_[2] = 6;
+    reply_[3] = 0xEC; // Precision about 2^-20 s
+    memcpy(reply_ + 12, "GOOG", 4);
+    put_u64(reply_ + 16, ntp_from_unix_us(t2 - 16000000));
+    memcpy(reply_ + 24, packet + 40, 8); // Originate: the client's transmit timestamp
+    put_u64(reply_ + 32, ntp_from_unix_us(t2));
+    put_u64(reply_ + 40, ntp_from_unix_us(t3));
+    pending_ = true;
+    arrival_us_ = clock_.true_us + up + 40 + down;
+    requests++;
+    return true;
+  }
+
+  size_t receive(uint8_t *packet, size_t size) override
+  {
+    if (!pending_ || clock_.true_us < arrival_us_ || size < NTP_PACKET_SIZE)
+      return 0;
+    pending_ = false;
+    memcpy(packet, reply_, NTP_PACKET_SIZE);
+    return NTP_PACKET_SIZE;
+  }
+
+  bool pending() const { return pending_; }
+  int64_t arrival_us() const { return arrival_us_; }
+  double uniform() { return std::uniform_real_distribution<double>(0, 1)(rng_); }
+
+  SimClock &clock_;
+  std::mt19937 rng_;
+  double loss;          // Probability a request or its reply is lost
+  double spikes;        // Probability of 50-300 ms of queueing on one leg
+  double false_replies; // Probability the reply is 1-5 s off
+  int64_t server_offset_us;
+  bool offline;
+  uint32_t requests = 0;
+
+private:
+  static void put_u64(uint8_t *p, uint64_t v)
+  {
+    for (int i = 7; i >= 0; i--, v >>= 8)
+      p[i] = (uint8_t)v;
+  }
+
+  int64_t path_delay(int64_t base_us)
+  {
+    int64_t d = base_us + (int64_t)std::exponential_distribution<double>(1.0 / 1500)(rng_);
+    if (uniform() < spikes)
+      d += 50000 + (int64_t)(uniform() * 250000);
+    return d;
+  }
+
+  uint8_t reply_[NTP_PACKET_SIZE];
+  bool pending_;
+  int64_t arrival_us_;
+};
+
+/***************************************************************************************************
+ * Run
+ * Steps the simulation a second at a time, and to each reply's arrival plus a random main loop
+ * latency, calling poll() like loop() does. Scores the shown time against true time every second.
+ **************************************************************************************************/
+struct Score
+{
+  int64_t max_error_us;
+  int64_t max_offline_error_us;
+  uint32_t max_bound_us;
+  uint32_t seconds;
+  uint32_t over_bound; // Seconds the error exceeded error_us()
+  uint32_t backwards;  // Shown time went backwards between two reads, after the warm-up
+  uint32_t late_steps; // Steps after the warm-up
+  double sum_sq;
+};
+
+struct Run
+{
+  Run(SimClock &c, NtpStandIn &s) : clock(c), server(s), sync(s), rng(99), last_shown(0), steps(0)
+  {
+    memset(&score, 0, sizeof(score));
+  }
+
+  void until(int64_t end_us, bool scored)
+  {
+    int64_t tick = clock.true_us + 1000000;
+    while (clock.true_us < end_us)
+    {
+      int64_t next = tick;
+      bool reply = server.pending() && server.arrival_us() + 3000 < tick;
+      if (reply)
+        next = server.arrival_us() + (int64_t)(std::uniform_real_distribution<double>(0, 3000)(rng));
+      clock.advance_to(next);
+      sync.poll(clock.local_us());
+      bool warm = clock.true_us - SIM_START_US >= WARMUP_US;
+      if (warm && sync.stats().steps != steps)
+        score.late_steps++;
+      steps = sync.stats().steps;
+      if (reply)
+        continue;
+
+      tick += 1000000;
+      if (!sync.synced())
+        continue;
+      int64_t local = clock.local_us();
+      int64_t shown = sync.now_us(local);
+      if (shown < last_shown && warm)
+        score.backwards++;
+      last_shown = shown;
+      if (!scored || !warm)
+        continue;
+
+      int64_t error = llabs(shown - clock.true_us);
+      uint32_t bound = sync.error_us(local);
+      score.seconds++;
+      score.sum_sq += (double)error * error;
+      score.over_bound += (uint64_t)error > bound;
+      if (error > score.max_error_us && !server.offline)
+        score.max_error_us = error;
+      if (error > score.max_offline_error_us && server.offline)
+        score.max_offline_error_us = error;
+      if (bound > score.max_bound_us)
+        score.max_bound_us = bound;
+    }
+  }
+
+  SimClock &clock;
+  NtpStandIn &server;
+  TimeSync sync;
+  std::mt19937 rng;
+  int64_t last_shown;
+  uint32_t steps;
+  Score score;
+};
+
+static bool report(const char *name, bool ok, const char *detail)
+{
+  printf("%-8s %s (%s)\n", name, ok ? "ok" : "FAILED", detail);
+  return ok;
+}
+
+static bool test_codec()
+{
+  bool ok = true;
+  const int64_t times[] = {0, SIM_START_US, 2085978495999999LL /* 2036-02-07 06:28:15 */, 2085978496000000LL,
+                           4102444800123456LL /* 2100 */};
+  for (int64_t t : times)
+    ok &= ntp_to_unix_us(ntp_from_unix_us(t)) == t;
+  ok &= ntp_from_unix_us(2085978496000000LL) >> 32 == 0; // Era 1 starts at NTP second 0
+
+  uint8_t request[NTP_PACKET_SIZE], reply[NTP_PACKET_SIZE];
+  sntp_request(request, 0x1122334455667788ULL);
+  ok &= request[0] == 0x23;
+
+  memset(reply, 0, sizeof(reply));
+  reply[0] = 0x24;
+  reply[1] = 2;
+  memcpy(reply + 24, request + 40, 8);
+  uint64_t t2 = ntp_from_unix_us(SIM_START_US + 500000), t3 = ntp_from_unix_us(SIM_START_US + 500100);
+  for (int i = 0; i < 8; i++)
+  {
+    reply[32 + i] = (uint8_t)(t2 >> (56 - 8 * i));
+    reply[40 + i] = (uint8_t)(t3 >> (56 - 8 * i));
+  }
+  SntpSample sample;
+  ok &= sntp_reply(reply, 0x1122334455667788ULL, 1000000, 1020100, sample) == SNTP_OK;
+  ok &= sample.local_us == 1010050 && sample.server_us == SIM_START_US + 500050 && sample.delay_us == 20000;
+  ok &= sntp_reply(reply, 0x1122334455667789ULL, 1000000, 1020100, sample) == SNTP_UNMATCHED;
+  reply[0] = 0xE4; // Leap indicator 3: server not synchronised
+  ok &= sntp_reply(reply, 0x1122334455667788ULL, 1000000, 1020100, sample) == SNTP_BAD;
+  reply[0] = 0x24;
+  reply[1] = 0; // Kiss-o'-death
+  ok &= sntp_reply(reply, 0x1122334455667788ULL, 1000000, 1020100, sample) == SNTP_KISS_OF_DEATH;
+  return report("codec", ok, "timestamps across 2036, matching, leap, kiss-o'-death");
+}
+
+static bool test_week(double days, uint32_t seed)
+{
+  SimClock clock(37, 1);
+  NtpStandIn server(clock, seed);
+  server.loss = 0.05;
+  server.spikes = 0.1;
+  server.false_replies = 0.05;
+  Run run(clock, server);
+
+  // Stepping to an SNTP reply every hour, as configTime() did, on the same clock and path
+  SimClock hourly_clock(37, 1);
+  int64_t end = SIM_START_US + (int64_t)(days * DAY_US);
+  int64_t offline_from = SIM_START_US + 3 * DAY_US, offline_to = offline_from + DAY_US;
+
+  printf("\n day  requests  max error ms  max bound ms  poll s  drift ppb  (true %.0f)\n", -clock.ppm() * 1000);
+  uint32_t day_requests = 0;
+  for (int day = 0; clock.true_us < end; day++)
+  {
+    int64_t day_end = SIM_START_US + (day + 1) * DAY_US;
+    if (day_end > end)
+      day_end = end;
+    int64_t max_error = run.score.max_error_us, max_offline = run.score.max_offline_error_us;
+    run.score.max_error_us = run.score.max_offline_error_us = 0;
+    run.score.max_bound_us = 0;
+
+    while (clock.true_us < day_end)
+    {
+      int64_t t = clock.true_us + 60000000;
+      server.offline = t > offline_from && t <= offline_to;
+      run.until(t < day_end ? t : day_end, true);
+    }
+    printf("%4d %9u %13.1f %13.1f %7u %10d%s\n", day, server.requests - day_requests,
+           (run.score.max_error_us > run.score.max_offline_error_us ? run.score.max_error_us
+                                                                    : run.score.max_offline_error_us) /
+               1000.0,
+           run.score.max_bound_us / 1000.0, run.sync.poll_interval_s(), run.sync.skew_ppb(),
+           run.score.max_offline_error_us ? "  offline" : "");
+    day_requests = server.requests;
+    if (max_error > run.score.max_error_us)
+      run.score.max_error_us = max_error;
+    if (max_offline > run.score.max_offline_error_us)
+      run.score.max_offline_error_us = max_offline;
+  }
+
+  // Hourly stepping: error just before each step is the worst; offline it runs free for the day
+  double hourly_max = 0, hourly_offline_max = 0;
+  uint32_t hourly_requests = 0;
+  std::mt19937 rng(seed);
+  std::exponential_distribution<double> jitter(1.0 / 1500);
+  int64_t anchor_true = 0, anchor_local = 0;
+  while (hourly_clock.true_us < end)
+  {
+    bool offline = hourly_clock.true_us > offline_from && hourly_clock.true_us <= offline_to;
+    if (anchor_true)
+    {
+      double error = fabs((double)(anchor_true + (hourly_clock.local_us() - anchor_local) - hourly_clock.true_us));
+      double &max = offline ? hourly_offline_max : hourly_max;
+      if (error > max)
+        max = error;
+    }
+    if (!offline)
+    {
+      // The reply's midpoint is off by half the difference between the legs
+      double up = 9000 + jitter(rng), down = 13000 + jitter(rng);
+      anchor_true = hourly_clock.true_us + (int64_t)((up - down) / 2);
+      anchor_local = hourly_clock.local_us();
+      hourly_requests++;
+    }
+    hourly_clock.advance_to(hourly_clock.true_us + 3600000000LL);
+  }
+
+  Score &s = run.score;
+  TimeSyncStats stats = run.sync.stats();
+  double rms = sqrt(s.sum_sq / (s.seconds ? s.seconds : 1));
+  printf("\nrequests=%u accepted=%u timeouts=%u slow=%u outliers=%u resets=%u steps=%u\n", stats.requests,
+         stats.accepted, stats.timeouts, stats.slow, stats.outliers, stats.resets, stats.steps);
+  printf("drift-compensated: %u requests, error rms %.2f ms, max %.1f ms online, %.1f ms after a day offline\n",
+         server.requests, rms / 1000, s.max_error_us / 1000.0, s.max_offline_error_us / 1000.0);
+  printf("hourly stepping:   %u requests, max error %.1f ms online, %.1f ms after a day offline\n", hourly_requests,
+         hourly_max / 1000, hourly_offline_max / 1000);
+  printf("error over its bound in %u of %u seconds; after the warm-up, %u steps and %u times backwards\n\n",
+         s.over_bound, s.seconds, s.late_steps, s.backwards);
+
+  // A bad first reply is corrected by a second step, inside the warm-up
+  bool ok = s.max_error_us < TIMESYNC_TARGET_US && s.backwards == 0 && s.late_steps == 0;
+  ok &= s.over_bound <= s.seconds / 100; // An estimate, not a guarantee: it must hold 99% of the time
+  ok &= server.requests * 3 < hourly_requests;
+  ok &= days < 4 || (s.max_offline_error_us < 100000 && s.max_offline_error_us * 10 < hourly_offline_max);
+  ok &= fabs(run.sync.skew_ppb() + clock.ppm() * 1000) < 1000; // Local runs fast: server - local falls
+  char detail[96];
+  snprintf(detail, sizeof(detail), "%.0f days, %u requests, %.1f ms max error", days, server.requests,
+           s.max_error_us / 1000.0);
+  return report("week", ok, detail);
+}
+
+// Settled sync on a clean path, then the server's time moves by `jump_us`
+static void settle(Run &run)
+{
+  run.until(SIM_START_US + DAY_US, false);
+}
+
+static bool test_slew(uint32_t seed)
+{
+  SimClock clock(-12, 0);
+  NtpStandIn server(clock, seed);
+  Run run(clock, server);
+  settle(run);
+
+  server.server_offset_us = 60000;
+  int64_t from = clock.true_us;
+  run.until(from + DAY_US, false);
+  int64_t error = llabs(run.sync.now_us(clock.local_us()) - clock.true_us - server.server_offset_us);
+  TimeSyncStats stats = run.sync.stats();
+  bool ok = error <= run.sync.error_us(clock.local_us()) && run.score.backwards == 0 && stats.steps == 1 && stats.resets == 0;
+  char detail[96];
+  snprintf(detail, sizeof(detail), "%.1f ms off a day later, %u outliers on the way", error / 1000.0, stats.outliers);
+  return report("slew", ok, detail);
+}
+
+static bool test_step(uint32_t seed)
+{
+  SimClock clock(20, 0);
+  NtpStandIn server(clock, seed);
+  Run run(clock, server);
+  settle(run);
+
+  server.server_offset_us = 10000000;
+  run.until(clock.true_us + DAY_US, false);
+  int64_t error = llabs(run.sync.now_us(clock.local_us()) - clock.true_us - server.server_offset_us);
+  TimeSyncStats stats = run.sync.stats();
+  bool ok = error <= run.sync.error_us(clock.local_us()) && stats.resets == 1 && stats.steps == 2 && stats.outliers == TIMESYNC_RESET_OUTLIERS - 1;
+  char detail[96];
+  snprintf(detail, sizeof(detail), "%u outliers, then reset and stepped; %.1f ms off", stats.outliers,
+           error / 1000.0);
+  return report("step", ok, detail);
+}
+
+int main(int argc, char **argv)
+{
+  double days = argc > 1 ? atof(argv[1]) : 7;
+  uint32_t seed = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 10) : 1;
+  if (days <= 0)
+  {
+    fprintf(stderr, "usage: timesync [days] [seed]\n");
+    return 2;
+  }
+
+  bool ok = test_codec();
+  ok &= test_week(days, seed);
+  ok &= test_slew(seed);
+  ok &= test_step(seed);
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+/***************************************************************************************************
+ * TLS reconnect probe (host build, `pio run -e tlsprobe`, needs libmbedtls-dev)
+ *
+ * Runs the firmware's TLS transport (lib/TlsLink) against a broker the way a box on flaky Wi-Fi
+ * does: connect, MQTT CONNECT/CONNACK, drop the connection, repeat. The first handshake is full,
+ * the following ones should resume; the summary shows both.
+ *
+ *   program <host> <port> <ca.crt> [pin-sha256] [--count N] [--server-name NAME]
+ *
+ * Against the local test broker from scripts/mosquitto_tls/make_certs.sh:
+ *   program 127.0.0.1 8883 scripts/mosquitto_tls/certs/ca.crt --server-name medibox-broker
+ **************************************************************************************************/
+#include <TlsLink.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <mbedtls/net_sockets.h>
+
+static uint32_t clock_us()
+{
+  using namespace std::chrono;
+  return (uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+static int sock_send(void *io, const unsigned char *data, size_t len)
+{
+  ssize_t n = send(*(int *)io, data, len, MSG_NOSIGNAL);
+  return n >= 0 ? (int)n : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+static int sock_recv(void *io, unsigned char *data, size_t len)
+{
+  ssize_t n = recv(*(int *)io, data, len, 0);
+  if (n > 0)
+    return (int)n;
+  return n == 0 ? MBEDTLS_ERR_NET_CONN_RESET : MBEDTLS_ERR_NET_RECV_FAILED;
+}
+
+static int tcp_connect(const char *host, const char *port)
+{
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *res;
+  if (getaddrinfo(host, port, &hints, &res) != 0)
+    return -1;
+
+  int fd = -1;
+  for (addrinfo *ai = res; ai; ai = ai->ai_next)
+  {
+    fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (fd < 0)
+      continue;
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+      break;
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+
+  if (fd >= 0)
+  {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  return fd;
+}
+
+static bool read_file(const char *path, std::string &out)
+{
+  FILE *f = fopen(path, "rb");
+  if (!f)
+    return false;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    out.append(buf, n);
+  fclose(f);
+  return true;
+}
+
+/***************************************************************************************************
+ * mqtt_session()
+ * Minimal MQTT 3.1.1 exchange over the TLS link: CONNECT, wait for CONNACK, DISCONNECT.
+ **************************************************************************************************/
+static bool mqtt_session(TlsLink &link, const char *client_id)
+{
+  unsigned char packet[64];
+  size_t id_len = strlen(client_id);
+  size_t n = 0;
+  packet[n++] = 0x10;                 // CONNECT
+  packet[n++] = (unsigned char)(12 + id_len);
+  const unsigned char header[] = {0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02, 0x00, 0x3c};
+  memcpy(packet + n, header, sizeof(header));
+  n += sizeof(header);
+  packet[n++] = 0x00;
+  packet[n++] = (unsigned char)id_len;
+  memcpy(packet + n, client_id, id_len);
+  n += id_len;
+
+  if (link.write(packet, n) != (int)n)
+    return false;
+
+  unsigned char connack[4];
+  size_t got = 0;
+  while (got < sizeof(connack))
+  {
+    int r = link.read(connack + got, sizeof(connack) - got);
+    if (r < 0)
+      return false;
+    got += r;
+  }
+
+  const unsigned char disconnect[] = {0xe0, 0x00};
+  link.write(disconnect, sizeof(disconnect));
+  return connack[0] == 0x20 && connack[3] == 0x00;
+}
+
+static double median_ms(std::vector<uint32_t> v)
+{
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  return v[v.size() / 2] / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *host = NULL, *port = NULL, *ca_path = NULL, *pin_hex = NULL;
+  const char *server_name = "medibox-broker";
+  int count = 10;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--count") && i + 1 < argc)
+      count = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--server-name") && i + 1 < argc)
+      server_name = argv[++i];
+    else if (!host)
+      host = argv[i];
+    else if (!port)
+      port = argv[i];
+    else if (!ca_path)
+      ca_path = argv[i];
+    else
+      pin_hex = argv[i];
+  }
+  if (!host || !port || !ca_path)
+  {
+    fprintf(stderr, "usage: %s <host> <port> <ca.crt> [pin-sha256] [--count N] [--server-name NAME]\n", argv[0]);
+    return 2;
+  }
+
+  std::string ca;
+  if (!read_file(ca_path, ca))
+  {
+    fprintf(stderr, "cannot read %s\n", ca_path);
+    return 1;
+  }
+
+  uint8_t pin[TLS_PIN_LEN];
+  if (pin_hex && !tls_parse_pin(pin_hex, pin))
+  {
+    fprintf(stderr, "pin must be a SHA-256 hex string\n");
+    return 2;
+  }
+
+  TlsLink link;
+  if (!link.begin(ca.c_str(), pin_hex ? pin : NULL, server_name, clock_us, NULL))
+  {
+    fprintf(stderr, "TLS setup failed: -0x%04x\n", -link.stats().last_error);
+    return 1;
+  }
+
+  std::vector<uint32_t> full_us, resumed_us;
+  for (int i = 0; i < count; i++)
+  {
+    int fd = tcp_connect(host, port);
+    if (fd < 0)
+    {
+      fprintf(stderr, "connect %s:%s: %s\n", host, port, strerror(errno));
+      return 1;
+    }
+
+    bool ok = link.handshake(&fd, sock_send, sock_recv, 15000);
+    if (ok)
+    {
+      const TlsStats &s = link.stats();
+      bool resumed = link.last_resumed();
+      (resumed ? resumed_us : full_us).push_back(resumed ? s.last_resumed_us : s.last_full_us);
+      ok = mqtt_session(link, "tlsprobe");
+      printf("%3d  %-7s  %8.2f ms  mqtt %s\n", i, resumed ? "resumed" : "full",
+             (resumed ? s.last_resumed_us : s.last_full_us) / 1000.0, ok ? "ok" : "FAILED");
+    }
+    else
+    {
+      printf("%3d  handshake failed: -0x%04x%s\n", i, -link.stats().last_error,
+             link.stats().pin_failures ? " (pin mismatch)" : "");
+    }
+    link.close();
+    close(fd);
+  }
+
+  const TlsStats &s = link.stats();
+  printf("\nfull     %3u  median %8.2f ms\nresumed  %3u  median %8.2f ms\nfailed   %3u\n", s.full_handshakes,
+         median_ms(full_us), s.resumed_handshakes, median_ms(resumed_us), s.failed_handshakes);
+  return s.failed_handshakes ? 1 : 0;
+}
@@ -7,35 +7,46 @@
 #include <time.h>
 #include <ESP32Servo.h>
 #include <PubSubClient.h>
-// Display and Pin Configurations
-#define SCREEN_WIDTH 128
-#define SCREEN_HEIGHT 64
+#include <MediboxConfig.h>
+#include <MediboxMqtt.h>
+#include <IndicatorEsp32.h>
+#include <AlertEngine.h>
+#include <LdrAcquisition.h>
+#include <DisplayFlusher.h>
+#include <BoardProfile.h>
+#include <EventBus.h>
+#include <SampleLog.h>
+#include <MqttTransport.h>
+#include <LogDrain.h>
+#include <MediboxCore.h>
+#include <TraceRecorder.h>
+#include <JournalStore.h>
+#include <GlyphCache.h>
+#include <TimeService.h>
+// Display and Pin Configurations (from the board profile selected by the build env)
+constexpr int SCREEN_WIDTH = BOARD.screen_width;
+constexpr int SCREEN_HEIGHT = BOARD.screen_height;
 #define OLED_RESET -1
-#define SCREEN_ADDRESS 0x3c
-
-#define BUZZER 5
-#define LED_1 15
-#define LED_2 2
-#define PB_CANCEL 34
-#define PB_OK 32
-#define PB_UP 33
-#define PB_DOWN 35
-#define DHTPIN 12
-#define SERVO_PIN 13
-
-#define NTP_SERVER "time.google.com"
-#define UTC_OFFSET_DST 0
-#define LDR_PIN 36 // analog pin
-
-char tempAr[6];
+constexpr uint8_t SCREEN_ADDRESS = BOARD.screen_address;
+
+constexpr int BUZZER = BOARD.pin_buzzer;
+constexpr int LED_1 = BOARD.pin_led_1;
+constexpr int LED_2 = BOARD.pin_led_2;
+constexpr int PB_CANCEL = BOARD.pin_cancel;
+constexpr int PB_OK = BOARD.pin_ok;
+constexpr int PB_UP = BOARD.pin_up;
+constexpr int PB_DOWN = BOARD.pin_down;
+constexpr int DHTPIN = BOARD.pin_dht;
+constexpr int SERVO_PIN = BOARD.pin_servo;
+
 // LDR Configuration
 // Global Variables
 int UTC_OFFSET = 0;
 int offset_hours = 0;
 int offset_mins = 0;
 
-WiFiClient espClient;
-PubSubClient mqttClient(espClient);
+PubSubClient mqttClient(mqtt_transport()); // Plain TCP, or pinned TLS with -DMEDIBOX_MQTT_TLS
+MediboxTopics topics; // medibox/<device-id>/... derived from the MAC in setupMqtt()
 
 int days = 0;
 int hours = 0;
@@ -44,21 +55,11 @@ int seconds = 0;
 String dayOfWeek = "";
 Servo shade_servo;
 
-float theta_offset = 30;
-float gammma = 0.75;
-float Tmed = 30.0;
-
-bool alarm_enabled = false;
-const int N_ALARMS = 3;
-int alarm_hours[N_ALARMS] = {0, 1, 0};
-int alarm_minutes[N_ALARMS] = {1, 10, 0};
-bool alarm_triggered[N_ALARMS] = {false, false, false};
-int temp_alarm_hour = 25; // to store the alarm time when the user presses the ok button _initially set to 25 to avoid any confusion with the actual time
-int temp_alarm_minute = 00;
-
-// Musical Notes
-const int N_NOTES = 8;
-const int MUSICAL_NOTES[] = {262, 294, 330, 349, 392, 440, 494, 523};
+const int N_ALARMS = BOARD.n_alarms;
+// Power-on alarm times; boards with fewer alarms take the first N_ALARMS
+const uint8_t DEFAULT_ALARM_HOURS[CORE_MAX_ALARMS] = {0, 1, 0, 0};
+const uint8_t DEFAULT_ALARM_MINUTES[CORE_MAX_ALARMS] = {1, 10, 0, 0};
+static_assert(N_ALARMS <= CORE_MAX_ALARMS, "no default for every alarm");
 
 // Menu Configuration
 enum MenuState
@@ -68,32 +69,32 @@ enum MenuState
   TIME_ZONE_SETTING,
   ALARM_SETTING
 };
-#define MAX_SAMPLES 100
-float ldr_readings[MAX_SAMPLES];
-int ldr_index = 0;
-int ldr_sample_count = 24;
+// Storage for the core's compressed sensor history, stamped with epoch seconds
+SampleBlock light_blocks[BOARD.light_log_blocks];
+SampleBlock temp_blocks[BOARD.env_log_blocks];
+SampleBlock hum_blocks[BOARD.env_log_blocks];
 
 unsigned long lastLdrSample = 0;
-unsigned long lastLdrUpload = 0;
-int valid_sample_count = 0;
-int ts = 5;   // Sampling interval (seconds)
-int tu = 120; // Upload interval (seconds)
+unsigned long lastEnvSample = 0;
+#define ENV_SAMPLE_MS 2000 // DHT22 minimum sampling period
+
+unsigned long buttons_ready_at = 0; // Button events stamped before this are bounces or stale
+#define ALARM_RING_MS (5 * 60 * 1000UL) // An alarm nobody answers is stopped and journaled as missed
 
 const int MAX_VISIBLE_MENU_ITEMS = 3;
-const String MENU_ITEMS[] = {
-    "Set Time Zone",
-    "Set Alarm 1",
-    "Set Alarm 2",
-    "Set Alarm 3",
-    "Disable Alarms"};
+// Menu: time zone, one entry per alarm, disable alarms
+const char *const ALARM_MENU_ITEMS[] = {"Set Alarm 1", "Set Alarm 2", "Set Alarm 3", "Set Alarm 4"};
+const int MENU_ITEM_COUNT = N_ALARMS + 2;
 
 const String DAYS_OF_WEEK[] = {
     "Sunday", "Monday", "Tuesday", "Wednesday",
     "Thursday", "Friday", "Saturday"};
 
 // Global Objects
-Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET);
+Adafruit_SSD1306 display(SCREEN_WIDTH, SCREEN_HEIGHT, &Wire, OLED_RESET, DISPLAY_I2C_HZ, DISPLAY_I2C_HZ);
 DHTesp dhtSensor;
+GlyphCache glyphs_2; // Pre-rendered text sizes 2 and 3 for the clock, alarm and time zone screens
+GlyphCache glyphs_3;
 
 // Current States
 MenuState currentState = HOME_SCREEN;
@@ -104,6 +105,8 @@ int menuScrollOffset = 0;
  * Function Prototypes
  **************************************************************************************************/
 void display_time();
+void build_glyph_caches();
+void draw_glyphs(const GlyphCache &cache, int x, int y, const char *text);
 void update_time_with_check_alarm();
 void update_time();
 void go_to_menu();
@@ -113,17 +116,117 @@ void display_menu();
 int wait_for_menu_button();
 void set_time_zone();
 void set_alarm(int alarmIndex);
-void ring_alarm();
+void ring_alarm(uint8_t index);
 void disable_all_alarms();
 void print_line(String text, int column, int row, int text_size);
-void check_temp();
+void sample_env();
 void sample_ldr();
 void reset_alarm_triggered();
-void update_servo_angle();
 void connectToBroker();
 void setupMqtt();
 void receiveCallback(char *topic, byte *payload, unsigned int length);
-void publish_light_average();
+void apply_main_switch(bool on);
+
+// Event subscribers
+void on_tick_display(const Event &event);
+void on_tick_check_alarms(const Event &event);
+void on_tick_report(const Event &event);
+void on_alarm_fired(const Event &event);
+void on_light_sample(const Event &event);
+void on_env_sample(const Event &event);
+void on_config_changed(const Event &event);
+void on_button(const Event &event);
+
+/***************************************************************************************************
+ * Event bus
+ * Every sample is produced once (update_time, sample_ldr, sample_env, the button ISRs, the config
+ * callback) and fanned out here; handlers of one event run in table order. The behaviour itself
+ * lives in MediboxCore, which reports back through BoxIo below.
+ **************************************************************************************************/
+const EventSubscription EVENT_SUBSCRIPTIONS[] = {
+    {EVT_TIME_TICK, on_tick_display},
+    {EVT_TIME_TICK, on_tick_check_alarms},
+    {EVT_TIME_TICK, on_tick_report},
+    {EVT_ALARM_FIRED, on_alarm_fired},
+    {EVT_LIGHT_SAMPLE, on_light_sample},
+    {EVT_ENV_SAMPLE, on_env_sample},
+    {EVT_CONFIG_CHANGED, on_config_changed},
+    {EVT_BUTTON, on_button}};
+
+EventBus bus(EVENT_SUBSCRIPTIONS, sizeof(EVENT_SUBSCRIPTIONS) / sizeof(EVENT_SUBSCRIPTIONS[0]));
+
+/***************************************************************************************************
+ * BoxIo
+ * The core's outputs on this board. Alarms and config changes go back onto the bus, so the alarm
+ * screen and the sampling retime stay subscribers like the rest.
+ **************************************************************************************************/
+class BoxIo : public MediboxCoreIo
+{
+public:
+  void servo_write(int angle) override
+  {
+    shade_servo.write(angle);
+  }
+
+  void publish(const char *topic, const char *payload, bool retain) override
+  {
+    mqttClient.publish(topic, payload, retain);
+  }
+
+  void alarm_fired(uint8_t index) override
+  {
+    bus.publish(event_alarm_fired(millis(), index));
+  }
+
+  void env_warning(bool active) override
+  {
+    if (active)
+    {
+      indicator_play(IND_LED_2, &PATTERN_ENV_WARNING, PRIORITY_ENV_WARNING);
+    }
+    else
+    {
+      indicator_stop(IND_LED_2, PRIORITY_ENV_WARNING);
+    }
+  }
+
+  void main_switch(bool on) override
+  {
+    apply_main_switch(on);
+  }
+
+  void config_changed(const ConfigChanged &change) override
+  {
+    bus.publish(event_config_changed(millis(), change.version, change.fields, change.window_changed));
+  }
+};
+
+BoxIo box_io;
+MediboxCore core(box_io); // Alarms, sensor history, alerts, shade model and config
+
+ButtonDebounce ok_button;
+ButtonDebounce cancel_button;
+
+// Not IRAM_ATTR: bus.post() and event_button() live in flash. The Arduino GPIO handler is not an
+// IRAM interrupt either, so these never run while the flash cache is off. Both edges interrupt;
+// only the first close of a push is posted.
+void on_ok_pressed()
+{
+  uint32_t now = millis();
+  if (button_debounce_edge(ok_button, now, digitalRead(PB_OK) == LOW))
+  {
+    bus.post(event_button(now, PB_OK));
+  }
+}
+
+void on_cancel_pressed()
+{
+  uint32_t now = millis();
+  if (button_debounce_edge(cancel_button, now, digitalRead(PB_CANCEL) == LOW))
+  {
+    bus.post(event_button(now, PB_CANCEL));
+  }
+}
 
 /***************************************************************************************************
  * setup()
@@ -132,58 +235,72 @@ void publish_light_average();
 void setup()
 {
   Serial.begin(115200);
+  log_drain_begin();
 
-  pinMode(BUZZER, OUTPUT);
-  pinMode(LED_1, OUTPUT);
-  pinMode(LED_2, OUTPUT);
   pinMode(PB_CANCEL, INPUT_PULLUP);
   pinMode(PB_OK, INPUT_PULLUP);
   pinMode(PB_UP, INPUT_PULLUP);
   pinMode(PB_DOWN, INPUT_PULLUP);
-  pinMode(LDR_PIN, INPUT);
+  button_debounce_init(ok_button);
+  button_debounce_init(cancel_button);
+  attachInterrupt(digitalPinToInterrupt(PB_OK), on_ok_pressed, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(PB_CANCEL), on_cancel_pressed, CHANGE);
+  indicator_begin(LED_1, LED_2, BUZZER);
+  if constexpr (BOARD.has_ldr)
+  {
+    ldr_acquisition_begin(core.config_store());
+  }
+
+  dhtSensor.setup(DHTPIN, BOARD.env_sensor == ENV_SENSOR_DHT11 ? DHTesp::DHT11 : DHTesp::DHT22);
+  if constexpr (BOARD.has_servo)
+  {
+    shade_servo.attach(SERVO_PIN);
+    shade_servo.setPeriodHertz(50);           // Standard 50Hz for servos
+    shade_servo.attach(SERVO_PIN, 500, 2400); // Min and max pulse widths
+  }
 
-  dhtSensor.setup(DHTPIN, DHTesp::DHT22);
-  shade_servo.attach(SERVO_PIN);
-  shade_servo.setPeriodHertz(50);           // Standard 50Hz for servos
-  shade_servo.attach(SERVO_PIN, 500, 2400); // Min and max pulse widths
+  LOG_INFO("Board profile: %s", BOARD.name);
 
-  WiFi.begin("Wokwi-GUEST", "", 6);
+  WiFi.begin(BOARD.wifi_ssid, BOARD.wifi_password, BOARD.wifi_channel);
   while (WiFi.status() != WL_CONNECTED)
   {
     delay(250);
-    Serial.println("Connecting to WiFi...");
+    LOG_DEBUG("Connecting to WiFi...");
   }
-  Serial.println("WiFi connected!");
+  LOG_INFO("WiFi connected!");
 
-  configTime(UTC_OFFSET, UTC_OFFSET_DST, NTP_SERVER);
+  time_service_begin(BOARD.ntp_server);
+  time_service_set_utc_offset(UTC_OFFSET);
 
-  struct tm timeinfo;
   int tries = 0;
-  while (!getLocalTime(&timeinfo) && tries < 20)
+  while (!time_service_synced() && tries < 40)
   {
-    Serial.println("Waiting for NTP time sync...");
-    delay(500);
+    LOG_DEBUG("Waiting for NTP time sync...");
+    time_service_poll();
+    delay(250);
     tries++;
   }
-  if (tries >= 20)
+  if (tries >= 40)
   {
-    Serial.println("Failed to sync time from NTP!");
+    LOG_WARN("Failed to sync time from NTP!");
   }
   else
   {
-    Serial.println("Time successfully synced!");
+    LOG_INFO("Time successfully synced!");
   }
 
   if (!display.begin(SSD1306_SWITCHCAPVCC, SCREEN_ADDRESS))
   {
-    Serial.println(F("SSD1306 allocation failed"));
+    LOG_ERROR("SSD1306 allocation failed");
     for (;;)
       ;
   }
 
   display.ssd1306_command(0x81);
   display.ssd1306_command(0xFF);
+  display_flusher_begin(display, SCREEN_ADDRESS);
 
+  build_glyph_caches();
   display.clearDisplay();
   display.setTextWrap(false);
 
@@ -193,18 +310,27 @@ void setup()
   display.println("Welcome");
   display.setCursor(10, 36);
   display.println("Medibox!");
-  display.display();
+  display_flush();
   delay(1000);
 
   display.clearDisplay();
-  display.display();
+  display_flush();
+  journal_store_begin();
   setupMqtt();
-  Serial.println("Setup complete!");
+
+  CoreLayout layout = {N_ALARMS, BOARD.has_servo,
+                       light_blocks, BOARD.light_log_blocks,
+                       temp_blocks, hum_blocks, BOARD.env_log_blocks,
+                       DEFAULT_ALARM_HOURS, DEFAULT_ALARM_MINUTES};
+  core.set_trace(trace_recorder_begin()); // Records every core input with -DMEDIBOX_TRACE
+  core.begin(millis(), layout, topics);
+  LOG_INFO("Setup complete!");
 }
 
 /***************************************************************************************************
  * loop()
- * Continuously checks time, handles button presses, and checks temperature.
+ * Produces the time, light and environment events, then runs whatever the button interrupts
+ * queued. Everything else happens in the subscribers.
  **************************************************************************************************/
 void loop()
 {
@@ -213,25 +339,19 @@ void loop()
     connectToBroker();
   }
   mqttClient.loop();
+  log_mqtt_sink_poll(mqttClient, topics.log);
+  trace_recorder_poll(mqttClient, topics.trace);
+  journal_store_poll(mqttClient, topics.journal);
+  time_service_poll();
   update_time_with_check_alarm();
 
-  sample_ldr();
-  update_servo_angle();
-
-  if (digitalRead(PB_OK) == LOW)
+  if constexpr (BOARD.has_ldr)
   {
-    delay(200);
-    go_to_menu();
+    sample_ldr();
   }
+  sample_env();
 
-  if (digitalRead(PB_CANCEL) == LOW)
-  {
-    delay(200);
-    handle_cancel_button();
-  }
-
-  check_temp();
-  publish_light_average();
+  bus.drain();
 }
 
 /***************************************************************************************************
@@ -244,7 +364,7 @@ void print_line(String text, int column, int row, int text_size)
   display.setTextColor(SSD1306_WHITE);
   display.setCursor(column, row);
   display.println(text);
-  display.display();
+  display_flush();
 }
 
 /***************************************************************************************************
@@ -256,7 +376,7 @@ void update_time()
   struct tm timeinfo;
   if (!getLocalTime(&timeinfo))
   {
-    Serial.println("Failed to obtain time");
+    LOG_WARN("Failed to obtain time");
     return;
   }
 
@@ -267,9 +387,42 @@ void update_time()
   dayOfWeek = DAYS_OF_WEEK[timeinfo.tm_wday];
 }
 
+/***************************************************************************************************
+ * build_glyph_caches()
+ * Captures the characters of the clock, alarm and time zone screens at text sizes 2 and 3 from
+ * GFX itself, so the cached text is pixel-for-pixel what print() would draw. Leaves the frame
+ * cleared.
+ **************************************************************************************************/
+void build_glyph_caches()
+{
+  GlyphCache *caches[] = {&glyphs_2, &glyphs_3};
+  const uint8_t sizes[] = {2, 3};
+  for (int i = 0; i < 2; i++)
+  {
+    glyph_cache_init(*caches[i], sizes[i]);
+    for (const char *c = GLYPH_CHARS; *c; c++)
+    {
+      display.clearDisplay();
+      display.drawChar(0, 0, *c, SSD1306_WHITE, SSD1306_WHITE, sizes[i]);
+      glyph_cache_capture(*caches[i], *c, display.getBuffer(), SCREEN_WIDTH);
+    }
+  }
+  display.clearDisplay();
+}
+
+/***************************************************************************************************
+ * draw_glyphs()
+ * Draws text from a glyph cache straight into the display buffer, in place of setTextSize(),
+ * setCursor() and print(): a byte OR per page column instead of a fillRect() per font pixel.
+ **************************************************************************************************/
+void draw_glyphs(const GlyphCache &cache, int x, int y, const char *text)
+{
+  glyph_draw(cache, display.getBuffer(), SCREEN_WIDTH, SCREEN_HEIGHT, x, y, text);
+}
+
 /***************************************************************************************************
  * display_time()
- * Displays the current time, day, and alarm status on the OLED.
+ * Displays the current time, day, and alarm status (or the environment alert banner) on the OLED.
  **************************************************************************************************/
 void display_time()
 {
@@ -282,56 +435,144 @@ void display_time()
   display.print(", ");
   display.print(days);
 
-  display.setTextSize(3);
-  display.setCursor(10, 16);
   char timeStr[10];
   snprintf(timeStr, sizeof(timeStr), "%02d:%02d", hours, minutes);
-  display.print(timeStr);
+  draw_glyphs(glyphs_3, 10, 16, timeStr);
 
   display.setTextSize(1);
   display.setCursor(110, 35);
   snprintf(timeStr, sizeof(timeStr), "%02d", seconds);
   display.print(timeStr);
 
+  char banner[24];
   display.fillRect(0, 56, display.width(), 8, WHITE);
   display.setTextColor(BLACK);
   display.setCursor(2, 57);
-  display.print(alarm_enabled ? "ALARM ACTIVE" : "ALARM OFF");
+  if (core.format_alert_banner(banner, sizeof(banner)))
+  {
+    display.print("! ");
+    display.print(banner);
+  }
+  else
+  {
+    display.print(core.alarms_enabled() ? "ALARM ACTIVE" : "ALARM OFF");
+  }
 
-  display.display();
+  display_flush();
 }
 
 /***************************************************************************************************
  * update_time_with_check_alarm()
- * Updates time, displays it if on home screen, and checks alarms.
+ * Updates time and publishes a TimeTick whenever the second changes; the home screen and the
+ * alarm check subscribe to it.
  **************************************************************************************************/
 void update_time_with_check_alarm()
 {
+  int last_second = seconds;
   update_time();
 
+  if (seconds != last_second)
+  {
+    struct tm timeinfo;
+    getLocalTime(&timeinfo, 0);
+    bus.publish(event_time_tick(millis(), hours, minutes, seconds, days, timeinfo.tm_wday));
+  }
+}
+
+void on_tick_display(const Event &event)
+{
   if (currentState == HOME_SCREEN)
   {
     display_time();
   }
+}
+
+void on_tick_check_alarms(const Event &event)
+{
+  core.time_tick(event.timestamp_ms, event.time);
+}
 
-  if (alarm_enabled)
+/***************************************************************************************************
+ * on_tick_report()
+ * Logs the bus, logger, journal, display, config store and time sync counters every ten minutes.
+ **************************************************************************************************/
+void on_tick_report(const Event &event)
+{
+  if (event.time.seconds != 0 || event.time.minutes % 10 != 0)
   {
-    for (int i = 0; i < N_ALARMS; i++)
-    {
-      if (!alarm_triggered[i] &&
-          alarm_hours[i] == hours &&
-          alarm_minutes[i] == minutes)
-      {
-        ring_alarm();
-        alarm_triggered[i] = true;
-      }
-      if (alarm_triggered[i] && temp_alarm_hour == hours && temp_alarm_minute == minutes)
-      {
-        ring_alarm();
-        alarm_triggered[i] = true;
-      }
-    }
+    return;
   }
+
+  EventBusStats stats = bus.stats();
+  LOG_INFO("Events: time_tick=%u light_sample=%u env_sample=%u config_changed=%u button=%u alarm_fired=%u "
+           "posted=%u dropped=%u high_water=%u",
+           stats.dispatched[EVT_TIME_TICK], stats.dispatched[EVT_LIGHT_SAMPLE], stats.dispatched[EVT_ENV_SAMPLE],
+           stats.dispatched[EVT_CONFIG_CHANGED], stats.dispatched[EVT_BUTTON], stats.dispatched[EVT_ALARM_FIRED],
+           stats.posted, stats.dropped, stats.queue_high_water);
+
+  BinLogStats logged = binlog.stats();
+  LogDrainStats drain = log_drain_stats();
+  LOG_INFO("Log: written=%u dropped=%u truncated=%u printed=%u mqtt=%u mqtt_dropped=%u max_drain_us=%u",
+           logged.written, logged.dropped, logged.truncated, drain.printed, drain.mqtt_records, drain.mqtt_dropped,
+           drain.max_drain_us);
+
+  JournalStats journal = journal_store_journal_stats();
+  JournalStoreStats stored = journal_store_stats();
+  LOG_INFO("Journal: seq %u-%u recorded=%u committed=%u commits=%u errors=%u dropped=%u max_commit_us=%u "
+           "streamed=%u",
+           stored.first_seq, stored.end_seq, journal.recorded, journal.committed, journal.commits,
+           journal.write_errors, journal.dropped, stored.max_commit_us, stored.streamed);
+
+  DisplayFlushStats flushed = display_flush_stats();
+  LOG_INFO("Display: submitted=%u flushed=%u coalesced=%u last_flush_us=%u max_flush_us=%u", flushed.submitted,
+           flushed.flushed, flushed.coalesced, flushed.last_flush_us, flushed.max_flush_us);
+
+  ConfigStoreStats config = core.config_store().stats();
+  LOG_INFO("Config: v%u published=%u read_retries=%u", core.config_store().version(), config.published,
+           config.retries);
+
+  TimeServiceStats clock = time_service_stats();
+  TimeSyncStats ntp = time_service_sync_stats();
+  LOG_INFO("Time: error_ms=%u drift_ppb=%d poll_s=%u requests=%u accepted=%u timeouts=%u slow=%u outliers=%u "
+           "resets=%u steps=%u clock_steps=%u clock_slews=%u",
+           clock.error_ms, clock.drift_ppb, clock.poll_interval_s, ntp.requests, ntp.accepted, ntp.timeouts,
+           ntp.slow, ntp.outliers, ntp.resets, ntp.steps, clock.clock_steps, clock.clock_slews);
+
+#if defined(MEDIBOX_TRACE)
+  TraceRecorderStats trace = trace_recorder_stats();
+  LOG_INFO("Trace: recorded=%u dropped=%u chunks=%u restarts=%u", trace.bytes_recorded, trace.bytes_dropped,
+           trace.chunks_sent, trace.restarts);
+#endif
+}
+
+/***************************************************************************************************
+ * on_button()
+ * OK and CANCEL on the home screen, queued by the pin interrupts once debounced there. The menus
+ * still poll the buttons themselves, so presses stamped before the last screen returned are
+ * dropped, and the button is let go (or held for a second) before the menu opens, so the menu does
+ * not take the same press as its own.
+ **************************************************************************************************/
+void on_button(const Event &event)
+{
+  if ((long)(event.timestamp_ms - buttons_ready_at) < 0)
+  {
+    return;
+  }
+
+  unsigned long held_since = millis();
+  while (digitalRead(event.button.pin) == LOW && millis() - held_since < 1000)
+  {
+    delay(10);
+  }
+  if (event.button.pin == PB_OK)
+  {
+    go_to_menu();
+  }
+  else if (event.button.pin == PB_CANCEL)
+  {
+    handle_cancel_button();
+  }
+  buttons_ready_at = millis();
 }
 
 /***************************************************************************************************
@@ -350,11 +591,10 @@ void set_time_zone()
     display.setTextSize(1);
     display.setCursor(0, 0);
     display.print("Set Time Zone (Hour)");
-    display.setTextSize(2);
-    display.setCursor(20, 20);
-    display.print(temp_offset_hour);
-    display.print(" hrs");
-    display.display();
+    char offsetStr[12];
+    snprintf(offsetStr, sizeof(offsetStr), "%d hrs", temp_offset_hour);
+    draw_glyphs(glyphs_2, 20, 20, offsetStr);
+    display_flush();
 
     int pressed = wait_for_menu_button();
     if (pressed == PB_UP)
@@ -385,11 +625,10 @@ void set_time_zone()
       display.setCursor(0, 0);
       display.print("Set Time Zone (Mins)");
 
-      display.setTextSize(2);
-      display.setCursor(10, 20);
-      display.print(temp_offset_min);
-      display.print(" min");
-      display.display();
+      char offsetStr[12];
+      snprintf(offsetStr, sizeof(offsetStr), "%d min", temp_offset_min);
+      draw_glyphs(glyphs_2, 10, 20, offsetStr);
+      display_flush();
 
       int pressed = wait_for_menu_button();
       if (pressed == PB_UP)
@@ -413,7 +652,7 @@ void set_time_zone()
         {
           UTC_OFFSET = (offset_hours * 3600) + (offset_mins * 60);
         }
-        configTime(UTC_OFFSET, UTC_OFFSET_DST, NTP_SERVER);
+        time_service_set_utc_offset(UTC_OFFSET);
         break;
       }
       else if (pressed == PB_CANCEL)
@@ -430,7 +669,7 @@ void set_time_zone()
     display.setTextSize(2);
     display.setCursor(10, 20);
     display.print("TZ Updated");
-    display.display();
+    display_flush();
     delay(1000);
   }
 
@@ -443,10 +682,10 @@ void set_time_zone()
  **************************************************************************************************/
 void set_alarm(int alarmIndex)
 {
-  alarm_enabled = true;
+  core.set_alarms_enabled(millis(), true);
 
-  int temp_hour = alarm_hours[alarmIndex];
-  int temp_minute = alarm_minutes[alarmIndex];
+  int temp_hour = core.alarm_hours(alarmIndex);
+  int temp_minute = core.alarm_minutes(alarmIndex);
   bool canceled = false;
   bool hourSet = false;
   bool minuteSet = false;
@@ -459,12 +698,10 @@ void set_alarm(int alarmIndex)
     display.print("Set Alarm ");
     display.print(alarmIndex + 1);
 
-    display.setTextSize(2);
-    display.setCursor(20, 20);
     char alarmStr[10];
     snprintf(alarmStr, sizeof(alarmStr), "%02d:%02d", temp_hour, temp_minute);
-    display.print(alarmStr);
-    display.display();
+    draw_glyphs(glyphs_2, 20, 20, alarmStr);
+    display_flush();
 
     int pressed = wait_for_menu_button();
     if (pressed == PB_UP)
@@ -477,7 +714,7 @@ void set_alarm(int alarmIndex)
     }
     else if (pressed == PB_OK)
     {
-      alarm_hours[alarmIndex] = temp_hour;
+      core.set_alarm(millis(), alarmIndex, temp_hour, core.alarm_minutes(alarmIndex));
       hourSet = true;
       break;
     }
@@ -497,12 +734,10 @@ void set_alarm(int alarmIndex)
       display.setCursor(0, 0);
       display.print("Set Alarm Mins");
 
-      display.setTextSize(2);
-      display.setCursor(20, 20);
       char alarmStr[10];
       snprintf(alarmStr, sizeof(alarmStr), "%02d:%02d", temp_hour, temp_minute);
-      display.print(alarmStr);
-      display.display();
+      draw_glyphs(glyphs_2, 20, 20, alarmStr);
+      display_flush();
 
       int pressed = wait_for_menu_button();
       if (pressed == PB_UP)
@@ -515,7 +750,7 @@ void set_alarm(int alarmIndex)
       }
       else if (pressed == PB_OK)
       {
-        alarm_minutes[alarmIndex] = temp_minute;
+        core.set_alarm(millis(), alarmIndex, temp_hour, temp_minute);
         minuteSet = true;
         break;
       }
@@ -536,18 +771,27 @@ void set_alarm(int alarmIndex)
     display.print(alarmIndex + 1);
     display.setCursor(10, 40);
     display.print("Set!");
-    display.display();
+    display_flush();
     delay(1000);
   }
 
   reset_to_home_screen();
 }
 
+void on_alarm_fired(const Event &event)
+{
+  journal_store_record(JOURNAL_FIRED, event.alarm.index, 0);
+  ring_alarm(event.alarm.index);
+  buttons_ready_at = millis(); // The dismiss/snooze press is not a home-screen press
+}
+
 /***************************************************************************************************
  * ring_alarm()
- * Rings the buzzer, lights LED_1, and waits until PB_CANCEL is pressed or runs through a tone cycle.
+ * Starts the alarm light and melody on the indicator engine and waits until PB_CANCEL (dismiss) or
+ * PB_OK (snooze) is pressed, or ALARM_RING_MS passed. The answer and how long it took go to the
+ * adherence journal.
  **************************************************************************************************/
-void ring_alarm()
+void ring_alarm(uint8_t index)
 {
   display.clearDisplay();
   display.setTextColor(WHITE);
@@ -556,57 +800,49 @@ void ring_alarm()
   display.print("MEDICINE");
   display.setCursor(20, 40);
   display.print("TIME!");
-  display.display();
-  delay(100);
+  display_flush();
 
-  digitalWrite(LED_1, HIGH);
+  indicator_play(IND_LED_1, &PATTERN_ALARM_LIGHT, PRIORITY_MEDICINE_ALARM);
+  indicator_play(IND_BUZZER, &PATTERN_ALARM_MELODY, PRIORITY_MEDICINE_ALARM);
 
-  bool break_happened = false;
-  while (!break_happened && digitalRead(PB_CANCEL) == HIGH && digitalRead(PB_OK) == HIGH)
+  unsigned long started = millis();
+  while (digitalRead(PB_CANCEL) == HIGH && digitalRead(PB_OK) == HIGH && millis() - started < ALARM_RING_MS)
   {
-    for (int i = 0; i < N_NOTES; i++)
-    {
-      // Check for Cancel button press
-      if (digitalRead(PB_CANCEL) == LOW)
-      {
-        delay(200);
-        break_happened = true;
-        display.clearDisplay();
-        alarm_enabled = false;
-        print_line("Alarm", 10, 20, 2);
-        print_line("OFF", 10, 50, 2);
-        noTone(BUZZER);
-        digitalWrite(LED_1, LOW);
-        delay(1000);
-        break;
-      }
+    delay(10);
+  }
+  unsigned long latency = millis() - started;
 
-      // Check for OK button press
-      if (digitalRead(PB_OK) == LOW)
-      {
-        delay(200);
-        break_happened = true;
-        temp_alarm_hour = hours;
-        temp_alarm_minute = minutes + 5;
-        alarm_enabled = true;
-        display.clearDisplay();
-        print_line("Alarm", 10, 20, 2);
-        print_line("Snoozed", 10, 50, 2);
-        noTone(BUZZER);
-        digitalWrite(LED_1, LOW);
-        delay(1000);
-        break;
-      }
+  indicator_stop(IND_LED_1, PRIORITY_MEDICINE_ALARM);
+  indicator_stop(IND_BUZZER, PRIORITY_MEDICINE_ALARM);
 
-      // Play tone with a slight delay
-      tone(BUZZER, MUSICAL_NOTES[i], 200);
-      delay(220);
-      noTone(BUZZER);
-      delay(20);
-    }
+  if (latency >= ALARM_RING_MS)
+  {
+    // The core is not told: the alarm stays rung for today, as if it had been answered
+    journal_store_record(JOURNAL_MISSED, index, latency);
+    display.clearDisplay();
+    print_line("Alarm", 10, 20, 2);
+    print_line("Missed", 10, 50, 2);
+  }
+  else if (digitalRead(PB_CANCEL) == LOW)
+  {
+    journal_store_record(JOURNAL_DISMISSED, index, latency);
+    delay(200);
+    display.clearDisplay();
+    core.alarm_dismissed(millis());
+    print_line("Alarm", 10, 20, 2);
+    print_line("OFF", 10, 50, 2);
   }
+  else
+  {
+    journal_store_record(JOURNAL_SNOOZED, index, latency);
+    delay(200);
+    core.alarm_snoozed(millis());
+    display.clearDisplay();
+    print_line("Alarm", 10, 20, 2);
+    print_line("Snoozed", 10, 50, 2);
+  }
+  delay(1000);
 
-  digitalWrite(LED_1, LOW);
   reset_to_home_screen();
 }
 
@@ -630,14 +866,16 @@ void go_to_menu()
       currentState = TIME_ZONE_SETTING;
       set_time_zone();
       break;
-    case 1:
-    case 2:
-    case 3: // Set Alarms
-      currentState = ALARM_SETTING;
-      set_alarm(currentMenuIndex - 1);
-      break;
-    case 4: // Disable Alarms
-      disable_all_alarms();
+    default:
+      if (currentMenuIndex <= N_ALARMS) // Set Alarms
+      {
+        currentState = ALARM_SETTING;
+        set_alarm(currentMenuIndex - 1);
+      }
+      else // Disable Alarms
+      {
+        disable_all_alarms();
+      }
       break;
     }
     break;
@@ -702,7 +940,7 @@ int wait_for_menu_button()
  **************************************************************************************************/
 void display_menu()
 {
-  int totalMenuItems = sizeof(MENU_ITEMS) / sizeof(MENU_ITEMS[0]);
+  int totalMenuItems = MENU_ITEM_COUNT;
   int visibleItems = min(MAX_VISIBLE_MENU_ITEMS, totalMenuItems);
 
   display.clearDisplay();
@@ -726,15 +964,20 @@ void display_menu()
 
     int16_t x1, y1;
     uint16_t w, h;
-    display.getTextBounds(MENU_ITEMS[itemIndex], 0, 0, &x1, &y1, &w, &h);
+    const char *label = "Disable Alarms";
+    if (itemIndex == 0)
+      label = "Set Time Zone";
+    else if (itemIndex <= N_ALARMS)
+      label = ALARM_MENU_ITEMS[itemIndex - 1];
+    display.getTextBounds(label, 0, 0, &x1, &y1, &w, &h);
     int16_t x = (SCREEN_WIDTH - w) / 2;
 
     display.setCursor(x, i * 20 + 10);
-    display.println(MENU_ITEMS[itemIndex]);
+    display.println(label);
     display.setTextColor(SSD1306_WHITE);
   }
 
-  display.display();
+  display_flush();
 
   int pressed = wait_for_menu_button();
   if (pressed == PB_UP)
@@ -787,11 +1030,7 @@ void display_menu()
  **************************************************************************************************/
 void disable_all_alarms()
 {
-  alarm_enabled = false;
-  for (int i = 0; i < N_ALARMS; i++)
-  {
-    alarm_triggered[i] = false;
-  }
+  core.set_alarms_enabled(millis(), false);
 
   display.clearDisplay();
   display.setTextSize(2);
@@ -799,175 +1038,77 @@ void disable_all_alarms()
   display.print("Alarms");
   display.setCursor(20, 40);
   display.print("Disabled");
-  display.display();
+  display_flush();
 
   delay(1000);
   reset_to_home_screen();
 }
 
 /***************************************************************************************************
- * check_temp()
- * Reads temperature/humidity and displays a big ALERT if out of the specified range.
+ * sample_env()
+ * Reads the DHT once per sampling period and publishes the reading as an EnvSample.
  **************************************************************************************************/
-void check_temp()
+void sample_env()
 {
-  TempAndHumidity data = dhtSensor.getTempAndHumidity();
-  float temperature = data.temperature;
-  float humidity = data.humidity;
-  String(data.temperature, 2).toCharArray(tempAr, 6);
-
-  const float MIN_TEMP = 26.0;
-  const float MAX_TEMP = 32.0;
-  const float MIN_HUM = 60.0;
-  const float MAX_HUM = 80.0;
-
-  bool tempLow = temperature < MIN_TEMP;
-  bool tempHigh = temperature > MAX_TEMP;
-  bool humLow = humidity < MIN_HUM;
-  bool humHigh = humidity > MAX_HUM;
-
-  if (tempLow || tempHigh || humLow || humHigh)
+  if (millis() - lastEnvSample < ENV_SAMPLE_MS)
   {
-    display.clearDisplay();
-    display.setTextSize(3);
-    display.setTextColor(SSD1306_WHITE);
-
-    int y = 0;
-
-    display.setCursor(0, y);
-    display.println("ALERT!");
-    y += 35;
-
-    display.setTextSize(1);
-
-    if (tempLow)
-    {
-      display.setCursor(0, y);
-      display.println("Temp is TOO LOW!");
-      y += 12;
-    }
-    else if (tempHigh)
-    {
-      display.setCursor(0, y);
-      display.println("Temp is TOO HIGH!");
-      y += 12;
-    }
-
-    if (humLow)
-    {
-      display.setCursor(0, y);
-      display.println("Humidity is LOW!");
-      y += 12;
-    }
-    else if (humHigh)
-    {
-      display.setCursor(0, y);
-      display.println("Humidity is HIGH!");
-      y += 12;
-    }
-
-    display.display();
-
-    for (int i = 0; i < 4; i++)
-    {
-      digitalWrite(LED_2, HIGH);
-      delay(200);
-      digitalWrite(LED_2, LOW);
-      delay(200);
-    }
-
-    delay(1000);
-
-    if (currentState == HOME_SCREEN)
-    {
-      display_time();
-    }
+    return;
   }
+  lastEnvSample = millis();
+
+  TempAndHumidity data = dhtSensor.getTempAndHumidity();
+  bus.publish(event_env_sample(lastEnvSample, data.temperature, data.humidity));
 }
 
 /***************************************************************************************************
- * void update_sampling_parameters(int new_ts, int new_tu)
- * change sampling paramiters according to chnged tu and ts.
+ * on_env_sample()
+ * Hands the reading to the core, which runs the alerts, stores it and moves the shade.
  **************************************************************************************************/
-
-void update_sampling_parameters(int new_ts, int new_tu)
+void on_env_sample(const Event &event)
 {
-  ts = new_ts;
-  tu = new_tu;
+  core.env_sample(event.timestamp_ms, (uint32_t)time(nullptr), event.env.temperature, event.env.humidity);
+}
 
-  ldr_sample_count = tu / ts;
-  if (ldr_sample_count > MAX_SAMPLES)
-  {
-    ldr_sample_count = MAX_SAMPLES; // prevent overflow
-  }
+/***************************************************************************************************
+ * void update_sampling_parameters()
+ * Retimes LDR sampling after ts or tu changed. The light log is windowed by time, so the history
+ * is kept and a longer tu simply averages further back.
+ **************************************************************************************************/
 
-  ldr_index = 0; // reset buffer position
+void update_sampling_parameters()
+{
+  lastLdrSample = millis() - core.snapshot().sample_ms; // Sample at the new rate right away
 }
 
 /***************************************************************************************************
  * float read_ldr_normalized()
- * Reads the LDR value and normalizes it to a range of 0-1.
+ * Filtered, calibrated LDR reading (0-1) from the background acquisition task, averaged over the
+ * last sampling period.
  **************************************************************************************************/
 float read_ldr_normalized()
 {
-  int raw = analogRead(LDR_PIN);
-  return raw / 4095.0; // Normalize to 0-1
+  return ldr_latest_normalized();
 }
 /***************************************************************************************************
  * void sample_ldr()
- * Samples the LDR value at regular intervals and stores it in a circular buffer.
+ * Publishes the LDR value as a LightSample every ts seconds.
  **************************************************************************************************/
 void sample_ldr()
 {
-  if (millis() - lastLdrSample >= ts * 1000)
+  if (millis() - lastLdrSample >= core.snapshot().sample_ms)
   {
-    ldr_readings[ldr_index] = read_ldr_normalized();
-    // Serial.print("LDR[");
-    // Serial.print(ldr_index);
-    // Serial.print("] = ");
-    // Serial.println(ldr_readings[ldr_index], 4);
-
-    ldr_index = (ldr_index + 1) % ldr_sample_count;
-
-    if (valid_sample_count < ldr_sample_count)
-    {
-      valid_sample_count++;
-    }
-
     lastLdrSample = millis();
+    bus.publish(event_light_sample(lastLdrSample, read_ldr_normalized()));
   }
 }
-/***************************************************************************************************
- * float calculate_average_ldr()
- * Calculates the average of the LDR readings stored in the circular buffer.loop
- **************************************************************************************************/
-float calculate_average_ldr()
-{
-  if (valid_sample_count == 0)
-    return 0;
-
-  float sum = 0;
-  for (int i = 0; i < valid_sample_count; i++)
-  {
-    sum += ldr_readings[i];
-  }
-  return sum / valid_sample_count;
-}
 
 /***************************************************************************************************
- * void update_servo_angle()
- * Calculates the servo angle based on LDR readings and temperature, then updates the servo position.
+ * void on_light_sample()
+ * Hands each LightSample to the core, which stores it, publishes the average and moves the shade.
  **************************************************************************************************/
-void update_servo_angle()
+void on_light_sample(const Event &event)
 {
-  float I = calculate_average_ldr(); // 0 to 1
-  float T = dhtSensor.getTempAndHumidity().temperature;
-
-  float ratio = log((float)ts / tu);
-  float theta = theta_offset + (180 - theta_offset) * I * gammma * ratio * (T / Tmed); // corrected variable name
-
-  theta = constrain(theta, 0, 180); // safety
-  shade_servo.write((int)theta);
+  core.light_sample(event.timestamp_ms, (uint32_t)time(nullptr), event.light.intensity);
 }
 
 /***************************************************************************************************
@@ -976,75 +1117,65 @@ void update_servo_angle()
  **************************************************************************************************/
 void recieveCallback(char *topic, byte *payload, unsigned int length)
 {
-  Serial.print("Message arrived [");
-  Serial.print(topic);
-  Serial.print("] ");
+  LOG_DEBUG("Message arrived [%s] %s", topic, log_str(payload, length));
 
-  char payloadCharAr[length + 1]; // +1 for null-terminator
-  for (int i = 0; i < length; i++)
+  core.mqtt_message(millis(), (uint32_t)time(nullptr), topic, payload, length);
+  if (strcmp(topic, topics.journal_get) == 0)
   {
-    Serial.print((char)payload[i]);
-    payloadCharAr[i] = (char)payload[i];
+    journal_store_request(payload, length);
   }
-  payloadCharAr[length] = '\0'; // Null-terminate the string
-
-  Serial.println();
+}
 
-  if (strcmp(topic, "ENTC-ADMIN-MAIN-ON-OFF") == 0)
-  {
-    if (payloadCharAr[0] == '1')
-    {
-      Serial.println("Turning ON");
-      tone(BUZZER, 1000, 200);
-    }
-    else if (payloadCharAr[0] == '0')
-    {
-      Serial.println("Turning OFF");
-      noTone(BUZZER);
-    }
-  }
-  else if (strcmp(topic, "ENTC-ADMIN-LIGHT-Tu") == 0)
-  {
-    int new_tu = atoi(payloadCharAr);
-    update_sampling_parameters(ts, new_tu);
-    Serial.print("Updated tu = ");
-    Serial.println(new_tu);
-  }
-  else if (strcmp(topic, "ENTC-ADMIN-LIGHT-Ts") == 0)
-  {
-    int new_ts = atoi(payloadCharAr);
-    update_sampling_parameters(new_ts, tu);
-    Serial.print("Updated ts = ");
-    Serial.println(new_ts);
-  }
-  else if (strcmp(topic, "medibox/theta_offset") == 0)
+/***************************************************************************************************
+ * void on_config_changed()
+ * Retimes LDR sampling when ts or tu moved, and logs the new values.
+ **************************************************************************************************/
+void on_config_changed(const Event &event)
+{
+  const MediboxConfig &config = core.config();
+  if (event.config.window_changed)
   {
-    theta_offset = atof(payloadCharAr);
-    Serial.print("Updated theta_offset: ");
-    Serial.println(theta_offset);
+    update_sampling_parameters();
   }
-  else if (strcmp(topic, "medibox/gamma") == 0)
+
+  LOG_INFO("Applied config v%u: ts=%d tu=%d theta_offset=%.2f gamma=%.2f Tmed=%.2f", config.version, config.ts,
+           config.tu, config.theta_offset, config.gamma, config.tmed);
+}
+
+/***************************************************************************************************
+ * void apply_main_switch()
+ * Handles the dashboard's main switch.
+ **************************************************************************************************/
+void apply_main_switch(bool on)
+{
+  if (on)
   {
-    gammma = atof(payloadCharAr);
-    Serial.print("Updated gamma: ");
-    Serial.println(gammma);
+    LOG_INFO("Turning ON");
+    indicator_play(IND_BUZZER, &PATTERN_SWITCH_BEEP, PRIORITY_NOTIFY);
   }
-  else if (strcmp(topic, "medibox/tmed") == 0)
+  else
   {
-    Tmed = atof(payloadCharAr);
-    Serial.print("Updated Tmed: ");
-    Serial.println(Tmed);
+    LOG_INFO("Turning OFF");
+    indicator_stop(IND_BUZZER, PRIORITY_NOTIFY);
   }
 }
 
 /***************************************************************************************************
  * void setupMqtt()
- * Sets up the MQTT client with the server and callback.
+ * Derives the device id from the MAC and sets up the MQTT client with the server and callback.
  **************************************************************************************************/
 
 void setupMqtt()
 {
-  mqttClient.setServer("test.mosquitto.org", 1883);
+  uint8_t mac[6];
+  char device_id[DEVICE_ID_LEN];
+  WiFi.macAddress(mac);
+  make_device_id(mac, device_id, sizeof(device_id));
+  build_topics(topics, device_id);
+  LOG_INFO("Device id: %s", topics.device_id);
+
+  mqtt_transport_begin();
+  mqttClient.setServer(mqtt_broker_host(BOARD.mqtt_host), mqtt_broker_port(BOARD.mqtt_port));
   mqttClient.setCallback(recieveCallback);
 }
 
@@ -1056,36 +1187,17 @@ void connectToBroker()
 {
   while (!mqttClient.connected())
   {
-    Serial.println("Attempting MQTT connetion");
-    if (mqttClient.connect("ESP32-75645365"))
+    LOG_INFO("Attempting MQTT connection");
+    if (mqttClient.connect(topics.device_id))
     {
-      Serial.println("connected");
-      mqttClient.subscribe("ENTC-ADMIN-MAIN-ON-OFF");
-      mqttClient.subscribe("ENTC-ADMIN-LIGHT-Tu");
-      mqttClient.subscribe("ENTC-ADMIN-LIGHT-Ts");
-      mqttClient.subscribe("medibox/theta_offset");
-      mqttClient.subscribe("medibox/gamma");
-      mqttClient.subscribe("medibox/tmed");
+      LOG_INFO("MQTT connected");
+      mqttClient.subscribe(topics.config);
+      mqttClient.subscribe(topics.journal_get);
     }
     else
     {
-      Serial.print("failed");
-      Serial.println(mqttClient.state());
+      LOG_WARN("MQTT connect failed, state %d", mqttClient.state());
       delay(5000);
     }
   }
 }
-
-/***************************************************************************************************
- * void publish_light_average()
- * Publishes the average LDR reading to the MQTT broker.
- **************************************************************************************************/
-void publish_light_average()
-{
-  float avg = calculate_average_ldr();
-  char buffer[10];
-  dtostrf(avg, 4, 2, buffer);
-  mqttClient.publish("ENTC-ADMIN-LIGHT", buffer, true); // Retain = true
-  Serial.println(buffer);
-  lastLdrUpload = millis();
-}